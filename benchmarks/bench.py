@@ -0,0 +1,311 @@
+""" Benchmark and regression suite of the fast_ligru kernels.
+
+Sweeps batch x hidden x seq x dtype x activation and times one layer of
+every implementation, without gradients ("inference") and with a backward
+pass ("train"):
+  - fast_ligru: `LiGRU` or `SLiGRU`,
+  - cudnn_gru: `torch.nn.GRU` of the same sizes, the fused cuDNN baseline,
+  - jit: a TorchScript loop over the same recurrence, on the GPU and, with
+    `--cpu`, on the CPU.
+The lines printed by the native `bench_passes` harness (see
+`bench_passes.cu.cc`), which times the passes of `libhaste` without PyTorch,
+are merged in when `--native` is given. Results are written as one JSON
+document holding the environment and one record per measurement.
+
+    python benchmarks/bench.py --native benchmarks/bench_passes --out bench.json
+    python benchmarks/bench.py --compare baseline.json bench.json
+
+`--compare` matches the records of two runs and exits with status 1 when a
+step got slower than `--threshold` (10% by default).
+
+Author: Adel Moumen 2023
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+
+import torch
+from torch import Tensor
+
+sys.path.insert(0, os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+
+from fast_ligru_pytorch.ligru import LiGRU  # noqa: E402
+from fast_ligru_pytorch.stabilised_ligru import SLiGRU  # noqa: E402
+
+DTYPES = {
+    "float": torch.float32,
+    "half": torch.float16,
+    "bfloat16": torch.bfloat16,
+    "double": torch.float64,
+}
+NONLINEARITIES = ["relu", "leaky_relu", "sin", "tanh"]
+KEY_FIELDS = [
+    "source", "impl", "device", "cell", "pass",
+    "dtype", "batch", "hidden", "seq", "activation",
+]
+
+
+@torch.jit.script
+def _reference_recurrence(
+    wx: Tensor, u: Tensor, h: Tensor, activation: int, normalize: bool
+) -> Tensor:
+    """Li-GRU (SLi-GRU when `normalize`) recurrence over a batch-first `wx`."""
+    hs = []
+    for t in range(wx.shape[1]):
+        uh = h @ u.t()
+        if normalize:
+            uh = torch.layer_norm(uh, [uh.shape[1]])
+        a, z = (wx[:, t] + uh).chunk(2, 1)
+        z = torch.sigmoid(z)
+        if activation == 0:
+            c = torch.relu(a)
+        elif activation == 1:
+            c = torch.nn.functional.leaky_relu(a, 0.01)
+        elif activation == 2:
+            c = torch.sin(a)
+        else:
+            c = torch.tanh(a)
+        h = z * h + (1 - z) * c
+        hs.append(h)
+    return torch.stack(hs, 1)
+
+
+class _Reference(torch.nn.Module):
+    def __init__(self, input_size, hidden_size, activation, normalize):
+        super().__init__()
+        self.w = torch.nn.Linear(input_size, 2 * hidden_size, bias=False)
+        self.u = torch.nn.Linear(hidden_size, 2 * hidden_size, bias=False)
+        self.activation = activation
+        self.normalize = normalize
+        self.hidden_size = hidden_size
+
+    def forward(self, x):
+        h = x.new_zeros(x.shape[0], self.hidden_size)
+        return _reference_recurrence(
+            self.w(x), self.u.weight, h, self.activation, self.normalize
+        )
+
+
+def _build(impl, cell, input_size, hidden, activation, shape):
+    if impl == "fast_ligru":
+        cls = LiGRU if cell == "1_0" else SLiGRU
+        return cls(
+            input_shape=shape,
+            hidden_size=hidden,
+            num_layers=1,
+            nonlinearity=NONLINEARITIES[activation],
+        )
+    if impl == "cudnn_gru":
+        return torch.nn.GRU(input_size, hidden, batch_first=True)
+    return _Reference(input_size, hidden, activation, cell == "2_0")
+
+
+def _recurrent_flops(impl, batch, hidden):
+    """FLOPs of the recurrent product of one step (the GRU has 3 gates)."""
+    gates = 3 if impl == "cudnn_gru" else 2
+    return 2.0 * batch * gates * hidden * hidden
+
+
+def _time(fn, device, warmup, iters):
+    """Mean milliseconds of `fn()` and the peak memory it allocated."""
+    for _ in range(warmup):
+        fn()
+    if device.type == "cuda":
+        torch.cuda.synchronize(device)
+        torch.cuda.reset_peak_memory_stats(device)
+        start = torch.cuda.Event(enable_timing=True)
+        stop = torch.cuda.Event(enable_timing=True)
+        start.record()
+        for _ in range(iters):
+            fn()
+        stop.record()
+        stop.synchronize()
+        return start.elapsed_time(stop) / iters, torch.cuda.max_memory_allocated(device)
+
+    import time
+
+    begin = time.perf_counter()
+    for _ in range(iters):
+        fn()
+    return (time.perf_counter() - begin) * 1e3 / iters, None
+
+
+def _bench_python(args):
+    records = []
+    devices = [torch.device("cuda")] if torch.cuda.is_available() else []
+    if args.cpu:
+        devices.append(torch.device("cpu"))
+
+    for device in devices:
+        for cell in args.cell:
+            for dtype_name in args.dtype:
+                dtype = DTYPES[dtype_name]
+                if device.type == "cpu" and dtype_name != "float":
+                    continue
+                if cell == "1_0" and dtype_name == "bfloat16":
+                    continue
+                for activation in args.activation:
+                    for hidden in args.hidden:
+                        for batch in args.batch:
+                            for seq in args.seq:
+                                records += _bench_config(
+                                    args, device, cell, dtype_name, dtype,
+                                    activation, hidden, batch, seq,
+                                )
+    return records
+
+
+def _bench_config(args, device, cell, dtype_name, dtype, activation, hidden, batch, seq):
+    records = []
+    shape = (batch, seq, args.input_size)
+    impls = ["fast_ligru", "jit"]
+    # The GRU has no activation or normalization choice: time it once.
+    if activation == args.activation[0] and cell == args.cell[0]:
+        impls.append("cudnn_gru")
+    if device.type == "cpu":
+        iters = max(1, args.iters // 4)
+    else:
+        iters = args.iters
+
+    for impl in impls:
+        torch.manual_seed(0)
+        model = _build(impl, cell, args.input_size, hidden, activation, shape)
+        model = model.to(device=device, dtype=dtype)
+        x = torch.randn(shape, device=device, dtype=dtype)
+
+        def inference():
+            with torch.no_grad():
+                model(x)
+
+        def train():
+            out = model(x)
+            out = out[0] if isinstance(out, tuple) else out
+            out.float().sum().backward()
+
+        for name, fn in (("inference", inference), ("train", train)):
+            model.train(name == "train")
+            ms, peak = _time(fn, device, args.warmup, iters)
+            step_s = ms * 1e-3 / seq
+            flops = _recurrent_flops(impl, batch, hidden) * (3 if name == "train" else 1)
+            records.append(
+                {
+                    "source": "python",
+                    "impl": impl,
+                    "device": device.type,
+                    "cell": "gru" if impl == "cudnn_gru" else cell,
+                    "pass": name,
+                    "dtype": dtype_name,
+                    "batch": batch,
+                    "hidden": hidden,
+                    "seq": seq,
+                    "activation": -1 if impl == "cudnn_gru" else activation,
+                    "ms": ms,
+                    "step_us": step_s * 1e6,
+                    "tflops": flops / step_s * 1e-12,
+                    "peak_bytes": peak,
+                }
+            )
+            print(json.dumps(records[-1]), file=sys.stderr)
+    return records
+
+
+def _bench_native(args):
+    def join(values):
+        return ",".join(str(v) for v in values)
+
+    command = [
+        args.native,
+        "--cell", join(args.cell),
+        "--batch", join(args.batch),
+        "--hidden", join(args.hidden),
+        "--seq", join(args.seq),
+        "--dtype", join(args.dtype),
+        "--activation", join(args.activation),
+        "--warmup", str(args.warmup),
+        "--iters", str(args.iters),
+    ]
+    output = subprocess.run(command, check=True, stdout=subprocess.PIPE, text=True).stdout
+    records = []
+    for line in output.splitlines():
+        if line.strip():
+            record = json.loads(line)
+            record.update({"impl": "fast_ligru", "device": "cuda"})
+            records.append(record)
+    return records
+
+
+def _environment():
+    env = {"torch": torch.__version__}
+    if torch.cuda.is_available():
+        env["gpu"] = torch.cuda.get_device_name()
+        env["cuda"] = torch.version.cuda
+        env["cudnn"] = torch.backends.cudnn.version()
+    try:
+        env["git"] = subprocess.run(
+            ["git", "rev-parse", "HEAD"], check=True, stdout=subprocess.PIPE, text=True
+        ).stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        pass
+    return env
+
+
+def _compare(baseline_path, current_path, threshold):
+    def index(path):
+        with open(path) as f:
+            records = json.load(f)["results"]
+        return {tuple(r.get(k) for k in KEY_FIELDS): r for r in records}
+
+    baseline, current = index(baseline_path), index(current_path)
+    regressions = 0
+    for key in sorted(set(baseline) & set(current), key=str):
+        ratio = current[key]["step_us"] / baseline[key]["step_us"]
+        if ratio > 1.0 + threshold:
+            regressions += 1
+            fields = ", ".join(f"{k}={v}" for k, v in zip(KEY_FIELDS, key))
+            print(f"slower x{ratio:.2f}: {fields}")
+    print(f"{regressions} regressions over {len(set(baseline) & set(current))} matched records")
+    return 1 if regressions else 0
+
+
+def _ints(text):
+    return [int(v) for v in text.split(",")]
+
+
+def _names(text):
+    return text.split(",")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--cell", type=_names, default=["1_0", "2_0"])
+    parser.add_argument("--batch", type=_ints, default=[8, 32])
+    parser.add_argument("--hidden", type=_ints, default=[512, 1024])
+    parser.add_argument("--seq", type=_ints, default=[100])
+    parser.add_argument("--dtype", type=_names, default=["float", "half"])
+    parser.add_argument("--activation", type=_ints, default=[0])
+    parser.add_argument("--input-size", type=int, default=80)
+    parser.add_argument("--warmup", type=int, default=3)
+    parser.add_argument("--iters", type=int, default=20)
+    parser.add_argument("--cpu", action="store_true", help="also time the CPU")
+    parser.add_argument("--native", help="path of the bench_passes binary")
+    parser.add_argument("--out", default="bench.json")
+    parser.add_argument("--compare", nargs=2, metavar=("BASELINE", "CURRENT"))
+    parser.add_argument("--threshold", type=float, default=0.1)
+    args = parser.parse_args()
+
+    if args.compare:
+        sys.exit(_compare(*args.compare, args.threshold))
+
+    results = _bench_python(args)
+    if args.native:
+        results += _bench_native(args)
+    with open(args.out, "w") as f:
+        json.dump({"environment": _environment(), "results": results}, f, indent=1)
+    print(f"wrote {len(results)} records to {args.out}")
+
+
+if __name__ == "__main__":
+    main()
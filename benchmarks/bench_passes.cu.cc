@@ -0,0 +1,415 @@
+// Copyright 2022 Adel Moumen. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+// Times the passes of `libhaste` directly, without PyTorch, over a sweep of
+// shapes, and prints one JSON object per line and measured pass:
+//
+//   bench_passes --cell 1_0,2_0 --batch 8,32 --hidden 512,1024 --seq 100
+//                --dtype float,half --activation 0 --warmup 3 --iters 20
+//
+// Every list flag takes comma-separated values and the sweep runs their
+// cartesian product. Each configuration reports the forward pass with and
+// without the gate cache and the backward pass. `flops` and `bytes` count the
+// recurrent GEMMs and the minimal traffic of one step (the weight, the
+// states and the gate inputs and outputs), from which the achieved TFLOP/s
+// and GB/s follow; `peak_bytes` is the device memory the call needs, i.e. its
+// tensors and workspace.
+
+#include <cublas_v2.h>
+#include <cuda_bf16.h>
+#include <cuda_fp16.h>
+#include <cuda_runtime_api.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "layer_norm.h"
+#include "ligru_1_0.h"
+#include "ligru_2_0.h"
+
+namespace {
+
+#define CHECK_CUDA(expr)                                                       \
+  do {                                                                         \
+    const cudaError_t status = (expr);                                         \
+    if (status != cudaSuccess) {                                               \
+      std::fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__,                  \
+                   cudaGetErrorString(status));                                \
+      std::exit(1);                                                            \
+    }                                                                          \
+  } while (0)
+
+struct Options {
+  std::vector<std::string> cells{"1_0", "2_0"};
+  std::vector<int> batch{8, 32};
+  std::vector<int> hidden{512, 1024};
+  std::vector<int> seq{100};
+  std::vector<std::string> dtypes{"float", "half"};
+  std::vector<int> activations{0};
+  int warmup = 3;
+  int iters = 20;
+};
+
+struct Config {
+  std::string cell;
+  std::string dtype;
+  int batch;
+  int hidden;
+  int seq;
+  int activation;
+};
+
+std::vector<std::string> split(const char *list) {
+  std::vector<std::string> items;
+  std::string item;
+  for (const char *c = list;; ++c) {
+    if (*c == ',' || *c == '\0') {
+      if (!item.empty())
+        items.push_back(item);
+      item.clear();
+      if (*c == '\0')
+        break;
+    } else {
+      item += *c;
+    }
+  }
+  return items;
+}
+
+std::vector<int> split_ints(const char *list) {
+  std::vector<int> values;
+  for (const auto &item : split(list))
+    values.push_back(std::atoi(item.c_str()));
+  return values;
+}
+
+Options parse(int argc, char **argv) {
+  Options options;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const std::string flag = argv[i];
+    const char *value = argv[i + 1];
+    if (flag == "--cell")
+      options.cells = split(value);
+    else if (flag == "--batch")
+      options.batch = split_ints(value);
+    else if (flag == "--hidden")
+      options.hidden = split_ints(value);
+    else if (flag == "--seq")
+      options.seq = split_ints(value);
+    else if (flag == "--dtype")
+      options.dtypes = split(value);
+    else if (flag == "--activation")
+      options.activations = split_ints(value);
+    else if (flag == "--warmup")
+      options.warmup = std::atoi(value);
+    else if (flag == "--iters")
+      options.iters = std::atoi(value);
+    else {
+      std::fprintf(stderr, "unknown flag %s\n", flag.c_str());
+      std::exit(2);
+    }
+  }
+  return options;
+}
+
+// Device allocations of one configuration, whose sum is its peak footprint.
+class Arena {
+public:
+  ~Arena() {
+    for (void *p : pointers_)
+      cudaFree(p);
+  }
+
+  template <typename T> T *alloc(const size_t count) {
+    void *p = nullptr;
+    CHECK_CUDA(cudaMalloc(&p, count * sizeof(T)));
+    pointers_.push_back(p);
+    bytes_ += count * sizeof(T);
+    return static_cast<T *>(p);
+  }
+
+  size_t bytes() const { return bytes_; }
+
+private:
+  std::vector<void *> pointers_;
+  size_t bytes_ = 0;
+};
+
+// Deterministic uniform values in `[-scale, scale]`.
+template <typename T>
+__global__ void Fill(const size_t count, const uint32_t seed, const float scale,
+                     T *data) {
+  const size_t i = blockDim.x * static_cast<size_t>(blockIdx.x) + threadIdx.x;
+  if (i >= count)
+    return;
+  uint32_t x = static_cast<uint32_t>(i) * 2654435761u ^ seed;
+  x ^= x >> 16;
+  x *= 0x7feb352du;
+  x ^= x >> 15;
+  const float unit = (x & 0xffffff) / static_cast<float>(0xffffff);
+  data[i] = static_cast<T>(scale * (2.0f * unit - 1.0f));
+}
+
+template <typename T>
+void fill(T *data, const size_t count, const uint32_t seed, const float scale) {
+  const int block = 256;
+  Fill<T><<<(count + block - 1) / block, block>>>(count, seed, scale, data);
+}
+
+// Mean milliseconds of `iters` calls of `run` after `warmup` untimed ones.
+template <typename Run>
+float time_ms(const int warmup, const int iters, const cudaStream_t stream,
+              Run run) {
+  for (int i = 0; i < warmup; ++i)
+    run();
+  cudaEvent_t start, stop;
+  CHECK_CUDA(cudaEventCreate(&start));
+  CHECK_CUDA(cudaEventCreate(&stop));
+  CHECK_CUDA(cudaEventRecord(start, stream));
+  for (int i = 0; i < iters; ++i)
+    run();
+  CHECK_CUDA(cudaEventRecord(stop, stream));
+  CHECK_CUDA(cudaEventSynchronize(stop));
+  float ms = 0.0f;
+  CHECK_CUDA(cudaEventElapsedTime(&ms, start, stop));
+  CHECK_CUDA(cudaEventDestroy(start));
+  CHECK_CUDA(cudaEventDestroy(stop));
+  CHECK_CUDA(cudaGetLastError());
+  return ms / iters;
+}
+
+void report(const Config &c, const char *pass, const float ms,
+            const double step_flops, const double step_bytes,
+            const size_t peak_bytes) {
+  const double step_s = ms * 1e-3 / c.seq;
+  std::printf("{\"source\": \"native\", \"cell\": \"%s\", \"pass\": \"%s\", "
+              "\"dtype\": \"%s\", \"batch\": %d, \"hidden\": %d, \"seq\": %d, "
+              "\"activation\": %d, \"ms\": %.6f, \"step_us\": %.4f, "
+              "\"flops\": %.0f, \"bytes\": %.0f, \"tflops\": %.4f, "
+              "\"gbps\": %.3f, \"peak_bytes\": %zu}\n",
+              c.cell.c_str(), pass, c.dtype.c_str(), c.batch, c.hidden, c.seq,
+              c.activation, ms, step_s * 1e6, step_flops * c.seq,
+              step_bytes * c.seq, step_flops / step_s * 1e-12,
+              step_bytes / step_s * 1e-9, peak_bytes);
+  std::fflush(stdout);
+}
+
+// Per-step cost model shared by both cells: the forward product `h u^T` is
+// `2 * B * 2H * H` flops and the backward adds the products for `dh` and
+// `du`; every step reads `u`, `wx` and `h`, writes `h` and, when training,
+// the `[B, 3H]` gate cache (the backward reads it back and writes `dwx`).
+struct StepCost {
+  double forward_flops, backward_flops;
+  double forward_bytes, inference_bytes, backward_bytes;
+};
+
+StepCost step_cost(const Config &c, const size_t element, const bool norm) {
+  const double b = c.batch, h = c.hidden, e = static_cast<double>(element);
+  StepCost cost;
+  cost.forward_flops = 4.0 * b * h * h;
+  cost.backward_flops = 2.0 * cost.forward_flops;
+  const double weights = 2.0 * h * h * e;
+  const double states = (2.0 * b * h + 2.0 * b * h) * e;
+  // SLi-GRU also keeps and reads back the pre-normalization product.
+  const double extra = norm ? 2.0 * b * h * e : 0.0;
+  cost.inference_bytes = weights + states;
+  cost.forward_bytes = cost.inference_bytes + 3.0 * b * h * e + extra;
+  // The backward reads `u` and writes `du`, and reads the gate cache back
+  // next to the states to write the `[B, 2H]` slice of `dwx`.
+  cost.backward_bytes =
+      2.0 * weights + states + 3.0 * b * h * e + 2.0 * b * h * e + extra;
+  return cost;
+}
+
+template <typename T>
+void bench_1_0(const Config &c, const Options &o, cublasHandle_t blas,
+               cudaStream_t stream) {
+  using namespace haste::v0::ligru_1_0;
+  const int B = c.batch, H = c.hidden, S = c.seq;
+
+  Arena arena;
+  T *wx = arena.alloc<T>(size_t(B) * S * 2 * H);
+  T *u = arena.alloc<T>(size_t(2) * H * H);
+  T *h = arena.alloc<T>(size_t(S + 1) * B * H);
+  T *v = arena.alloc<T>(size_t(S) * B * 3 * H);
+  T *grad = arena.alloc<T>(size_t(S + 1) * B * H);
+  T *dwx = arena.alloc<T>(size_t(S) * B * 2 * H);
+  T *du = arena.alloc<T>(size_t(2) * H * H);
+  const size_t workspace_bytes =
+      std::max(ForwardPass<T>::GetWorkspaceSize(S, B, H, true),
+               BackwardPass<T>::GetWorkspaceSize(S, B, H, true));
+  void *workspace = arena.alloc<char>(workspace_bytes);
+
+  fill(wx, size_t(B) * S * 2 * H, 1, 0.5f);
+  fill(u, size_t(2) * H * H, 2, 1.0f / std::sqrt(static_cast<float>(H)));
+  fill(grad, size_t(S + 1) * B * H, 3, 0.1f);
+  CHECK_CUDA(cudaMemset(h, 0, sizeof(T) * B * H));
+
+  const StepCost cost = step_cost(c, sizeof(T), false);
+  // The inference pass does not touch `v`, `grad` or the gradients.
+  const size_t inference_bytes =
+      arena.bytes() - sizeof(T) * (size_t(S) * B * 3 * H +
+                                   size_t(S + 1) * B * H +
+                                   size_t(S) * B * 2 * H + 2 * H * H);
+
+  ForwardPass<T> training(true, B, 0, H, blas, c.activation, stream);
+  ForwardPass<T> inference(false, B, 0, H, blas, c.activation, stream);
+  BackwardPass<T> backward(B, 0, H, blas, c.activation, stream);
+
+  float ms = time_ms(o.warmup, o.iters, stream, [&] {
+    training.Run(S, wx, u, h, v, workspace, true);
+  });
+  report(c, "forward", ms, cost.forward_flops, cost.forward_bytes,
+         arena.bytes());
+
+  ms = time_ms(o.warmup, o.iters, stream, [&] {
+    inference.Run(S, wx, u, h, nullptr, workspace, true);
+  });
+  report(c, "inference", ms, cost.forward_flops, cost.inference_bytes,
+         inference_bytes);
+
+  training.Run(S, wx, u, h, v, workspace, true);
+  ms = time_ms(o.warmup, o.iters, stream, [&] {
+    backward.Run(S, wx, u, h, v, grad, dwx, du, workspace);
+  });
+  report(c, "backward", ms, cost.backward_flops, cost.backward_bytes,
+         arena.bytes());
+}
+
+template <typename T>
+void bench_2_0(const Config &c, const Options &o, cublasHandle_t blas,
+               cudaStream_t stream) {
+  using namespace haste::v0;
+  const int B = c.batch, H = c.hidden, S = c.seq;
+
+  Arena arena;
+  T *wx = arena.alloc<T>(size_t(B) * S * 2 * H);
+  T *u = arena.alloc<T>(size_t(2) * H * H);
+  T *h = arena.alloc<T>(size_t(S + 1) * B * H);
+  T *norm_cache = arena.alloc<T>(size_t(S) * B * 2);
+  T *v = arena.alloc<T>(size_t(S) * B * 3 * H);
+  T *act_uh = arena.alloc<T>(size_t(S) * B * 2 * H);
+  T *grad = arena.alloc<T>(size_t(S + 1) * B * H);
+  T *dwx = arena.alloc<T>(size_t(S) * B * 2 * H);
+  T *du = arena.alloc<T>(size_t(2) * H * H);
+  const size_t workspace_bytes =
+      std::max(std::max(ligru_2_0::ForwardPass<T>::GetWorkspaceSize(S, B, H,
+                                                                    true),
+                        ligru_2_0::ForwardPass<T>::GetWorkspaceSize(S, B, H,
+                                                                    false)),
+               ligru_2_0::BackwardPass<T>::GetWorkspaceSize(S, B, H, true));
+  void *workspace = arena.alloc<char>(workspace_bytes);
+
+  fill(wx, size_t(B) * S * 2 * H, 1, 0.5f);
+  fill(u, size_t(2) * H * H, 2, 1.0f / std::sqrt(static_cast<float>(H)));
+  fill(grad, size_t(S + 1) * B * H, 3, 0.1f);
+  CHECK_CUDA(cudaMemset(h, 0, sizeof(T) * B * H));
+
+  const StepCost cost = step_cost(c, sizeof(T), true);
+  const size_t inference_bytes =
+      arena.bytes() -
+      sizeof(T) * (size_t(S) * B * 3 * H + size_t(S) * B * 2 * H +
+                   size_t(S + 1) * B * H + size_t(S) * B * 2 * H + 2 * H * H);
+
+  ligru_2_0::ForwardPass<T> training(true, B, 0, H, blas, c.activation,
+                                     stream);
+  ligru_2_0::ForwardPass<T> inference(false, B, 0, H, blas, c.activation,
+                                      stream);
+  ligru_2_0::BackwardPass<T> backward(B, 0, H, blas, c.activation, stream);
+
+  auto run_training = [&] {
+    layer_norm::ForwardPass<T> norm(S * B, 2 * H, nullptr, nullptr,
+                                    norm_cache);
+    training.Run(S, wx, u, h, v, norm, act_uh, workspace, true);
+  };
+
+  float ms = time_ms(o.warmup, o.iters, stream, run_training);
+  report(c, "forward", ms, cost.forward_flops, cost.forward_bytes,
+         arena.bytes());
+
+  ms = time_ms(o.warmup, o.iters, stream, [&] {
+    layer_norm::ForwardPass<T> norm(S * B, 2 * H, nullptr, nullptr,
+                                    norm_cache);
+    inference.Run(S, wx, u, h, nullptr, norm, nullptr, workspace, true);
+  });
+  report(c, "inference", ms, cost.forward_flops, cost.inference_bytes,
+         inference_bytes);
+
+  run_training();
+  ms = time_ms(o.warmup, o.iters, stream, [&] {
+    layer_norm::BackwardPass<T> norm(S * B, 2 * H, nullptr, nullptr, act_uh,
+                                     nullptr, nullptr, norm_cache);
+    backward.Run(S, wx, u, h, v, grad, dwx, du, workspace, norm);
+  });
+  report(c, "backward", ms, cost.backward_flops, cost.backward_bytes,
+         arena.bytes());
+}
+
+void bench(const Config &c, const Options &o, cublasHandle_t blas,
+           cudaStream_t stream) {
+  if (c.cell == "1_0") {
+    if (c.dtype == "float")
+      return bench_1_0<float>(c, o, blas, stream);
+    if (c.dtype == "half")
+      return bench_1_0<__half>(c, o, blas, stream);
+    if (c.dtype == "double")
+      return bench_1_0<double>(c, o, blas, stream);
+  } else if (c.cell == "2_0") {
+    if (c.dtype == "float")
+      return bench_2_0<float>(c, o, blas, stream);
+    if (c.dtype == "half")
+      return bench_2_0<__half>(c, o, blas, stream);
+    if (c.dtype == "bfloat16")
+      return bench_2_0<__nv_bfloat16>(c, o, blas, stream);
+    if (c.dtype == "double")
+      return bench_2_0<double>(c, o, blas, stream);
+  }
+  // Li-GRU has no bf16 kernels; skip the combinations that do not exist.
+  std::fprintf(stderr, "skipping cell %s with dtype %s\n", c.cell.c_str(),
+               c.dtype.c_str());
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+  const Options options = parse(argc, argv);
+
+  cublasHandle_t blas;
+  cudaStream_t stream;
+  CHECK_CUDA(cudaStreamCreate(&stream));
+  if (cublasCreate(&blas) != CUBLAS_STATUS_SUCCESS) {
+    std::fprintf(stderr, "cublasCreate failed\n");
+    return 1;
+  }
+  cublasSetStream(blas, stream);
+
+  for (const auto &cell : options.cells)
+    for (const auto &dtype : options.dtypes)
+      for (const int activation : options.activations)
+        for (const int hidden : options.hidden)
+          for (const int batch : options.batch)
+            for (const int seq : options.seq)
+              bench({cell, dtype, batch, hidden, seq, activation}, options,
+                    blas, stream);
+
+  cublasDestroy(blas);
+  cudaStreamDestroy(stream);
+  return 0;
+}
@@ -44,7 +44,7 @@ extension = cpp_extension.CUDAExtension(
     sources = glob('frameworks/pytorch/*.cc'),
     extra_compile_args = extra_args,
     include_dirs = [os.path.join(base_path, 'lib'), os.path.join(CUDA_HOME, 'include')],
-    libraries = ['haste'],
+    libraries = ['haste', 'cublasLt'],
     library_dirs = ['.'])
 
 setup(name = 'fast_ligru',
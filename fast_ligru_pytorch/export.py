@@ -0,0 +1,47 @@
+""" Export of trained models for the standalone C++ runtime.
+
+Author: Adel Moumen 2023
+"""
+
+import struct
+
+import torch
+
+_MAGIC = b"FLIGRU\0\0"
+_VERSION = 1
+
+
+def write_model(path, cell, activation, bidirectional, ws, bs, us):
+    """Writes the model file loaded by `haste::v0::LiGRUModel` (see
+    `lib/ligru_model.h` for the layout).
+    Arguments
+    ---------
+    path : str
+        Destination file.
+    cell : int
+        0 for a Li-GRU, 1 for a SLi-GRU.
+    activation : int
+        Activation code of the layers.
+    bidirectional : bool
+        Whether every layer runs both directions.
+    ws, bs, us : list of torch.Tensor
+        Per-layer folded input projections, biases and recurrent weights.
+    """
+    with open(path, "wb") as f:
+        f.write(_MAGIC)
+        f.write(
+            struct.pack(
+                "<7i",
+                _VERSION,
+                cell,
+                len(ws),
+                ws[0].shape[1],
+                us[0].shape[1],
+                int(bidirectional),
+                activation,
+            )
+        )
+        for layer in zip(ws, bs, us):
+            for t in layer:
+                t = t.detach().to("cpu", torch.float32).contiguous()
+                f.write(t.numpy().astype("<f4", copy=False).tobytes())
@@ -0,0 +1,113 @@
+""" Inference of several independent models of the same shape in one pass.
+
+    from fast_ligru_pytorch.grouped import grouped_forward
+
+    outputs = grouped_forward([model_a, model_b, model_c], x)
+    for output, hh in outputs:
+        ...
+
+Every layer runs the recurrences of all the models together: one
+strided-batched GEMM and one pointwise launch per time step instead of one
+of each per model, which fills the GPU when the models are small.
+
+Author: Adel Moumen 2023
+"""
+
+from typing import List, Optional
+
+import torch
+from torch import Tensor
+
+import fast_ligru
+
+from .ligru import LiGRU
+from .stabilised_ligru import SLiGRU
+
+
+def _can_group(models, x):
+    """Whether the models can run grouped: CUDA inference without gradients
+    over unidirectional models of the same class and shape, with the full
+    precision recurrent weights on the device of `x`."""
+    first = models[0]
+    if not (x.is_cuda and not torch.is_grad_enabled() and len(models) > 1):
+        return False
+    if not isinstance(first, (LiGRU, SLiGRU)):
+        return False
+    for model in models:
+        if (
+            type(model) is not type(first)
+            or model.training
+            or model.bidirectional
+            or model.num_layers != first.num_layers
+            or model.hidden_size != first.hidden_size
+            or model.nonlinearity != first.nonlinearity
+            or model.zoneout != first.zoneout
+            or model.fea_dim != first.fea_dim
+        ):
+            return False
+        for lay in model.rnn:
+            if lay.u_quantized is not None or lay.h_init.device != x.device:
+                return False
+    return True
+
+
+def _projection(lay, x):
+    """Returns the input projection of `lay`, with the folded batch norm bias
+    added, since the grouped recurrence takes no bias."""
+    if lay._can_fold_norm(x):
+        w, bias = lay._folded_projection(x)
+        return w + bias
+    return lay._input_projection(x)
+
+
+def grouped_forward(models, x, hx: Optional[List[Tensor]] = None):
+    """Returns the `(output, hh)` that each of `models` returns for `x`, in
+    the same order.
+    Arguments
+    ---------
+    models : list
+        `LiGRU` or `SLiGRU` models of the same class and configuration and
+        different weights, in eval mode.
+    x : torch.Tensor
+        The input tensor fed to every model.
+    hx : list
+        Starting hidden state of each model, or None.
+    """
+    if not _can_group(models, x):
+        if hx is None:
+            return [model(x) for model in models]
+        return [model(x, hx=h) for model, h in zip(models, hx)]
+
+    first = models[0]
+    if first.reshape and x.ndim == 4:
+        x = x.reshape(x.shape[0], x.shape[1], x.shape[2] * x.shape[3])
+    forward = (
+        fast_ligru.ligru_1_0_grouped_forward
+        if isinstance(first, LiGRU)
+        else fast_ligru.ligru_2_0_grouped_forward
+    )
+
+    # `xs[g]` is the input of the current layer of model `g`.
+    xs = [x] * len(models)
+    finals = [[] for _ in models]
+    for i in range(first.num_layers):
+        lays = [model.rnn[i] for model in models]
+        wx = torch.stack([_projection(lay, xg) for lay, xg in zip(lays, xs)], 1)
+        batch = x.shape[0]
+        if hx is None:
+            h0 = [lay.h_init.expand(batch, -1) for lay in lays]
+        else:
+            h0 = [h[i] for h in hx]
+        h0 = torch.stack(h0, 1).to(wx.dtype)
+        u = torch.stack([lay.u.weight for lay in lays]).to(wx.dtype)
+
+        # `[T + 1, B, G, H]`, back to one batch-first output per model.
+        output = forward(
+            wx.contiguous(), h0.contiguous(), u.contiguous(),
+            lays[0].activation, lays[0].zoneout,
+        )
+        xs = list(output[1:].permute(2, 1, 0, 3).unbind(0))
+        for g, xg in enumerate(xs):
+            finals[g].append(xg[:, -1, :])
+
+    return [(xg, torch.stack(h, dim=0)) for xg, h in zip(xs, finals)]
@@ -0,0 +1,58 @@
+""" Sampled per-phase timing of the fast_ligru passes.
+
+    from fast_ligru_pytorch import profiling
+
+    profiling.enable(sample_period=100)
+    ...  # training or inference
+    for scope, phases in profiling.stats().items():
+        print(scope, phases["recurrent_gemm"]["ms"])
+
+Author: Adel Moumen 2023
+"""
+
+import fast_ligru
+
+
+def enable(sample_period=100):
+    """Times one in every `sample_period` calls of the passes, counted over
+    all layers and threads. Timed calls record a pair of CUDA events around
+    each phase they issue; the others only pay a counter increment, so a
+    large period can be left on in production. Calls replayed from a CUDA
+    graph (see `fast_ligru.set_cuda_graphs`) or captured into one are not
+    timed.
+    """
+    fast_ligru.set_profiler_sample_period(int(sample_period))
+
+
+def disable():
+    """Stops timing; the figures gathered so far are kept."""
+    fast_ligru.set_profiler_sample_period(0)
+
+
+def reset():
+    """Clears the figures gathered so far."""
+    fast_ligru.reset_profiler()
+
+
+def stats(synchronize=True):
+    """Returns the cumulative figures of the timed calls as
+    `{scope: {phase: {"count", "ms", "bytes", "gbps"}}}`, where `scope` is
+    the pass entry point (e.g. "ligru_1_0::BackwardPass::Run") and `phase` one
+    of "input_projection", "recurrent_gemm", "layer_norm", "pointwise",
+    "persistent" and "weight_grad". `count` is the number of timed ranges
+    and `bytes` the device memory traffic they are modeled to move.
+    Arguments
+    ---------
+    synchronize : bool
+        If True, waits for the timed calls still running on the GPU;
+        otherwise they are left out until a later call.
+    """
+    result = {}
+    for scope, phase, count, ms, nbytes in fast_ligru.profiler_stats(synchronize):
+        result.setdefault(scope, {})[phase] = {
+            "count": count,
+            "ms": ms,
+            "bytes": nbytes,
+            "gbps": nbytes / (ms * 1e6) if ms > 0 else 0.0,
+        }
+    return result
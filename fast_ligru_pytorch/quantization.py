@@ -0,0 +1,69 @@
+""" Per-channel quantization of the recurrent weights for inference.
+
+Author: Adel Moumen 2023
+"""
+
+import torch
+
+# Format name -> (binding code, largest representable magnitude).
+FORMATS = {"int8": (0, 127.0), "fp8": (1, 448.0)}
+
+
+def quantize_per_channel(weight, fmt="int8", calibrate=True, num_candidates=20):
+    """Returns `(data, scale)` such that `dequantize(data, scale, fmt)`
+    approximates the `[R, C]` `weight`, with one fp32 scale per row (output
+    channel). `data` holds one byte per element: int8 values, or the bytes of
+    fp8 e4m3 values as uint8.
+    Arguments
+    ---------
+    weight : torch.Tensor
+        Weight to quantize, e.g. the `[2H, H]` recurrent weight of a layer.
+    fmt : str
+        "int8" or "fp8".
+    calibrate : bool
+        If True, the clipping range of each row is searched among
+        `num_candidates` fractions of its absolute maximum, from 1 down to
+        0.5, for the smallest squared reconstruction error: saturating a few
+        outliers buys a finer step for the rest of the row. Otherwise the
+        absolute maximum is used.
+    """
+    if fmt not in FORMATS:
+        raise ValueError(f"unknown quantization format {fmt!r}")
+    if fmt == "fp8" and not hasattr(torch, "float8_e4m3fn"):
+        raise RuntimeError("fp8 quantization needs PyTorch 2.1 or later")
+
+    qmax = FORMATS[fmt][1]
+    w = weight.detach().float()
+    absmax = w.abs().amax(dim=1).clamp(min=1e-12)
+    ratios = torch.linspace(1.0, 0.5, num_candidates) if calibrate else [1.0]
+
+    best_scale, best_error = None, None
+    for ratio in ratios:
+        scale = absmax * float(ratio) / qmax
+        error = (dequantize(_quantize(w, scale, fmt), scale, fmt) - w).pow(2).sum(1)
+        if best_scale is None:
+            best_scale, best_error = scale, error
+        else:
+            better = error < best_error
+            best_scale = torch.where(better, scale, best_scale)
+            best_error = torch.where(better, error, best_error)
+
+    return _quantize(w, best_scale, fmt).contiguous(), best_scale.contiguous()
+
+
+def dequantize(data, scale, fmt="int8"):
+    """Returns the fp32 weight that `(data, scale)` of
+    `quantize_per_channel` stands for."""
+    if fmt == "fp8":
+        values = data.view(torch.float8_e4m3fn).float()
+    else:
+        values = data.float()
+    return values * scale.unsqueeze(1)
+
+
+def _quantize(w, scale, fmt):
+    qmax = FORMATS[fmt][1]
+    x = (w / scale.unsqueeze(1)).clamp(-qmax, qmax)
+    if fmt == "fp8":
+        return x.to(torch.float8_e4m3fn).view(torch.uint8)
+    return x.round().to(torch.int8)
@@ -15,6 +15,10 @@ except ImportError:
         "Could not import fast_ligru. Please make sure that fast_ligru is installed correctly."
     )
 
+from .export import write_model
+from .quantization import FORMATS, quantize_per_channel
+from .ligru import _zoneout_seed
+
 
 class ApplyLiGRUCell(torch.autograd.Function):
     """ This function implements a SLight GRU (liGRU).
@@ -23,28 +27,62 @@ class ApplyLiGRUCell(torch.autograd.Function):
     """
 
     @staticmethod
-    def forward(ctx, training, wx, u, h, activation):
+    def forward(ctx, training, wx, u, h, activation, bidirectional, batch_sizes=None,
+                recompute=False, bias=None, zoneout=0.0, sample=False):
         """Forward pass of the Sligru cell.
 
         Args:
             ctx : context object
             training : save for backward intermediate results
-            wx : input weights (BN(Wx))
-            u : recurrent weights 
+            wx : input weights (BN(Wx)), batch first
+            u : recurrent weights, read in place by the kernels
             h : hidden state
             activation : string activation function
+            bidirectional : run the reverse direction over the same wx and
+                interleave both directions in the output
+            batch_sizes : number of sequences still running at each step of
+                a batch sorted by decreasing length, or None if they all span
+                the whole input
+            recompute : keep no gate cache and rebuild the gates from the
+                hidden states in the backward pass (unidirectional, fixed-length
+                batches only)
+            bias : per-channel bias added to wx inside the recurrence, or None
+                (fixed-length batches without recompute only)
+            zoneout : probability that a hidden unit keeps its previous value
+                at each step
+            sample : draw the zoneout masks rather than blending by their
+                expectation
 
         Returns:
             output : output of the ligru cell
         """
 
-        output, cache, act_uh, act_uh_norm_cache, = fast_ligru.ligru_2_0_forward(
-            training, wx.contiguous(), h.contiguous(), u.T.contiguous(), activation,
-        )
+        recompute = training and recompute and batch_sizes is None and not bidirectional
+        u = u.contiguous()
+        seed = _zoneout_seed() if sample and zoneout > 0 else 0
+        if batch_sizes is not None:
+            # The packed kernels walk a time-major input.
+            wx = wx.transpose(0, 1).contiguous()
+            output, cache, act_uh, act_uh_norm_cache, = fast_ligru.ligru_2_0_packed_forward(
+                training, wx, h.contiguous(), u, activation, batch_sizes,
+                zoneout, sample, seed,
+            )
+        else:
+            wx = wx.contiguous()
+            output, cache, act_uh, act_uh_norm_cache, = fast_ligru.ligru_2_0_forward(
+                training and not recompute, wx, h.contiguous(), u, activation,
+                bidirectional, bias, zoneout, sample, seed,
+            )
 
         ctx.activation = activation
+        ctx.bidirectional = bidirectional
+        ctx.batch_sizes = batch_sizes
+        ctx.recompute = recompute
+        ctx.zoneout = (zoneout, sample, seed)
+        ctx.h_shape = h.shape
+        ctx.h_dtype = h.dtype
 
-        ctx.save_for_backward(output, cache, act_uh, act_uh_norm_cache, wx, u, cache)
+        ctx.save_for_backward(output, cache, act_uh, act_uh_norm_cache, wx, u)
 
         return output
 
@@ -52,20 +90,67 @@ class ApplyLiGRUCell(torch.autograd.Function):
     def backward(ctx, grad_out):
         """Backward pass of the ligru cell. """
 
-        h, cache, act_uh, act_uh_norm_cache, wx, u, cache, = ctx.saved_tensors
-
-        du, dwx, tmp_dwx, = fast_ligru.ligru_2_0_backward(
-            wx.contiguous(),
-            u.contiguous(),
-            h,
-            cache,
-            act_uh,
-            act_uh_norm_cache,
-            grad_out.contiguous(),
-            ctx.activation,
-        )
+        h, cache, act_uh, act_uh_norm_cache, wx, u, = ctx.saved_tensors
+
+        if ctx.batch_sizes is not None:
+            du, dwx, dh0, = fast_ligru.ligru_2_0_packed_backward(
+                wx,
+                u,
+                h,
+                cache,
+                act_uh,
+                act_uh_norm_cache,
+                grad_out.contiguous(),
+                ctx.activation,
+                ctx.batch_sizes,
+                *ctx.zoneout,
+                None,
+            )
+        elif ctx.recompute:
+            du, dwx, dh0, = fast_ligru.ligru_2_0_recompute_backward(
+                wx,
+                u,
+                h,
+                act_uh_norm_cache,
+                grad_out.contiguous(),
+                ctx.activation,
+                *ctx.zoneout,
+                None,
+            )
+        else:
+            du, dwx, dh0, = fast_ligru.ligru_2_0_backward(
+                wx,
+                u,
+                h,
+                cache,
+                act_uh,
+                act_uh_norm_cache,
+                grad_out.contiguous(),
+                ctx.activation,
+                ctx.bidirectional,
+                *ctx.zoneout,
+                None,
+            )
 
-        return None, dwx, du.T, None, None, None
+        # `dh0` carries the gradient into the initial state, e.g. the final
+        # state of the previous segment of a long sequence; the first output
+        # slot is a copy of that state, as is the last one for the reverse
+        # direction, whose `[2B, H]` state follows the forward one. A
+        # broadcast `[1, H]` state sums it over the batch.
+        dh = None
+        if ctx.needs_input_grad[3]:
+            if ctx.bidirectional:
+                hidden = dh0.shape[-1]
+                dh0 = dh0 + torch.stack(
+                    [grad_out[0, :, :hidden], grad_out[-1, :, hidden:]])
+                dh0 = dh0.flatten(0, 1)
+            else:
+                dh0 = dh0 + grad_out[0]
+            dh = dh0.sum_to_size(ctx.h_shape).to(ctx.h_dtype)
+
+        # `dwx` is always time-major; `du` already has the layout of `u`.
+        return (None, dwx.transpose(0, 1), du, dh, None, None, None, None,
+                None, None, None)
 
 
 class SLiGRU(torch.nn.Module):
@@ -104,6 +189,15 @@ class SLiGRU(torch.nn.Module):
     bidirectional : bool
         If True, a bidirectional model that scans the sequence both
         right-to-left and left-to-right is used.
+    recompute : bool
+        If True, training keeps no gate cache on the GPU and the backward pass
+        recomputes the gates from the hidden states, trading one extra
+        recurrent product per step for less activation memory. Bidirectional
+        layers and variable-length batches keep the cache.
+    zoneout : float
+        Probability that a hidden unit keeps its previous value at each step,
+        as in `LiGRU`. It acts on the state after the gates, so the layer
+        norm of the recurrent products is unchanged.
     Example
     -------
     >>> inp_tensor = torch.rand([4, 10, 20])
@@ -124,6 +218,8 @@ class SLiGRU(torch.nn.Module):
         dropout=0,
         re_init=True,
         bidirectional=False,
+        recompute=False,
+        zoneout=0.0,
     ):
         super().__init__()
         self.hidden_size = hidden_size
@@ -133,8 +229,11 @@ class SLiGRU(torch.nn.Module):
         self.bias = bias
         self.re_init = re_init
         self.bidirectional = bidirectional
+        self.recompute = recompute
+        self.zoneout = zoneout
         self.dropout = dropout if dropout > 0 else None
         self.reshape = False
+        self.stack_chunk_size = 16
 
         # Computing the feature dimensionality
         if len(input_shape) > 3:
@@ -163,6 +262,8 @@ class SLiGRU(torch.nn.Module):
                 nonlinearity=self.nonlinearity,
                 normalization=self.normalization,
                 bidirectional=self.bidirectional,
+                recompute=self.recompute,
+                zoneout=self.zoneout,
             )
             rnn.append(rnn_lay)
 
@@ -172,7 +273,71 @@ class SLiGRU(torch.nn.Module):
                 current_dim = self.hidden_size
         return rnn
 
-    def forward(self, x, hx: Optional[Tensor] = None):
+    def distribute(self, devices):
+        """Places layer `l` on `devices[l % len(devices)]` and returns the
+        module. The activations then move from one device to the next between
+        layers, in training as in inference, while the inputs and outputs of
+        `forward` stay on the device of the input. Only inference is
+        pipelined: without gradients, the native stack runs the layers over
+        chunks of time steps, so the devices work on consecutive layers
+        concurrently. Training runs the layers one after another, one device
+        at a time, so there `distribute` spreads memory, not time.
+        Arguments
+        ---------
+        devices : list
+            CUDA devices to spread the layers over.
+        """
+        devices = [torch.device(device) for device in devices]
+        for i, ligru_lay in enumerate(self.rnn):
+            ligru_lay.to(devices[i % len(devices)])
+        return self
+
+    def quantize(self, fmt="int8", calibrate=True):
+        """Quantizes the recurrent weight of every layer per output channel
+        (see `quantization.quantize_per_channel`) and returns the module.
+        Without gradients, eval-mode CUDA inference then runs its recurrences
+        on the quantized weights, which cuts the weight traffic of every step
+        by 2x (fp16) to 4x (fp32); the full-precision weights stay untouched
+        for training, streaming sessions and exported models. `fmt=None`
+        drops the quantized weights. They are not part of the state dict:
+        call `quantize` again after loading a model.
+        Arguments
+        ---------
+        fmt : str
+            "int8", "fp8" (e4m3, needs PyTorch 2.1+ and CUDA 11.8+) or None.
+        calibrate : bool
+            Whether to search the clipping range of each channel.
+        """
+        for ligru_lay in self.rnn:
+            ligru_lay.quantize(fmt, calibrate)
+        return self
+
+    def prepare_weights(self, l2_persistence=True):
+        """Prepares the weights for repeated inference calls and returns the
+        module. The eval-mode batch norms are folded into the input
+        projections once, and the folded weights are reused by every call
+        until a parameter or running statistic changes. With
+        `l2_persistence`, enough of the L2 cache of each device (on Ampere and
+        later GPUs) is set aside for the largest recurrent weight it holds,
+        which the kernels then keep cached across the steps of a call; the
+        carve-out is shared by the whole process.
+        """
+        largest = {}
+        with torch.no_grad():
+            for ligru_lay in self.rnn:
+                if ligru_lay._can_fold_norm(None):
+                    ligru_lay.folded_input_projection()
+                weight = ligru_lay.u.weight
+                if weight.is_cuda:
+                    size = weight.numel() * weight.element_size()
+                    largest[weight.device] = max(largest.get(weight.device, 0), size)
+
+        if l2_persistence:
+            for device, size in largest.items():
+                fast_ligru.reserve_l2_persistence(size, device.index)
+        return self
+
+    def forward(self, x, hx: Optional[Tensor] = None, lengths: Optional[Tensor] = None):
         """Returns the output of the liGRU.
         Arguments
         ---------
@@ -180,6 +345,11 @@ class SLiGRU(torch.nn.Module):
             The input tensor.
         hx : torch.Tensor
             Starting hidden state.
+        lengths : torch.Tensor
+            Number of valid time steps of each sequence (at least one) when
+            `x` is a padded batch. The padded steps are not computed, their
+            outputs are zero and each final state is taken at the last valid
+            step of its sequence.
         """
         # Reshaping input tensors for 4d inputs
         if self.reshape:
@@ -187,10 +357,224 @@ class SLiGRU(torch.nn.Module):
                 x = x.reshape(x.shape[0], x.shape[1], x.shape[2] * x.shape[3])
 
         # run ligru
-        output, hh = self._forward_ligru(x, hx=hx)
+        if lengths is not None:
+            output, hh = self._forward_packed(x, lengths, hx=hx)
+        elif self._can_forward_stack(x):
+            output, hh = self._forward_stack(x, hx=hx)
+        else:
+            output, hh = self._forward_ligru(x, hx=hx)
 
         return output, hh
 
+    def final_state(self, x, hx: Optional[Tensor] = None):
+        """Returns only the final hidden state of every layer, with the same
+        layout as the second output of `forward`. Without gradients on CUDA,
+        the last layer keeps a ping-pong buffer of two states instead of its
+        whole output sequence.
+        Arguments
+        ---------
+        x : torch.Tensor
+            The input tensor.
+        hx : torch.Tensor
+            Starting hidden state.
+        """
+        if self.reshape:
+            if x.ndim == 4:
+                x = x.reshape(x.shape[0], x.shape[1], x.shape[2] * x.shape[3])
+
+        if self.bidirectional:
+            return self._forward_ligru(x, hx=hx)[1]
+
+        h = []
+        device = x.device
+        for i, ligru_lay in enumerate(self.rnn):
+            layer_device = ligru_lay.h_init.device
+            x = x.to(layer_device)
+            hx_i = hx[i].to(layer_device) if hx is not None else None
+            if i == len(self.rnn) - 1:
+                h.append(ligru_lay.final_state(x, hx=hx_i).to(device))
+                break
+
+            x = ligru_lay(x, hx=hx_i)
+
+            if self.dropout:
+                x = self.dropout(x)
+
+            h.append(x[:, -1, :].to(device))
+
+        return torch.stack(h, dim=0)
+
+    def _can_forward_stack(self, x):
+        """Whether the whole stack can run in one native wavefront call. This
+        is only possible without gradients, without zoneout or quantized
+        weights and with the batch norm in eval mode, so that the input
+        projections can be computed chunk by chunk."""
+        return (
+            x.is_cuda
+            and not self.training
+            and not torch.is_grad_enabled()
+            and not self.bidirectional
+            and self.normalization == "batchnorm"
+            and not self.zoneout
+            and all(lay.u_quantized is None for lay in self.rnn)
+        )
+
+    def _forward_stack(self, x, hx: Optional[Tensor]):
+        """Returns the output of the liGRU computed by pipelining the layers
+        over chunks of time steps.
+        Arguments
+        ---------
+        x : torch.Tensor
+            Input tensor.
+        hx : torch.Tensor
+        """
+        ws, bs, us = self._native_weights()
+
+        if hx is None:
+            hx = x.new_zeros(self.num_layers, x.shape[0], self.hidden_size)
+
+        output, hh = fast_ligru.ligru_2_0_stack_forward(
+            x.transpose(0, 1).contiguous(),
+            ws,
+            bs,
+            us,
+            hx.contiguous(),
+            self.rnn[0].activation,
+            self.stack_chunk_size,
+        )
+
+        return output.transpose(0, 1), hh
+
+    def streaming_session(self, num_slots):
+        """Returns a native session that runs the whole stack over successive
+        chunks of up to `num_slots` concurrent streams, keeping their hidden
+        states on the device between calls. The weights are snapshotted, so
+        the model must be in eval mode and the session re-created after any
+        update. `session.step(x, slots)` takes a (batch, time, fea) chunk and
+        the slot of each batch entry, as a CPU tensor, and returns the
+        (batch, time, hidden) output of the last layer.
+        Arguments
+        ---------
+        num_slots : int
+            Number of hidden state slots to keep on the device.
+        """
+        if self.training or self.bidirectional or self.normalization != "batchnorm":
+            raise ValueError(
+                "streaming sessions require a unidirectional batchnorm model in eval mode"
+            )
+        if self.zoneout:
+            raise ValueError("streaming sessions do not support zoneout")
+        if len({ligru_lay.h_init.device for ligru_lay in self.rnn}) > 1:
+            raise ValueError("streaming sessions require all layers on one device")
+
+        with torch.no_grad():
+            ws, bs, us = self._native_weights()
+
+        return _StreamingSession(
+            fast_ligru.ligru_2_0_streaming_session(
+                ws, bs, us, self.rnn[0].activation, num_slots
+            ),
+            self.reshape,
+        )
+
+    def continuous_batcher(self, num_slots):
+        """Returns a native scheduler serving up to `num_slots` concurrent
+        streams over a streaming session (see `streaming_session`). Streams
+        `join()` to get a slot, `push(slot, frames)` their (time, fea) input
+        as it arrives and `pop(slot)` their outputs; every `step()` advances
+        all the streams with pending input as one dynamic batch.
+        Arguments
+        ---------
+        num_slots : int
+            Maximum number of concurrent streams.
+        """
+        return fast_ligru.ContinuousBatcher(self.streaming_session(num_slots).session)
+
+    def export_weights(self, path):
+        """Writes the model to `path` for the standalone C++ runtime
+        (`lib/ligru_model.h`), with the eval-mode batch norm folded into the
+        input projections. Dropout only applies in training and is not
+        exported.
+        Arguments
+        ---------
+        path : str
+            Destination file.
+        """
+        if self.normalization != "batchnorm":
+            raise ValueError("exported models require batchnorm normalization")
+        if self.zoneout:
+            raise ValueError("exported models do not support zoneout")
+
+        with torch.no_grad():
+            ws, bs, us = self._native_weights()
+
+        write_model(
+            path, 1, self.rnn[0].activation, self.bidirectional, ws, bs, us
+        )
+
+    def _native_weights(self):
+        """Returns the per-layer folded input projections, biases and
+        recurrent weights expected by the native stack kernels."""
+        ws, bs, us = [], [], []
+        for ligru_lay in self.rnn:
+            w, b = ligru_lay.folded_input_projection()
+            ws.append(w)
+            bs.append(b)
+            us.append(ligru_lay.u.weight.contiguous())
+        return ws, bs, us
+
+    def _forward_packed(self, x, lengths, hx: Optional[Tensor]):
+        """Returns the output of the liGRU over a padded batch of sequences
+        of different lengths. The batch is processed sorted by decreasing
+        length, as in a `PackedSequence`, so that every step only runs the
+        sequences that have not ended yet.
+        Arguments
+        ---------
+        x : torch.Tensor
+            Input tensor.
+        lengths : torch.Tensor
+            Number of valid time steps of each sequence.
+        hx : torch.Tensor
+        """
+        if self.bidirectional:
+            raise ValueError("variable-length inputs require a unidirectional model")
+
+        lengths = torch.as_tensor(lengths, dtype=torch.long).cpu()
+        sorted_lengths, order = torch.sort(lengths, descending=True)
+        time_steps = x.shape[1]
+        max_length = int(sorted_lengths[0])
+        batch_sizes = (
+            sorted_lengths.unsqueeze(0) > torch.arange(max_length).unsqueeze(1)
+        ).sum(1)
+
+        order = order.to(x.device)
+        last = (sorted_lengths - 1).to(x.device)
+        rows = torch.arange(x.shape[0], device=x.device)
+
+        x = x[order, :max_length]
+        if hx is not None:
+            hx = hx[:, order]
+
+        h = []
+        device = x.device
+        for i, ligru_lay in enumerate(self.rnn):
+            layer_device = ligru_lay.h_init.device
+            x = ligru_lay(
+                x.to(layer_device),
+                hx=hx[i].to(layer_device) if hx is not None else None,
+                batch_sizes=batch_sizes,
+            )
+
+            if self.dropout and i < len(self.rnn) - 1:
+                x = self.dropout(x)
+
+            h.append(x[rows.to(layer_device), last.to(layer_device)].to(device))
+
+        x = x.to(device)
+        inverse = torch.argsort(order)
+        x = torch.nn.functional.pad(x[inverse], (0, 0, 0, time_steps - max_length))
+        return x, torch.stack(h, dim=0)[:, inverse]
+
     def _forward_ligru(self, x, hx: Optional[Tensor]):
         """Returns the output of the vanilla liGRU.
         Arguments
@@ -205,17 +589,22 @@ class SLiGRU(torch.nn.Module):
             if self.bidirectional:
                 hx = hx.reshape(self.num_layers, self.batch_size * 2, self.hidden_size)
 
-        # Processing the different layers
+        # Processing the different layers, each on its own device (see
+        # `distribute`)
+        device = x.device
         for i, ligru_lay in enumerate(self.rnn):
+            layer_device = ligru_lay.h_init.device
+            x = x.to(layer_device)
             if hx is not None:
-                x = ligru_lay(x, hx=hx[i])
+                x = ligru_lay(x, hx=hx[i].to(layer_device))
             else:
                 x = ligru_lay(x, hx=None)
 
             if self.dropout and i < len(self.rnn) - 1:
                 x = self.dropout(x)
 
-            h.append(x[:, -1, :])
+            h.append(x[:, -1, :].to(device))
+        x = x.to(device)
         h = torch.stack(h, dim=1)
 
         if self.bidirectional:
@@ -249,6 +638,11 @@ class LiGRU_Layer(torch.nn.Module):
     bidirectional : bool
         if True, a bidirectional model that scans the sequence both
         right-to-left and left-to-right is used.
+    recompute : bool
+        If True, the backward pass recomputes the gates instead of reading a
+        cache saved by the forward pass.
+    zoneout : float
+        Probability that a hidden unit keeps its previous value at each step.
     """
 
     def __init__(
@@ -260,6 +654,8 @@ class LiGRU_Layer(torch.nn.Module):
         nonlinearity="relu",
         normalization="batchnorm",
         bidirectional=False,
+        recompute=False,
+        zoneout=0.0,
     ):
 
         super(LiGRU_Layer, self).__init__()
@@ -267,6 +663,8 @@ class LiGRU_Layer(torch.nn.Module):
         self.input_size = int(input_size)
         self.batch_size = batch_size
         self.bidirectional = bidirectional
+        self.recompute = recompute
+        self.zoneout = zoneout
 
         self.w = nn.Linear(self.input_size, 2 * self.hidden_size, bias=False)
 
@@ -296,6 +694,15 @@ class LiGRU_Layer(torch.nn.Module):
         # Initial state
         self.register_buffer("h_init", torch.zeros(1, self.hidden_size))
 
+        # Quantized copy of `u` for inference (see `quantize`).
+        self.quantization = None
+        self.register_buffer("u_quantized", None, persistent=False)
+        self.register_buffer("u_scale", None, persistent=False)
+
+        # `(key, weight, bias)` of the last folded input projection (see
+        # `folded_input_projection`).
+        self._folded = None
+
         # Setting the activation function
         if nonlinearity == "tanh":
             self.activation = 3
@@ -310,40 +717,168 @@ class LiGRU_Layer(torch.nn.Module):
             self.activation = 0
             self.act = torch.nn.ReLU()
 
-    def forward(self, x, hx: Optional[Tensor] = None):
-        # type: (Tensor, Optional[Tensor]) -> Tensor # noqa F821
+    def forward(self, x, hx: Optional[Tensor] = None, batch_sizes: Optional[Tensor] = None):
+        # type: (Tensor, Optional[Tensor], Optional[Tensor]) -> Tensor # noqa F821
         """Returns the output of the liGRU layer.
         Arguments
         ---------
         x : torch.Tensor
             Input tensor.
+        batch_sizes : torch.Tensor
+            Number of sequences still running at each time step of a batch
+            sorted by decreasing length (unidirectional layers only).
         """
-        if self.bidirectional:
+        # The CUDA kernels run the reverse direction natively over the same
+        # input projection.
+        flip = self.bidirectional and not x.is_cuda
+        if flip:
             x_flip = x.flip(1)
             x = torch.cat([x, x_flip], dim=0)
 
-        # Feed-forward affine transformations (all steps in parallel)
-        w = self.w(x)
-
-        # Apply batch normalization
-        if self.normalize:
-            w_bn = self.norm(w.reshape(w.shape[0] * w.shape[1], w.shape[2]))
-            w = w_bn.reshape(w.shape[0], w.shape[1], w.shape[2])
+        bias = None
+        if self._can_fold_norm(x) and batch_sizes is None:
+            w, bias = self._folded_projection(x)
+        else:
+            w = self._input_projection(x)
 
         # Processing time steps
         if hx is not None:
-            h = self._ligru_cell(w, hx)
+            h = self._ligru_cell(w, hx, batch_sizes, bias)
         else:
-            h = self._ligru_cell(w, self.h_init)
+            h = self._ligru_cell(w, self.h_init, batch_sizes, bias)
 
-        if self.bidirectional:
+        if flip:
             h_f, h_b = h.chunk(2, dim=0)
             h_b = h_b.flip(1)
             h = torch.cat([h_f, h_b], dim=2)
 
         return h
 
-    def _ligru_cell_cpu(self, w, ht):
+    def final_state(self, x, hx: Optional[Tensor] = None):
+        """Returns the hidden state after the last time step of a
+        unidirectional layer. Without gradients on CUDA, no output sequence
+        or gate cache is kept on the device.
+        Arguments
+        ---------
+        x : torch.Tensor
+            Input tensor.
+        hx : torch.Tensor
+            Starting hidden state.
+        """
+        if (
+            self.bidirectional
+            or not x.is_cuda
+            or torch.is_grad_enabled()
+            or self.u_quantized is not None
+        ):
+            return self.forward(x, hx=hx)[:, -1]
+
+        bias = None
+        if self._can_fold_norm(x):
+            w, bias = self._folded_projection(x)
+        else:
+            w = self._input_projection(x)
+        ht = hx if hx is not None else self.h_init
+
+        return fast_ligru.ligru_2_0_forward_final(
+            w.contiguous(),
+            ht.to(w.dtype).contiguous(),
+            self.u.weight.to(w.dtype).contiguous(),
+            self.activation,
+            bias,
+            self.zoneout,
+            self.training,
+            _zoneout_seed() if self.training and self.zoneout > 0 else 0,
+        )
+
+    def quantize(self, fmt="int8", calibrate=True):
+        """Sets the per-channel quantized copy of `u` read by inference (see
+        `LiGRU.quantize`), or drops it when `fmt` is None."""
+        if fmt is None:
+            self.quantization = None
+            self.u_quantized = None
+            self.u_scale = None
+            return
+        data, scale = quantize_per_channel(self.u.weight, fmt, calibrate)
+        self.quantization = fmt
+        self.u_quantized = data.to(self.u.weight.device)
+        self.u_scale = scale.to(self.u.weight.device)
+
+    def _can_run_quantized(self, batch_sizes: Optional[Tensor] = None):
+        """Whether the recurrence can read the quantized `u`, which is only
+        done by eval-mode inference over full-length batches."""
+        return (
+            self.u_quantized is not None
+            and not self.training
+            and not torch.is_grad_enabled()
+            and batch_sizes is None
+        )
+
+    def _input_projection(self, x):
+        """Returns the batch-normalized feed-forward affine transformation of
+        every time step (all steps in parallel).
+        Arguments
+        ---------
+        x : torch.Tensor
+            Input tensor.
+        """
+        w = self.w(x)
+
+        # Apply batch normalization
+        if self.normalize:
+            w_bn = self.norm(w.reshape(w.shape[0] * w.shape[1], w.shape[2]))
+            w = w_bn.reshape(w.shape[0], w.shape[1], w.shape[2])
+
+        return w
+
+    def folded_input_projection(self):
+        """Returns the input projection with the eval-mode batch norm folded
+        in, as a (weight, bias) pair such that
+        `x @ weight.T + bias == self.norm(self.w(x))`. Without gradients
+        the pair is computed once and reused until one of the tensors it is
+        folded from is modified or moved.
+        """
+        sources = (
+            self.w.weight, self.norm.weight, self.norm.bias,
+            self.norm.running_mean, self.norm.running_var,
+        )
+        key = tuple((t.data_ptr(), t._version) for t in sources)
+        if self._folded is not None and self._folded[0] == key:
+            return self._folded[1], self._folded[2]
+
+        scale = self.norm.weight / torch.sqrt(self.norm.running_var + self.norm.eps)
+        weight = self.w.weight * scale.unsqueeze(1)
+        bias = self.norm.bias - self.norm.running_mean * scale
+        weight, bias = weight.contiguous(), bias.contiguous()
+        if not torch.is_grad_enabled():
+            self._folded = (key, weight, bias)
+        return weight, bias
+
+    def _can_fold_norm(self, x):
+        """Whether the input projection can run as a single GEMM with the
+        batch norm folded in, its shift being added by the recurrence kernels.
+        This needs the running statistics of an eval-mode batch norm and no
+        gradients, since the folded weight is not a parameter."""
+        return (
+            not torch.is_grad_enabled()
+            and isinstance(self.norm, nn.BatchNorm1d)
+            and not self.norm.training
+            and self.norm.running_var is not None
+        )
+
+    def _folded_projection(self, x):
+        """Returns `x @ weight.T` and `bias` for the folded pair of
+        `folded_input_projection`, in the dtype of the projection.
+        Arguments
+        ---------
+        x : torch.Tensor
+            Input tensor.
+        """
+        weight, bias = self.folded_input_projection()
+        w = torch.nn.functional.linear(x, weight)
+        return w, bias.to(w.dtype)
+
+    def _ligru_cell_cpu(self, w, ht, batch_sizes: Optional[Tensor] = None):
         """Returns the hidden states for each time step.
         Arguments
         ---------
@@ -354,35 +889,132 @@ class LiGRU_Layer(torch.nn.Module):
 
         # Loop over time axis
         for k in range(w.shape[1]):
-            gates = w[:, k] + self.recurrent_norm(self.u(ht))
-            at, zt = gates.chunk(2, 1)
-            zt = torch.sigmoid(zt)
-            hcand = self.act(at)
-            ht = zt * ht + (1 - zt) * hcand
+            if batch_sizes is not None and batch_sizes[k] < w.shape[0]:
+                # Sequences past their end keep their state and output zeros.
+                b = int(batch_sizes[k])
+                h_run = self._ligru_step(w[:b, k], ht[:b])
+                hiddens.append(torch.cat([h_run, torch.zeros_like(ht[b:])]))
+                ht = torch.cat([h_run, ht[b:]])
+                continue
+
+            ht = self._ligru_step(w[:, k], ht)
             hiddens.append(ht)
 
         # Stacking hidden states
         h = torch.stack(hiddens, dim=1)
         return h
 
-    def _ligru_cell(self, w, ht):
+    def _ligru_step(self, wx, ht):
+        """Returns the hidden state after one time step."""
+        gates = wx + self.recurrent_norm(self.u(ht))
+        at, zt = gates.chunk(2, 1)
+        zt = torch.sigmoid(zt)
+        hcand = self.act(at)
+        h_next = zt * ht + (1 - zt) * hcand
+        if self.zoneout > 0:
+            keep = (
+                torch.bernoulli(torch.full_like(h_next, self.zoneout))
+                if self.training
+                else self.zoneout
+            )
+            h_next = keep * ht + (1 - keep) * h_next
+        return h_next
+
+    def _ligru_cell(self, w, ht, batch_sizes: Optional[Tensor] = None,
+                    bias: Optional[Tensor] = None):
         """Returns the hidden states for each time step.
         Arguments
         ---------
         wx : torch.Tensor
             Linearly transformed input.
+        bias : torch.Tensor
+            Bias added to `wx` by the recurrence (see `_folded_projection`).
         """
 
         if w.is_cuda:
-            w = w.permute(1, 0, 2)
-
-            output = ApplyLiGRUCell.apply(True, w, self.u.weight, ht, self.activation)
+            if self._can_run_quantized(batch_sizes):
+                output = fast_ligru.ligru_2_0_quantized_forward(
+                    w.contiguous(),
+                    ht.to(w.dtype).contiguous(),
+                    self.u_quantized,
+                    self.u_scale,
+                    FORMATS[self.quantization][0],
+                    self.activation,
+                    self.bidirectional,
+                    bias,
+                    self.zoneout,
+                )
+            else:
+                # Only keep the gate cache when a backward pass can follow.
+                # Under autocast, `w` is half precision while the parameters
+                # stay fp32, so the recurrence runs in the dtype of the input
+                # projection.
+                output = ApplyLiGRUCell.apply(
+                    torch.is_grad_enabled(),
+                    w,
+                    self.u.weight.to(w.dtype),
+                    ht.to(w.dtype),
+                    self.activation,
+                    self.bidirectional,
+                    batch_sizes,
+                    self.recompute,
+                    bias,
+                    self.zoneout,
+                    self.training,
+                )
 
             output = output.permute(1, 0, 2)
 
+            if self.bidirectional:
+                return output[:, 1:-1]
             return output[:, 1:]
+        elif self._can_run_cpu_kernel(w, batch_sizes):
+            return fast_ligru.ligru_2_0_cpu_forward(
+                w.contiguous(),
+                ht.to(w.dtype),
+                self.u.weight.to(w.dtype).contiguous(),
+                self.activation,
+                bias,
+                self.zoneout,
+            )
         else:
-            return self._ligru_cell_cpu(w, ht)
+            if bias is not None:
+                w = w + bias
+            return self._ligru_cell_cpu(w, ht, batch_sizes)
+
+    def _can_run_cpu_kernel(self, w, batch_sizes: Optional[Tensor] = None):
+        """Whether the recurrence of a CPU tensor can run on the native CPU
+        kernels, which only implement inference over full-length fp32 or fp64
+        batches and apply zoneout as its eval-mode expectation."""
+        return (
+            not torch.is_grad_enabled()
+            and batch_sizes is None
+            and w.dtype in (torch.float32, torch.float64)
+            and not (self.training and self.zoneout > 0)
+        )
+
+
+class _StreamingSession:
+    """Batch-first wrapper around a native streaming session."""
+
+    def __init__(self, session, reshape):
+        self.session = session
+        self.reshape = reshape
+
+    def step(self, x, slots):
+        if self.reshape and x.ndim == 4:
+            x = x.reshape(x.shape[0], x.shape[1], x.shape[2] * x.shape[3])
+        output = self.session.step(x.transpose(0, 1).contiguous(), slots)
+        return output.transpose(0, 1)
+
+    def reset(self, slots):
+        self.session.reset(slots)
+
+    def set_state(self, slots, h):
+        self.session.set_state(slots, h)
+
+    def state(self):
+        return self.session.state()
 
 
 def rnn_init(module):
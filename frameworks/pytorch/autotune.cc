@@ -0,0 +1,37 @@
+// Copyright 2022 Adel Moumen, All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#include <torch/extension.h>
+
+#include "autotune.h"
+#include "graph_cache.h"
+
+namespace {
+
+// Graphs captured before tuning was enabled, or with the choices of another
+// cache file, replay the old choices; they are captured again afterwards.
+void set_autotune(const bool enabled, const std::string &cache_file) {
+  haste::v0::autotune::Configure(enabled, cache_file);
+  clear_cuda_graphs();
+}
+
+} // anonymous namespace
+
+void autotune_init(py::module &m) {
+  m.def("set_autotune", &set_autotune,
+        "Enables or disables the tuning of GEMM algorithms and launch shapes; "
+        "choices are loaded from and appended to `cache_file` when given",
+        py::arg("enabled"), py::arg("cache_file") = "");
+}
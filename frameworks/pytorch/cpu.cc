@@ -0,0 +1,94 @@
+// Copyright 2022 Adel Moumen
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#include <ATen/Parallel.h>
+#include <torch/extension.h>
+
+#include "ligru_cpu.h"
+#include "pass_cache.h"
+#include "support.h"
+
+namespace {
+
+using haste::v0::ligru_cpu::ForwardPass;
+
+using torch::Tensor;
+
+// Inference forward of either cell on the host. `wx` is batch-first,
+// `[B, T, 2H]`, `h_init` is `[B, H]` or `[1, H]` (shared by the whole batch)
+// and `u` is the `[2H, H]` recurrent weight; the optional `[2H]` `bias` is
+// added to `wx` inside the recurrence. Zoneout is applied as its expectation.
+// Returns the `[B, T, H]` states. The batch is split over the intra-op threads
+// of PyTorch (`torch.set_num_threads`).
+Tensor cpu_forward(const bool layer_norm, const Tensor &wx,
+                   const Tensor &h_init, const Tensor &u, const int activation,
+                   const c10::optional<Tensor> &bias, const double zoneout) {
+  const auto seq_length = wx.size(1);
+  const auto batch_size = wx.size(0);
+  const auto hidden_size = h_init.size(1);
+
+  CHECK_CPU_INPUT(wx);
+  CHECK_CPU_INPUT(u);
+  TORCH_CHECK(h_init.device().is_cpu(), "h_init must be a CPU tensor");
+  const Tensor h0 = h_init.expand({batch_size, hidden_size}).contiguous();
+  const Tensor b = bias.value_or(Tensor());
+  if (b.defined())
+    CHECK_CPU_INPUT(b);
+  const haste::v0::Zoneout zoneout_params = make_zoneout(zoneout, false, 0);
+
+  Tensor output =
+      torch::empty({batch_size, seq_length, hidden_size}, wx.options());
+
+  AT_DISPATCH_FLOATING_TYPES(wx.scalar_type(), "ligru_cpu_forward", ([&] {
+    auto &forward = cached_host_pass<ForwardPass<scalar_t>>(
+        static_cast<int>(batch_size), static_cast<int>(hidden_size),
+        activation, layer_norm, at::get_num_threads());
+
+    forward.SetBias(b.defined() ? b.data_ptr<scalar_t>() : nullptr);
+    forward.SetZoneout(zoneout_params);
+    forward.Run(seq_length, wx.data_ptr<scalar_t>(), u.data_ptr<scalar_t>(),
+                h0.data_ptr<scalar_t>(), output.data_ptr<scalar_t>());
+    // Later users of the cached pass expect no bias or zoneout.
+    forward.SetBias(nullptr);
+    forward.SetZoneout(haste::v0::Zoneout());
+  }));
+
+  return output;
+}
+
+Tensor ligru_1_0_cpu_forward(const Tensor &wx, const Tensor &h_init,
+                             const Tensor &u, const int activation,
+                             const c10::optional<Tensor> &bias,
+                             const double zoneout) {
+  return cpu_forward(false, wx, h_init, u, activation, bias, zoneout);
+}
+
+Tensor ligru_2_0_cpu_forward(const Tensor &wx, const Tensor &h_init,
+                             const Tensor &u, const int activation,
+                             const c10::optional<Tensor> &bias,
+                             const double zoneout) {
+  return cpu_forward(true, wx, h_init, u, activation, bias, zoneout);
+}
+
+} // anonymous namespace
+
+void cpu_init(py::module &m) {
+  m.def("ligru_1_0_cpu_forward", &ligru_1_0_cpu_forward,
+        "Li-GRU inference forward on the CPU",
+        py::call_guard<py::gil_scoped_release>());
+  m.def("ligru_2_0_cpu_forward", &ligru_2_0_cpu_forward,
+        "Li-GRU 2.0 inference forward on the CPU",
+        py::call_guard<py::gil_scoped_release>());
+}
@@ -0,0 +1,161 @@
+// Copyright 2022 Adel Moumen
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#include <ATen/cuda/CUDAContext.h>
+#include <ATen/cuda/CUDAEvent.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+
+#include "graph_cache.h"
+
+namespace {
+
+struct GraphEntry {
+  cudaGraphExec_t exec;
+  std::vector<const void *> pointers;
+};
+
+std::atomic<bool> graphs_enabled(false);
+std::mutex graphs_mutex;
+std::map<GraphKey, GraphEntry> graphs;
+// Keys already run once outside a capture, which is when the autotuner
+// benchmarks the GEMMs and launch shapes of a new shape; a capture only sees
+// the choices cached by then.
+std::set<GraphKey> warmed_up;
+
+void set_cuda_graphs(const bool enabled) { graphs_enabled = enabled; }
+
+// The side stream graphs are recorded and replayed on, one per device and
+// thread. `record` hands it to `cached_pass`, which keys passes by stream,
+// so a fresh pool stream per call would build a pass per pool stream.
+const at::cuda::CUDAStream &capture_stream(const int device) {
+  thread_local std::map<int, at::cuda::CUDAStream> streams;
+  auto it = streams.find(device);
+  if (it == streams.end())
+    it = streams.emplace(device, at::cuda::getStreamFromPool(false, device))
+             .first;
+  return it->second;
+}
+
+// Captures `record` on `stream` and stores the executable graph under `key`,
+// updating the existing executable in place when the topology is unchanged.
+// Returns nullptr (with the CUDA error state cleared) if capture fails, in
+// which case nothing has been executed.
+GraphEntry *capture(const GraphKey &key, const cudaStream_t &stream,
+                    const std::function<void(const cudaStream_t &)> &record) {
+  cudaGraph_t graph;
+  if (cudaStreamBeginCapture(stream, cudaStreamCaptureModeThreadLocal) !=
+      cudaSuccess) {
+    cudaGetLastError();
+    return nullptr;
+  }
+  record(stream);
+  if (cudaStreamEndCapture(stream, &graph) != cudaSuccess) {
+    cudaGetLastError();
+    return nullptr;
+  }
+
+  auto it = graphs.find(key);
+  if (it != graphs.end()) {
+#if CUDART_VERSION >= 12000
+    cudaGraphExecUpdateResultInfo result_info;
+    const cudaError_t status =
+        cudaGraphExecUpdate(it->second.exec, graph, &result_info);
+#else
+    cudaGraphNode_t error_node;
+    cudaGraphExecUpdateResult result;
+    const cudaError_t status =
+        cudaGraphExecUpdate(it->second.exec, graph, &error_node, &result);
+#endif
+    if (status != cudaSuccess) {
+      cudaGetLastError();
+      cudaGraphExecDestroy(it->second.exec);
+      graphs.erase(it);
+      it = graphs.end();
+    }
+  }
+
+  if (it == graphs.end()) {
+    cudaGraphExec_t exec;
+    if (cudaGraphInstantiateWithFlags(&exec, graph, 0) != cudaSuccess) {
+      cudaGetLastError();
+      cudaGraphDestroy(graph);
+      return nullptr;
+    }
+    it = graphs.emplace(key, GraphEntry{exec, {}}).first;
+  }
+
+  cudaGraphDestroy(graph);
+  return &it->second;
+}
+
+} // anonymous namespace
+
+void clear_cuda_graphs() {
+  std::lock_guard<std::mutex> lock(graphs_mutex);
+  for (auto &it : graphs)
+    cudaGraphExecDestroy(it.second.exec);
+  graphs.clear();
+  warmed_up.clear();
+}
+
+void run_with_graph(const GraphKey &key, const std::vector<const void *> &pointers,
+                    const std::function<void(const cudaStream_t &)> &record) {
+  const at::cuda::CUDAStream stream = at::cuda::getCurrentCUDAStream();
+  if (!graphs_enabled) {
+    record(stream);
+    return;
+  }
+
+  // The legacy default stream cannot be captured, so graphs are recorded and
+  // replayed on a side stream ordered with the current one.
+  const at::cuda::CUDAStream side_stream =
+      capture_stream(stream.device_index());
+  at::cuda::CUDAEvent ready;
+  ready.record(stream);
+  ready.block(side_stream);
+
+  {
+    std::lock_guard<std::mutex> lock(graphs_mutex);
+
+    auto it = graphs.find(key);
+    GraphEntry *entry = nullptr;
+    if (it != graphs.end() && it->second.pointers == pointers)
+      entry = &it->second;
+    else if (warmed_up.count(key))
+      entry = capture(key, side_stream, record);
+    else
+      warmed_up.insert(key);
+    if (entry) {
+      entry->pointers = pointers;
+      cudaGraphLaunch(entry->exec, side_stream);
+    } else {
+      record(side_stream);
+    }
+  }
+
+  at::cuda::CUDAEvent done;
+  done.record(side_stream);
+  done.block(stream);
+}
+
+void graph_cache_init(py::module &m) {
+  m.def("set_cuda_graphs", &set_cuda_graphs,
+        "Enables or disables CUDA graph capture and replay of the time loops");
+  m.def("clear_cuda_graphs", &clear_cuda_graphs,
+        "Releases every cached CUDA graph");
+}
@@ -0,0 +1,86 @@
+// Copyright 2022 Adel Moumen
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#pragma once
+
+#include <cuda_runtime_api.h>
+#include <functional>
+#include <torch/extension.h>
+#include <tuple>
+#include <vector>
+
+enum GraphKernel {
+  kLiGRUForward,
+  kLiGRUBackward,
+  kSLiGRUForward,
+  kSLiGRUBackward,
+  kLiGRUBidirectionalForward,
+  kLiGRUBidirectionalBackward,
+  kSLiGRUBidirectionalForward,
+  kSLiGRUBidirectionalBackward,
+  kLiGRUInference,
+  kSLiGRUInference,
+  kLiGRURecomputeBackward,
+  kSLiGRURecomputeBackward,
+  kLiGRUQuantizedForward,
+  kSLiGRUQuantizedForward,
+  kLiGRUQuantizedBidirectionalForward,
+  kSLiGRUQuantizedBidirectionalForward,
+  kLiGRUGroupedForward,
+  kSLiGRUGroupedForward,
+};
+
+// Everything that shapes the launch sequence of one recurrent time loop. Two
+// calls with the same key issue the same kernels and GEMMs and only differ by
+// their data pointers.
+struct GraphKey {
+  GraphKernel kernel;
+  int device;
+  int scalar_type;
+  int activation;
+  bool training;
+  int64_t seq_length;
+  int64_t batch_size;
+  int64_t hidden_size;
+  // Selects between kernels of the same `kernel` loop, e.g. the format of a
+  // quantized weight, the number of grouped layers or whether a backward
+  // starts from a carried state gradient.
+  int variant = 0;
+
+  bool operator<(const GraphKey &other) const {
+    return std::tie(kernel, device, scalar_type, activation, training,
+                    seq_length, batch_size, hidden_size, variant) <
+           std::tie(other.kernel, other.device, other.scalar_type,
+                    other.activation, other.training, other.seq_length,
+                    other.batch_size, other.hidden_size, other.variant);
+  }
+};
+
+// Runs `record` on the current CUDA stream. When graph mode is enabled (see
+// `set_cuda_graphs`), the work is instead captured into a CUDA graph cached
+// under `key` and replayed: a call with the same `pointers` as the previous
+// one replays the instantiated graph directly, and a call with new pointers
+// is re-captured and applied to the cached executable graph with
+// `cudaGraphExecUpdate` instead of instantiating a new one. The first call
+// of each key runs eagerly, so that the autotuner can benchmark it before
+// anything is captured.
+void run_with_graph(const GraphKey &key, const std::vector<const void *> &pointers,
+                    const std::function<void(const cudaStream_t &)> &record);
+
+// Releases every cached graph, e.g. once the choices they were captured with
+// are stale.
+void clear_cuda_graphs();
+
+void graph_cache_init(py::module &m);
@@ -0,0 +1,36 @@
+// Copyright 2022 Adel Moumen, All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#include <c10/cuda/CUDAGuard.h>
+#include <torch/extension.h>
+
+#include "l2_persistence.h"
+
+namespace {
+
+size_t reserve_l2_persistence(const size_t bytes, const int device) {
+  const at::cuda::CUDAGuard guard(static_cast<c10::DeviceIndex>(device));
+  return haste::v0::l2_persistence::Reserve(bytes);
+}
+
+} // anonymous namespace
+
+void l2_persistence_init(py::module &m) {
+  m.def("reserve_l2_persistence", &reserve_l2_persistence,
+        "Sets aside up to `bytes` of the L2 cache of `device` for the "
+        "recurrent weights and returns the size set aside",
+        py::arg("bytes"), py::arg("device"),
+        py::call_guard<py::gil_scoped_release>());
+}
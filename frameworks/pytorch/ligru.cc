@@ -3,7 +3,11 @@
 #include <torch/extension.h>
 #include <vector>
 
+#include "graph_cache.h"
 #include "ligru_1_0.h"
+#include "pass_cache.h"
+#include "stack.h"
+#include "streaming.h"
 #include "support.h"
 
 namespace {
@@ -13,48 +17,561 @@ using haste::v0::ligru_1_0::ForwardPass;
 
 using torch::Tensor;
 
+// `wx` is batch-first, `[B, T, 2H]`, and `u` is the `[2H, H]` recurrent weight
+// as stored by `nn.Linear`; both are read in place. The optional `[2H]` `bias`
+// is added to `wx` by the recurrence kernels, so that a projection with the
+// batch norm folded in needs no separate pass to add its shift.
+// `zoneout` is the zoneout probability of the hidden state, whose masks are
+// drawn from `seed` when `sample` is set; the backward pass gets the same
+// three values.
 std::vector<Tensor> ligru_1_0_forward(const bool training, const Tensor& wx, const Tensor& h_init,
-                                  const Tensor& u_t, const int& activation) {
+                                  const Tensor& u, const int& activation,
+                                  const bool bidirectional,
+                                  const c10::optional<Tensor> &bias,
+                                  const double zoneout, const bool sample,
+                                  const int64_t seed) {
 
+  const auto seq_length = wx.size(1);
+  const auto batch_size = wx.size(0);
+  const auto hidden_size = h_init.size(1);
+  const auto directions = bidirectional ? 2 : 1;
+
+  CHECK_INPUT(wx);
+  CHECK_INPUT(h_init);
+  CHECK_INPUT(u);
+  const Tensor b = bias.value_or(Tensor());
+  if (b.defined())
+    CHECK_INPUT(b);
+  const haste::v0::Zoneout zoneout_params =
+      make_zoneout(zoneout, sample, seed);
+
+  const auto options = wx.options();
+  const at::cuda::CUDAGuard guard(options.device_index());
+
+  Tensor output = torch::empty({seq_length + directions, batch_size,
+                                hidden_size * directions},
+                               options);
+  // The gate cache is only read by the backward pass.
+  Tensor cache = training ? torch::empty({seq_length * directions, batch_size,
+                                          hidden_size * 3},
+                                         options)
+                          : torch::empty({0}, options);
+
+  if (bidirectional)
+    init_bidirectional_state(output, h_init);
+  else
+    output[0] = h_init;
+
+  const GraphKey key{bidirectional ? kLiGRUBidirectionalForward
+                                   : kLiGRUForward,
+                     options.device_index(),
+                     static_cast<int>(wx.scalar_type()),
+                     activation,
+                     training,
+                     seq_length,
+                     batch_size,
+                     hidden_size};
+
+  AT_DISPATCH_FLOATING_TYPES_AND_HALF(
+      wx.scalar_type(), "ligru_forward", ([&] {
+        using Pass = ForwardPass<typename native_type<scalar_t>::T>;
+        Tensor workspace = cached_workspace(
+            Pass::GetWorkspaceSize(seq_length, batch_size, hidden_size,
+                                   training, bidirectional),
+            options);
+        run_with_graph(
+            key,
+            with_zoneout({wx.data_ptr(), u.data_ptr(), output.data_ptr(),
+                          cache.data_ptr(), workspace.data_ptr(),
+                          b.defined() ? b.data_ptr() : nullptr},
+                         zoneout_params),
+            [&](const cudaStream_t &stream) {
+              auto &forward = cached_pass<Pass>(
+                  training, batch_size, 0, hidden_size,
+                  at::cuda::getCurrentCUDABlasHandle(), activation, stream);
+
+              forward.SetBias(ptr_or_null<scalar_t>(b));
+              forward.SetZoneout(zoneout_params);
+              if (bidirectional) {
+                forward.RunBidirectional(
+                    seq_length, ptr<scalar_t>(wx), ptr<scalar_t>(u),
+                    ptr<scalar_t>(output), ptr<scalar_t>(cache),
+                    workspace.data_ptr(), true);
+              } else {
+                forward.Run(seq_length, ptr<scalar_t>(wx), ptr<scalar_t>(u),
+                            ptr<scalar_t>(output), ptr<scalar_t>(cache),
+                            workspace.data_ptr(), true);
+              }
+              // Later users of the cached pass expect no bias or zoneout.
+              forward.SetBias(nullptr);
+              forward.SetZoneout(haste::v0::Zoneout());
+            });
+      }));
+
+  return {output, cache};
+}
+
+// Same layouts as `ligru_1_0_forward`.
+Tensor ligru_1_0_forward_final(const Tensor &wx, const Tensor &h_init,
+                               const Tensor &u, const int activation,
+                               const c10::optional<Tensor> &bias,
+                               const double zoneout, const bool sample,
+                               const int64_t seed) {
+  const auto seq_length = wx.size(1);
+  const auto batch_size = wx.size(0);
+  const auto hidden_size = h_init.size(1);
+
+  CHECK_INPUT(wx);
+  CHECK_INPUT(h_init);
+  CHECK_INPUT(u);
+  const Tensor b = bias.value_or(Tensor());
+  if (b.defined())
+    CHECK_INPUT(b);
+  const haste::v0::Zoneout zoneout_params =
+      make_zoneout(zoneout, sample, seed);
+
+  const auto options = wx.options();
+  const at::cuda::CUDAGuard guard(options.device_index());
+
+  Tensor h = torch::empty({2, batch_size, hidden_size}, options);
+
+  h[0] = h_init;
+
+  const GraphKey key{kLiGRUInference,
+                     options.device_index(),
+                     static_cast<int>(wx.scalar_type()),
+                     activation,
+                     false,
+                     seq_length,
+                     batch_size,
+                     hidden_size};
+
+  AT_DISPATCH_FLOATING_TYPES_AND_HALF(
+      wx.scalar_type(), "ligru_forward_final", ([&] {
+        using Pass = ForwardPass<typename native_type<scalar_t>::T>;
+        Tensor workspace = cached_workspace(
+            Pass::GetWorkspaceSize(seq_length, batch_size, hidden_size, false),
+            options);
+        run_with_graph(
+            key,
+            with_zoneout({wx.data_ptr(), u.data_ptr(), h.data_ptr(),
+                          workspace.data_ptr(),
+                          b.defined() ? b.data_ptr() : nullptr},
+                         zoneout_params),
+            [&](const cudaStream_t &stream) {
+              auto &forward = cached_pass<Pass>(
+                  false, batch_size, 0, hidden_size,
+                  at::cuda::getCurrentCUDABlasHandle(), activation, stream);
+
+              forward.SetBias(ptr_or_null<scalar_t>(b));
+              forward.SetZoneout(zoneout_params);
+              forward.RunInference(seq_length, ptr<scalar_t>(wx),
+                                   ptr<scalar_t>(u), ptr<scalar_t>(h),
+                                   workspace.data_ptr(), true);
+              forward.SetBias(nullptr);
+              forward.SetZoneout(haste::v0::Zoneout());
+            });
+      }));
+
+  return h[seq_length % 2];
+}
+
+// Inference variant of `ligru_1_0_forward` whose recurrent products read the
+// per-channel quantized weight `u_data`/`u_scale` in `format` (see
+// `make_quantized_weight`) instead of `u`. Zoneout is applied as its
+// expectation, and no gate cache is returned.
+Tensor ligru_1_0_quantized_forward(const Tensor &wx, const Tensor &h_init,
+                                   const Tensor &u_data, const Tensor &u_scale,
+                                   const int64_t format, const int activation,
+                                   const bool bidirectional,
+                                   const c10::optional<Tensor> &bias,
+                                   const double zoneout) {
+  const auto seq_length = wx.size(1);
+  const auto batch_size = wx.size(0);
+  const auto hidden_size = h_init.size(1);
+  const auto directions = bidirectional ? 2 : 1;
+
+  CHECK_INPUT(wx);
+  CHECK_INPUT(h_init);
+  const haste::v0::QuantizedWeight u =
+      make_quantized_weight(u_data, u_scale, format, hidden_size);
+  const Tensor b = bias.value_or(Tensor());
+  if (b.defined())
+    CHECK_INPUT(b);
+  const haste::v0::Zoneout zoneout_params = make_zoneout(zoneout, false, 0);
+
+  const auto options = wx.options();
+  const at::cuda::CUDAGuard guard(options.device_index());
+
+  Tensor output = torch::empty({seq_length + directions, batch_size,
+                                hidden_size * directions},
+                               options);
+  Tensor cache = torch::empty({0}, options);
+
+  if (bidirectional)
+    init_bidirectional_state(output, h_init);
+  else
+    output[0] = h_init;
+
+  GraphKey key{bidirectional ? kLiGRUQuantizedBidirectionalForward
+                             : kLiGRUQuantizedForward,
+               options.device_index(),
+               static_cast<int>(wx.scalar_type()),
+               activation,
+               false,
+               seq_length,
+               batch_size,
+               hidden_size};
+  key.variant = static_cast<int>(format);
+
+  AT_DISPATCH_FLOATING_TYPES_AND_HALF(
+      wx.scalar_type(), "ligru_quantized_forward", ([&] {
+        using Pass = ForwardPass<typename native_type<scalar_t>::T>;
+        Tensor workspace = cached_workspace(
+            Pass::GetWorkspaceSize(seq_length, batch_size, hidden_size, false,
+                                   bidirectional),
+            options);
+        run_with_graph(
+            key,
+            with_zoneout({wx.data_ptr(), u.data, u.scale, output.data_ptr(),
+                          workspace.data_ptr(),
+                          b.defined() ? b.data_ptr() : nullptr},
+                         zoneout_params),
+            [&](const cudaStream_t &stream) {
+              auto &forward = cached_pass<Pass>(
+                  false, batch_size, 0, hidden_size,
+                  at::cuda::getCurrentCUDABlasHandle(), activation, stream);
+
+              forward.SetBias(ptr_or_null<scalar_t>(b));
+              forward.SetZoneout(zoneout_params);
+              forward.SetQuantizedWeight(u);
+              if (bidirectional) {
+                forward.RunBidirectional(seq_length, ptr<scalar_t>(wx),
+                                         nullptr, ptr<scalar_t>(output),
+                                         ptr<scalar_t>(cache),
+                                         workspace.data_ptr(), true);
+              } else {
+                forward.Run(seq_length, ptr<scalar_t>(wx), nullptr,
+                            ptr<scalar_t>(output), ptr<scalar_t>(cache),
+                            workspace.data_ptr(), true);
+              }
+              forward.SetBias(nullptr);
+              forward.SetZoneout(haste::v0::Zoneout());
+              forward.SetQuantizedWeight(haste::v0::QuantizedWeight());
+            });
+      }));
+
+  return output;
+}
+
+// Inference over `G` independent layers of the same shape fed the same batch
+// (an ensemble, or the heads of a multi-task model), run as one pass over
+// their `B * G` rows (see `ForwardPass::SetGroups`). `wx` is
+// `[B, G, T, 2H]`, `h_init` `[B, G, H]` and `u` the `[G, 2H, H]` stack of
+// the recurrent weights; the output is `[T + 1, B, G, H]`, its first step
+// holding `h_init`. Zoneout is applied as its expectation.
+Tensor ligru_1_0_grouped_forward(const Tensor &wx, const Tensor &h_init,
+                                 const Tensor &u, const int activation,
+                                 const double zoneout) {
+  const auto groups = wx.size(1);
+  const auto seq_length = wx.size(2);
+  const auto batch_size = wx.size(0) * groups;
+  const auto hidden_size = h_init.size(2);
+
+  CHECK_INPUT(wx);
+  CHECK_INPUT(h_init);
+  CHECK_INPUT(u);
+  TORCH_CHECK(u.size(0) == groups, "u must hold one weight per group");
+  const haste::v0::Zoneout zoneout_params = make_zoneout(zoneout, false, 0);
+
+  const auto options = wx.options();
+  const at::cuda::CUDAGuard guard(options.device_index());
+
+  Tensor output = torch::empty(
+      {seq_length + 1, wx.size(0), groups, hidden_size}, options);
+  Tensor cache = torch::empty({0}, options);
+
+  output[0] = h_init;
+
+  GraphKey key{kLiGRUGroupedForward,
+               options.device_index(),
+               static_cast<int>(wx.scalar_type()),
+               activation,
+               false,
+               seq_length,
+               batch_size,
+               hidden_size};
+  key.variant = static_cast<int>(groups);
+
+  AT_DISPATCH_FLOATING_TYPES_AND_HALF(
+      wx.scalar_type(), "ligru_grouped_forward", ([&] {
+        using Pass = ForwardPass<typename native_type<scalar_t>::T>;
+        Tensor workspace = cached_workspace(
+            Pass::GetWorkspaceSize(seq_length, batch_size, hidden_size, false),
+            options);
+        run_with_graph(
+            key,
+            with_zoneout({wx.data_ptr(), u.data_ptr(), output.data_ptr(),
+                          workspace.data_ptr()},
+                         zoneout_params),
+            [&](const cudaStream_t &stream) {
+              auto &forward = cached_pass<Pass>(
+                  false, batch_size, 0, hidden_size,
+                  at::cuda::getCurrentCUDABlasHandle(), activation, stream);
+
+              forward.SetZoneout(zoneout_params);
+              forward.SetGroups(groups);
+              forward.Run(seq_length, ptr<scalar_t>(wx), ptr<scalar_t>(u),
+                          ptr<scalar_t>(output), ptr<scalar_t>(cache),
+                          workspace.data_ptr(), true);
+              forward.SetZoneout(haste::v0::Zoneout());
+              forward.SetGroups(1);
+            });
+      }));
+
+  return output;
+}
+
+// `wx` and `u` are the tensors given to `ligru_1_0_forward`, and `du` comes
+// back in the layout of `u`. `dwx` is time-major, `[T, B, 2H]`. The pass
+// also returns `dh0`, the `[B, H]` gradient of the initial state, and starts
+// from the optional `[B, H]` `dh_final`, the gradient carried into the last
+// state, which lets a long sequence be differentiated one segment at a time.
+// Both are `[2, B, H]` in a bidirectional pass, forward direction first.
+std::vector<Tensor> ligru_1_0_backward(const Tensor& wx, const Tensor& u, const Tensor& h,
+                                   const Tensor& cache, const Tensor& grad_out, const int& activation,
+                                   const bool bidirectional, const double zoneout,
+                                   const bool sample, const int64_t seed,
+                                   const c10::optional<Tensor> &dh_final) {
+
+  const auto time_steps = wx.size(1);
+  const auto batch_size = wx.size(0);
+  const auto hidden_size = wx.size(2) / 2;
+  const auto directions = bidirectional ? 2 : 1;
+
+  CHECK_INPUT(wx);
+  CHECK_INPUT(u);
+  CHECK_INPUT(h);
+  CHECK_INPUT(cache);
+  CHECK_INPUT(grad_out);
+  const Tensor dh_t = dh_final.value_or(Tensor());
+  if (dh_t.defined())
+    CHECK_INPUT(dh_t);
+  const haste::v0::Zoneout zoneout_params =
+      make_zoneout(zoneout, sample, seed);
+
+  const auto options = wx.options();
+  const at::cuda::CUDAGuard guard(options.device_index());
+
+  // Every step writes its whole slice of `dwx` and the pass writes `du`.
+  Tensor dwx = torch::empty(
+      {time_steps * directions, batch_size, hidden_size * 2}, options);
+  Tensor du = torch::empty({hidden_size * 2, hidden_size}, options);
+  Tensor dh0 = bidirectional
+                   ? torch::empty({2, batch_size, hidden_size}, options)
+                   : torch::empty({batch_size, hidden_size}, options);
+  TORCH_CHECK(!dh_t.defined() || dh_t.numel() == dh0.numel(),
+              "dh_final must have the shape of the initial state gradient");
+
+  GraphKey key{bidirectional ? kLiGRUBidirectionalBackward : kLiGRUBackward,
+               options.device_index(),
+               static_cast<int>(wx.scalar_type()),
+               activation,
+               true,
+               time_steps,
+               batch_size,
+               hidden_size};
+  key.variant = dh_t.defined();
+
+  AT_DISPATCH_FLOATING_TYPES_AND_HALF(
+      wx.scalar_type(), "ligru_backward", ([&] {
+        using Pass = BackwardPass<typename native_type<scalar_t>::T>;
+        Tensor workspace = cached_workspace(
+            Pass::GetWorkspaceSize(time_steps, batch_size, hidden_size, true,
+                                   bidirectional),
+            options);
+        run_with_graph(
+            key,
+            with_zoneout({wx.data_ptr(), u.data_ptr(), h.data_ptr(),
+                          cache.data_ptr(), grad_out.data_ptr(),
+                          dwx.data_ptr(), du.data_ptr(),
+                          workspace.data_ptr(), ptr_or_null<scalar_t>(dh_t),
+                          dh0.data_ptr()},
+                         zoneout_params),
+            [&](const cudaStream_t &stream) {
+              auto &backward = cached_pass<Pass>(
+                  batch_size, 0, hidden_size,
+                  at::cuda::getCurrentCUDABlasHandle(), activation, stream);
+
+              backward.SetZoneout(zoneout_params);
+              backward.SetStateGradient(ptr_or_null<scalar_t>(dh_t),
+                                        ptr<scalar_t>(dh0));
+              if (bidirectional) {
+                backward.RunBidirectional(
+                    time_steps, ptr<scalar_t>(wx), ptr<scalar_t>(u),
+                    ptr<scalar_t>(h), ptr<scalar_t>(cache),
+                    ptr<scalar_t>(grad_out), ptr<scalar_t>(dwx),
+                    ptr<scalar_t>(du), workspace.data_ptr());
+              } else {
+                backward.Run(time_steps, ptr<scalar_t>(wx), ptr<scalar_t>(u),
+                             ptr<scalar_t>(h), ptr<scalar_t>(cache),
+                             ptr<scalar_t>(grad_out), ptr<scalar_t>(dwx),
+                             ptr<scalar_t>(du), workspace.data_ptr());
+              }
+              backward.SetZoneout(haste::v0::Zoneout());
+              backward.SetStateGradient(nullptr, nullptr);
+            });
+      }));
+
+  // Both directions read the same `wx`.
+  if (bidirectional)
+    dwx = dwx.view({2, time_steps, batch_size, hidden_size * 2}).sum(0);
+
+  return {du, dwx, dh0};
+}
+
+// Backward of a `ligru_1_0_forward` run with `training == false`, which keeps
+// no gate cache. Takes and returns the layouts of `ligru_1_0_backward`.
+std::vector<Tensor> ligru_1_0_recompute_backward(
+    const Tensor &wx, const Tensor &u, const Tensor &h, const Tensor &grad_out,
+    const int activation, const double zoneout, const bool sample,
+    const int64_t seed, const c10::optional<Tensor> &dh_final) {
+  const auto time_steps = wx.size(1);
+  const auto batch_size = wx.size(0);
+  const auto hidden_size = wx.size(2) / 2;
+
+  CHECK_INPUT(wx);
+  CHECK_INPUT(u);
+  CHECK_INPUT(h);
+  CHECK_INPUT(grad_out);
+  const Tensor dh_t = dh_final.value_or(Tensor());
+  if (dh_t.defined())
+    CHECK_INPUT(dh_t);
+  const haste::v0::Zoneout zoneout_params =
+      make_zoneout(zoneout, sample, seed);
+
+  const auto options = wx.options();
+  const at::cuda::CUDAGuard guard(options.device_index());
+
+  Tensor dwx = torch::empty({time_steps, batch_size, hidden_size * 2}, options);
+  Tensor du = torch::empty({hidden_size * 2, hidden_size}, options);
+  Tensor dh0 = torch::empty({batch_size, hidden_size}, options);
+  TORCH_CHECK(!dh_t.defined() || dh_t.numel() == dh0.numel(),
+              "dh_final must have the shape of the initial state gradient");
+
+  GraphKey key{kLiGRURecomputeBackward,
+               options.device_index(),
+               static_cast<int>(wx.scalar_type()),
+               activation,
+               true,
+               time_steps,
+               batch_size,
+               hidden_size};
+  key.variant = dh_t.defined();
+
+  AT_DISPATCH_FLOATING_TYPES_AND_HALF(
+      wx.scalar_type(), "ligru_recompute_backward", ([&] {
+        using Pass = BackwardPass<typename native_type<scalar_t>::T>;
+        Tensor workspace = cached_workspace(
+            Pass::GetWorkspaceSize(time_steps, batch_size, hidden_size, false),
+            options);
+        run_with_graph(
+            key,
+            with_zoneout({wx.data_ptr(), u.data_ptr(), h.data_ptr(),
+                          grad_out.data_ptr(), dwx.data_ptr(), du.data_ptr(),
+                          workspace.data_ptr(), ptr_or_null<scalar_t>(dh_t),
+                          dh0.data_ptr()},
+                         zoneout_params),
+            [&](const cudaStream_t &stream) {
+              auto &backward = cached_pass<Pass>(
+                  batch_size, 0, hidden_size,
+                  at::cuda::getCurrentCUDABlasHandle(), activation, stream);
+
+              backward.SetZoneout(zoneout_params);
+              backward.SetStateGradient(ptr_or_null<scalar_t>(dh_t),
+                                        ptr<scalar_t>(dh0));
+              backward.RunRecompute(
+                  time_steps, ptr<scalar_t>(wx), ptr<scalar_t>(u),
+                  ptr<scalar_t>(h), ptr<scalar_t>(grad_out),
+                  ptr<scalar_t>(dwx), ptr<scalar_t>(du), workspace.data_ptr(),
+                  true);
+              backward.SetZoneout(haste::v0::Zoneout());
+              backward.SetStateGradient(nullptr, nullptr);
+            });
+      }));
+
+  return {du, dwx, dh0};
+}
+
+// Variable-length forward over a batch sorted by decreasing length. Rows of
+// `output` past a sequence's end stay zero. Unlike `ligru_1_0_forward`, `wx`
+// is time-major, `[T, B, 2H]`.
+std::vector<Tensor> ligru_1_0_packed_forward(const bool training,
+                                             const Tensor &wx,
+                                             const Tensor &h_init,
+                                             const Tensor &u,
+                                             const int activation,
+                                             const Tensor &batch_sizes,
+                                             const double zoneout,
+                                             const bool sample,
+                                             const int64_t seed) {
   const auto seq_length = wx.size(0);
   const auto batch_size = wx.size(1);
   const auto hidden_size = h_init.size(1);
 
   CHECK_INPUT(wx);
   CHECK_INPUT(h_init);
-  CHECK_INPUT(u_t);
+  CHECK_INPUT(u);
+  const std::vector<int> sizes =
+      packed_batch_sizes(batch_sizes, seq_length, batch_size);
+  const haste::v0::Zoneout zoneout_params =
+      make_zoneout(zoneout, sample, seed);
 
   const auto options = wx.options();
   const at::cuda::CUDAGuard guard(options.device_index());
 
   Tensor output =
-      torch::empty({seq_length + 1, batch_size, hidden_size}, options);
-  Tensor cache =
-      torch::empty({seq_length, batch_size, hidden_size * 3}, options);
-  Tensor tmp_uh = torch::zeros({batch_size, hidden_size * 2}, options);
+      torch::zeros({seq_length + 1, batch_size, hidden_size}, options);
+  Tensor cache = training ? torch::empty({seq_length, batch_size,
+                                          hidden_size * 3},
+                                         options)
+                          : torch::empty({0}, options);
 
   output[0] = h_init;
 
+  const cudaStream_t stream = at::cuda::getCurrentCUDAStream().stream();
   AT_DISPATCH_FLOATING_TYPES_AND_HALF(
-      wx.scalar_type(), "ligru_forward", ([&] {
-        ForwardPass<typename native_type<scalar_t>::T> forward(
+      wx.scalar_type(), "ligru_packed_forward", ([&] {
+        using Pass = ForwardPass<typename native_type<scalar_t>::T>;
+        Tensor workspace = cached_workspace(
+            Pass::GetWorkspaceSize(seq_length, batch_size, hidden_size,
+                                   training),
+            options);
+        auto &forward = cached_pass<Pass>(
             training, batch_size, 0, hidden_size,
-            at::cuda::getCurrentCUDABlasHandle(),
-            activation, 
-            at::cuda::getCurrentCUDAStream());
+            at::cuda::getCurrentCUDABlasHandle(), activation, stream);
 
-        forward.Run(seq_length, ptr<scalar_t>(wx), ptr<scalar_t>(u_t),
-                    ptr<scalar_t>(output), ptr<scalar_t>(cache),
-                    ptr<scalar_t>(tmp_uh));
+        forward.SetZoneout(zoneout_params);
+        forward.RunPacked(seq_length, sizes.data(), ptr<scalar_t>(wx),
+                          ptr<scalar_t>(u), ptr<scalar_t>(output),
+                          ptr<scalar_t>(cache), workspace.data_ptr());
+        forward.SetZoneout(haste::v0::Zoneout());
       }));
 
   return {output, cache};
 }
 
-std::vector<Tensor> ligru_1_0_backward(const Tensor& wx, const Tensor& u, const Tensor& h,
-                                   const Tensor& cache, const Tensor& grad_out, const int& activation) {
-
-  const auto input_size = wx.size(0);
+std::vector<Tensor> ligru_1_0_packed_backward(const Tensor &wx, const Tensor &u,
+                                              const Tensor &h,
+                                              const Tensor &cache,
+                                              const Tensor &grad_out,
+                                              const int activation,
+                                              const Tensor &batch_sizes,
+                                              const double zoneout,
+                                              const bool sample,
+                                              const int64_t seed,
+                                              const c10::optional<Tensor>
+                                                  &dh_final) {
   const auto time_steps = wx.size(0);
   const auto batch_size = wx.size(1);
   const auto hidden_size = wx.size(2) / 2;
@@ -64,29 +581,130 @@ std::vector<Tensor> ligru_1_0_backward(const Tensor& wx, const Tensor& u, const
   CHECK_INPUT(h);
   CHECK_INPUT(cache);
   CHECK_INPUT(grad_out);
+  const Tensor dh_t = dh_final.value_or(Tensor());
+  if (dh_t.defined())
+    CHECK_INPUT(dh_t);
+  const std::vector<int> sizes =
+      packed_batch_sizes(batch_sizes, time_steps, batch_size);
+  const haste::v0::Zoneout zoneout_params =
+      make_zoneout(zoneout, sample, seed);
 
   const auto options = wx.options();
   const at::cuda::CUDAGuard guard(options.device_index());
 
-  Tensor dwx = torch::zeros({time_steps, batch_size, hidden_size * 2}, options);
-  Tensor du = torch::zeros({hidden_size, hidden_size * 2}, options);
-  Tensor dh = torch::zeros({batch_size, hidden_size}, options);
+  Tensor dwx =
+      torch::zeros({time_steps, batch_size, hidden_size * 2}, options);
+  Tensor du = torch::empty({hidden_size * 2, hidden_size}, options);
+  Tensor dh0 = torch::empty({batch_size, hidden_size}, options);
+  TORCH_CHECK(!dh_t.defined() || dh_t.numel() == dh0.numel(),
+              "dh_final must have the shape of the initial state gradient");
 
+  const cudaStream_t stream = at::cuda::getCurrentCUDAStream().stream();
   AT_DISPATCH_FLOATING_TYPES_AND_HALF(
-      wx.scalar_type(), "ligru_backward", ([&] {
-        BackwardPass<typename native_type<scalar_t>::T> backward(
-            batch_size, input_size, hidden_size,
-            at::cuda::getCurrentCUDABlasHandle(),
-            activation,
-            at::cuda::getCurrentCUDAStream());
-
-        backward.Run(time_steps, ptr<scalar_t>(wx), ptr<scalar_t>(u),
-                     ptr<scalar_t>(h), ptr<scalar_t>(cache),
-                     ptr<scalar_t>(grad_out), ptr<scalar_t>(dwx),
-                     ptr<scalar_t>(du), ptr<scalar_t>(dh));
+      wx.scalar_type(), "ligru_packed_backward", ([&] {
+        using Pass = BackwardPass<typename native_type<scalar_t>::T>;
+        Tensor workspace = cached_workspace(
+            Pass::GetWorkspaceSize(time_steps, batch_size, hidden_size, true),
+            options);
+        auto &backward = cached_pass<Pass>(
+            batch_size, 0, hidden_size,
+            at::cuda::getCurrentCUDABlasHandle(), activation, stream);
+
+        backward.SetZoneout(zoneout_params);
+        backward.SetStateGradient(ptr_or_null<scalar_t>(dh_t),
+                                  ptr<scalar_t>(dh0));
+        backward.RunPacked(time_steps, sizes.data(), ptr<scalar_t>(wx),
+                           ptr<scalar_t>(u), ptr<scalar_t>(h),
+                           ptr<scalar_t>(cache), ptr<scalar_t>(grad_out),
+                           ptr<scalar_t>(dwx), ptr<scalar_t>(du),
+                           workspace.data_ptr());
+        backward.SetZoneout(haste::v0::Zoneout());
+        backward.SetStateGradient(nullptr, nullptr);
       }));
 
-  return {du, dwx, dh};
+  return {du, dwx, dh0};
+}
+
+std::vector<Tensor> ligru_1_0_stack_forward(const Tensor &x,
+                                            const std::vector<Tensor> &ws,
+                                            const std::vector<Tensor> &bs,
+                                            const std::vector<Tensor> &us,
+                                            const Tensor &h_init,
+                                            const int activation,
+                                            const int64_t chunk_size) {
+  const auto batch_size = x.size(1);
+  const auto hidden_size = h_init.size(2);
+
+  TORCH_CHECK(us.size() == ws.size(), "expected one u per layer");
+
+  for (const auto &u : us)
+    CHECK_INPUT(u);
+
+  std::vector<Tensor> result;
+  AT_DISPATCH_FLOATING_TYPES_AND_HALF(
+      x.scalar_type(), "ligru_stack_forward", ([&] {
+        result = stack_forward(
+            x, ws, bs, h_init, chunk_size,
+            [&](const int64_t l, const Tensor &wx, const Tensor &b,
+                const Tensor &h, const cudaStream_t &stream) {
+              using Pass = ForwardPass<typename native_type<scalar_t>::T>;
+              // Each layer runs on its own stream and so gets its own
+              // workspace.
+              Tensor workspace = cached_workspace(
+                  Pass::GetWorkspaceSize(wx.size(0), batch_size, hidden_size,
+                                         false),
+                  wx.options());
+              auto &forward = cached_pass<Pass>(
+                  false, batch_size, 0, hidden_size,
+                  at::cuda::getCurrentCUDABlasHandle(), activation, stream);
+
+              forward.SetBias(ptr_or_null<scalar_t>(b));
+              forward.Run(wx.size(0), ptr<scalar_t>(wx), ptr<scalar_t>(us[l]),
+                          ptr<scalar_t>(h), nullptr, workspace.data_ptr());
+              forward.SetBias(nullptr);
+            });
+      }));
+
+  return result;
+}
+
+StreamingSession ligru_1_0_streaming_session(const std::vector<Tensor> &ws,
+                                             const std::vector<Tensor> &bs,
+                                             const std::vector<Tensor> &us,
+                                             const int activation,
+                                             const int64_t num_slots) {
+  TORCH_CHECK(!us.empty() && us.size() == ws.size(),
+              "expected one u per layer");
+  for (const auto &u : us)
+    CHECK_INPUT(u);
+
+  return StreamingSession(
+      ws, bs, us[0].size(1), num_slots,
+      [us, activation](const int64_t l, const Tensor &wx, const Tensor &b,
+                       const Tensor &h, const Tensor &table,
+                       const Tensor &slots, const cudaStream_t &stream) {
+        const auto batch_size = wx.size(1);
+        const auto hidden_size = h.size(2);
+
+        AT_DISPATCH_FLOATING_TYPES_AND_HALF(
+            wx.scalar_type(), "ligru_streaming_step", ([&] {
+              using Pass = ForwardPass<typename native_type<scalar_t>::T>;
+              Tensor workspace = cached_workspace(
+                  Pass::GetWorkspaceSize(wx.size(0), batch_size, hidden_size,
+                                         false),
+                  wx.options());
+              auto &forward = cached_pass<Pass>(
+                  false, batch_size, 0, hidden_size,
+                  at::cuda::getCurrentCUDABlasHandle(), activation, stream);
+
+              forward.SetBias(ptr_or_null<scalar_t>(b));
+              forward.RunIndexed(wx.size(0), ptr<scalar_t>(wx),
+                                 ptr<scalar_t>(us[l]), ptr<scalar_t>(h),
+                                 nullptr, workspace.data_ptr(),
+                                 ptr<scalar_t>(table), slots.data_ptr<int>());
+              forward.SetBias(nullptr);
+            }));
+      });
 }
 
 } // anonymous namespace
@@ -94,6 +712,29 @@ std::vector<Tensor> ligru_1_0_backward(const Tensor& wx, const Tensor& u, const
 void ligru_1_0_init(py::module &m) {
   m.def("ligru_1_0_forward", &ligru_1_0_forward, "Li-GRU forward",
         py::call_guard<py::gil_scoped_release>());
+  m.def("ligru_1_0_forward_final", &ligru_1_0_forward_final,
+        "Li-GRU inference keeping only the final hidden state",
+        py::call_guard<py::gil_scoped_release>());
+  m.def("ligru_1_0_quantized_forward", &ligru_1_0_quantized_forward,
+        "Li-GRU inference with a quantized recurrent weight",
+        py::call_guard<py::gil_scoped_release>());
+  m.def("ligru_1_0_grouped_forward", &ligru_1_0_grouped_forward,
+        "Li-GRU inference over several layers of the same shape",
+        py::call_guard<py::gil_scoped_release>());
   m.def("ligru_1_0_backward", &ligru_1_0_backward, "Li-GRU backward",
         py::call_guard<py::gil_scoped_release>());
+  m.def("ligru_1_0_recompute_backward", &ligru_1_0_recompute_backward,
+        "Li-GRU backward recomputing the gates from the hidden states",
+        py::call_guard<py::gil_scoped_release>());
+  m.def("ligru_1_0_packed_forward", &ligru_1_0_packed_forward,
+        "Li-GRU forward over variable-length sequences",
+        py::call_guard<py::gil_scoped_release>());
+  m.def("ligru_1_0_packed_backward", &ligru_1_0_packed_backward,
+        "Li-GRU backward over variable-length sequences",
+        py::call_guard<py::gil_scoped_release>());
+  m.def("ligru_1_0_stack_forward", &ligru_1_0_stack_forward,
+        "Li-GRU multi-layer wavefront inference",
+        py::call_guard<py::gil_scoped_release>());
+  m.def("ligru_1_0_streaming_session", &ligru_1_0_streaming_session,
+        "Creates a Li-GRU streaming inference session");
 }
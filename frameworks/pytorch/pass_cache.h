@@ -0,0 +1,64 @@
+// Copyright 2022 Adel Moumen
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#pragma once
+
+#include <cuda_runtime_api.h>
+#include <map>
+#include <memory>
+#include <tuple>
+
+// Upper bound on the passes kept per thread and pass type; the cache is
+// flushed when it is reached (e.g. when the batch size changes every call).
+constexpr size_t kMaxCachedPasses = 64;
+
+// Returns a `Pass` constructed with `args`, reusing the one built by a
+// previous call from the same thread on the same device. This keeps the
+// stream/event creation of the pass constructor and the synchronization of
+// its destructor out of every forward and backward call.
+template <typename Pass, typename... Args> Pass &cached_pass(const Args &...args) {
+  using Key = std::tuple<int, Args...>;
+  thread_local std::map<Key, std::unique_ptr<Pass>> passes;
+
+  int device;
+  cudaGetDevice(&device);
+  const Key key(device, args...);
+
+  auto it = passes.find(key);
+  if (it == passes.end()) {
+    if (passes.size() >= kMaxCachedPasses)
+      passes.clear();
+    it = passes.emplace(key, std::unique_ptr<Pass>(new Pass(args...))).first;
+  }
+  return *it->second;
+}
+
+// Same as `cached_pass` for the passes of the CPU backend, which belong to no
+// device; a cached pass keeps the threads of its pool alive between calls.
+template <typename Pass, typename... Args>
+Pass &cached_host_pass(const Args &...args) {
+  using Key = std::tuple<Args...>;
+  thread_local std::map<Key, std::unique_ptr<Pass>> passes;
+
+  const Key key(args...);
+
+  auto it = passes.find(key);
+  if (it == passes.end()) {
+    if (passes.size() >= kMaxCachedPasses)
+      passes.clear();
+    it = passes.emplace(key, std::unique_ptr<Pass>(new Pass(args...))).first;
+  }
+  return *it->second;
+}
@@ -0,0 +1,50 @@
+// Copyright 2022 Adel Moumen, All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#include <torch/extension.h>
+
+#include "profiler.h"
+
+namespace {
+
+namespace profiler = haste::v0::profiler;
+
+// One `(scope, phase, count, milliseconds, bytes)` tuple per entry point and
+// phase timed so far.
+std::vector<py::tuple> profiler_stats(const bool synchronize) {
+  std::vector<profiler::PhaseStats> stats;
+  {
+    py::gil_scoped_release release;
+    stats = profiler::GetStats(synchronize);
+  }
+  std::vector<py::tuple> result;
+  for (const auto &s : stats)
+    result.push_back(py::make_tuple(s.scope, profiler::PhaseName(s.phase),
+                                    s.count, s.milliseconds, s.bytes));
+  return result;
+}
+
+} // anonymous namespace
+
+void profiler_init(py::module &m) {
+  m.def("set_profiler_sample_period", &profiler::SetSamplePeriod,
+        "Times one in every `period` calls of the passes (0 disables timing)");
+  m.def("profiler_stats", &profiler_stats,
+        "Returns the cumulative per-phase timings of the timed calls",
+        py::arg("synchronize") = true);
+  m.def("reset_profiler", &profiler::ResetStats,
+        "Clears the cumulative per-phase timings",
+        py::call_guard<py::gil_scoped_release>());
+}
@@ -0,0 +1,143 @@
+// Copyright 2022 Adel Moumen
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#include <algorithm>
+
+#include "scheduler.h"
+
+using torch::Tensor;
+
+ContinuousBatcher::ContinuousBatcher(const StreamingSession &session)
+    : session_(session), streams_(session.state().size(1)) {
+  for (int64_t slot = static_cast<int64_t>(streams_.size()) - 1; slot >= 0;
+       --slot)
+    free_slots_.push_back(slot);
+}
+
+ContinuousBatcher::Stream &ContinuousBatcher::stream(const int64_t slot) {
+  TORCH_CHECK(slot >= 0 && slot < static_cast<int64_t>(streams_.size()) &&
+                  streams_[slot].active,
+              "no active stream in slot ", slot);
+  return streams_[slot];
+}
+
+int64_t ContinuousBatcher::join() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  TORCH_CHECK(!free_slots_.empty(), "every slot is taken");
+
+  const int64_t slot = free_slots_.back();
+  free_slots_.pop_back();
+  streams_[slot] = Stream();
+  streams_[slot].active = true;
+  session_.reset(torch::tensor({slot}));
+  return slot;
+}
+
+void ContinuousBatcher::leave(const int64_t slot) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  stream(slot) = Stream();
+  free_slots_.push_back(slot);
+}
+
+void ContinuousBatcher::push(const int64_t slot, const Tensor &frames) {
+  TORCH_CHECK(frames.dim() == 2, "expected [T,F] frames");
+  std::lock_guard<std::mutex> lock(mutex_);
+  Stream &s = stream(slot);
+  // Converted here, so that a mismatched frame fails or is cast at the call
+  // that pushed it rather than inside a later batched step.
+  s.frames.push_back(frames.to(session_.state().options()));
+  s.queued += frames.size(0);
+}
+
+Tensor ContinuousBatcher::take(Stream &s, int64_t steps) {
+  std::vector<Tensor> parts;
+  s.queued -= steps;
+  while (steps > 0) {
+    const Tensor &front = s.frames.front();
+    const int64_t n = std::min(steps, front.size(0) - s.offset);
+    parts.push_back(front.narrow(0, s.offset, n));
+    s.offset += n;
+    steps -= n;
+    if (s.offset == front.size(0)) {
+      s.frames.pop_front();
+      s.offset = 0;
+    }
+  }
+  return parts.size() == 1 ? parts[0] : torch::cat(parts);
+}
+
+int64_t ContinuousBatcher::step(const int64_t max_steps) {
+  TORCH_CHECK(max_steps > 0, "max_steps must be positive");
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  std::vector<int64_t> slots;
+  int64_t steps = max_steps;
+  for (int64_t slot = 0; slot < static_cast<int64_t>(streams_.size());
+       ++slot) {
+    if (streams_[slot].active && streams_[slot].queued > 0) {
+      slots.push_back(slot);
+      steps = std::min(steps, streams_[slot].queued);
+    }
+  }
+  if (slots.empty())
+    return 0;
+
+  std::vector<Tensor> inputs;
+  for (const int64_t slot : slots)
+    inputs.push_back(take(streams_[slot], steps));
+
+  const Tensor x = torch::stack(inputs, 1).contiguous();
+  const Tensor output = session_.step(x, torch::tensor(slots));
+  for (size_t b = 0; b < slots.size(); ++b)
+    streams_[slots[b]].outputs.push_back(output.select(1, b));
+
+  return static_cast<int64_t>(slots.size());
+}
+
+Tensor ContinuousBatcher::pop(const int64_t slot) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Stream &s = stream(slot);
+  if (s.outputs.empty()) {
+    const Tensor state = session_.state();
+    return torch::empty({0, state.size(2)}, state.options());
+  }
+
+  const Tensor output = torch::cat(s.outputs);
+  s.outputs.clear();
+  return output;
+}
+
+int64_t ContinuousBatcher::pending(const int64_t slot) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stream(slot).queued;
+}
+
+void scheduler_init(py::module &m) {
+  py::class_<ContinuousBatcher>(m, "ContinuousBatcher")
+      .def(py::init<const StreamingSession &>())
+      .def("join", &ContinuousBatcher::join,
+           "Takes a free slot for a new stream and returns it")
+      .def("leave", &ContinuousBatcher::leave,
+           "Releases the slot of a stream")
+      .def("push", &ContinuousBatcher::push,
+           "Queues the [T,F] frames of a stream")
+      .def("step", &ContinuousBatcher::step,
+           "Advances every stream with pending input in one batched step",
+           py::arg("max_steps") = 1, py::call_guard<py::gil_scoped_release>())
+      .def("pop", &ContinuousBatcher::pop,
+           "Returns the [T,H] outputs of a stream produced since the last call")
+      .def("pending", &ContinuousBatcher::pending,
+           "Number of queued frames of a stream");
+}
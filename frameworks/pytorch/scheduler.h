@@ -0,0 +1,76 @@
+// Copyright 2022 Adel Moumen
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <torch/extension.h>
+#include <vector>
+
+#include "streaming.h"
+
+// Continuous batching of many inference streams over one `StreamingSession`.
+// Streams join and leave at any time and feed their frames as they arrive;
+// each call to `step` gathers every stream that has pending input into one
+// dynamic batch, indexed by the session slots the streams occupy, and
+// advances it. Joining or leaving never moves the state of other streams.
+//
+// All methods may be called from different threads.
+class ContinuousBatcher {
+public:
+  // Shares the state table of `session`, whose slots it manages.
+  explicit ContinuousBatcher(const StreamingSession &session);
+
+  // Takes a free slot for a new stream, zeroes its state and returns it.
+  int64_t join();
+
+  // Releases the slot of a stream, dropping its pending input and output.
+  void leave(const int64_t slot);
+
+  // Queues the [T,F] frames of a stream, on any device and of any floating
+  // type; they are copied to the device and dtype of the session.
+  void push(const int64_t slot, const torch::Tensor &frames);
+
+  // Advances every stream with pending input by as many steps as all of them
+  // can take, up to `max_steps`, in one batched session step. Returns the
+  // number of streams advanced.
+  int64_t step(const int64_t max_steps);
+
+  // Returns the [T,H] outputs of a stream produced since the last call.
+  torch::Tensor pop(const int64_t slot);
+
+  // Number of queued frames of a stream.
+  int64_t pending(const int64_t slot);
+
+private:
+  struct Stream {
+    bool active = false;
+    std::deque<torch::Tensor> frames;
+    int64_t offset = 0;
+    int64_t queued = 0;
+    std::vector<torch::Tensor> outputs;
+  };
+
+  Stream &stream(const int64_t slot);
+  torch::Tensor take(Stream &stream, int64_t steps);
+
+  StreamingSession session_;
+  std::vector<Stream> streams_;
+  std::vector<int64_t> free_slots_;
+  std::mutex mutex_;
+};
+
+void scheduler_init(py::module &m);
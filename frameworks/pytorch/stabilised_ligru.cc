@@ -3,8 +3,12 @@
 #include <torch/extension.h>
 #include <vector>
 
+#include "graph_cache.h"
 #include "layer_norm.h"
 #include "ligru_2_0.h"
+#include "pass_cache.h"
+#include "stack.h"
+#include "streaming.h"
 #include "support.h"
 
 namespace {
@@ -14,58 +18,630 @@ namespace layer_norm_ligru = haste::v0::ligru_2_0;
 
 using torch::Tensor;
 
+// Takes the layouts of `ligru_1_0_forward`: a batch-first `wx`, the
+// `nn.Linear` weight `u`, the optional bias added inside the recurrence and
+// the zoneout parameters.
 std::vector<Tensor> ligru_2_0_forward(const bool training, const Tensor& wx, const Tensor& h_init,
-                                  const Tensor& u_t, const int activation) {
+                                  const Tensor& u, const int activation,
+                                  const bool bidirectional,
+                                  const c10::optional<Tensor> &bias,
+                                  const double zoneout, const bool sample,
+                                  const int64_t seed) {
 
-  const auto seq_length = wx.size(0);
-  const auto batch_size = wx.size(1);
+  const auto seq_length = wx.size(1);
+  const auto batch_size = wx.size(0);
   const auto hidden_size = h_init.size(1);
+  const auto directions = bidirectional ? 2 : 1;
 
   CHECK_INPUT(wx);
   CHECK_INPUT(h_init);
-  CHECK_INPUT(u_t);
+  CHECK_INPUT(u);
+  const Tensor b = bias.value_or(Tensor());
+  if (b.defined())
+    CHECK_INPUT(b);
+  const haste::v0::Zoneout zoneout_params =
+      make_zoneout(zoneout, sample, seed);
 
   const auto options = wx.options();
   const at::cuda::CUDAGuard guard(options.device_index());
 
-  Tensor output =
-      torch::empty({seq_length + 1, batch_size, hidden_size}, options);
-  Tensor cache =
-      torch::empty({seq_length, batch_size, hidden_size * 3}, options);
+  Tensor output = torch::empty({seq_length + directions, batch_size,
+                                hidden_size * directions},
+                               options);
+  // The gate cache and the per-step recurrent projections are only read by
+  // the backward pass; inference keeps its single step in the workspace.
+  Tensor cache = training ? torch::empty({seq_length * directions, batch_size,
+                                          hidden_size * 3},
+                                         options)
+                          : torch::empty({0}, options);
+  Tensor act_uh = training ? torch::empty({seq_length * directions,
+                                           batch_size, hidden_size * 2},
+                                          options)
+                           : torch::empty({0}, options);
+  Tensor act_uh_norm_cache =
+      torch::empty({seq_length * directions, batch_size, 2}, options);
 
-  Tensor act_uh =
-      torch::empty({seq_length, batch_size, hidden_size * 2}, options);
-  Tensor tmp_uh_norm = torch::empty({batch_size, hidden_size * 2}, options);
-  Tensor act_uh_norm_cache = torch::empty({seq_length, batch_size, 2}, options);
+  if (bidirectional)
+    init_bidirectional_state(output, h_init);
+  else
+    output[0] = h_init;
 
-  output[0] = h_init;
+  const GraphKey key{bidirectional ? kSLiGRUBidirectionalForward
+                                   : kSLiGRUForward,
+                     options.device_index(),
+                     static_cast<int>(wx.scalar_type()),
+                     activation,
+                     training,
+                     seq_length,
+                     batch_size,
+                     hidden_size};
 
-  AT_DISPATCH_FLOATING_TYPES(
+  AT_DISPATCH_FLOATING_TYPES_AND2(
+      at::ScalarType::Half, at::ScalarType::BFloat16,
       wx.scalar_type(), "ligru_2_0_forward", ([&] {
-        layer_norm::ForwardPass<scalar_t> layer_norm1(
-            seq_length * batch_size, hidden_size * 2, nullptr,
-            nullptr, act_uh_norm_cache.data_ptr<scalar_t>());
-
-        layer_norm_ligru::ForwardPass<typename native_type<scalar_t>::T>
-            forward(training, batch_size, 0, hidden_size,
-                    at::cuda::getCurrentCUDABlasHandle(),
-                    activation,
-                    at::cuda::getCurrentCUDAStream());
-
-        forward.Run(seq_length, wx.data_ptr<scalar_t>(), u_t.data_ptr<scalar_t>(),
-                    output.data_ptr<scalar_t>(), cache.data_ptr<scalar_t>(),
-                    layer_norm1, tmp_uh_norm.data_ptr<scalar_t>(),
-                    act_uh.data_ptr<scalar_t>());
+        using T = typename native_type<scalar_t>::T;
+        using Pass = layer_norm_ligru::ForwardPass<T>;
+        Tensor workspace = cached_workspace(
+            Pass::GetWorkspaceSize(seq_length, batch_size, hidden_size,
+                                   training, bidirectional),
+            options);
+
+        run_with_graph(
+            key,
+            with_zoneout({wx.data_ptr(), u.data_ptr(), output.data_ptr(),
+                          cache.data_ptr(), act_uh.data_ptr(),
+                          act_uh_norm_cache.data_ptr(), workspace.data_ptr(),
+                          b.defined() ? b.data_ptr() : nullptr},
+                         zoneout_params),
+            [&](const cudaStream_t &stream) {
+              layer_norm::ForwardPass<T> layer_norm1(
+                  seq_length * batch_size, hidden_size * 2, nullptr, nullptr,
+                  ptr<scalar_t>(act_uh_norm_cache));
+
+              auto &forward = cached_pass<Pass>(
+                  training, batch_size, 0, hidden_size,
+                  at::cuda::getCurrentCUDABlasHandle(), activation, stream);
+
+              forward.SetBias(ptr_or_null<scalar_t>(b));
+              forward.SetZoneout(zoneout_params);
+              if (bidirectional) {
+                layer_norm::ForwardPass<T> layer_norm2(
+                    seq_length * batch_size, hidden_size * 2, nullptr, nullptr,
+                    ptr<scalar_t>(act_uh_norm_cache[seq_length]));
+
+                forward.RunBidirectional(
+                    seq_length, ptr<scalar_t>(wx), ptr<scalar_t>(u),
+                    ptr<scalar_t>(output), ptr<scalar_t>(cache), layer_norm1,
+                    layer_norm2, ptr<scalar_t>(act_uh), workspace.data_ptr(),
+                    true);
+              } else {
+                forward.Run(seq_length, ptr<scalar_t>(wx), ptr<scalar_t>(u),
+                            ptr<scalar_t>(output), ptr<scalar_t>(cache),
+                            layer_norm1, ptr<scalar_t>(act_uh),
+                            workspace.data_ptr(), true);
+              }
+              // Later users of the cached pass expect no bias or zoneout.
+              forward.SetBias(nullptr);
+              forward.SetZoneout(haste::v0::Zoneout());
+            });
       }));
 
   return {output, cache, act_uh, act_uh_norm_cache};
 }
 
+Tensor ligru_2_0_forward_final(const Tensor &wx, const Tensor &h_init,
+                               const Tensor &u, const int activation,
+                               const c10::optional<Tensor> &bias,
+                               const double zoneout, const bool sample,
+                               const int64_t seed) {
+  const auto seq_length = wx.size(1);
+  const auto batch_size = wx.size(0);
+  const auto hidden_size = h_init.size(1);
+
+  CHECK_INPUT(wx);
+  CHECK_INPUT(h_init);
+  CHECK_INPUT(u);
+  const Tensor b = bias.value_or(Tensor());
+  if (b.defined())
+    CHECK_INPUT(b);
+  const haste::v0::Zoneout zoneout_params =
+      make_zoneout(zoneout, sample, seed);
+
+  const auto options = wx.options();
+  const at::cuda::CUDAGuard guard(options.device_index());
+
+  Tensor h = torch::empty({2, batch_size, hidden_size}, options);
+  Tensor act_uh_norm_cache = torch::empty({seq_length, batch_size, 2}, options);
+
+  h[0] = h_init;
+
+  const GraphKey key{kSLiGRUInference,
+                     options.device_index(),
+                     static_cast<int>(wx.scalar_type()),
+                     activation,
+                     false,
+                     seq_length,
+                     batch_size,
+                     hidden_size};
+
+  AT_DISPATCH_FLOATING_TYPES_AND2(
+      at::ScalarType::Half, at::ScalarType::BFloat16,
+      wx.scalar_type(), "ligru_2_0_forward_final", ([&] {
+        using T = typename native_type<scalar_t>::T;
+        using Pass = layer_norm_ligru::ForwardPass<T>;
+        Tensor workspace = cached_workspace(
+            Pass::GetWorkspaceSize(seq_length, batch_size, hidden_size, false),
+            options);
+
+        run_with_graph(
+            key,
+            with_zoneout({wx.data_ptr(), u.data_ptr(), h.data_ptr(),
+                          act_uh_norm_cache.data_ptr(), workspace.data_ptr(),
+                          b.defined() ? b.data_ptr() : nullptr},
+                         zoneout_params),
+            [&](const cudaStream_t &stream) {
+              layer_norm::ForwardPass<T> layer_norm1(
+                  seq_length * batch_size, hidden_size * 2, nullptr, nullptr,
+                  ptr<scalar_t>(act_uh_norm_cache));
+
+              auto &forward = cached_pass<Pass>(
+                  false, batch_size, 0, hidden_size,
+                  at::cuda::getCurrentCUDABlasHandle(), activation, stream);
+
+              forward.SetBias(ptr_or_null<scalar_t>(b));
+              forward.SetZoneout(zoneout_params);
+              forward.RunInference(seq_length, ptr<scalar_t>(wx),
+                                   ptr<scalar_t>(u), ptr<scalar_t>(h),
+                                   layer_norm1, workspace.data_ptr(), true);
+              forward.SetBias(nullptr);
+              forward.SetZoneout(haste::v0::Zoneout());
+            });
+      }));
+
+  return h[seq_length % 2];
+}
+
+// Same as `ligru_1_0_quantized_forward`.
+Tensor ligru_2_0_quantized_forward(const Tensor &wx, const Tensor &h_init,
+                                   const Tensor &u_data, const Tensor &u_scale,
+                                   const int64_t format, const int activation,
+                                   const bool bidirectional,
+                                   const c10::optional<Tensor> &bias,
+                                   const double zoneout) {
+  const auto seq_length = wx.size(1);
+  const auto batch_size = wx.size(0);
+  const auto hidden_size = h_init.size(1);
+  const auto directions = bidirectional ? 2 : 1;
+
+  CHECK_INPUT(wx);
+  CHECK_INPUT(h_init);
+  const haste::v0::QuantizedWeight u =
+      make_quantized_weight(u_data, u_scale, format, hidden_size);
+  const Tensor b = bias.value_or(Tensor());
+  if (b.defined())
+    CHECK_INPUT(b);
+  const haste::v0::Zoneout zoneout_params = make_zoneout(zoneout, false, 0);
+
+  const auto options = wx.options();
+  const at::cuda::CUDAGuard guard(options.device_index());
+
+  Tensor output = torch::empty({seq_length + directions, batch_size,
+                                hidden_size * directions},
+                               options);
+  Tensor cache = torch::empty({0}, options);
+  Tensor act_uh = torch::empty({0}, options);
+  Tensor act_uh_norm_cache =
+      torch::empty({seq_length * directions, batch_size, 2}, options);
+
+  if (bidirectional)
+    init_bidirectional_state(output, h_init);
+  else
+    output[0] = h_init;
+
+  GraphKey key{bidirectional ? kSLiGRUQuantizedBidirectionalForward
+                             : kSLiGRUQuantizedForward,
+               options.device_index(),
+               static_cast<int>(wx.scalar_type()),
+               activation,
+               false,
+               seq_length,
+               batch_size,
+               hidden_size};
+  key.variant = static_cast<int>(format);
+
+  AT_DISPATCH_FLOATING_TYPES_AND2(
+      at::ScalarType::Half, at::ScalarType::BFloat16,
+      wx.scalar_type(), "ligru_2_0_quantized_forward", ([&] {
+        using T = typename native_type<scalar_t>::T;
+        using Pass = layer_norm_ligru::ForwardPass<T>;
+        Tensor workspace = cached_workspace(
+            Pass::GetWorkspaceSize(seq_length, batch_size, hidden_size, false,
+                                   bidirectional),
+            options);
+
+        run_with_graph(
+            key,
+            with_zoneout({wx.data_ptr(), u.data, u.scale, output.data_ptr(),
+                          act_uh_norm_cache.data_ptr(), workspace.data_ptr(),
+                          b.defined() ? b.data_ptr() : nullptr},
+                         zoneout_params),
+            [&](const cudaStream_t &stream) {
+              layer_norm::ForwardPass<T> layer_norm1(
+                  seq_length * batch_size, hidden_size * 2, nullptr, nullptr,
+                  ptr<scalar_t>(act_uh_norm_cache));
+
+              auto &forward = cached_pass<Pass>(
+                  false, batch_size, 0, hidden_size,
+                  at::cuda::getCurrentCUDABlasHandle(), activation, stream);
+
+              forward.SetBias(ptr_or_null<scalar_t>(b));
+              forward.SetZoneout(zoneout_params);
+              forward.SetQuantizedWeight(u);
+              if (bidirectional) {
+                layer_norm::ForwardPass<T> layer_norm2(
+                    seq_length * batch_size, hidden_size * 2, nullptr, nullptr,
+                    ptr<scalar_t>(act_uh_norm_cache[seq_length]));
+
+                forward.RunBidirectional(
+                    seq_length, ptr<scalar_t>(wx), nullptr,
+                    ptr<scalar_t>(output), ptr<scalar_t>(cache), layer_norm1,
+                    layer_norm2, ptr<scalar_t>(act_uh), workspace.data_ptr(),
+                    true);
+              } else {
+                forward.Run(seq_length, ptr<scalar_t>(wx), nullptr,
+                            ptr<scalar_t>(output), ptr<scalar_t>(cache),
+                            layer_norm1, ptr<scalar_t>(act_uh),
+                            workspace.data_ptr(), true);
+              }
+              forward.SetBias(nullptr);
+              forward.SetZoneout(haste::v0::Zoneout());
+              forward.SetQuantizedWeight(haste::v0::QuantizedWeight());
+            });
+      }));
+
+  return output;
+}
+
+// Same layouts as `ligru_1_0_grouped_forward`.
+Tensor ligru_2_0_grouped_forward(const Tensor &wx, const Tensor &h_init,
+                                 const Tensor &u, const int activation,
+                                 const double zoneout) {
+  const auto groups = wx.size(1);
+  const auto seq_length = wx.size(2);
+  const auto batch_size = wx.size(0) * groups;
+  const auto hidden_size = h_init.size(2);
+
+  CHECK_INPUT(wx);
+  CHECK_INPUT(h_init);
+  CHECK_INPUT(u);
+  TORCH_CHECK(u.size(0) == groups, "u must hold one weight per group");
+  const haste::v0::Zoneout zoneout_params = make_zoneout(zoneout, false, 0);
+
+  const auto options = wx.options();
+  const at::cuda::CUDAGuard guard(options.device_index());
+
+  Tensor output = torch::empty(
+      {seq_length + 1, wx.size(0), groups, hidden_size}, options);
+  Tensor cache = torch::empty({0}, options);
+  Tensor act_uh_norm_cache =
+      torch::empty({seq_length, batch_size, 2}, options);
+
+  output[0] = h_init;
+
+  GraphKey key{kSLiGRUGroupedForward,
+               options.device_index(),
+               static_cast<int>(wx.scalar_type()),
+               activation,
+               false,
+               seq_length,
+               batch_size,
+               hidden_size};
+  key.variant = static_cast<int>(groups);
+
+  AT_DISPATCH_FLOATING_TYPES_AND2(
+      at::ScalarType::Half, at::ScalarType::BFloat16,
+      wx.scalar_type(), "ligru_2_0_grouped_forward", ([&] {
+        using T = typename native_type<scalar_t>::T;
+        using Pass = layer_norm_ligru::ForwardPass<T>;
+        Tensor workspace = cached_workspace(
+            Pass::GetWorkspaceSize(seq_length, batch_size, hidden_size, false),
+            options);
+
+        run_with_graph(
+            key,
+            with_zoneout({wx.data_ptr(), u.data_ptr(), output.data_ptr(),
+                          act_uh_norm_cache.data_ptr(), workspace.data_ptr()},
+                         zoneout_params),
+            [&](const cudaStream_t &stream) {
+              layer_norm::ForwardPass<T> layer_norm1(
+                  seq_length * batch_size, hidden_size * 2, nullptr, nullptr,
+                  ptr<scalar_t>(act_uh_norm_cache));
+
+              auto &forward = cached_pass<Pass>(
+                  false, batch_size, 0, hidden_size,
+                  at::cuda::getCurrentCUDABlasHandle(), activation, stream);
+
+              forward.SetZoneout(zoneout_params);
+              forward.SetGroups(groups);
+              forward.Run(seq_length, ptr<scalar_t>(wx), ptr<scalar_t>(u),
+                          ptr<scalar_t>(output), ptr<scalar_t>(cache),
+                          layer_norm1, nullptr, workspace.data_ptr(), true);
+              forward.SetZoneout(haste::v0::Zoneout());
+              forward.SetGroups(1);
+            });
+      }));
+
+  return output;
+}
+
+// Layouts as in `ligru_1_0_backward`.
 std::vector<Tensor> ligru_2_0_backward(const Tensor& wx, const Tensor& u, const Tensor& h,
                                    const Tensor& cache, const Tensor& act_uh,
-                                   const Tensor& act_uh_norm_cache, const Tensor& grad_out, const int& activation) {
+                                   const Tensor& act_uh_norm_cache, const Tensor& grad_out, const int& activation,
+                                   const bool bidirectional, const double zoneout,
+                                   const bool sample, const int64_t seed,
+                                   const c10::optional<Tensor> &dh_final) {
+
+  const auto time_steps = wx.size(1);
+  const auto batch_size = wx.size(0);
+  const auto hidden_size = wx.size(2) / 2;
+  const auto directions = bidirectional ? 2 : 1;
+
+  CHECK_INPUT(wx);
+  CHECK_INPUT(u);
+  CHECK_INPUT(h);
+  CHECK_INPUT(cache);
+  CHECK_INPUT(grad_out);
+  CHECK_INPUT(act_uh);
+  CHECK_INPUT(act_uh_norm_cache);
+  const Tensor dh_t = dh_final.value_or(Tensor());
+  if (dh_t.defined())
+    CHECK_INPUT(dh_t);
+  const haste::v0::Zoneout zoneout_params =
+      make_zoneout(zoneout, sample, seed);
+
+  const auto options = wx.options();
+  const at::cuda::CUDAGuard guard(options.device_index());
+
+  Tensor dwx = torch::empty(
+      {time_steps * directions, batch_size, hidden_size * 2}, options);
+  Tensor du = torch::empty({hidden_size * 2, hidden_size}, options);
+  Tensor dh0 = bidirectional
+                   ? torch::empty({2, batch_size, hidden_size}, options)
+                   : torch::empty({batch_size, hidden_size}, options);
+  TORCH_CHECK(!dh_t.defined() || dh_t.numel() == dh0.numel(),
+              "dh_final must have the shape of the initial state gradient");
 
-  const auto input_size = wx.size(0);
+  GraphKey key{bidirectional ? kSLiGRUBidirectionalBackward : kSLiGRUBackward,
+               options.device_index(),
+               static_cast<int>(wx.scalar_type()),
+               activation,
+               true,
+               time_steps,
+               batch_size,
+               hidden_size};
+  key.variant = dh_t.defined();
+
+  AT_DISPATCH_FLOATING_TYPES_AND2(
+      at::ScalarType::Half, at::ScalarType::BFloat16,
+      wx.scalar_type(), "ligru_2_0_backward", ([&] {
+        using T = typename native_type<scalar_t>::T;
+        using Pass = layer_norm_ligru::BackwardPass<T>;
+        Tensor workspace = cached_workspace(
+            Pass::GetWorkspaceSize(time_steps, batch_size, hidden_size, true,
+                                   bidirectional),
+            options);
+
+        run_with_graph(
+            key,
+            with_zoneout({wx.data_ptr(), u.data_ptr(), h.data_ptr(),
+                          cache.data_ptr(), grad_out.data_ptr(),
+                          act_uh.data_ptr(), act_uh_norm_cache.data_ptr(),
+                          dwx.data_ptr(), du.data_ptr(),
+                          workspace.data_ptr(), ptr_or_null<scalar_t>(dh_t),
+                          dh0.data_ptr()},
+                         zoneout_params),
+            [&](const cudaStream_t &stream) {
+              layer_norm::BackwardPass<T> layer_norm1(
+                  time_steps * batch_size, hidden_size * 2, nullptr, nullptr,
+                  ptr<scalar_t>(act_uh), nullptr, nullptr,
+                  ptr<scalar_t>(act_uh_norm_cache));
+
+              auto &backward = cached_pass<Pass>(
+                  batch_size, 0, hidden_size,
+                  at::cuda::getCurrentCUDABlasHandle(), activation, stream);
+
+              backward.SetZoneout(zoneout_params);
+              backward.SetStateGradient(ptr_or_null<scalar_t>(dh_t),
+                                        ptr<scalar_t>(dh0));
+              if (bidirectional) {
+                layer_norm::BackwardPass<T> layer_norm2(
+                    time_steps * batch_size, hidden_size * 2, nullptr, nullptr,
+                    ptr<scalar_t>(act_uh[time_steps]), nullptr, nullptr,
+                    ptr<scalar_t>(act_uh_norm_cache[time_steps]));
+
+                backward.RunBidirectional(
+                    time_steps, ptr<scalar_t>(wx), ptr<scalar_t>(u),
+                    ptr<scalar_t>(h), ptr<scalar_t>(cache),
+                    ptr<scalar_t>(grad_out), ptr<scalar_t>(dwx),
+                    ptr<scalar_t>(du), workspace.data_ptr(), layer_norm1,
+                    layer_norm2);
+              } else {
+                backward.Run(time_steps, ptr<scalar_t>(wx), ptr<scalar_t>(u),
+                             ptr<scalar_t>(h), ptr<scalar_t>(cache),
+                             ptr<scalar_t>(grad_out), ptr<scalar_t>(dwx),
+                             ptr<scalar_t>(du), workspace.data_ptr(),
+                             layer_norm1);
+              }
+              backward.SetZoneout(haste::v0::Zoneout());
+              backward.SetStateGradient(nullptr, nullptr);
+            });
+      }));
+
+  // Both directions read the same `wx`.
+  if (bidirectional)
+    dwx = dwx.view({2, time_steps, batch_size, hidden_size * 2}).sum(0);
+
+  return {du, dwx, dh0};
+}
+
+// Backward of a `ligru_2_0_forward` run with `training == false`, which keeps
+// only the layer norm statistics of the recurrent products. Layouts as in
+// `ligru_2_0_backward`.
+std::vector<Tensor> ligru_2_0_recompute_backward(
+    const Tensor &wx, const Tensor &u, const Tensor &h,
+    const Tensor &act_uh_norm_cache, const Tensor &grad_out,
+    const int activation, const double zoneout, const bool sample,
+    const int64_t seed, const c10::optional<Tensor> &dh_final) {
+  const auto time_steps = wx.size(1);
+  const auto batch_size = wx.size(0);
+  const auto hidden_size = wx.size(2) / 2;
+
+  CHECK_INPUT(wx);
+  CHECK_INPUT(u);
+  CHECK_INPUT(h);
+  CHECK_INPUT(act_uh_norm_cache);
+  CHECK_INPUT(grad_out);
+  const Tensor dh_t = dh_final.value_or(Tensor());
+  if (dh_t.defined())
+    CHECK_INPUT(dh_t);
+  const haste::v0::Zoneout zoneout_params =
+      make_zoneout(zoneout, sample, seed);
+
+  const auto options = wx.options();
+  const at::cuda::CUDAGuard guard(options.device_index());
+
+  Tensor dwx =
+      torch::empty({time_steps, batch_size, hidden_size * 2}, options);
+  Tensor du = torch::empty({hidden_size * 2, hidden_size}, options);
+  Tensor dh0 = torch::empty({batch_size, hidden_size}, options);
+  TORCH_CHECK(!dh_t.defined() || dh_t.numel() == dh0.numel(),
+              "dh_final must have the shape of the initial state gradient");
+
+  GraphKey key{kSLiGRURecomputeBackward,
+               options.device_index(),
+               static_cast<int>(wx.scalar_type()),
+               activation,
+               true,
+               time_steps,
+               batch_size,
+               hidden_size};
+  key.variant = dh_t.defined();
+
+  AT_DISPATCH_FLOATING_TYPES_AND2(
+      at::ScalarType::Half, at::ScalarType::BFloat16,
+      wx.scalar_type(), "ligru_2_0_recompute_backward", ([&] {
+        using T = typename native_type<scalar_t>::T;
+        using Pass = layer_norm_ligru::BackwardPass<T>;
+        Tensor workspace = cached_workspace(
+            Pass::GetWorkspaceSize(time_steps, batch_size, hidden_size, false),
+            options);
+
+        run_with_graph(
+            key,
+            with_zoneout({wx.data_ptr(), u.data_ptr(), h.data_ptr(),
+                          act_uh_norm_cache.data_ptr(), grad_out.data_ptr(),
+                          dwx.data_ptr(), du.data_ptr(), workspace.data_ptr(),
+                          ptr_or_null<scalar_t>(dh_t), dh0.data_ptr()},
+                         zoneout_params),
+            [&](const cudaStream_t &stream) {
+              auto &backward = cached_pass<Pass>(
+                  batch_size, 0, hidden_size,
+                  at::cuda::getCurrentCUDABlasHandle(), activation, stream);
+
+              backward.SetZoneout(zoneout_params);
+              backward.SetStateGradient(ptr_or_null<scalar_t>(dh_t),
+                                        ptr<scalar_t>(dh0));
+              backward.RunRecompute(
+                  time_steps, ptr<scalar_t>(wx), ptr<scalar_t>(u),
+                  ptr<scalar_t>(h), ptr<scalar_t>(grad_out),
+                  ptr<scalar_t>(dwx), ptr<scalar_t>(du),
+                  ptr<scalar_t>(act_uh_norm_cache), workspace.data_ptr(),
+                  true);
+              backward.SetZoneout(haste::v0::Zoneout());
+              backward.SetStateGradient(nullptr, nullptr);
+            });
+      }));
+
+  return {du, dwx, dh0};
+}
+
+// Variable-length forward over a batch sorted by decreasing length. Only the
+// `sum(batch_sizes)` active rows are normalized and kept for the backward.
+// `wx` is time-major, as in `ligru_1_0_packed_forward`.
+std::vector<Tensor> ligru_2_0_packed_forward(const bool training,
+                                             const Tensor &wx,
+                                             const Tensor &h_init,
+                                             const Tensor &u,
+                                             const int activation,
+                                             const Tensor &batch_sizes,
+                                             const double zoneout,
+                                             const bool sample,
+                                             const int64_t seed) {
+  const auto seq_length = wx.size(0);
+  const auto batch_size = wx.size(1);
+  const auto hidden_size = h_init.size(1);
+
+  CHECK_INPUT(wx);
+  CHECK_INPUT(h_init);
+  CHECK_INPUT(u);
+  const std::vector<int> sizes =
+      packed_batch_sizes(batch_sizes, seq_length, batch_size);
+  const haste::v0::Zoneout zoneout_params =
+      make_zoneout(zoneout, sample, seed);
+  const auto rows = batch_sizes.sum().item<int64_t>();
+
+  const auto options = wx.options();
+  const at::cuda::CUDAGuard guard(options.device_index());
+
+  Tensor output =
+      torch::zeros({seq_length + 1, batch_size, hidden_size}, options);
+  Tensor cache = training ? torch::empty({seq_length, batch_size,
+                                          hidden_size * 3},
+                                         options)
+                          : torch::empty({0}, options);
+  Tensor act_uh = training ? torch::empty({rows, hidden_size * 2}, options)
+                           : torch::empty({0}, options);
+  Tensor act_uh_norm_cache = torch::empty({rows, 2}, options);
+
+  output[0] = h_init;
+
+  const cudaStream_t stream = at::cuda::getCurrentCUDAStream().stream();
+  AT_DISPATCH_FLOATING_TYPES_AND2(
+      at::ScalarType::Half, at::ScalarType::BFloat16,
+      wx.scalar_type(), "ligru_2_0_packed_forward", ([&] {
+        using T = typename native_type<scalar_t>::T;
+
+        layer_norm::ForwardPass<T> layer_norm1(
+            rows, hidden_size * 2, nullptr, nullptr,
+            ptr<scalar_t>(act_uh_norm_cache));
+
+        using Pass = layer_norm_ligru::ForwardPass<T>;
+        Tensor workspace = cached_workspace(
+            Pass::GetWorkspaceSize(seq_length, batch_size, hidden_size,
+                                   training),
+            options);
+        auto &forward = cached_pass<Pass>(
+            training, batch_size, 0, hidden_size,
+            at::cuda::getCurrentCUDABlasHandle(), activation, stream);
+
+        forward.SetZoneout(zoneout_params);
+        forward.RunPacked(seq_length, sizes.data(), ptr<scalar_t>(wx),
+                          ptr<scalar_t>(u), ptr<scalar_t>(output),
+                          ptr<scalar_t>(cache), layer_norm1,
+                          ptr<scalar_t>(act_uh), workspace.data_ptr());
+        forward.SetZoneout(haste::v0::Zoneout());
+      }));
+
+  return {output, cache, act_uh, act_uh_norm_cache};
+}
+
+std::vector<Tensor> ligru_2_0_packed_backward(
+    const Tensor &wx, const Tensor &u, const Tensor &h, const Tensor &cache,
+    const Tensor &act_uh, const Tensor &act_uh_norm_cache,
+    const Tensor &grad_out, const int activation, const Tensor &batch_sizes,
+    const double zoneout, const bool sample, const int64_t seed,
+    const c10::optional<Tensor> &dh_final) {
   const auto time_steps = wx.size(0);
   const auto batch_size = wx.size(1);
   const auto hidden_size = wx.size(2) / 2;
@@ -77,45 +653,194 @@ std::vector<Tensor> ligru_2_0_backward(const Tensor& wx, const Tensor& u, const
   CHECK_INPUT(grad_out);
   CHECK_INPUT(act_uh);
   CHECK_INPUT(act_uh_norm_cache);
+  const Tensor dh_t = dh_final.value_or(Tensor());
+  if (dh_t.defined())
+    CHECK_INPUT(dh_t);
+  const std::vector<int> sizes =
+      packed_batch_sizes(batch_sizes, time_steps, batch_size);
+  const haste::v0::Zoneout zoneout_params =
+      make_zoneout(zoneout, sample, seed);
 
   const auto options = wx.options();
   const at::cuda::CUDAGuard guard(options.device_index());
 
-  Tensor dwx = torch::empty({time_steps, batch_size, hidden_size * 2}, options);
-  Tensor tmp_dwx =
-      torch::empty({time_steps, batch_size, hidden_size * 2}, options);
-  Tensor du = torch::zeros({hidden_size, hidden_size * 2}, options);
-  Tensor dh = torch::zeros({batch_size, hidden_size}, options);
+  Tensor dwx =
+      torch::zeros({time_steps, batch_size, hidden_size * 2}, options);
+  Tensor du = torch::empty({hidden_size * 2, hidden_size}, options);
+  Tensor dh0 = torch::empty({batch_size, hidden_size}, options);
+  TORCH_CHECK(!dh_t.defined() || dh_t.numel() == dh0.numel(),
+              "dh_final must have the shape of the initial state gradient");
 
-  AT_DISPATCH_FLOATING_TYPES(
-      wx.scalar_type(), "ligru_2_0_backward", ([&] {
+  const cudaStream_t stream = at::cuda::getCurrentCUDAStream().stream();
+  AT_DISPATCH_FLOATING_TYPES_AND2(
+      at::ScalarType::Half, at::ScalarType::BFloat16,
+      wx.scalar_type(), "ligru_2_0_packed_backward", ([&] {
+        using T = typename native_type<scalar_t>::T;
+
+        layer_norm::BackwardPass<T> layer_norm1(
+            act_uh.size(0), hidden_size * 2, nullptr, nullptr,
+            ptr<scalar_t>(act_uh), nullptr, nullptr,
+            ptr<scalar_t>(act_uh_norm_cache));
 
-        layer_norm::BackwardPass<scalar_t> layer_norm1(
-            time_steps * batch_size, hidden_size * 2, nullptr,
-            nullptr, act_uh.data_ptr<scalar_t>(), nullptr, nullptr,
-            act_uh_norm_cache.data_ptr<scalar_t>());
-
-        layer_norm_ligru::BackwardPass<scalar_t> backward(
-            batch_size, input_size, hidden_size,
-            at::cuda::getCurrentCUDABlasHandle(),
-            activation,
-            at::cuda::getCurrentCUDAStream());
-
-        backward.Run(time_steps, wx.data_ptr<scalar_t>(),
-                     u.data_ptr<scalar_t>(), h.data_ptr<scalar_t>(),
-                     cache.data_ptr<scalar_t>(), grad_out.data_ptr<scalar_t>(),
-                     tmp_dwx.data_ptr<scalar_t>(), dwx.data_ptr<scalar_t>(),
-                     du.data_ptr<scalar_t>(), dh.data_ptr<scalar_t>(),
-                     layer_norm1);
+        using Pass = layer_norm_ligru::BackwardPass<T>;
+        Tensor workspace = cached_workspace(
+            Pass::GetWorkspaceSize(time_steps, batch_size, hidden_size, true),
+            options);
+        auto &backward = cached_pass<Pass>(
+            batch_size, 0, hidden_size,
+            at::cuda::getCurrentCUDABlasHandle(), activation, stream);
+
+        backward.SetZoneout(zoneout_params);
+        backward.SetStateGradient(ptr_or_null<scalar_t>(dh_t),
+                                  ptr<scalar_t>(dh0));
+        backward.RunPacked(time_steps, sizes.data(), ptr<scalar_t>(wx),
+                           ptr<scalar_t>(u), ptr<scalar_t>(h),
+                           ptr<scalar_t>(cache), ptr<scalar_t>(grad_out),
+                           ptr<scalar_t>(dwx), ptr<scalar_t>(du),
+                           workspace.data_ptr(), layer_norm1);
+        backward.SetZoneout(haste::v0::Zoneout());
+        backward.SetStateGradient(nullptr, nullptr);
       }));
 
-  return {du, dwx, tmp_dwx};
+  return {du, dwx, dh0};
 }
+
+std::vector<Tensor> ligru_2_0_stack_forward(const Tensor &x,
+                                            const std::vector<Tensor> &ws,
+                                            const std::vector<Tensor> &bs,
+                                            const std::vector<Tensor> &us,
+                                            const Tensor &h_init,
+                                            const int activation,
+                                            const int64_t chunk_size) {
+  const auto seq_length = x.size(0);
+  const auto batch_size = x.size(1);
+  const auto hidden_size = h_init.size(2);
+  const auto options = x.options();
+
+  TORCH_CHECK(us.size() == ws.size(), "expected one u per layer");
+
+  std::vector<Tensor> act_uh_norm_cache;
+  for (const auto &u : us) {
+    CHECK_INPUT(u);
+    act_uh_norm_cache.push_back(torch::empty({seq_length, batch_size, 2},
+                                             options.device(u.device())));
+  }
+
+  std::vector<Tensor> result;
+  AT_DISPATCH_FLOATING_TYPES_AND2(
+      at::ScalarType::Half, at::ScalarType::BFloat16,
+      x.scalar_type(), "ligru_2_0_stack_forward", ([&] {
+        using T = typename native_type<scalar_t>::T;
+
+        std::vector<layer_norm::ForwardPass<T>> layer_norms;
+        for (auto &cache : act_uh_norm_cache)
+          layer_norms.emplace_back(seq_length * batch_size, hidden_size * 2,
+                                   nullptr, nullptr,
+                                   ptr<scalar_t>(cache));
+
+        result = stack_forward(
+            x, ws, bs, h_init, chunk_size,
+            [&](const int64_t l, const Tensor &wx, const Tensor &b,
+                const Tensor &h, const cudaStream_t &stream) {
+              using Pass = layer_norm_ligru::ForwardPass<T>;
+              // One workspace per layer stream, as in the Li-GRU stack.
+              Tensor workspace = cached_workspace(
+                  Pass::GetWorkspaceSize(wx.size(0), batch_size, hidden_size,
+                                         false),
+                  options);
+              auto &forward = cached_pass<Pass>(
+                  false, batch_size, 0, hidden_size,
+                  at::cuda::getCurrentCUDABlasHandle(), activation, stream);
+
+              forward.SetBias(ptr_or_null<scalar_t>(b));
+              forward.Run(wx.size(0), ptr<scalar_t>(wx), ptr<scalar_t>(us[l]),
+                          ptr<scalar_t>(h), nullptr, layer_norms[l], nullptr,
+                          workspace.data_ptr());
+              forward.SetBias(nullptr);
+            });
+      }));
+
+  return result;
+}
+StreamingSession ligru_2_0_streaming_session(const std::vector<Tensor> &ws,
+                                             const std::vector<Tensor> &bs,
+                                             const std::vector<Tensor> &us,
+                                             const int activation,
+                                             const int64_t num_slots) {
+  TORCH_CHECK(!us.empty() && us.size() == ws.size(),
+              "expected one u per layer");
+  for (const auto &u : us)
+    CHECK_INPUT(u);
+
+  return StreamingSession(
+      ws, bs, us[0].size(1), num_slots,
+      [us, activation](const int64_t l, const Tensor &wx, const Tensor &b,
+                       const Tensor &h, const Tensor &table,
+                       const Tensor &slots, const cudaStream_t &stream) {
+        const auto seq_length = wx.size(0);
+        const auto batch_size = wx.size(1);
+        const auto hidden_size = h.size(2);
+        const auto options = wx.options();
+        Tensor act_uh_norm_cache =
+            torch::empty({seq_length, batch_size, 2}, options);
+
+        AT_DISPATCH_FLOATING_TYPES_AND2(
+            at::ScalarType::Half, at::ScalarType::BFloat16,
+            wx.scalar_type(), "ligru_2_0_streaming_step", ([&] {
+              using T = typename native_type<scalar_t>::T;
+
+              layer_norm::ForwardPass<T> layer_norm1(
+                  seq_length * batch_size, hidden_size * 2, nullptr, nullptr,
+                  ptr<scalar_t>(act_uh_norm_cache));
+
+              using Pass = layer_norm_ligru::ForwardPass<T>;
+              Tensor workspace = cached_workspace(
+                  Pass::GetWorkspaceSize(seq_length, batch_size, hidden_size,
+                                         false),
+                  options);
+              auto &forward = cached_pass<Pass>(
+                  false, batch_size, 0, hidden_size,
+                  at::cuda::getCurrentCUDABlasHandle(), activation, stream);
+
+              forward.SetBias(ptr_or_null<scalar_t>(b));
+              forward.RunIndexed(
+                  seq_length, ptr<scalar_t>(wx), ptr<scalar_t>(us[l]),
+                  ptr<scalar_t>(h), nullptr, layer_norm1, nullptr,
+                  workspace.data_ptr(), ptr<scalar_t>(table),
+                  slots.data_ptr<int>());
+              forward.SetBias(nullptr);
+            }));
+      });
+}
+
 } // anonymous namespace
 
 void ligru_2_0_init(py::module &m) {
   m.def("ligru_2_0_forward", &ligru_2_0_forward, "Li-GRU 2.0 forward",
         py::call_guard<py::gil_scoped_release>());
+  m.def("ligru_2_0_forward_final", &ligru_2_0_forward_final,
+        "Li-GRU 2.0 inference keeping only the final hidden state",
+        py::call_guard<py::gil_scoped_release>());
+  m.def("ligru_2_0_quantized_forward", &ligru_2_0_quantized_forward,
+        "Li-GRU 2.0 inference with a quantized recurrent weight",
+        py::call_guard<py::gil_scoped_release>());
+  m.def("ligru_2_0_grouped_forward", &ligru_2_0_grouped_forward,
+        "Li-GRU 2.0 inference over several layers of the same shape",
+        py::call_guard<py::gil_scoped_release>());
   m.def("ligru_2_0_backward", &ligru_2_0_backward, "Li-GRU 2.0 backward",
         py::call_guard<py::gil_scoped_release>());
+  m.def("ligru_2_0_recompute_backward", &ligru_2_0_recompute_backward,
+        "Li-GRU 2.0 backward recomputing the gates from the hidden states",
+        py::call_guard<py::gil_scoped_release>());
+  m.def("ligru_2_0_packed_forward", &ligru_2_0_packed_forward,
+        "Li-GRU 2.0 forward over variable-length sequences",
+        py::call_guard<py::gil_scoped_release>());
+  m.def("ligru_2_0_packed_backward", &ligru_2_0_packed_backward,
+        "Li-GRU 2.0 backward over variable-length sequences",
+        py::call_guard<py::gil_scoped_release>());
+  m.def("ligru_2_0_stack_forward", &ligru_2_0_stack_forward,
+        "Li-GRU 2.0 multi-layer wavefront inference",
+        py::call_guard<py::gil_scoped_release>());
+  m.def("ligru_2_0_streaming_session", &ligru_2_0_streaming_session,
+        "Creates a Li-GRU 2.0 streaming inference session");
 }
@@ -0,0 +1,147 @@
+// Copyright 2022 Adel Moumen
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#pragma once
+
+#include <ATen/cuda/CUDAContext.h>
+#include <ATen/cuda/CUDAEvent.h>
+#include <c10/cuda/CUDAGuard.h>
+#include <algorithm>
+#include <torch/extension.h>
+#include <vector>
+
+#include "support.h"
+
+// Runs a stack of recurrent layers in inference mode as a wavefront over
+// chunks of `chunk_size` time steps. Each layer owns a stream: it projects
+// chunk `c` of the layer below with its input GEMM as soon as that chunk is
+// available and runs its recurrence on it, so chunk `c` of layer `l` overlaps
+// with chunk `c + 1` of layer `l - 1` and the stack takes roughly `L + T`
+// instead of `L * T` step times.
+//
+// x: [T,B,F] time-major input.
+// ws: per layer input projection [2H,F_l] (batch norm already folded in), on
+//   the device the layer runs on.
+// bs: per layer bias [2H], or an undefined tensor for none.
+// h_init: [L,B,H] initial hidden states.
+// run_layer(l, wx, b, h, stream): runs layer `l` over the [k,B,2H] projected
+//   chunk `wx` plus the bias `b` (`bs[l]`, which the projection leaves out so
+//   that the recurrence kernels add it) on `stream`, reading the state in
+//   `h[0]` and writing the k following slots of `h`.
+//
+// Returns the [T,B,H] output of the last layer and the [L,B,H] final states,
+// both on the device of `x`.
+template <typename RunLayer>
+std::vector<torch::Tensor>
+stack_forward(const torch::Tensor &x, const std::vector<torch::Tensor> &ws,
+              const std::vector<torch::Tensor> &bs, const torch::Tensor &h_init,
+              const int64_t chunk_size, const RunLayer &run_layer) {
+  const auto seq_length = x.size(0);
+  const auto batch_size = x.size(1);
+  const auto num_layers = static_cast<int64_t>(ws.size());
+  const auto hidden_size = h_init.size(2);
+
+  CHECK_INPUT(x);
+  CHECK_INPUT(h_init);
+  TORCH_CHECK(bs.size() == ws.size(), "expected one bias per layer");
+  TORCH_CHECK(h_init.size(0) == num_layers,
+              "h_init must hold one state per layer");
+  TORCH_CHECK(chunk_size > 0, "chunk_size must be positive");
+
+  const auto options = x.options();
+  const at::cuda::CUDAGuard guard(options.device_index());
+  const at::cuda::CUDAStream caller_stream = at::cuda::getCurrentCUDAStream();
+
+  // Layer `l` runs on the device of `ws[l]`. When the layer below (or `x`)
+  // lives on another device, each of its chunks is first copied peer to peer
+  // into `staging[l]`; this is what lets a stack spread over several GPUs
+  // pipeline its layers across them. The stack only runs inference, so
+  // training over several GPUs is not pipelined.
+  std::vector<torch::Tensor> outputs;
+  std::vector<torch::Tensor> wx;
+  std::vector<torch::Tensor> staging;
+  std::vector<at::cuda::CUDAStream> streams;
+  std::vector<c10::DeviceIndex> devices{options.device_index()};
+  for (int64_t l = 0; l < num_layers; ++l) {
+    CHECK_INPUT(ws[l]);
+    const auto device = ws[l].device();
+    const auto input_device = l == 0 ? x.device() : ws[l - 1].device();
+    const auto layer_options = options.device(device);
+    outputs.push_back(torch::empty({seq_length + 1, batch_size, hidden_size},
+                                   layer_options));
+    outputs[l][0] = h_init[l];
+    wx.push_back(
+        torch::empty({chunk_size, batch_size, hidden_size * 2}, layer_options));
+    staging.push_back(
+        device == input_device
+            ? torch::Tensor()
+            : torch::empty({chunk_size, batch_size, ws[l].size(1)},
+                           layer_options));
+    streams.push_back(at::cuda::getStreamFromPool(false, device.index()));
+    if (std::find(devices.begin(), devices.end(), device.index()) ==
+        devices.end())
+      devices.push_back(device.index());
+  }
+
+  at::cuda::CUDAEvent ready;
+  ready.record(caller_stream);
+  for (auto &stream : streams)
+    ready.block(stream);
+
+  std::vector<at::cuda::CUDAEvent> chunk_done(num_layers);
+  for (int64_t begin = 0; begin < seq_length; begin += chunk_size) {
+    const auto steps = std::min(chunk_size, seq_length - begin);
+
+    for (int64_t l = 0; l < num_layers; ++l) {
+      const c10::cuda::CUDAStreamGuard stream_guard(streams[l]);
+      if (l > 0)
+        chunk_done[l - 1].block(streams[l]);
+
+      auto input = l == 0 ? x.narrow(0, begin, steps)
+                          : outputs[l - 1].narrow(0, begin + 1, steps);
+      if (staging[l].defined()) {
+        auto local = staging[l].narrow(0, 0, steps);
+        cudaMemcpyPeerAsync(local.data_ptr(), streams[l].device_index(),
+                            input.data_ptr(), input.get_device(),
+                            input.nbytes(), streams[l].stream());
+        input = local;
+      }
+      const auto input_2d = input.view({steps * batch_size, input.size(2)});
+      auto wx_2d = wx[l].narrow(0, 0, steps).view(
+          {steps * batch_size, hidden_size * 2});
+      at::mm_out(wx_2d, input_2d, ws[l].t());
+
+      run_layer(l, wx[l].narrow(0, 0, steps), bs[l],
+                outputs[l].narrow(0, begin, steps + 1), streams[l].stream());
+      chunk_done[l].record(streams[l]);
+    }
+  }
+
+  // Every buffer above was allocated on the current stream of its device and
+  // is read across devices, so all of those streams wait for every layer
+  // before the buffers can be released or copied back.
+  for (const auto device : devices) {
+    const at::cuda::CUDAStream current = at::cuda::getCurrentCUDAStream(device);
+    for (auto &event : chunk_done)
+      event.block(current);
+  }
+
+  std::vector<torch::Tensor> h_n;
+  for (auto &output : outputs)
+    h_n.push_back(output[seq_length].to(options.device()));
+
+  return {outputs.back().narrow(0, 1, seq_length).to(options.device()),
+          torch::stack(h_n)};
+}
@@ -0,0 +1,117 @@
+// Copyright 2022 Adel Moumen
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#include <ATen/cuda/CUDAContext.h>
+#include <c10/cuda/CUDAGuard.h>
+#include <vector>
+
+#include "streaming.h"
+#include "support.h"
+
+using torch::Tensor;
+
+StreamingSession::StreamingSession(const std::vector<Tensor> &ws,
+                                   const std::vector<Tensor> &bs,
+                                   const int64_t hidden_size,
+                                   const int64_t num_slots, RunLayer run_layer)
+    : ws_(ws), bs_(bs), run_layer_(std::move(run_layer)) {
+  TORCH_CHECK(!ws.empty(), "expected at least one layer");
+  TORCH_CHECK(bs.size() == ws.size(), "expected one bias per layer");
+  TORCH_CHECK(num_slots > 0, "num_slots must be positive");
+  for (const auto &w : ws) {
+    CHECK_INPUT(w);
+    TORCH_CHECK(w.size(0) == hidden_size * 2,
+                "expected [2H,F] input projections");
+  }
+
+  state_ = torch::zeros({static_cast<int64_t>(ws.size()), num_slots,
+                         hidden_size},
+                        ws[0].options());
+}
+
+Tensor StreamingSession::slot_index(const Tensor &slots,
+                                    const c10::ScalarType type) const {
+  TORCH_CHECK(slots.dim() == 1, "slots must be a 1-D index tensor");
+  TORCH_CHECK(slots.device().is_cpu(), "slots must be a CPU tensor");
+  // Staged from the host right away, so the copy need not block.
+  return slots.to(state_.device(), type, /*non_blocking=*/true);
+}
+
+Tensor StreamingSession::step(const Tensor &x, const Tensor &slots) {
+  const auto seq_length = x.size(0);
+  const auto batch_size = x.size(1);
+  const auto hidden_size = state_.size(2);
+
+  CHECK_INPUT(x);
+  TORCH_CHECK(slots.size(0) == batch_size, "expected one slot per sequence");
+  const at::cuda::CUDAGuard guard(x.device().index());
+  const cudaStream_t stream = at::cuda::getCurrentCUDAStream().stream();
+  const Tensor index = slot_index(slots, torch::kInt);
+
+  // The final states are scattered back to `slots`, so a duplicate would race
+  // with itself and leave its row of the table undefined. The slots are on
+  // the host, so this does not wait on the device.
+  const Tensor host_slots = slots.to(torch::kLong).contiguous();
+  const int64_t *slot = host_slots.data_ptr<int64_t>();
+  std::vector<bool> taken(state_.size(1), false);
+  for (int64_t b = 0; b < batch_size; ++b) {
+    TORCH_CHECK(slot[b] >= 0 && slot[b] < state_.size(1),
+                "slots must be in [0, num_slots)");
+    TORCH_CHECK(!taken[slot[b]], "slots must be distinct");
+    taken[slot[b]] = true;
+  }
+
+  const auto num_layers = static_cast<int64_t>(ws_.size());
+
+  Tensor input = x;
+  for (int64_t l = 0; l < num_layers; ++l) {
+    const auto input_2d = input.reshape({seq_length * batch_size, -1});
+    // The bias is added by the recurrence kernels.
+    const Tensor wx = at::mm(input_2d, ws_[l].t())
+                          .view({seq_length, batch_size, hidden_size * 2});
+
+    Tensor h = torch::empty({seq_length + 1, batch_size, hidden_size},
+                            state_.options());
+    run_layer_(l, wx, bs_[l], h, state_[l], index, stream);
+    input = h.narrow(0, 1, seq_length);
+  }
+
+  return input;
+}
+
+void StreamingSession::reset(const Tensor &slots) {
+  state_.index_fill_(1, slot_index(slots, torch::kLong), 0);
+}
+
+void StreamingSession::set_state(const Tensor &slots, const Tensor &h) {
+  TORCH_CHECK(h.dim() == 3 && h.size(0) == state_.size(0) &&
+                  h.size(2) == state_.size(2),
+              "expected a [L,B,H] state");
+  state_.index_copy_(1, slot_index(slots, torch::kLong),
+                     h.to(state_.options()));
+}
+
+void streaming_init(py::module &m) {
+  py::class_<StreamingSession>(m, "StreamingSession")
+      .def("step", &StreamingSession::step,
+           "Runs every layer over one [T,B,F] chunk of the streams in `slots`",
+           py::call_guard<py::gil_scoped_release>())
+      .def("reset", &StreamingSession::reset,
+           "Zeroes the hidden states of `slots`")
+      .def("set_state", &StreamingSession::set_state,
+           "Overwrites the hidden states of `slots`")
+      .def("state", &StreamingSession::state,
+           "Returns the [L,S,H] hidden state table");
+}
@@ -0,0 +1,75 @@
+// Copyright 2022 Adel Moumen
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#pragma once
+
+#include <cuda_runtime_api.h>
+#include <functional>
+#include <torch/extension.h>
+#include <vector>
+
+// Inference over a stack of recurrent layers fed one chunk at a time, for
+// many concurrent client streams. The session owns a [L,S,H] table of hidden
+// states resident on the device, one row per layer and slot. Each call to
+// `step` runs every layer over a [T,B,F] chunk whose batch entry `b` belongs
+// to slot `slots[b]`, starting from and updating the states of those slots,
+// so the streams batched together can change from one call to the next.
+//
+// A session is not thread-safe: calls on one session must be serialized.
+class StreamingSession {
+public:
+  // run_layer(l, wx, b, h, table, slots, stream): runs layer `l` over the
+  //   [T,B,2H] projected chunk `wx` plus its bias `b` (undefined for none) on
+  //   `stream` and writes its outputs to the [T+1,B,H] buffer `h`. The
+  //   initial state of batch entry `b` is row `slots[b]` of the layer's [S,H]
+  //   state `table`, and its final state is written back there.
+  using RunLayer = std::function<void(
+      const int64_t, const torch::Tensor &, const torch::Tensor &,
+      const torch::Tensor &, const torch::Tensor &, const torch::Tensor &,
+      const cudaStream_t &)>;
+
+  // ws: per layer input projection [2H,F_l] (batch norm already folded in).
+  // bs: per layer bias [2H], or an undefined tensor for none.
+  StreamingSession(const std::vector<torch::Tensor> &ws,
+                   const std::vector<torch::Tensor> &bs,
+                   const int64_t hidden_size, const int64_t num_slots,
+                   RunLayer run_layer);
+
+  // x: [T,B,F] time-major chunk; slots: [B] distinct slot indices, on the
+  // CPU like every `slots` argument, so that they are checked without a
+  // device sync.
+  // Returns the [T,B,H] output of the last layer.
+  torch::Tensor step(const torch::Tensor &x, const torch::Tensor &slots);
+
+  // Zeroes the states of `slots`, e.g. when a new client stream takes them.
+  void reset(const torch::Tensor &slots);
+
+  // Overwrites the states of `slots` with the [L,B,H] tensor `h`.
+  void set_state(const torch::Tensor &slots, const torch::Tensor &h);
+
+  // Returns the [L,S,H] state table.
+  torch::Tensor state() const { return state_; }
+
+private:
+  torch::Tensor slot_index(const torch::Tensor &slots,
+                           const c10::ScalarType type) const;
+
+  std::vector<torch::Tensor> ws_;
+  std::vector<torch::Tensor> bs_;
+  RunLayer run_layer_;
+  torch::Tensor state_;
+};
+
+void streaming_init(py::module &m);
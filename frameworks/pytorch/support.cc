@@ -17,10 +17,25 @@
 
 #include <torch/extension.h>
 
+#include "graph_cache.h"
+#include "scheduler.h"
+#include "streaming.h"
+
 void ligru_1_0_init(py::module &);
 void ligru_2_0_init(py::module &);
+void cpu_init(py::module &);
+void profiler_init(py::module &);
+void autotune_init(py::module &);
+void l2_persistence_init(py::module &);
 
 PYBIND11_MODULE(TORCH_EXTENSION_NAME, m) {
   ligru_2_0_init(m);
   ligru_1_0_init(m);
+  graph_cache_init(m);
+  streaming_init(m);
+  scheduler_init(m);
+  cpu_init(m);
+  profiler_init(m);
+  autotune_init(m);
+  l2_persistence_init(m);
 }
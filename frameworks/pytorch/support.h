@@ -18,7 +18,18 @@
 
 #pragma once
 
+#include <ATen/cuda/CUDAContext.h>
+#include <cstdint>
+#include <cstring>
+#include <cuda_bf16.h>
+#include <cuda_fp16.h>
+#include <map>
 #include <torch/extension.h>
+#include <utility>
+#include <vector>
+
+#include "quantized_weight.h"
+#include "zoneout.h"
 
 #define CHECK_CUDA(x)                                                          \
   TORCH_CHECK(x.device().is_cuda(), #x " must be a CUDA tensor")
@@ -27,11 +38,135 @@
 #define CHECK_INPUT(x)                                                         \
   CHECK_CUDA(x);                                                               \
   CHECK_CONTIGUOUS(x)
+#define CHECK_CPU_INPUT(x)                                                     \
+  TORCH_CHECK(x.device().is_cpu(), #x " must be a CPU tensor");                \
+  CHECK_CONTIGUOUS(x)
 
 template <typename U> struct native_type { using T = U; };
 
 template <> struct native_type<c10::Half> { using T = __half; };
 
+template <> struct native_type<c10::BFloat16> { using T = __nv_bfloat16; };
+
 template <typename U> typename native_type<U>::T *ptr(torch::Tensor t) {
   return reinterpret_cast<typename native_type<U>::T *>(t.data_ptr<U>());
 }
+
+// Same as `ptr`, but maps an undefined tensor (an absent optional input) to a
+// null pointer.
+template <typename U>
+typename native_type<U>::T *ptr_or_null(const torch::Tensor &t) {
+  return t.defined() ? ptr<U>(t) : nullptr;
+}
+
+// Zoneout of a binding call: `prob` is 0 to disable it, and the masks are
+// drawn from `seed` when `sample` is set (see `haste::v0::Zoneout`).
+inline haste::v0::Zoneout make_zoneout(const double prob, const bool sample,
+                                       const int64_t seed) {
+  TORCH_CHECK(prob >= 0.0 && prob < 1.0, "zoneout must be in [0, 1)");
+  haste::v0::Zoneout zoneout;
+  zoneout.prob = static_cast<float>(prob);
+  zoneout.sample = sample && prob > 0.0;
+  zoneout.seed = static_cast<unsigned long long>(seed);
+  return zoneout;
+}
+
+// Quantized recurrent weight of a binding call: `data` is the `[2H, H]`
+// weight stored one byte per element (int8 for `format` 0, the bytes of an
+// fp8 e4m3 tensor for 1) and `scale` its `[2H]` fp32 per-channel scales.
+inline haste::v0::QuantizedWeight
+make_quantized_weight(const torch::Tensor &data, const torch::Tensor &scale,
+                      const int64_t format, const int64_t hidden_size) {
+  CHECK_INPUT(data);
+  CHECK_INPUT(scale);
+  TORCH_CHECK(format == 0 || format == 1,
+              "format must be 0 (int8) or 1 (fp8 e4m3)");
+  TORCH_CHECK(format == 0 || haste::v0::kFp8WeightsSupported,
+              "fp8 weights need a build against CUDA 11.8 or later");
+  TORCH_CHECK(data.element_size() == 1 && data.dim() == 2 &&
+                  data.size(0) == hidden_size * 2 &&
+                  data.size(1) == hidden_size,
+              "expected a [2H, H] one-byte quantized weight");
+  TORCH_CHECK(scale.scalar_type() == torch::kFloat &&
+                  scale.numel() == hidden_size * 2,
+              "expected [2H] fp32 per-channel scales");
+  haste::v0::QuantizedWeight weight;
+  weight.format = static_cast<haste::v0::WeightFormat>(format);
+  weight.data = data.data_ptr();
+  weight.scale = scale.data_ptr<float>();
+  return weight;
+}
+
+// Appends the zoneout parameters to the `run_with_graph` pointers of a call.
+// They are kernel arguments, so a cached graph has to be re-captured when
+// they change, exactly as when a data pointer does.
+inline std::vector<const void *>
+with_zoneout(std::vector<const void *> pointers,
+             const haste::v0::Zoneout &zoneout) {
+  uint32_t prob_bits;
+  std::memcpy(&prob_bits, &zoneout.prob, sizeof(prob_bits));
+  const uint64_t mode = static_cast<uint64_t>(zoneout.sample) << 32 | prob_bits;
+  for (const uint64_t value : {mode, uint64_t{zoneout.seed},
+                               uint64_t{zoneout.offset}})
+    pointers.push_back(
+        reinterpret_cast<const void *>(static_cast<uintptr_t>(value)));
+  return pointers;
+}
+
+// Writes the initial states of a bidirectional layer into the first and last
+// slots of its [T+2,B,2H] output. `h_init` is either [1,H], shared by every
+// sequence and both directions, or [2B,H] with the forward states first.
+inline void init_bidirectional_state(torch::Tensor &output,
+                                     const torch::Tensor &h_init) {
+  const auto batch_size = output.size(1);
+  const auto hidden_size = output.size(2) / 2;
+  const auto h = h_init.expand({batch_size * 2, hidden_size})
+                     .reshape({2, batch_size, hidden_size})
+                     .permute({1, 0, 2})
+                     .reshape({batch_size, hidden_size * 2});
+  output[0] = h;
+  output[output.size(0) - 1] = h;
+}
+
+// Copies the per-step batch sizes of a packed batch, a CPU int64 tensor laid
+// out like `PackedSequence.batch_sizes`, to the host array the packed passes
+// read, checking that they never grow and stay within `batch_size`.
+inline std::vector<int> packed_batch_sizes(const torch::Tensor &batch_sizes,
+                                           const int64_t seq_length,
+                                           const int64_t batch_size) {
+  TORCH_CHECK(!batch_sizes.device().is_cuda() &&
+                  batch_sizes.scalar_type() == torch::kLong,
+              "batch_sizes must be a CPU int64 tensor");
+  TORCH_CHECK(batch_sizes.numel() == seq_length,
+              "expected one batch size per time step");
+
+  const auto sizes = batch_sizes.contiguous();
+  const int64_t *data = sizes.data_ptr<int64_t>();
+  std::vector<int> result(data, data + seq_length);
+  for (int64_t i = 0; i < seq_length; ++i) {
+    TORCH_CHECK(result[i] > 0 && result[i] <= batch_size &&
+                    (i == 0 || result[i] <= result[i - 1]),
+                "batch_sizes must be non-increasing and within [1, ",
+                batch_size, "]");
+  }
+  return result;
+}
+
+// Returns a byte buffer of at least `bytes` for the `workspace` of a pass
+// (see `GetWorkspaceSize`). The buffer is kept per thread, device and current
+// stream and only reallocated when a larger one is asked for, so steady-state
+// calls make no allocation for the temporaries; work ordered on one stream
+// never uses it concurrently.
+inline torch::Tensor cached_workspace(const size_t bytes,
+                                      const torch::TensorOptions &options) {
+  using Key = std::pair<int, cudaStream_t>;
+  thread_local std::map<Key, torch::Tensor> workspaces;
+
+  const Key key(options.device_index(),
+                at::cuda::getCurrentCUDAStream().stream());
+  torch::Tensor &workspace = workspaces[key];
+  if (!workspace.defined() || static_cast<size_t>(workspace.numel()) < bytes)
+    workspace = torch::empty({static_cast<int64_t>(bytes)},
+                             options.dtype(torch::kByte));
+  return workspace;
+}
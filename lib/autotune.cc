@@ -0,0 +1,458 @@
+// Copyright 2022 Adel Moumen. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#include <atomic>
+#include <cublasLt.h>
+#include <cublas_v2.h>
+#include <cuda_bf16.h>
+#include <cuda_fp16.h>
+#include <cuda_runtime_api.h>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "autotune.h"
+#include "blas.h"
+
+namespace haste {
+namespace v0 {
+namespace autotune {
+
+struct GemmPlan {
+  cublasLtHandle_t handle;
+  cublasLtMatmulDesc_t desc;
+  cublasLtMatrixLayout_t a;
+  cublasLtMatrixLayout_t b;
+  cublasLtMatrixLayout_t c;
+  cublasLtMatmulAlgo_t algo;
+};
+
+} // namespace autotune
+} // namespace v0
+} // namespace haste
+
+namespace {
+
+using haste::v0::autotune::GemmPlan;
+using haste::v0::autotune::Key;
+
+constexpr int kFileVersion = 1;
+constexpr int kRepeats = 10;
+constexpr int kMaxDevices = 64;
+// cuBLASLt heuristics tried per GEMM shape, and the split-K factors tried on
+// the best of them when the product has at most `kSplitKMaxColumns` columns
+// (the batch of a per-step product), too few to fill the device otherwise.
+constexpr int kHeuristics = 8;
+constexpr int kSplitKMaxColumns = 64;
+constexpr int kSplitK[] = {2, 4, 8};
+
+template <typename T> struct lt_type;
+
+template <> struct lt_type<float> {
+  using scale_t = float;
+  static constexpr cudaDataType_t data = CUDA_R_32F;
+  static constexpr cudaDataType_t scale = CUDA_R_32F;
+  static constexpr cublasComputeType_t compute = CUBLAS_COMPUTE_32F;
+};
+
+template <> struct lt_type<double> {
+  using scale_t = double;
+  static constexpr cudaDataType_t data = CUDA_R_64F;
+  static constexpr cudaDataType_t scale = CUDA_R_64F;
+  static constexpr cublasComputeType_t compute = CUBLAS_COMPUTE_64F;
+};
+
+template <> struct lt_type<__half> {
+  using scale_t = float;
+  static constexpr cudaDataType_t data = CUDA_R_16F;
+  static constexpr cudaDataType_t scale = CUDA_R_32F;
+  static constexpr cublasComputeType_t compute = CUBLAS_COMPUTE_32F;
+};
+
+template <> struct lt_type<__nv_bfloat16> {
+  using scale_t = float;
+  static constexpr cudaDataType_t data = CUDA_R_16BF;
+  static constexpr cudaDataType_t scale = CUDA_R_32F;
+  static constexpr cublasComputeType_t compute = CUBLAS_COMPUTE_32F;
+};
+
+struct Registry {
+  std::mutex mutex;
+  std::string path;
+  std::map<Key, int> choices;
+  // Per device, since each plan holds that device's cuBLASLt handle; the
+  // choices they are tuned to are shared by every device of an architecture.
+  // Null plans stand for shapes the cuBLAS default won.
+  std::map<std::pair<int, Key>, std::unique_ptr<GemmPlan>> plans;
+  std::map<int, cublasLtHandle_t> lt_handles;
+  std::map<int, cublasHandle_t> blas_handles;
+};
+
+// Never destroyed: plans may still be used from static destructors.
+Registry &registry() {
+  static Registry *instance = new Registry;
+  return *instance;
+}
+
+std::atomic<bool> tuning_enabled(false);
+std::atomic<int> device_arch[kMaxDevices];
+
+std::string FileHeader() {
+  std::ostringstream header;
+  header << "fast_ligru-autotune " << kFileVersion << " " << cublasLtGetVersion();
+  return header.str();
+}
+
+// Loads the choices of `path` into `r`, or starts a new file there when it
+// is missing or was written by another version. Called with `r.mutex` held.
+void LoadFile(Registry &r, const std::string &path) {
+  std::ifstream in(path);
+  std::string header;
+  if (in && std::getline(in, header) && header == FileHeader()) {
+    std::string line;
+    while (std::getline(in, line)) {
+      std::istringstream fields(line);
+      Key key;
+      int choice;
+      bool valid = true;
+      for (int &value : key)
+        valid = valid && static_cast<bool>(fields >> value);
+      if (valid && fields >> choice)
+        r.choices.emplace(key, choice);
+    }
+    return;
+  }
+  std::ofstream out(path, std::ios::trunc);
+  out << FileHeader() << "\n";
+}
+
+// Called with `r.mutex` held.
+void AppendFile(const Registry &r, const Key &key, const int choice) {
+  if (r.path.empty())
+    return;
+  std::ofstream out(r.path, std::ios::app);
+  for (const int value : key)
+    out << value << " ";
+  out << choice << "\n";
+}
+
+bool Capturing(const cudaStream_t &stream) {
+  cudaStreamCaptureStatus capture;
+  if (cudaStreamIsCapturing(stream, &capture) != cudaSuccess) {
+    cudaGetLastError();
+    return true;
+  }
+  return capture != cudaStreamCaptureStatusNone;
+}
+
+// Per-device handles used to tune and run the plans. Called with `r.mutex`
+// held.
+template <typename Handle>
+Handle DeviceHandle(std::map<int, Handle> &handles,
+                    cublasStatus_t (*create)(Handle *)) {
+  int device;
+  cudaGetDevice(&device);
+  auto it = handles.find(device);
+  if (it != handles.end())
+    return it->second;
+  Handle handle = nullptr;
+  if (create(&handle) != CUBLAS_STATUS_SUCCESS)
+    handle = nullptr;
+  handles[device] = handle;
+  return handle;
+}
+
+void DestroyPlan(GemmPlan &plan) {
+  cublasLtMatrixLayoutDestroy(plan.c);
+  cublasLtMatrixLayoutDestroy(plan.b);
+  cublasLtMatrixLayoutDestroy(plan.a);
+  cublasLtMatmulDescDestroy(plan.desc);
+}
+
+// The cuBLASLt candidates of `plan`'s shape: the heuristics, then split-K
+// variants of the first one for narrow products. None needs a workspace.
+std::vector<cublasLtMatmulAlgo_t> LtCandidates(const GemmPlan &plan,
+                                               const int n) {
+  std::vector<cublasLtMatmulAlgo_t> algos;
+
+  cublasLtMatmulPreference_t preference;
+  if (cublasLtMatmulPreferenceCreate(&preference) != CUBLAS_STATUS_SUCCESS)
+    return algos;
+  const size_t workspace_size = 0;
+  cublasLtMatmulPreferenceSetAttribute(
+      preference, CUBLASLT_MATMUL_PREF_MAX_WORKSPACE_BYTES, &workspace_size,
+      sizeof(workspace_size));
+
+  cublasLtMatmulHeuristicResult_t results[kHeuristics];
+  int count = 0;
+  if (cublasLtMatmulAlgoGetHeuristic(plan.handle, plan.desc, plan.a, plan.b,
+                                     plan.c, plan.c, preference, kHeuristics,
+                                     results, &count) != CUBLAS_STATUS_SUCCESS)
+    count = 0;
+  cublasLtMatmulPreferenceDestroy(preference);
+
+  for (int i = 0; i < count; ++i) {
+    if (results[i].state == CUBLAS_STATUS_SUCCESS)
+      algos.push_back(results[i].algo);
+  }
+  if (algos.empty() || n > kSplitKMaxColumns)
+    return algos;
+
+  const cublasLtMatmulAlgo_t base = algos.front();
+  for (const int split : kSplitK) {
+    cublasLtMatmulAlgo_t algo = base;
+    const int32_t splits = split;
+    const uint32_t scheme = CUBLASLT_REDUCTION_SCHEME_INPLACE;
+    cublasLtMatmulAlgoConfigSetAttribute(
+        &algo, CUBLASLT_ALGO_CONFIG_SPLITK_NUM, &splits, sizeof(splits));
+    cublasLtMatmulAlgoConfigSetAttribute(
+        &algo, CUBLASLT_ALGO_CONFIG_REDUCTION_SCHEME, &scheme, sizeof(scheme));
+    cublasLtMatmulHeuristicResult_t check;
+    if (cublasLtMatmulAlgoCheck(plan.handle, plan.desc, plan.a, plan.b, plan.c,
+                                plan.c, &algo,
+                                &check) == CUBLAS_STATUS_SUCCESS &&
+        check.workspaceSize == 0)
+      algos.push_back(algo);
+  }
+  return algos;
+}
+
+} // anonymous namespace
+
+namespace haste {
+namespace v0 {
+namespace autotune {
+
+void Configure(const bool enabled, const std::string &path) {
+  Registry &r = registry();
+  {
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.path = path;
+    if (!path.empty())
+      LoadFile(r, path);
+  }
+  tuning_enabled = enabled;
+}
+
+bool Enabled() { return tuning_enabled.load(std::memory_order_relaxed); }
+
+int DeviceArch() {
+  int device = 0;
+  cudaGetDevice(&device);
+  if (device < 0 || device >= kMaxDevices)
+    return 0;
+  int arch = device_arch[device].load(std::memory_order_relaxed);
+  if (arch == 0) {
+    int major = 0, minor = 0;
+    cudaDeviceGetAttribute(&major, cudaDevAttrComputeCapabilityMajor, device);
+    cudaDeviceGetAttribute(&minor, cudaDevAttrComputeCapabilityMinor, device);
+    arch = major * 10 + minor;
+    device_arch[device].store(arch, std::memory_order_relaxed);
+  }
+  return arch;
+}
+
+int Select(const Key &key, const int count,
+           const std::function<bool(int)> &run, const cudaStream_t &stream) {
+  if (!Enabled() || count <= 1)
+    return 0;
+
+  Registry &r = registry();
+  {
+    std::lock_guard<std::mutex> lock(r.mutex);
+    const auto it = r.choices.find(key);
+    if (it != r.choices.end())
+      return it->second < count ? it->second : 0;
+  }
+  if (Capturing(stream))
+    return 0;
+
+  // The first run of each candidate checks that it can run and warms it up;
+  // the lock is not held meanwhile, since candidates may select their own
+  // choices.
+  cudaEvent_t start, stop;
+  cudaEventCreate(&start);
+  cudaEventCreate(&stop);
+  int best = 0;
+  float best_ms = std::numeric_limits<float>::infinity();
+  for (int i = 0; i < count; ++i) {
+    if (!run(i) || cudaGetLastError() != cudaSuccess)
+      continue;
+    cudaEventRecord(start, stream);
+    for (int repeat = 0; repeat < kRepeats; ++repeat)
+      run(i);
+    cudaEventRecord(stop, stream);
+    float ms;
+    if (cudaEventSynchronize(stop) != cudaSuccess ||
+        cudaEventElapsedTime(&ms, start, stop) != cudaSuccess) {
+      cudaGetLastError();
+      continue;
+    }
+    if (ms < best_ms) {
+      best_ms = ms;
+      best = i;
+    }
+  }
+  cudaEventDestroy(stop);
+  cudaEventDestroy(start);
+
+  std::lock_guard<std::mutex> lock(r.mutex);
+  if (r.choices.emplace(key, best).second)
+    AppendFile(r, key, best);
+  return r.choices[key];
+}
+
+template <typename T>
+const GemmPlan *PlanGemm(const cublasOperation_t transa,
+                         const cublasOperation_t transb, const int m,
+                         const int n, const int k, const int lda,
+                         const int ldb, const int ldc,
+                         const cudaStream_t &stream) {
+  if (!Enabled())
+    return nullptr;
+
+  const Key key = {kGemm, type_code<T>(), DeviceArch(), transa, transb, m, n,
+                   k,     lda,          ldb,          ldc};
+  int device = 0;
+  cudaGetDevice(&device);
+  const std::pair<int, Key> plan_key(device, key);
+  Registry &r = registry();
+  GemmPlan plan;
+  cublasHandle_t blas_handle;
+  {
+    std::lock_guard<std::mutex> lock(r.mutex);
+    const auto it = r.plans.find(plan_key);
+    if (it != r.plans.end())
+      return it->second.get();
+    plan.handle = DeviceHandle(r.lt_handles, &cublasLtCreate);
+    blas_handle = DeviceHandle(r.blas_handles, &cublasCreate);
+  }
+  // Tuning allocates scratch operands, which a graph capture forbids; the
+  // shape is planned by the first call outside one.
+  if (!plan.handle || !blas_handle || Capturing(stream))
+    return nullptr;
+
+  const int a_rows = transa == CUBLAS_OP_N ? m : k;
+  const int a_cols = transa == CUBLAS_OP_N ? k : m;
+  const int b_rows = transb == CUBLAS_OP_N ? k : n;
+  const int b_cols = transb == CUBLAS_OP_N ? n : k;
+  const int32_t op_a = transa;
+  const int32_t op_b = transb;
+  cublasLtMatmulDescCreate(&plan.desc, lt_type<T>::compute,
+                           lt_type<T>::scale);
+  cublasLtMatmulDescSetAttribute(plan.desc, CUBLASLT_MATMUL_DESC_TRANSA, &op_a,
+                                 sizeof(op_a));
+  cublasLtMatmulDescSetAttribute(plan.desc, CUBLASLT_MATMUL_DESC_TRANSB, &op_b,
+                                 sizeof(op_b));
+  cublasLtMatrixLayoutCreate(&plan.a, lt_type<T>::data, a_rows, a_cols, lda);
+  cublasLtMatrixLayoutCreate(&plan.b, lt_type<T>::data, b_rows, b_cols, ldb);
+  cublasLtMatrixLayoutCreate(&plan.c, lt_type<T>::data, m, n, ldc);
+  const std::vector<cublasLtMatmulAlgo_t> algos = LtCandidates(plan, n);
+
+  // Candidate 0 is the cuBLAS default, candidate `i` the algorithm
+  // `algos[i - 1]`, all timed on zeroed operands of the planned shape.
+  T *a = nullptr, *b = nullptr, *c = nullptr;
+  int choice = 0;
+  if (cudaMalloc(&a, sizeof(T) * lda * a_cols) == cudaSuccess &&
+      cudaMalloc(&b, sizeof(T) * ldb * b_cols) == cudaSuccess &&
+      cudaMalloc(&c, sizeof(T) * ldc * n) == cudaSuccess) {
+    cudaMemsetAsync(a, 0, sizeof(T) * lda * a_cols, stream);
+    cudaMemsetAsync(b, 0, sizeof(T) * ldb * b_cols, stream);
+    cudaMemsetAsync(c, 0, sizeof(T) * ldc * n, stream);
+    cublasSetStream(blas_handle, stream);
+    const T one = static_cast<T>(1.0);
+    const T zero = static_cast<T>(0.0);
+    choice = Select(
+        key, 1 + static_cast<int>(algos.size()),
+        [&](const int i) {
+          if (i == 0)
+            return blas<T>::gemm(blas_handle, transa, transb, m, n, k, &one, a,
+                                 lda, b, ldb, &zero, c,
+                                 ldc) == CUBLAS_STATUS_SUCCESS;
+          plan.algo = algos[i - 1];
+          return gemm<T>(&plan, blas_handle, transa, transb, m, n, k, &one, a,
+                         lda, b, ldb, &zero, c,
+                         ldc) == CUBLAS_STATUS_SUCCESS;
+        },
+        stream);
+    cudaStreamSynchronize(stream);
+  } else {
+    cudaGetLastError();
+  }
+  cudaFree(c);
+  cudaFree(b);
+  cudaFree(a);
+
+  std::unique_ptr<GemmPlan> tuned;
+  if (choice > 0) {
+    plan.algo = algos[choice - 1];
+    tuned.reset(new GemmPlan(plan));
+  } else {
+    DestroyPlan(plan);
+  }
+
+  std::lock_guard<std::mutex> lock(r.mutex);
+  std::unique_ptr<GemmPlan> &slot = r.plans[plan_key];
+  if (!slot && tuned)
+    slot = std::move(tuned);
+  else if (tuned)
+    DestroyPlan(*tuned);
+  return slot.get();
+}
+
+template <typename T>
+cublasStatus_t gemm(const GemmPlan *plan, cublasHandle_t handle,
+                    cublasOperation_t transa, cublasOperation_t transb, int m,
+                    int n, int k, const T *alpha, const T *A, int lda,
+                    const T *B, int ldb, const T *beta, T *C, int ldc) {
+  if (!plan)
+    return blas<T>::gemm(handle, transa, transb, m, n, k, alpha, A, lda, B,
+                         ldb, beta, C, ldc);
+
+  using scale_t = typename lt_type<T>::scale_t;
+  const scale_t alpha_s = static_cast<scale_t>(*alpha);
+  const scale_t beta_s = static_cast<scale_t>(*beta);
+  cudaStream_t stream;
+  cublasGetStream(handle, &stream);
+  return cublasLtMatmul(plan->handle, plan->desc, &alpha_s, A, plan->a, B,
+                        plan->b, &beta_s, C, plan->c, C, plan->c, &plan->algo,
+                        nullptr, 0, stream);
+}
+
+#define INSTANTIATE(T)                                                         \
+  template const GemmPlan *PlanGemm<T>(                                        \
+      const cublasOperation_t, const cublasOperation_t, const int, const int,  \
+      const int, const int, const int, const int, const cudaStream_t &);       \
+  template cublasStatus_t gemm<T>(const GemmPlan *, cublasHandle_t,            \
+                                  cublasOperation_t, cublasOperation_t, int,   \
+                                  int, int, const T *, const T *, int,         \
+                                  const T *, int, const T *, T *, int);
+
+INSTANTIATE(float)
+INSTANTIATE(double)
+INSTANTIATE(__half)
+INSTANTIATE(__nv_bfloat16)
+
+#undef INSTANTIATE
+
+} // namespace autotune
+} // namespace v0
+} // namespace haste
@@ -0,0 +1,90 @@
+// Copyright 2022 Adel Moumen. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#pragma once
+
+#include <array>
+#include <cublas_v2.h>
+#include <cuda_bf16.h>
+#include <cuda_fp16.h>
+#include <cuda_runtime_api.h>
+#include <functional>
+#include <string>
+
+namespace haste {
+namespace v0 {
+namespace autotune {
+
+// What a tuned choice is about; the first entry of every `Key`.
+enum Kind { kGemm = 0, kPointwise = 1, kPersistent = 2 };
+
+// A tuned shape: its `Kind`, then the integers that identify it (sizes,
+// `type_code`, `DeviceArch`, ...), zero-padded.
+using Key = std::array<int, 12>;
+
+template <typename T> constexpr int type_code();
+template <> constexpr int type_code<float>() { return 0; }
+template <> constexpr int type_code<double>() { return 1; }
+template <> constexpr int type_code<__half>() { return 2; }
+template <> constexpr int type_code<__nv_bfloat16>() { return 3; }
+
+// Enables or disables tuning (disabled by default). When `path` is not
+// empty, the choices it holds are loaded and every new one is appended to
+// it, so later processes skip the tuning; a file written by another cuBLASLt
+// version is discarded.
+void Configure(const bool enabled, const std::string &path);
+
+bool Enabled();
+
+// Compute capability of the current device, `10 * major + minor`.
+int DeviceArch();
+
+// Returns the index of the fastest of `count` candidates for `key`. On first
+// use, each candidate is run through `run(i)` on `stream` — which returns
+// false when candidate `i` cannot run — and timed, and the winner is cached.
+// The candidates must be interchangeable: each produces the same results
+// from the same inputs. Returns 0 without tuning while disabled or while
+// `stream` is being captured into a graph.
+int Select(const Key &key, const int count,
+           const std::function<bool(int)> &run, const cudaStream_t &stream);
+
+// The cuBLASLt algorithm and descriptors tuned for one GEMM shape.
+struct GemmPlan;
+
+// Returns the plan of the column-major `C[m, n] = op(A) op(B)` (+ `C` when
+// accumulating) with the given leading dimensions on the current device,
+// tuning it on scratch buffers on first use. Candidates are the cuBLAS
+// default, the cuBLASLt heuristics and, for small `n`, their split-K
+// variants, all without workspace so that GEMMs can run concurrently on
+// several streams. Returns null, which `gemm` runs through cuBLAS, when
+// tuning is disabled or the cuBLAS default won.
+template <typename T>
+const GemmPlan *PlanGemm(const cublasOperation_t transa,
+                         const cublasOperation_t transb, const int m,
+                         const int n, const int k, const int lda,
+                         const int ldb, const int ldc,
+                         const cudaStream_t &stream);
+
+// Same arguments as `blas<T>::gemm`, run with `plan` on the stream of
+// `handle`. `alpha` and `beta` are host pointers.
+template <typename T>
+cublasStatus_t gemm(const GemmPlan *plan, cublasHandle_t handle,
+                    cublasOperation_t transa, cublasOperation_t transb, int m,
+                    int n, int k, const T *alpha, const T *A, int lda,
+                    const T *B, int ldb, const T *beta, T *C, int ldc);
+
+} // namespace autotune
+} // namespace v0
+} // namespace haste
@@ -16,6 +16,8 @@
 #pragma once
 
 #include <cublas_v2.h>
+#include <cuda_bf16.h>
+#include <cuda_fp16.h>
 
 template <typename T> struct blas {
   struct set_pointer_mode {
@@ -42,14 +44,47 @@ template <typename T> struct blas {
   };
 };
 
-template <> struct blas<__half> {
-  static constexpr decltype(cublasHgemm) *gemm = &cublasHgemm;
+// 16-bit GEMMs go through `cublasGemmEx` so that products are accumulated in
+// fp32 on the tensor cores. `alpha` and `beta` are taken in the storage type,
+// like the typed entry points below, and must be host pointers.
+template <typename T, cudaDataType_t DataType> struct blas_ex {
+  static cublasStatus_t gemm(cublasHandle_t handle, cublasOperation_t transa,
+                             cublasOperation_t transb, int m, int n, int k,
+                             const T *alpha, const T *A, int lda, const T *B,
+                             int ldb, const T *beta, T *C, int ldc) {
+    const float alpha_f = static_cast<float>(*alpha);
+    const float beta_f = static_cast<float>(*beta);
+    return cublasGemmEx(handle, transa, transb, m, n, k, &alpha_f, A, DataType,
+                        lda, B, DataType, ldb, &beta_f, C, DataType, ldc,
+                        CUBLAS_COMPUTE_32F, CUBLAS_GEMM_DEFAULT_TENSOR_OP);
+  }
+  static cublasStatus_t
+  gemmStridedBatched(cublasHandle_t handle, cublasOperation_t transa,
+                     cublasOperation_t transb, int m, int n, int k,
+                     const T *alpha, const T *A, int lda, long long strideA,
+                     const T *B, int ldb, long long strideB, const T *beta,
+                     T *C, int ldc, long long strideC, int batch_count) {
+    const float alpha_f = static_cast<float>(*alpha);
+    const float beta_f = static_cast<float>(*beta);
+    return cublasGemmStridedBatchedEx(
+        handle, transa, transb, m, n, k, &alpha_f, A, DataType, lda, strideA,
+        B, DataType, ldb, strideB, &beta_f, C, DataType, ldc, strideC,
+        batch_count, CUBLAS_COMPUTE_32F, CUBLAS_GEMM_DEFAULT_TENSOR_OP);
+  }
 };
 
+template <> struct blas<__half> : blas_ex<__half, CUDA_R_16F> {};
+
+template <> struct blas<__nv_bfloat16> : blas_ex<__nv_bfloat16, CUDA_R_16BF> {};
+
 template <> struct blas<float> {
   static constexpr decltype(cublasSgemm) *gemm = &cublasSgemm;
+  static constexpr decltype(cublasSgemmStridedBatched) *gemmStridedBatched =
+      &cublasSgemmStridedBatched;
 };
 
 template <> struct blas<double> {
   static constexpr decltype(cublasDgemm) *gemm = &cublasDgemm;
+  static constexpr decltype(cublasDgemmStridedBatched) *gemmStridedBatched =
+      &cublasDgemmStridedBatched;
 };
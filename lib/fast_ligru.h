@@ -0,0 +1,79 @@
+/* Copyright 2022 Adel Moumen. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ==============================================================================
+ */
+
+/* C interface of the standalone inference runtime (see `ligru_model.h`),
+ * for applications that link `libhaste` without PyTorch. Every entry point
+ * returns a status code; a model handle must not be used by two threads at
+ * once. */
+
+#pragma once
+
+#include <cuda_runtime_api.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+  LIGRU_STATUS_SUCCESS = 0,
+  /* The model file could not be opened or is truncated. */
+  LIGRU_STATUS_IO_ERROR = 1,
+  /* The model file is not a model exported by `export_weights`. */
+  LIGRU_STATUS_INVALID_MODEL = 2,
+  /* An argument is out of range, e.g. a non-positive sequence length. */
+  LIGRU_STATUS_INVALID_VALUE = 3,
+  /* A CUDA runtime or cuBLAS call failed, e.g. out of device memory. */
+  LIGRU_STATUS_CUDA_ERROR = 4,
+} ligru_status_t;
+
+typedef struct ligru_model *ligru_model_t;
+
+/* Returns a static description of `status`. */
+const char *ligru_status_string(ligru_status_t status);
+
+/* Loads the model written by `LiGRU.export_weights` or
+ * `SLiGRU.export_weights` at `path` onto the current device. */
+ligru_status_t ligru_model_load(const char *path, ligru_model_t *model);
+
+/* Releases the device memory of `model`, which may be null. */
+void ligru_model_destroy(ligru_model_t model);
+
+/* Feature dimension of the input, and of the output (twice the hidden size
+ * for a bidirectional model). */
+int ligru_model_input_size(const ligru_model_t model);
+int ligru_model_output_size(const ligru_model_t model);
+
+/* Allocates the device buffers needed by inputs of up to `time_step` steps
+ * and `batch_size` sequences, so that later `ligru_model_forward` calls
+ * within these bounds make no allocation. Optional: buffers otherwise grow
+ * on demand. */
+ligru_status_t ligru_model_reserve(ligru_model_t model, int time_step,
+                                   int batch_size);
+
+/* Runs every layer over the time-major fp32 device tensor `x`,
+ * `[time_step, batch_size, input_size]`, from a zero initial state and writes
+ * the output of the last layer to `y`, `[time_step, batch_size, output_size]`.
+ * The work is queued on `stream` and the call returns without waiting for
+ * it. Calls on different streams share the model's scratch buffers, so each
+ * one is ordered after the previous call on the same model, whatever its
+ * stream; use one model per stream to run them concurrently. */
+ligru_status_t ligru_model_forward(ligru_model_t model, int time_step,
+                                   int batch_size, const float *x, float *y,
+                                   cudaStream_t stream);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
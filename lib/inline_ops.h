@@ -15,8 +15,19 @@
 
 #pragma once
 
+#include <cstdint>
+#include <initializer_list>
+
+#include <cuda_bf16.h>
 #include <cuda_fp16.h>
 
+// Type used to accumulate dot products and reductions over `T` values.
+template <typename T> struct acc_type { using type = T; };
+
+template <> struct acc_type<half> { using type = float; };
+
+template <> struct acc_type<__nv_bfloat16> { using type = float; };
+
 template <typename T> __device__ __forceinline__ T sigmoid(const T x) {
   return static_cast<T>(1.0) / (static_cast<T>(1.0) + exp(-x));
 }
@@ -43,6 +54,79 @@ template <typename T> __device__ __forceinline__ T d_sin(const T x) {
   return std::cos(x);
 }
 
+template <typename T> __device__ __forceinline__ T warp_reduce_sum(T val) {
+  for (int offset = 16; offset > 0; offset >>= 1)
+    val += __shfl_down_sync(0xffffffff, val, offset);
+  return val;
+}
+
+// Butterfly variant of `warp_reduce_sum` that leaves the total in every lane.
+template <typename T> __device__ __forceinline__ T warp_all_reduce_sum(T val) {
+  for (int offset = 16; offset > 0; offset >>= 1)
+    val += __shfl_xor_sync(0xffffffff, val, offset);
+  return val;
+}
+
+// `N` consecutive `T` values moved by a single load or store; `N * sizeof(T)`
+// must be a power of two of at most 16 bytes.
+template <typename T, int N> struct alignas(sizeof(T) * N) aligned_vector {
+  T val[N];
+};
+
+// Number of `T` values in the widest (16-byte) vector load.
+template <typename T> struct vector_width {
+  static constexpr int value = 16 / sizeof(T);
+};
+
+// True when `ptr` may be reinterpreted as an `aligned_vector<T, N>` pointer.
+template <typename T, int N> inline bool is_aligned(const T *ptr) {
+  return reinterpret_cast<uintptr_t>(ptr) % sizeof(aligned_vector<T, N>) == 0;
+}
+
+template <typename T, int N>
+inline bool is_aligned(std::initializer_list<const T *> ptrs) {
+  for (const T *ptr : ptrs)
+    if (!is_aligned<T, N>(ptr))
+      return false;
+  return true;
+}
+
+template <int N, typename T>
+__device__ __forceinline__ aligned_vector<T, N> load_vector(const T *ptr) {
+  return *reinterpret_cast<const aligned_vector<T, N> *>(ptr);
+}
+
+template <int N, typename T>
+__device__ __forceinline__ void store_vector(T *ptr,
+                                             const aligned_vector<T, N> &val) {
+  *reinterpret_cast<aligned_vector<T, N> *>(ptr) = val;
+}
+
+// Sums `val` over a one-dimensional block and returns the total to every
+// thread. `warp_sums` is a shared scratch buffer of at least 32 entries.
+template <typename T>
+__device__ __forceinline__ T block_reduce_sum(T val, T *warp_sums) {
+  const int lane = threadIdx.x % 32;
+  const int warp = threadIdx.x / 32;
+
+  val = warp_reduce_sum(val);
+  if (lane == 0)
+    warp_sums[warp] = val;
+  __syncthreads();
+
+  val = threadIdx.x < (blockDim.x + 31) / 32 ? warp_sums[lane]
+                                             : static_cast<T>(0.0);
+  if (warp == 0)
+    val = warp_reduce_sum(val);
+  if (threadIdx.x == 0)
+    warp_sums[0] = val;
+  __syncthreads();
+
+  val = warp_sums[0];
+  __syncthreads();
+  return val;
+}
+
 template <typename T>
 __device__ __forceinline__ T d_sigmoid(const T sigmoid_output) {
   return sigmoid_output * (static_cast<T>(1.0) - sigmoid_output);
@@ -60,6 +144,50 @@ template <typename T> __device__ __forceinline__ T d_leaky_relu(const T x) {
   return (x > static_cast<T>(0.) ? static_cast<T>(1.) : static_cast<T>(0.01));
 }
 
+// Candidate activations of the gate kernels. `forward` is applied to the
+// pre-activation `a` and `backward` gives the factor used for `da` in the
+// backward pass. The bindings select them with the integer codes 0 = ReLU,
+// 1 = LeakyReLU, 2 = Sin, 3 = Tanh.
+struct ReLU {
+  template <typename T> static __device__ __forceinline__ T forward(const T x) {
+    return relu(x);
+  }
+  template <typename T>
+  static __device__ __forceinline__ T backward(const T x) {
+    return d_relu(x);
+  }
+};
+
+struct LeakyReLU {
+  template <typename T> static __device__ __forceinline__ T forward(const T x) {
+    return leaky_relu(x);
+  }
+  template <typename T>
+  static __device__ __forceinline__ T backward(const T x) {
+    return d_leaky_relu(x);
+  }
+};
+
+struct Sin {
+  template <typename T> static __device__ __forceinline__ T forward(const T x) {
+    return sin(x);
+  }
+  template <typename T>
+  static __device__ __forceinline__ T backward(const T x) {
+    return d_sin(x);
+  }
+};
+
+struct Tanh {
+  template <typename T> static __device__ __forceinline__ T forward(const T x) {
+    return tanh(x);
+  }
+  template <typename T>
+  static __device__ __forceinline__ T backward(const T x) {
+    return d_tanh(x);
+  }
+};
+
 #if defined(__CUDA_ARCH__) && (__CUDA_ARCH__ < 600)
 
 __device__ __forceinline__ double atomicAdd(double *address, double val) {
@@ -102,4 +230,24 @@ template <> __device__ __forceinline__ half leaky_relu(const half x) {
          (x < static_cast<half>(0.) ? x : static_cast<half>(0.)) *
              static_cast<half>(0.01);
 }
-#endif
\ No newline at end of file
+#endif
+
+// Building with -DLIGRU_FAST_MATH (`make FAST_MATH=1`) evaluates the single
+// precision gate functions with the approximate SFU intrinsics.
+#if defined(LIGRU_FAST_MATH)
+template <> __device__ __forceinline__ float sigmoid(const float x) {
+  return __frcp_rn(1.0f + __expf(-x));
+}
+
+template <> __device__ __forceinline__ float Sin::forward(const float x) {
+  return __sinf(x);
+}
+
+template <> __device__ __forceinline__ float Sin::backward(const float x) {
+  return __cosf(x);
+}
+
+template <> __device__ __forceinline__ float Tanh::forward(const float x) {
+  return 1.0f - 2.0f * __frcp_rn(__expf(2.0f * x) + 1.0f);
+}
+#endif
@@ -0,0 +1,106 @@
+// Copyright 2022 Adel Moumen. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#include <algorithm>
+#include <cuda_runtime_api.h>
+
+#include "l2_persistence.h"
+
+namespace {
+
+// Returns the L2 set aside for persisting accesses on the current device.
+size_t ReservedBytes() {
+  size_t reserved = 0;
+  if (cudaDeviceGetLimit(&reserved, cudaLimitPersistingL2CacheSize) !=
+      cudaSuccess) {
+    cudaGetLastError();
+    return 0;
+  }
+  return reserved;
+}
+
+void SetWindow(const cudaStream_t stream, const void *base, const size_t bytes,
+               const float hit_ratio) {
+  cudaStreamAttrValue value = {};
+  value.accessPolicyWindow.base_ptr = const_cast<void *>(base);
+  value.accessPolicyWindow.num_bytes = bytes;
+  value.accessPolicyWindow.hitRatio = hit_ratio;
+  value.accessPolicyWindow.hitProp =
+      bytes ? cudaAccessPropertyPersisting : cudaAccessPropertyNormal;
+  value.accessPolicyWindow.missProp = cudaAccessPropertyStreaming;
+  if (cudaStreamSetAttribute(stream, cudaStreamAttributeAccessPolicyWindow,
+                             &value) != cudaSuccess)
+    cudaGetLastError();
+}
+
+} // anonymous namespace
+
+namespace haste {
+namespace v0 {
+namespace l2_persistence {
+
+size_t Reserve(const size_t bytes) {
+  int device;
+  int max_persisting = 0;
+  cudaGetDevice(&device);
+  cudaDeviceGetAttribute(&max_persisting, cudaDevAttrMaxPersistingL2CacheSize,
+                         device);
+  if (max_persisting == 0)
+    return 0;
+
+  const size_t size = std::min(bytes, static_cast<size_t>(max_persisting));
+  if (cudaDeviceSetLimit(cudaLimitPersistingL2CacheSize, size) != cudaSuccess) {
+    cudaGetLastError();
+    return 0;
+  }
+  return ReservedBytes();
+}
+
+Window::Window(const cudaStream_t *streams, const int count, const void *base,
+               const size_t bytes)
+    : count_(0) {
+  const size_t reserved = base && bytes ? ReservedBytes() : 0;
+  if (reserved == 0)
+    return;
+
+  int device;
+  int max_window = 0;
+  cudaGetDevice(&device);
+  cudaDeviceGetAttribute(&max_window, cudaDevAttrMaxAccessPolicyWindowSize,
+                         device);
+  if (max_window <= 0)
+    return;
+
+  const size_t window = std::min(bytes, static_cast<size_t>(max_window));
+  const float hit_ratio =
+      std::min(1.0f, static_cast<float>(reserved) / static_cast<float>(window));
+
+  count_ = std::min(count, kMaxStreams);
+  for (int i = 0; i < count_; ++i) {
+    streams_[i] = streams[i];
+    SetWindow(streams_[i], base, window, hit_ratio);
+  }
+}
+
+Window::~Window() {
+  // The lines already marked stay persisting until they are evicted by other
+  // persisting accesses, so the next call over the same weight still hits.
+  for (int i = 0; i < count_; ++i)
+    SetWindow(streams_[i], nullptr, 0, 0.0f);
+}
+
+} // namespace l2_persistence
+} // namespace v0
+} // namespace haste
@@ -0,0 +1,56 @@
+// Copyright 2022 Adel Moumen. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#pragma once
+
+#include <cstddef>
+#include <cuda_runtime_api.h>
+
+namespace haste {
+namespace v0 {
+namespace l2_persistence {
+
+// Sets aside up to `bytes` of the L2 cache of the current device for
+// persisting accesses (`cudaLimitPersistingL2CacheSize`), or none when
+// `bytes` is 0, the CUDA default, and returns the size actually set aside.
+// Devices before Ampere have no such carve-out and always return 0. The
+// limit is shared by the whole process.
+size_t Reserve(const size_t bytes);
+
+// Marks the `bytes` bytes at `base` (a recurrent weight, re-read by every
+// step) as persisting in L2 for the kernels issued on `streams[0..count)`
+// while it is alive, and restores the streams' default policy afterwards.
+// Has no effect when `base` is null or when no L2 has been set aside on the
+// current device (see `Reserve`). A window larger than the carve-out only
+// persists a matching fraction of its accesses.
+class Window {
+public:
+  Window(const cudaStream_t *streams, const int count, const void *base,
+         const size_t bytes);
+  ~Window();
+
+  Window(const Window &) = delete;
+  Window &operator=(const Window &) = delete;
+
+private:
+  static constexpr int kMaxStreams = 2;
+
+  cudaStream_t streams_[kMaxStreams];
+  int count_;
+};
+
+} // namespace l2_persistence
+} // namespace v0
+} // namespace haste
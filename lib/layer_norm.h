@@ -25,6 +25,11 @@ public:
   void RunPartial(const cudaStream_t &stream, const int minibatch, const T *x,
                   T *y);
 
+  // Reserves the statistics of the next `minibatch` rows for a caller that
+  // normalizes them in its own kernel, and returns their [minibatch,2]
+  // (mean, invstd) slice of the cache.
+  T *ReservePartial(const int minibatch);
+
 private:
   const int batch_size_;
   const int hidden_size_;
@@ -44,6 +49,12 @@ public:
   void RunPartial(const cudaStream_t &stream, const int minibatch, const T *dy,
                   T *dx);
 
+  // Reserves the next `minibatch` rows, in the order `RunPartial` consumes
+  // them, for a caller that computes their input gradient in its own kernel.
+  // Their [minibatch,H] slice of `x` is stored in `x` and their
+  // [minibatch,2] (mean, invstd) slice of the cache in `cache`.
+  void ReservePartial(const int minibatch, const T **x, const T **cache);
+
 private:
   const int batch_size_;
   const int hidden_size_;
@@ -20,69 +20,209 @@
 
 namespace {
 
-template <typename T, bool ApplyBeta>
-__global__ void LayerNormGrad(const int batch_size, const int hidden_size,
-                              const T *gamma, const T *x, const T *dy,
-                              T *dgamma, T *dbeta, T *dx, T *cache) {
-  const int batch = blockDim.x * blockIdx.x + threadIdx.x;
+// Rows handled by each block of the single-warp configurations.
+constexpr int kWarpRows = 4;
+
+// Sums the three partial reductions of a row spread over `kThreads` threads
+// along `threadIdx.x` and returns the totals to every thread.
+template <int kThreads, typename T>
+__device__ __forceinline__ void row_reduce_sum(T &a, T &b, T &c) {
+  a = warp_all_reduce_sum(a);
+  b = warp_all_reduce_sum(b);
+  c = warp_all_reduce_sum(c);
+
+  constexpr int kWarps = kThreads / 32;
+  if (kWarps > 1) {
+    __shared__ T warp_sums[3][kWarps];
+    if (threadIdx.x % 32 == 0) {
+      warp_sums[0][threadIdx.x / 32] = a;
+      warp_sums[1][threadIdx.x / 32] = b;
+      warp_sums[2][threadIdx.x / 32] = c;
+    }
+    __syncthreads();
+
+    a = b = c = static_cast<T>(0.0);
+    for (int i = 0; i < kWarps; ++i) {
+      a += warp_sums[0][i];
+      b += warp_sums[1][i];
+      c += warp_sums[2][i];
+    }
+  }
+}
+
+template <typename T>
+__device__ __forceinline__ T
+input_grad(const typename acc_type<T>::type centered_x,
+           const typename acc_type<T>::type dy,
+           const typename acc_type<T>::type invstd,
+           const typename acc_type<T>::type dsigma,
+           const typename acc_type<T>::type dmu, const int hidden_size) {
+  using acc_t = typename acc_type<T>::type;
+  return static_cast<T>(
+      (static_cast<acc_t>(2.0) * centered_x * dsigma / hidden_size) +
+      (invstd * dy) + (dmu / hidden_size));
+}
+
+// Backpropagates through rows of `hidden_size` values with `kThreads` threads
+// per row, each keeping its `kItems` vectors of centered `x` and `dy` in
+// registers between the reduction and the write of `dx`.
+template <typename T, int kThreads, int kVec, int kItems>
+__global__ void __launch_bounds__(kThreads == 32 ? 32 * kWarpRows : kThreads)
+    LayerNormGrad(const int batch_size, const int hidden_size, const T *x,
+                  const T *dy, T *dx, const T *cache) {
+  using acc_t = typename acc_type<T>::type;
+  using vec_t = aligned_vector<T, kVec>;
+
+  const int batch = blockIdx.x * blockDim.y + threadIdx.y;
   if (batch >= batch_size)
     return;
 
-  extern __shared__ int shared_var[];
-  T *shared = reinterpret_cast<T *>(shared_var);
-  const int index = threadIdx.y;
-  const int stride = blockDim.y;
-  const int batch_idx = batch * hidden_size;
-  const int batch_block_idx = threadIdx.x * stride * 3;
-
-  const T mean = cache[batch * 2 + 0];
-  const T invstd = cache[batch * 2 + 1];
-
-  T dsigma_tmp = static_cast<T>(0.0);
-  T dmu1_tmp = static_cast<T>(0.0);
-  T dmu2_tmp = static_cast<T>(0.0);
-  for (int i = index; i < hidden_size; i += stride) {
-    const T cur_dy = dy[batch_idx + i];
-    const T centered_x = x[batch_idx + i] - mean;
-    // const T z = centered_x * invstd;
-
-    const T db = cur_dy;
-    dsigma_tmp += centered_x * db;
-    dmu1_tmp += centered_x;
-    dmu2_tmp += db;
+  const int vectors = hidden_size / kVec;
+  const vec_t *x_row = reinterpret_cast<const vec_t *>(x + batch * hidden_size);
+  const vec_t *dy_row =
+      reinterpret_cast<const vec_t *>(dy + batch * hidden_size);
+  vec_t *dx_row = reinterpret_cast<vec_t *>(dx + batch * hidden_size);
+
+  const acc_t mean = static_cast<acc_t>(cache[batch * 2 + 0]);
+  const acc_t invstd = static_cast<acc_t>(cache[batch * 2 + 1]);
+
+  acc_t centered_x[kItems][kVec];
+  acc_t cur_dy[kItems][kVec];
+  acc_t dsigma_tmp = static_cast<acc_t>(0.0);
+  acc_t dmu1_tmp = static_cast<acc_t>(0.0);
+  acc_t dmu2_tmp = static_cast<acc_t>(0.0);
+#pragma unroll
+  for (int k = 0; k < kItems; ++k) {
+    const int v = threadIdx.x + k * kThreads;
+    if (v < vectors) {
+      const vec_t in_x = x_row[v];
+      const vec_t in_dy = dy_row[v];
+#pragma unroll
+      for (int j = 0; j < kVec; ++j) {
+        centered_x[k][j] = static_cast<acc_t>(in_x.val[j]) - mean;
+        cur_dy[k][j] = static_cast<acc_t>(in_dy.val[j]);
+        dsigma_tmp += centered_x[k][j] * cur_dy[k][j];
+        dmu1_tmp += centered_x[k][j];
+        dmu2_tmp += cur_dy[k][j];
+      }
+    }
   }
-  shared[batch_block_idx + index * 3 + 0] = dsigma_tmp;
-  shared[batch_block_idx + index * 3 + 1] = dmu1_tmp;
-  shared[batch_block_idx + index * 3 + 2] = dmu2_tmp;
-  __syncthreads();
-
-  for (int s = stride / 2; s > 0; s >>= 1) {
-    if (index < s) {
-      shared[batch_block_idx + index * 3 + 0] +=
-          shared[batch_block_idx + (index + s) * 3 + 0];
-      shared[batch_block_idx + index * 3 + 1] +=
-          shared[batch_block_idx + (index + s) * 3 + 1];
-      shared[batch_block_idx + index * 3 + 2] +=
-          shared[batch_block_idx + (index + s) * 3 + 2];
+  row_reduce_sum<kThreads>(dsigma_tmp, dmu1_tmp, dmu2_tmp);
+
+  const acc_t dsigma =
+      static_cast<acc_t>(-0.5) * dsigma_tmp * invstd * invstd * invstd;
+  const acc_t dmu =
+      (static_cast<acc_t>(-2.0) * dmu1_tmp * dsigma / hidden_size) -
+      (dmu2_tmp * invstd);
+
+#pragma unroll
+  for (int k = 0; k < kItems; ++k) {
+    const int v = threadIdx.x + k * kThreads;
+    if (v < vectors) {
+      vec_t out;
+#pragma unroll
+      for (int j = 0; j < kVec; ++j)
+        out.val[j] = input_grad<T>(centered_x[k][j], cur_dy[k][j], invstd,
+                                   dsigma, dmu, hidden_size);
+      dx_row[v] = out;
     }
-    __syncthreads();
   }
+}
+
+// Fallback for rows too wide to keep in registers; reads `x` and `dy` a second
+// time to write `dx`. One row per block.
+template <typename T, int kThreads, int kVec>
+__global__ void __launch_bounds__(kThreads)
+    LayerNormGradStrided(const int batch_size, const int hidden_size,
+                         const T *x, const T *dy, T *dx, const T *cache) {
+  using acc_t = typename acc_type<T>::type;
+  using vec_t = aligned_vector<T, kVec>;
 
-  const T dsigma = static_cast<T>(-0.5) * shared[batch_block_idx + 0] * invstd *
-                   invstd * invstd;
-  const T dmu = (static_cast<T>(-2.0) * shared[batch_block_idx + 1] * dsigma /
-                 hidden_size) -
-                (shared[batch_block_idx + 2] * invstd);
+  const int batch = blockIdx.x;
+  const int vectors = hidden_size / kVec;
+  const vec_t *x_row = reinterpret_cast<const vec_t *>(x + batch * hidden_size);
+  const vec_t *dy_row =
+      reinterpret_cast<const vec_t *>(dy + batch * hidden_size);
+  vec_t *dx_row = reinterpret_cast<vec_t *>(dx + batch * hidden_size);
 
-  for (int i = index; i < hidden_size; i += stride) {
-    const T cur_dy = dy[batch_idx + i];
-    const T centered_x = x[batch_idx + i] - mean;
+  const acc_t mean = static_cast<acc_t>(cache[batch * 2 + 0]);
+  const acc_t invstd = static_cast<acc_t>(cache[batch * 2 + 1]);
 
-    const T db = cur_dy;
-    dx[batch_idx + i] =
-        (static_cast<T>(2.0) * centered_x * dsigma / hidden_size) +
-        (invstd * db) + (dmu / hidden_size);
+  acc_t dsigma_tmp = static_cast<acc_t>(0.0);
+  acc_t dmu1_tmp = static_cast<acc_t>(0.0);
+  acc_t dmu2_tmp = static_cast<acc_t>(0.0);
+  for (int v = threadIdx.x; v < vectors; v += kThreads) {
+    const vec_t in_x = x_row[v];
+    const vec_t in_dy = dy_row[v];
+#pragma unroll
+    for (int j = 0; j < kVec; ++j) {
+      const acc_t centered_x = static_cast<acc_t>(in_x.val[j]) - mean;
+      const acc_t cur_dy = static_cast<acc_t>(in_dy.val[j]);
+      dsigma_tmp += centered_x * cur_dy;
+      dmu1_tmp += centered_x;
+      dmu2_tmp += cur_dy;
+    }
   }
+  row_reduce_sum<kThreads>(dsigma_tmp, dmu1_tmp, dmu2_tmp);
+
+  const acc_t dsigma =
+      static_cast<acc_t>(-0.5) * dsigma_tmp * invstd * invstd * invstd;
+  const acc_t dmu =
+      (static_cast<acc_t>(-2.0) * dmu1_tmp * dsigma / hidden_size) -
+      (dmu2_tmp * invstd);
+
+  for (int v = threadIdx.x; v < vectors; v += kThreads) {
+    const vec_t in_x = x_row[v];
+    const vec_t in_dy = dy_row[v];
+    vec_t out;
+#pragma unroll
+    for (int j = 0; j < kVec; ++j)
+      out.val[j] = input_grad<T>(static_cast<acc_t>(in_x.val[j]) - mean,
+                                 static_cast<acc_t>(in_dy.val[j]), invstd,
+                                 dsigma, dmu, hidden_size);
+    dx_row[v] = out;
+  }
+}
+
+template <typename T, int kThreads, int kVec, int kItems>
+void LaunchLayerNormGrad(const cudaStream_t &stream, const int batch_size,
+                         const int hidden_size, const T *x, const T *dy, T *dx,
+                         const T *cache) {
+  const int rows = kThreads == 32 ? kWarpRows : 1;
+  const dim3 blockDim(kThreads, rows);
+  const dim3 gridDim((batch_size + rows - 1) / rows);
+  LayerNormGrad<T, kThreads, kVec, kItems><<<gridDim, blockDim, 0, stream>>>(
+      batch_size, hidden_size, x, dy, dx, cache);
+}
+
+// Same shape selection as the forward pass; each thread holds twice as many
+// registers per vector here, so the widest cached shape stops at 1024 vectors.
+template <typename T, int kVec>
+void DispatchLayerNormGrad(const cudaStream_t &stream, const int batch_size,
+                           const int hidden_size, const T *x, const T *dy,
+                           T *dx, const T *cache) {
+  const int vectors = hidden_size / kVec;
+  if (vectors <= 32)
+    LaunchLayerNormGrad<T, 32, kVec, 1>(stream, batch_size, hidden_size, x, dy,
+                                        dx, cache);
+  else if (vectors <= 64)
+    LaunchLayerNormGrad<T, 32, kVec, 2>(stream, batch_size, hidden_size, x, dy,
+                                        dx, cache);
+  else if (vectors <= 128)
+    LaunchLayerNormGrad<T, 32, kVec, 4>(stream, batch_size, hidden_size, x, dy,
+                                        dx, cache);
+  else if (vectors <= 256)
+    LaunchLayerNormGrad<T, 128, kVec, 2>(stream, batch_size, hidden_size, x,
+                                         dy, dx, cache);
+  else if (vectors <= 512)
+    LaunchLayerNormGrad<T, 128, kVec, 4>(stream, batch_size, hidden_size, x,
+                                         dy, dx, cache);
+  else if (vectors <= 1024)
+    LaunchLayerNormGrad<T, 256, kVec, 4>(stream, batch_size, hidden_size, x,
+                                         dy, dx, cache);
+  else
+    LayerNormGradStrided<T, 256, kVec><<<batch_size, 256, 0, stream>>>(
+        batch_size, hidden_size, x, dy, dx, cache);
 }
 
 } // anonymous namespace
@@ -109,26 +249,32 @@ void BackwardPass<T>::RunPartial(const cudaStream_t &stream,
                                  const int minibatch, const T *dy, T *dx) {
   assert(partial_ - minibatch >= 0);
 
-  dim3 blockDim(4, 256);
-  dim3 gridDim;
-  gridDim.x = (minibatch + blockDim.x - 1) / blockDim.x;
-  const int shared_mem_size = sizeof(T) * blockDim.x * blockDim.y * 3;
-
-  if (beta_ && dbeta_) {
-    LayerNormGrad<T, true><<<gridDim, blockDim, shared_mem_size, stream>>>(
-        minibatch, hidden_size_, gamma_,
-        x_ + (partial_ - minibatch) * hidden_size_, dy, dgamma_, dbeta_, dx,
-        cache_ + (partial_ - minibatch) * 2);
-  } else {
-    LayerNormGrad<T, false><<<gridDim, blockDim, shared_mem_size, stream>>>(
-        minibatch, hidden_size_, gamma_,
-        x_ + (partial_ - minibatch) * hidden_size_, dy, dgamma_, nullptr, dx,
-        cache_ + (partial_ - minibatch) * 2);
-  }
+  constexpr int kVec = vector_width<T>::value;
+  const T *x = x_ + (partial_ - minibatch) * hidden_size_;
+  const T *cache = cache_ + (partial_ - minibatch) * 2;
+  if (hidden_size_ % kVec == 0 && is_aligned<T, kVec>(x) &&
+      is_aligned<T, kVec>(dy) && is_aligned<T, kVec>(dx))
+    DispatchLayerNormGrad<T, kVec>(stream, minibatch, hidden_size_, x, dy, dx,
+                                   cache);
+  else
+    DispatchLayerNormGrad<T, 1>(stream, minibatch, hidden_size_, x, dy, dx,
+                                cache);
+
+  partial_ -= minibatch;
+}
+
+template <typename T>
+void BackwardPass<T>::ReservePartial(const int minibatch, const T **x,
+                                     const T **cache) {
+  assert(partial_ - minibatch >= 0);
 
   partial_ -= minibatch;
+  *x = x_ + partial_ * hidden_size_;
+  *cache = cache_ + partial_ * 2;
 }
 
+template class BackwardPass<half>;
+template class BackwardPass<__nv_bfloat16>;
 template class BackwardPass<float>;
 template class BackwardPass<double>;
 
@@ -15,68 +15,240 @@
 
 #include <cassert>
 
+#include "inline_ops.h"
 #include "layer_norm.h"
 
 namespace {
 
+// Rows handled by each block of the single-warp configurations.
+constexpr int kWarpRows = 4;
+
+// Running statistics of a set of values: their count, mean and sum of squared
+// deviations from the mean.
+template <typename T> struct Welford {
+  T count;
+  T mean;
+  T m2;
+};
+
+// Combines the statistics of two disjoint sets (Chan et al.).
+template <typename T>
+__device__ __forceinline__ Welford<T> welford_merge(const Welford<T> &a,
+                                                    const Welford<T> &b) {
+  const T count = a.count + b.count;
+  if (count == static_cast<T>(0.0))
+    return a;
+  const T delta = b.mean - a.mean;
+  const T scale = b.count / count;
+  return {count, a.mean + delta * scale,
+          a.m2 + b.m2 + delta * delta * a.count * scale};
+}
+
+// Merges the statistics of a row spread over `kThreads` threads along
+// `threadIdx.x` and returns the row's statistics to every thread.
+template <int kThreads, typename T>
+__device__ __forceinline__ Welford<T> welford_row_reduce(Welford<T> w) {
+  for (int offset = 16; offset > 0; offset >>= 1) {
+    const Welford<T> other = {__shfl_xor_sync(0xffffffff, w.count, offset),
+                              __shfl_xor_sync(0xffffffff, w.mean, offset),
+                              __shfl_xor_sync(0xffffffff, w.m2, offset)};
+    w = welford_merge(w, other);
+  }
+
+  constexpr int kWarps = kThreads / 32;
+  if (kWarps > 1) {
+    __shared__ Welford<T> warp_stats[kWarps];
+    if (threadIdx.x % 32 == 0)
+      warp_stats[threadIdx.x / 32] = w;
+    __syncthreads();
+
+    w = warp_stats[0];
+    for (int i = 1; i < kWarps; ++i)
+      w = welford_merge(w, warp_stats[i]);
+  }
+  return w;
+}
+
 template <typename T, bool ApplyBeta>
-__global__ void LayerNorm(const int batch_size, const int hidden_size,
-                          const T *gamma, const T *beta, const T *x, T *y,
-                          T *cache) {
-  const int batch = blockDim.x * blockIdx.x + threadIdx.x;
+__device__ __forceinline__ T normalize(const typename acc_type<T>::type value,
+                                       const typename acc_type<T>::type mean,
+                                       const typename acc_type<T>::type invstd,
+                                       const T *beta, const int i) {
+  using acc_t = typename acc_type<T>::type;
+  const acc_t z = (value - mean) * invstd;
+  if (ApplyBeta)
+    return static_cast<T>(z + static_cast<acc_t>(beta[i]));
+  return static_cast<T>(z);
+}
+
+// Normalizes rows of `hidden_size` values with `kThreads` threads per row, each
+// holding `kItems` vectors of `kVec` values in registers so that `x` is read
+// once. Rows of a single warp are packed `kWarpRows` to a block.
+template <typename T, int kThreads, int kVec, int kItems, bool ApplyBeta>
+__global__ void __launch_bounds__(kThreads == 32 ? 32 * kWarpRows : kThreads)
+    LayerNorm(const int batch_size, const int hidden_size, const T *gamma,
+              const T *beta, const T *x, T *y, T *cache) {
+  using acc_t = typename acc_type<T>::type;
+  using vec_t = aligned_vector<T, kVec>;
+
+  const int batch = blockIdx.x * blockDim.y + threadIdx.y;
   if (batch >= batch_size)
     return;
 
-  extern __shared__ int shared_var[];
-  T *shared = reinterpret_cast<T *>(shared_var);
-  const int index = threadIdx.y;
-  const int stride = blockDim.y;
-  const int batch_idx = batch * hidden_size;
-  const int batch_block_idx = threadIdx.x * stride;
-
-  T sum = static_cast<T>(0.0);
-  for (int i = index; i < hidden_size; i += stride)
-    sum += x[batch_idx + i];
-  shared[batch_block_idx + index] = sum;
-  __syncthreads();
-
-  for (int s = stride / 2; s > 0; s >>= 1) {
-    if (index < s)
-      shared[batch_block_idx + index] += shared[batch_block_idx + index + s];
-    __syncthreads();
+  const int vectors = hidden_size / kVec;
+  const vec_t *x_row = reinterpret_cast<const vec_t *>(x + batch * hidden_size);
+  vec_t *y_row = reinterpret_cast<vec_t *>(y + batch * hidden_size);
+
+  acc_t values[kItems][kVec];
+  acc_t sum = static_cast<acc_t>(0.0);
+  int count = 0;
+#pragma unroll
+  for (int k = 0; k < kItems; ++k) {
+    const int v = threadIdx.x + k * kThreads;
+    if (v < vectors) {
+      const vec_t in = x_row[v];
+#pragma unroll
+      for (int j = 0; j < kVec; ++j) {
+        values[k][j] = static_cast<acc_t>(in.val[j]);
+        sum += values[k][j];
+      }
+      count += kVec;
+    }
   }
 
+  Welford<acc_t> w = {static_cast<acc_t>(count), static_cast<acc_t>(0.0),
+                      static_cast<acc_t>(0.0)};
+  if (count > 0) {
+    w.mean = sum / count;
+#pragma unroll
+    for (int k = 0; k < kItems; ++k) {
+      if (static_cast<int>(threadIdx.x) + k * kThreads < vectors) {
+#pragma unroll
+        for (int j = 0; j < kVec; ++j) {
+          const acc_t diff = values[k][j] - w.mean;
+          w.m2 += diff * diff;
+        }
+      }
+    }
+  }
+  w = welford_row_reduce<kThreads>(w);
 
-  const T mean = shared[batch_block_idx] / hidden_size;
-  __syncthreads();
+  const acc_t mean = w.mean;
+  const acc_t invstd = rsqrt(w.m2 / hidden_size + static_cast<acc_t>(1e-5));
 
-  // Reduce squared difference
-  T sumsq = static_cast<T>(0.0);
-  for (int i = index; i < hidden_size; i += stride) {
-    const T diff = x[batch_idx + i] - mean;
-    sumsq += diff * diff;
+#pragma unroll
+  for (int k = 0; k < kItems; ++k) {
+    const int v = threadIdx.x + k * kThreads;
+    if (v < vectors) {
+      vec_t out;
+#pragma unroll
+      for (int j = 0; j < kVec; ++j)
+        out.val[j] = normalize<T, ApplyBeta>(values[k][j], mean, invstd, beta,
+                                             v * kVec + j);
+      y_row[v] = out;
+    }
   }
-  shared[batch_block_idx + index] = sumsq;
-  __syncthreads();
 
-  for (int s = stride / 2; s > 0; s >>= 1) {
-    if (index < s)
-      shared[batch_block_idx + index] += shared[batch_block_idx + index + s];
-    __syncthreads();
+  if (threadIdx.x == 0) {
+    cache[batch * 2 + 0] = static_cast<T>(mean);
+    cache[batch * 2 + 1] = static_cast<T>(invstd);
+  }
+}
+
+// Fallback for rows too wide to keep in registers: accumulates the statistics
+// with per-element Welford updates in one pass and reads `x` again to write
+// `y`. One row per block.
+template <typename T, int kThreads, int kVec, bool ApplyBeta>
+__global__ void __launch_bounds__(kThreads)
+    LayerNormStrided(const int batch_size, const int hidden_size,
+                     const T *gamma, const T *beta, const T *x, T *y,
+                     T *cache) {
+  using acc_t = typename acc_type<T>::type;
+  using vec_t = aligned_vector<T, kVec>;
+
+  const int batch = blockIdx.x;
+  const int vectors = hidden_size / kVec;
+  const vec_t *x_row = reinterpret_cast<const vec_t *>(x + batch * hidden_size);
+  vec_t *y_row = reinterpret_cast<vec_t *>(y + batch * hidden_size);
+
+  Welford<acc_t> w = {static_cast<acc_t>(0.0), static_cast<acc_t>(0.0),
+                      static_cast<acc_t>(0.0)};
+  for (int v = threadIdx.x; v < vectors; v += kThreads) {
+    const vec_t in = x_row[v];
+#pragma unroll
+    for (int j = 0; j < kVec; ++j) {
+      const acc_t value = static_cast<acc_t>(in.val[j]);
+      w.count += static_cast<acc_t>(1.0);
+      const acc_t delta = value - w.mean;
+      w.mean += delta / w.count;
+      w.m2 += delta * (value - w.mean);
+    }
   }
+  w = welford_row_reduce<kThreads>(w);
+
+  const acc_t mean = w.mean;
+  const acc_t invstd = rsqrt(w.m2 / hidden_size + static_cast<acc_t>(1e-5));
 
-  const T invstd =
-      rsqrt(shared[batch_block_idx] / hidden_size + static_cast<T>(1e-5));
+  for (int v = threadIdx.x; v < vectors; v += kThreads) {
+    const vec_t in = x_row[v];
+    vec_t out;
+#pragma unroll
+    for (int j = 0; j < kVec; ++j)
+      out.val[j] = normalize<T, ApplyBeta>(static_cast<acc_t>(in.val[j]), mean,
+                                           invstd, beta, v * kVec + j);
+    y_row[v] = out;
+  }
 
-  for (int i = index; i < hidden_size; i += stride) {
-    if (ApplyBeta)
-      y[batch_idx + i] = (x[batch_idx + i] - mean) * invstd + beta[i];
-    else
-      y[batch_idx + i] = (x[batch_idx + i] - mean) * invstd;
+  if (threadIdx.x == 0) {
+    cache[batch * 2 + 0] = static_cast<T>(mean);
+    cache[batch * 2 + 1] = static_cast<T>(invstd);
   }
+}
+
+template <typename T, int kThreads, int kVec, int kItems, bool ApplyBeta>
+void LaunchLayerNorm(const cudaStream_t &stream, const int batch_size,
+                     const int hidden_size, const T *gamma, const T *beta,
+                     const T *x, T *y, T *cache) {
+  const int rows = kThreads == 32 ? kWarpRows : 1;
+  const dim3 blockDim(kThreads, rows);
+  const dim3 gridDim((batch_size + rows - 1) / rows);
+  LayerNorm<T, kThreads, kVec, kItems, ApplyBeta>
+      <<<gridDim, blockDim, 0, stream>>>(batch_size, hidden_size, gamma, beta,
+                                         x, y, cache);
+}
 
-  cache[batch * 2 + 0] = mean;
-  cache[batch * 2 + 1] = invstd;
+// Picks the launch shape from the number of `kVec`-wide vectors in a row: a
+// warp per row up to 128 vectors, a block per row beyond that, and the strided
+// kernel once a row no longer fits in registers.
+template <typename T, int kVec, bool ApplyBeta>
+void DispatchLayerNorm(const cudaStream_t &stream, const int batch_size,
+                       const int hidden_size, const T *gamma, const T *beta,
+                       const T *x, T *y, T *cache) {
+  const int vectors = hidden_size / kVec;
+  if (vectors <= 32)
+    LaunchLayerNorm<T, 32, kVec, 1, ApplyBeta>(stream, batch_size, hidden_size,
+                                               gamma, beta, x, y, cache);
+  else if (vectors <= 64)
+    LaunchLayerNorm<T, 32, kVec, 2, ApplyBeta>(stream, batch_size, hidden_size,
+                                               gamma, beta, x, y, cache);
+  else if (vectors <= 128)
+    LaunchLayerNorm<T, 32, kVec, 4, ApplyBeta>(stream, batch_size, hidden_size,
+                                               gamma, beta, x, y, cache);
+  else if (vectors <= 256)
+    LaunchLayerNorm<T, 128, kVec, 2, ApplyBeta>(stream, batch_size, hidden_size,
+                                                gamma, beta, x, y, cache);
+  else if (vectors <= 512)
+    LaunchLayerNorm<T, 128, kVec, 4, ApplyBeta>(stream, batch_size, hidden_size,
+                                                gamma, beta, x, y, cache);
+  else if (vectors <= 1024)
+    LaunchLayerNorm<T, 256, kVec, 4, ApplyBeta>(stream, batch_size, hidden_size,
+                                                gamma, beta, x, y, cache);
+  else if (vectors <= 2048)
+    LaunchLayerNorm<T, 256, kVec, 8, ApplyBeta>(stream, batch_size, hidden_size,
+                                                gamma, beta, x, y, cache);
+  else
+    LayerNormStrided<T, 256, kVec, ApplyBeta><<<batch_size, 256, 0, stream>>>(
+        batch_size, hidden_size, gamma, beta, x, y, cache);
 }
 
 } // anonymous namespace
@@ -101,17 +273,29 @@ void ForwardPass<T>::RunPartial(const cudaStream_t &stream, const int minibatch,
                                 const T *x, T *y) {
   assert(partial_ + minibatch <= batch_size_);
 
-  dim3 blockDim(4, 256);
-  dim3 gridDim;
-  gridDim.x = (minibatch + blockDim.x - 1) / blockDim.x;
-  const int shared_mem_size = sizeof(T) * blockDim.x * blockDim.y;
+  constexpr int kVec = vector_width<T>::value;
+  T *cache = cache_ + partial_ * 2;
+  if (hidden_size_ % kVec == 0 && is_aligned<T, kVec>(x) &&
+      is_aligned<T, kVec>(y))
+    DispatchLayerNorm<T, kVec, false>(stream, minibatch, hidden_size_, nullptr,
+                                      nullptr, x, y, cache);
+  else
+    DispatchLayerNorm<T, 1, false>(stream, minibatch, hidden_size_, nullptr,
+                                   nullptr, x, y, cache);
 
-  LayerNorm<T, false><<<gridDim, blockDim, shared_mem_size, stream>>>(
-      minibatch, hidden_size_, nullptr, nullptr, x, y, cache_ + partial_ * 2);
+  partial_ += minibatch;
+}
+
+template <typename T> T *ForwardPass<T>::ReservePartial(const int minibatch) {
+  assert(partial_ + minibatch <= batch_size_);
 
+  T *cache = cache_ + partial_ * 2;
   partial_ += minibatch;
+  return cache;
 }
 
+template class ForwardPass<half>;
+template class ForwardPass<__nv_bfloat16>;
 template class ForwardPass<float>;
 template class ForwardPass<double>;
 
@@ -16,9 +16,13 @@
 #pragma once
 
 #include <cublas_v2.h>
+#include <cstddef>
 #include <cuda_runtime_api.h>
 #include <string>
 
+#include "quantized_weight.h"
+#include "zoneout.h"
+
 namespace haste {
 namespace v0 {
 namespace ligru_1_0 {
@@ -36,13 +40,127 @@ public:
 
   // Releases internal resources.
   // Blocks until all iterations have completed executing on the GPU.
+  //
+  // Both passes leave `stream` ordered after the work issued by `Run`, so
+  // they can be kept alive and reused across calls.
   ~ForwardPass();
 
-  void Run(const int time_step, T *wx, const T *u, T *h, T *v, T *tmp_uh);
+  // Returns the number of bytes of `workspace` the entry points below need
+  // for sequences of up to `time_step` steps, `RunBidirectional` when
+  // `bidirectional` is set. The workspace only holds temporaries that do not
+  // outlive a call, so one 256-byte aligned arena can be allocated up front
+  // for the largest shape served and reused by every call ordered on
+  // `stream`; the passes never allocate device memory themselves.
+  static size_t GetWorkspaceSize(const int time_step, const int batch_size,
+                                 const int hidden_size, const bool training,
+                                 const bool bidirectional = false);
+
+  // Enables or disables the persistent forward kernel (enabled by default).
+  // When enabled, `Run` keeps `u` resident in shared memory and computes the
+  // whole sequence in a single cooperative launch whenever the hidden size
+  // fits on-chip, and falls back to one GEMM + pointwise launch per step
+  // otherwise.
+  void SetPersistent(const bool persistent);
+
+  // Sets the `[2 * hidden_size]` bias that every entry point below adds to
+  // each row of `wx` inside the recurrence, or clears it when `b` is null (the
+  // default). This lets an inference caller fold its input normalization into
+  // the projection weight and skip the separate pass that would add the
+  // shifted bias to `wx`. `b` is read by every later call until it is
+  // replaced, and the gate cache `v` includes it; `BackwardPass::RunRecompute`
+  // rebuilds the gates from `wx` alone, so it does not support a bias.
+  void SetBias(const T *b);
+
+  // Sets the zoneout every entry point below applies to the hidden state
+  // (none by default). `h` holds the states after zoneout and `v` the gates
+  // before it, and step `i` of a call uses the masks of step `i`;
+  // `RunBidirectional` draws the reverse direction from
+  // `reverse_direction(zoneout)`. The persistent kernel does not apply
+  // zoneout, so `Run` uses the per-step kernels while `prob` is non-zero.
+  void SetZoneout(const Zoneout &zoneout);
+
+  // Sets a quantized copy of `u` (see `quantized_weight.h`) that the per-step
+  // recurrent product of every entry point below reads instead of the `u`
+  // they are given, or clears it when `u.data` is null (the default). Only
+  // inference passes (`training == false`) support it, since the backward
+  // pass differentiates the full-precision weight. `Run` uses the
+  // per-step kernels while it is set.
+  void SetQuantizedWeight(const QuantizedWeight &u);
+
+  // Runs `groups` independent layers of the same shape in every entry point
+  // below (1, a single layer, by default): the `batch_size` rows given to the
+  // constructor hold `batch_size / groups` rows of each layer, row
+  // `b * groups + g` of `wx`, `h` and `v` belonging to layer `g`, and `u` is
+  // `[groups, 2 * hidden_size, hidden_size]`, the weights stacked in the
+  // same order. Each step then issues one strided-batched GEMM and one
+  // pointwise launch for all the layers, which keeps the GPU busy when each
+  // of them alone is too small to. `batch_size` must be a multiple of
+  // `groups`, as must every count of `RunPacked`. Grouped passes use the
+  // per-step kernels and support neither a bias, a quantized weight nor
+  // `RunPipelined`, whose projection has a single `w`; `BackwardPass` does
+  // not differentiate them.
+  void SetGroups(const int groups);
+
+  // `u` is the recurrent weight in its row-major `[2 * hidden_size,
+  // hidden_size]` layout (that of an `nn.Linear`), which every pass reads
+  // through the GEMM transpose flag, with no copy; when L2 has been set
+  // aside for persisting accesses (see `l2_persistence.h`), the forward
+  // entry points keep it there while they run. `wx` is
+  // `[time_step, batch_size, 2 * hidden_size]`, or
+  // `[batch_size, time_step, 2 * hidden_size]` when `batch_first` is set.
+  void Run(const int time_step, T *wx, const T *u, T *h, T *v,
+           void *workspace, const bool batch_first = false);
+
+  // Same as `Run`, but also computes the input projection `wx = x w^T` of
+  // the time-major `[time_step, batch_size, input_size]` input `x`, where `w`
+  // is the `[2 * hidden_size, input_size]` weight and `input_size` the one
+  // given to the constructor. The projection is issued in chunks of
+  // `chunk_size` steps on an internal stream of its own, so the recurrence
+  // over one chunk overlaps the GEMM of the next instead of waiting for the
+  // whole sequence. `wx` is the time-major output of the projection.
+  void RunPipelined(const int time_step, const int chunk_size, const T *x,
+                    const T *w, T *wx, const T *u, T *h, T *v,
+                    void *workspace);
+
+  // Same as `Run`, except that the initial state of batch entry `b` is read
+  // from row `slots[b]` of the `[S, hidden_size]` state table `h_table` and
+  // its final state is written back there (see `state_table.h`). `slots` is
+  // a device array of `batch_size` distinct indices; `h[0]` is overwritten.
+  void RunIndexed(const int time_step, T *wx, const T *u, T *h, T *v,
+                  void *workspace, T *h_table, const int *slots);
+
+  // Inference-only variant of `Run` that keeps no per-step state: `h` is a
+  // `[2, batch_size, hidden_size]` ping-pong buffer whose slot 0 holds the
+  // initial state, and the final state is left in slot `time_step % 2`.
+  // Requires a pass constructed with `training == false`.
+  void RunInference(const int time_step, T *wx, const T *u, T *h,
+                    void *workspace, const bool batch_first = false);
+
+  // Variant of `Run` for variable-length sequences sorted by decreasing
+  // length. `batch_sizes` is a host array of `time_step` non-increasing
+  // counts, the number of sequences still running at each step; tensors keep
+  // their padded layout but rows past `batch_sizes[i]` are neither computed
+  // nor written at step `i`.
+  void RunPacked(const int time_step, const int *batch_sizes, T *wx,
+                 const T *u, T *h, T *v, void *workspace);
+
+  // Runs both directions of a bidirectional layer, which share `wx` and `u`,
+  // concurrently. `h` is `[time_step + 2, batch_size, 2 * hidden_size]`: the
+  // first half of slot 0 holds the forward initial state, the second half of
+  // the last slot the reverse one, and slots 1 to `time_step` receive the
+  // interleaved outputs. `v` is `[2, time_step, batch_size, 3 * hidden_size]`
+  // (forward cache first).
+  void RunBidirectional(const int time_step, T *wx, const T *u, T *h, T *v,
+                        void *workspace, const bool batch_first = false);
 
 private:
   void IterateInternal(const T *u, const T *h, T *h_out, T *v, T *tmp_wx,
-                       T *tmp_uh);
+                       T *tmp_uh, const int batch_size, const int ldh,
+                       const int ldwx, const Zoneout &zoneout, const int step,
+                       const cudaStream_t &stream);
+
+  bool RunPersistent(const int time_step, const T *wx, int wx_step, int ldwx,
+                     const T *u, T *h, T *v);
 
   struct private_data;
   private_data *data_;
@@ -62,12 +180,72 @@ public:
   // Blocks until all iterations have completed executing on the GPU.
   ~BackwardPass();
 
+  // Sets the zoneout of the forward pass being differentiated, whose masks
+  // are regenerated at every step (none by default).
+  void SetZoneout(const Zoneout &zoneout);
+
+  // Sets the state gradients of a call that differentiates one segment of a
+  // longer sequence (truncated backpropagation through time), both
+  // `[batch_size, hidden_size]` device buffers and null by default. Every
+  // entry point below starts the recurrence from `dh_final`, the gradient
+  // flowing back into the last state from the next segment, instead of from
+  // zero, and leaves the gradient of the initial state `h[0]` in
+  // `dh_initial`, to be passed on to the previous segment. With
+  // `RunPacked`, row `b` of `dh_final` is that of the last state of
+  // sequence `b`. `RunBidirectional` takes both directions,
+  // `[2, batch_size, hidden_size]` with the forward one first: its final
+  // states are those of slots `time_step` and 1, and its initial states
+  // those of slots 0 and `time_step + 1`.
+  void SetStateGradient(const T *dh_final, T *dh_initial);
+
+  // Same as `ForwardPass::GetWorkspaceSize`, where `training` is the flag of
+  // the forward pass being differentiated: `false` sizes the workspace for
+  // `RunRecompute`.
+  static size_t GetWorkspaceSize(const int time_step, const int batch_size,
+                                 const int hidden_size, const bool training,
+                                 const bool bidirectional = false);
+
+  // `u_t` is the same weight matrix as the forward `u`, and `du` receives its
+  // gradient in that layout. `dwx` and `du` are overwritten.
   void Run(const int time_step, const T *wx_t, const T *u_t, const T *h,
-           const T *v, const T *grad_out, T *dwx, T *du, T *dh);
+           const T *v, const T *grad_out, T *dwx, T *du, void *workspace);
+
+  // Backward of a `ForwardPass::Run` made without a gate cache (a pass
+  // constructed with `training == false`). `a`, `z` and `hcand` are rebuilt
+  // at every step from `wx`, laid out as in the forward call, and the
+  // recurrent product of `h`.
+  void RunRecompute(const int time_step, const T *wx, const T *u_t,
+                    const T *h, const T *grad_out, T *dwx, T *du,
+                    void *workspace, const bool batch_first = false);
+
+  // Backward of `ForwardPass::RunPacked`. Rows of `dwx` past a step's
+  // batch size are left untouched, so the caller zero-fills it.
+  void RunPacked(const int time_step, const int *batch_sizes, const T *wx_t,
+                 const T *u_t, const T *h, const T *v, const T *grad_out,
+                 T *dwx, T *du, void *workspace);
+
+  // Backward of `ForwardPass::RunBidirectional`. `h` and `grad_out` use its
+  // `[time_step + 2, batch_size, 2 * hidden_size]` layout, `v` its cache,
+  // and `dwx` receives one gradient per direction
+  // (`[2, time_step, batch_size, 2 * hidden_size]`). `du` sums both
+  // directions.
+  void RunBidirectional(const int time_step, const T *wx_t, const T *u_t,
+                        const T *h, const T *v, const T *grad_out, T *dwx,
+                        T *du, void *workspace);
 
 private:
-  void IterateInternal(const T *u_t, const T *h, const T *v, const T *dh_new,
-                       T *dh, T *dwx);
+  // `v` is the gate cache of the step; when it is null the gates are
+  // recomputed from `wx` and `uh` instead.
+  void IterateInternal(const T *u_t, const T *h, const T *v, const T *wx,
+                       const T *uh, const T *dh_new, T *dh, T *dwx,
+                       const int batch_size, const int ldh, const int ldwx,
+                       const Zoneout &zoneout, const int step,
+                       const cudaStream_t &stream);
+
+  // Adds the `du` contribution of the `steps` steps starting at `h` and
+  // `dwx` on the second stream, overwriting `du` instead when `overwrite`.
+  void AccumulateGradient(const T *h, const T *dwx, T *du, const int steps,
+                          const bool overwrite);
 
   struct private_data;
   private_data *data_;
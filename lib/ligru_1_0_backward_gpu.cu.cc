@@ -16,185 +16,136 @@
 #include <cublas_v2.h>
 #include <cuda_runtime_api.h>
 
+#include "autotune.h"
 #include "blas.h"
-#include "device_assert.h"
 #include "inline_ops.h"
 #include "ligru_1_0.h"
+#include "profiler.h"
+#include "workspace.h"
+#include "zoneout.h"
 
 namespace {
 
-template <typename T>
-__global__ void PointwiseOperationsReLU(
-    const int batch_dim, const int hidden_dim, const T *h, const T *v,
-    T *dh_prev, const T *grad_out,
-    T *dwx) {
-  const int row = blockDim.x * blockIdx.x + threadIdx.x;
-  const int col = blockDim.y * blockIdx.y + threadIdx.y;
-
-  if (row >= hidden_dim || col >= batch_dim)
-    return;
-
-  const int base_idx = col * hidden_dim + row;
-
-  T dh = grad_out[base_idx] + dh_prev[base_idx];
-
-  const int stride3_base_idx = col * (hidden_dim * 3) + row;
-  const int z_idx = stride3_base_idx + 1 * hidden_dim;
-  const int a_idx = stride3_base_idx + 0 * hidden_dim;
-  const int hcand_idx = stride3_base_idx + 2 * hidden_dim;
-
-  const T z = v[z_idx];
-  const T a = v[a_idx];
-  const T hcand = v[hcand_idx];
-
-  const T tmp = (static_cast<T>(1.0) - z) * dh;
-  const T dat = d_relu(a) * tmp;
-  const T dzt = (h[base_idx] - hcand) * z * tmp;
-
-  dh_prev[base_idx] = dh * z;
-
-  const int idx = col * (hidden_dim * 2) + row;
-  dwx[idx + 1 * hidden_dim] = dzt;
-  dwx[idx + 0 * hidden_dim] = dat;
-}
-
-template <typename T>
-__global__ void PointwiseOperationsLeakyReLU(
-    const int batch_dim, const int hidden_dim, const T *h, const T *v,
-    T *dh_prev, const T *grad_out,
-    T *dwx) { 
-  const int row = blockDim.x * blockIdx.x + threadIdx.x;
+using haste::v0::Zoneout;
+using haste::v0::zoneout_keep;
+
+constexpr int kPointwiseBlockDim = 256;
+constexpr int kPointwiseMinBlocks = 4;
+
+// Number of steps whose `dwx` is folded into `du` by each product issued
+// during the backward recurrence.
+constexpr int kGradientChunk = 16;
+
+// Backpropagates through the gates of `kVec` consecutive hidden units of one
+// batch element per thread. The gates are read from the cache `v`, or
+// recomputed from `wx` (with rows `ldwx` apart) and `uh` when `Recompute` is
+// set. The zoneout masks of step `step` are regenerated from `zoneout`.
+// Vectorized launches need `hidden_dim` to be a multiple of `kVec` and every
+// pointer aligned to `aligned_vector<T, kVec>`.
+template <typename T, typename Activation, bool Recompute, int kVec>
+__global__ void __launch_bounds__(kPointwiseBlockDim, kPointwiseMinBlocks)
+    PointwiseOperations(const int batch_dim, const int hidden_dim,
+                        const int ldh, const int ldwx, const T *h, const T *v,
+                        const T *wx, const T *uh, T *dh_prev,
+                        const T *grad_out, T *dwx, const Zoneout zoneout,
+                        const int step) {
+  using acc_t = typename acc_type<T>::type;
+  using vec_t = aligned_vector<T, kVec>;
+
+  const int row = (blockDim.x * blockIdx.x + threadIdx.x) * kVec;
   const int col = blockDim.y * blockIdx.y + threadIdx.y;
 
   if (row >= hidden_dim || col >= batch_dim)
     return;
 
   const int base_idx = col * hidden_dim + row;
-
-  T dh = grad_out[base_idx] + dh_prev[base_idx];
-
-  const int stride3_base_idx = col * (hidden_dim * 3) + row;
-  const int z_idx = stride3_base_idx + 1 * hidden_dim;
-  const int a_idx = stride3_base_idx + 0 * hidden_dim;
-  const int hcand_idx = stride3_base_idx + 2 * hidden_dim;
-
-  const T z = v[z_idx];
-  const T a = v[a_idx];
-  const T hcand = v[hcand_idx];
-
-  const T tmp = (static_cast<T>(1.0) - z) * dh;
-  const T dat = d_leaky_relu(a) * tmp;
-  const T dzt = (h[base_idx] - hcand) * z * tmp;
-
-  dh_prev[base_idx] = dh * z;
-
-  const int idx = col * (hidden_dim * 2) + row;
-  dwx[idx + 1 * hidden_dim] = dzt;
-  dwx[idx + 0 * hidden_dim] = dat;
-}
-
-template <typename T>
-__global__ void PointwiseOperationsTanh(
-    const int batch_dim, const int hidden_dim, const T *h, const T *v,
-    T *dh_prev, const T *grad_out,
-    T *dwx) { 
-  const int row = blockDim.x * blockIdx.x + threadIdx.x;
-  const int col = blockDim.y * blockIdx.y + threadIdx.y;
-
-  if (row >= hidden_dim || col >= batch_dim)
-    return;
-
-  const int base_idx = col * hidden_dim + row;
-
-  T dh = grad_out[base_idx] + dh_prev[base_idx];
-
-  const int stride3_base_idx = col * (hidden_dim * 3) + row;
-  const int z_idx = stride3_base_idx + 1 * hidden_dim;
-  const int a_idx = stride3_base_idx + 0 * hidden_dim;
-  const int hcand_idx = stride3_base_idx + 2 * hidden_dim;
-
-  const T z = v[z_idx];
-  const T a = v[a_idx];
-  const T hcand = v[hcand_idx];
-
-  const T tmp = (static_cast<T>(1.0) - z) * dh;
-  const T dat = d_tanh(a) * tmp;
-  const T dzt = (h[base_idx] - hcand) * z * tmp;
-
-  dh_prev[base_idx] = dh * z;
-
+  const int h_idx = col * ldh + row;
   const int idx = col * (hidden_dim * 2) + row;
-  dwx[idx + 1 * hidden_dim] = dzt;
-  dwx[idx + 0 * hidden_dim] = dat;
-}
-
-template <typename T>
-__global__ void PointwiseOperationsSin(
-    const int batch_dim, const int hidden_dim, const T *h, const T *v,
-    T *dh_prev, const T *grad_out,
-    T *dwx) { // Zoneout mask (only used if ApplyZoneout==true)
-  const int row = blockDim.x * blockIdx.x + threadIdx.x;
-  const int col = blockDim.y * blockIdx.y + threadIdx.y;
-
-  if (row >= hidden_dim || col >= batch_dim)
-    return;
-
-  const int base_idx = col * hidden_dim + row;
-
-  T dh = grad_out[base_idx] + dh_prev[base_idx];
 
   const int stride3_base_idx = col * (hidden_dim * 3) + row;
   const int z_idx = stride3_base_idx + 1 * hidden_dim;
   const int a_idx = stride3_base_idx + 0 * hidden_dim;
   const int hcand_idx = stride3_base_idx + 2 * hidden_dim;
 
-  const T z = v[z_idx];
-  const T a = v[a_idx];
-  const T hcand = v[hcand_idx];
+  const vec_t grad = load_vector<kVec>(grad_out + h_idx);
+  const vec_t dh_next = load_vector<kVec>(dh_prev + base_idx);
+  const vec_t h_prev = load_vector<kVec>(h + h_idx);
 
-  const T tmp = (static_cast<T>(1.0) - z) * dh;
-  const T dat = d_sin(a) * tmp;
-  const T dzt = (h[base_idx] - hcand) * z * tmp;
-
-  dh_prev[base_idx] = dh * z;
+  vec_t gate_a, gate_z, gate_hcand, uh_a, uh_z;
+  if (Recompute) {
+    gate_a = load_vector<kVec>(wx + col * ldwx + row + 0 * hidden_dim);
+    gate_z = load_vector<kVec>(wx + col * ldwx + row + 1 * hidden_dim);
+    uh_a = load_vector<kVec>(uh + idx + 0 * hidden_dim);
+    uh_z = load_vector<kVec>(uh + idx + 1 * hidden_dim);
+  } else {
+    gate_a = load_vector<kVec>(v + a_idx);
+    gate_z = load_vector<kVec>(v + z_idx);
+    gate_hcand = load_vector<kVec>(v + hcand_idx);
+  }
 
-  const int idx = col * (hidden_dim * 2) + row;
-  dwx[idx + 1 * hidden_dim] = dzt;
-  dwx[idx + 0 * hidden_dim] = dat;
-}
+  vec_t dh_out, da_out, dz_out;
+#pragma unroll
+  for (int j = 0; j < kVec; ++j) {
+    const acc_t dh =
+        static_cast<acc_t>(grad.val[j]) + static_cast<acc_t>(dh_next.val[j]);
+
+    acc_t z, a, hcand;
+    if (Recompute) {
+      z = sigmoid(static_cast<acc_t>(gate_z.val[j]) +
+                  static_cast<acc_t>(uh_z.val[j]));
+      a = static_cast<acc_t>(gate_a.val[j]) + static_cast<acc_t>(uh_a.val[j]);
+      hcand = Activation::forward(a);
+    } else {
+      z = static_cast<acc_t>(gate_z.val[j]);
+      a = static_cast<acc_t>(gate_a.val[j]);
+      hcand = static_cast<acc_t>(gate_hcand.val[j]);
+    }
+
+    // A unit that zoned out passes its whole gradient to the previous state.
+    acc_t keep = static_cast<acc_t>(0.0);
+    if (zoneout.prob > 0.0f)
+      keep = zoneout_keep<acc_t>(zoneout, col * hidden_dim + row + j, step);
+    const acc_t dh_gates = (static_cast<acc_t>(1.0) - keep) * dh;
+
+    const acc_t tmp = (static_cast<acc_t>(1.0) - z) * dh_gates;
+    const acc_t dat = Activation::backward(a) * tmp;
+    const acc_t dzt = (static_cast<acc_t>(h_prev.val[j]) - hcand) * z * tmp;
+
+    dh_out.val[j] = static_cast<T>(keep * dh + z * dh_gates);
+    da_out.val[j] = static_cast<T>(dat);
+    dz_out.val[j] = static_cast<T>(dzt);
+  }
 
-#if defined(__CUDA_ARCH__) && (__CUDA_ARCH__ < 700)
-template <typename T>
-__global__ void PointwiseOperationsReLU(const int batch_dim,
-                                        const int hidden_dim, const half *h,
-                                        const half *v, half *dh,
-                                        const half *dh_new, half *dwx) {
-  device_assert_fail("FP16 is not supported on compute capability < 7.0.");
-}
+  store_vector(dh_prev + base_idx, dh_out);
 
-template <typename T>
-__global__ void
-PointwiseOperationsLeakyReLU(const int batch_dim, const int hidden_dim,
-                             const half *h, const half *v, half *dh,
-                             const half *dh_new, half *dwx) {
-  device_assert_fail("FP16 is not supported on compute capability < 7.0.");
+  store_vector(dwx + idx + 1 * hidden_dim, dz_out);
+  store_vector(dwx + idx + 0 * hidden_dim, da_out);
 }
 
 template <typename T>
-__global__ void PointwiseOperationsTanh(const int batch_dim,
-                                        const int hidden_dim, const half *h,
-                                        const half *v, half *dh,
-                                        const half *dh_new, half *dwx) {
-  device_assert_fail("FP16 is not supported on compute capability < 7.0.");
+using PointwiseKernel = void (*)(const int, const int, const int, const int,
+                                 const T *, const T *, const T *, const T *,
+                                 T *, const T *, T *, const Zoneout,
+                                 const int);
+
+template <typename T, bool Recompute, int kVec>
+PointwiseKernel<T> SelectPointwiseActivation(const int activation) {
+  if (activation == 0)
+    return PointwiseOperations<T, ReLU, Recompute, kVec>;
+  if (activation == 1)
+    return PointwiseOperations<T, LeakyReLU, Recompute, kVec>;
+  if (activation == 2)
+    return PointwiseOperations<T, Sin, Recompute, kVec>;
+  return PointwiseOperations<T, Tanh, Recompute, kVec>;
 }
 
-template <typename T>
-__global__ void
-PointwiseOperationsSin(const int batch_dim, const int hidden_dim, const half *h,
-                       const half *v, half *dh, const half *dh_new, half *dwx) {
-  device_assert_fail("FP16 is not supported on compute capability < 7.0.");
+template <typename T, int kVec>
+PointwiseKernel<T> SelectPointwiseKernel(const bool recompute,
+                                         const int activation) {
+  if (recompute)
+    return SelectPointwiseActivation<T, true, kVec>(activation);
+  return SelectPointwiseActivation<T, false, kVec>(activation);
 }
-#endif
 
 } // anonymous namespace
 
@@ -207,6 +158,9 @@ template <typename T> struct BackwardPass<T>::private_data {
   int input_size;
   int hidden_size;
   int activation;
+  Zoneout zoneout;
+  const T *dh_final;
+  T *dh_initial;
   cublasHandle_t blas_handle;
   cudaStream_t stream[2];
   cudaEvent_t event;
@@ -226,6 +180,8 @@ BackwardPass<T>::BackwardPass(const int batch_size, const int input_size,
   data_->hidden_size = hidden_size;
   data_->blas_handle = blas_handle;
   data_->sync_stream = stream;
+  data_->dh_final = nullptr;
+  data_->dh_initial = nullptr;
   cudaStreamCreate(&data_->stream[0]);
   cudaStreamCreate(&data_->stream[1]);
   cudaEventCreateWithFlags(&data_->event, cudaEventDisableTiming);
@@ -247,57 +203,259 @@ template <typename T> BackwardPass<T>::~BackwardPass() {
   delete data_;
 }
 
+template <typename T>
+void BackwardPass<T>::SetZoneout(const Zoneout &zoneout) {
+  data_->zoneout = zoneout;
+}
+
+template <typename T>
+void BackwardPass<T>::SetStateGradient(const T *dh_final, T *dh_initial) {
+  data_->dh_final = dh_final;
+  data_->dh_initial = dh_initial;
+}
+
+template <typename T>
+size_t BackwardPass<T>::GetWorkspaceSize(const int time_step,
+                                         const int batch_size,
+                                         const int hidden_size,
+                                         const bool training,
+                                         const bool bidirectional) {
+  // `dh` for each direction, plus the recurrent product `RunRecompute`
+  // redoes at every step.
+  const int directions = bidirectional ? 2 : 1;
+  size_t size = workspace_size<T>(directions * batch_size * hidden_size);
+  if (!training)
+    size += workspace_size<T>(batch_size * hidden_size * 2);
+  return size;
+}
+
 template <typename T>
 void BackwardPass<T>::IterateInternal(const T *u_t, const T *h, const T *v,
-                                      const T *grad_out, T *dh, T *dwx) {
+                                      const T *wx, const T *uh,
+                                      const T *grad_out, T *dh, T *dwx,
+                                      const int batch_size, const int ldh,
+                                      const int ldwx, const Zoneout &zoneout,
+                                      const int step,
+                                      const cudaStream_t &stream1) {
   const T alpha = static_cast<T>(1.0);
   const T beta_sum = static_cast<T>(1.0);
 
-  const int batch_size = data_->batch_size;
   const int hidden_size = data_->hidden_size;
   const cublasHandle_t blas_handle = data_->blas_handle;
-  const cudaStream_t stream1 = data_->stream[0];
   const cudaEvent_t event = data_->event;
 
-  const dim3 blockDim(32, 16);
-  const dim3 gridDim((hidden_size + blockDim.x - 1) / blockDim.x,
+  constexpr int kVec = vector_width<T>::value;
+  const bool recompute = v == nullptr;
+  const bool vectorized =
+      hidden_size % kVec == 0 &&
+      is_aligned<T, kVec>({h, v, wx, uh, dh, grad_out, dwx});
+  const PointwiseKernel<T> kernel =
+      vectorized ? SelectPointwiseKernel<T, kVec>(recompute, data_->activation)
+                 : SelectPointwiseKernel<T, 1>(recompute, data_->activation);
+  const int vec = vectorized ? kVec : 1;
+
+  const dim3 blockDim(32, kPointwiseBlockDim / 32);
+  const dim3 gridDim((hidden_size / vec + blockDim.x - 1) / blockDim.x,
                      (batch_size + blockDim.y - 1) / blockDim.y);
 
-  if (data_->activation == 0) {
-    PointwiseOperationsReLU<T><<<gridDim, blockDim, 0, stream1>>>(
-        batch_size, hidden_size, h, v, dh, grad_out, dwx);
-    cudaEventRecord(event, stream1);
-  } else if (data_->activation == 1) {
-    PointwiseOperationsLeakyReLU<T><<<gridDim, blockDim, 0, stream1>>>(
-        batch_size, hidden_size, h, v, dh, grad_out, dwx);
-    cudaEventRecord(event, stream1);
-  } else if (data_->activation == 2) {
-    PointwiseOperationsSin<T><<<gridDim, blockDim, 0, stream1>>>(
-        batch_size, hidden_size, h, v, dh, grad_out, dwx);
-    cudaEventRecord(event, stream1);
-  } else if (data_->activation == 3) {
-    PointwiseOperationsTanh<T><<<gridDim, blockDim, 0, stream1>>>(
-        batch_size, hidden_size, h, v, dh, grad_out, dwx);
-    cudaEventRecord(event, stream1);
+  {
+    const profiler::Range range(
+        profiler::kPointwise, stream1,
+        sizeof(T) * (recompute ? 10.0 : 9.0) * batch_size * hidden_size);
+    kernel<<<gridDim, blockDim, 0, stream1>>>(batch_size, hidden_size, ldh,
+                                              ldwx, h, v, wx, uh, dh, grad_out,
+                                              dwx, zoneout, step);
   }
-
+  // Lets the caller's `du` product on the other stream read `dwx`.
+  cudaEventRecord(event, stream1);
+
+  // dh += u^T dwx reads `dh` back, hence its two passes.
+  const profiler::Range range(
+      profiler::kRecurrentGemm, stream1,
+      sizeof(T) * (2.0 * hidden_size * hidden_size +
+                   4.0 * batch_size * hidden_size));
+  const autotune::GemmPlan *plan = autotune::PlanGemm<T>(
+      CUBLAS_OP_N, CUBLAS_OP_N, hidden_size, batch_size, hidden_size * 2,
+      hidden_size, hidden_size * 2, hidden_size, stream1);
   cublasSetStream(blas_handle, stream1);
-  blas<T>::gemm(blas_handle, CUBLAS_OP_N, CUBLAS_OP_N, hidden_size, batch_size,
-                hidden_size * 2, &alpha, u_t, hidden_size, dwx, hidden_size * 2,
-                &beta_sum, dh, hidden_size);
+  autotune::gemm<T>(plan, blas_handle, CUBLAS_OP_N, CUBLAS_OP_N, hidden_size,
+                    batch_size, hidden_size * 2, &alpha, u_t, hidden_size, dwx,
+                    hidden_size * 2, &beta_sum, dh, hidden_size);
+}
 
-  cudaStreamWaitEvent(stream1, event, 0);
-};
+template <typename T>
+void BackwardPass<T>::AccumulateGradient(const T *h, const T *dwx, T *du,
+                                         const int steps,
+                                         const bool overwrite) {
+  const T alpha = static_cast<T>(1.0);
+  const T beta = static_cast<T>(0.0);
+  const T beta_sum = static_cast<T>(1.0);
+
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream2 = data_->stream[1];
+
+  // `event` was last recorded after the pointwise kernel of the earliest
+  // step of the chunk, which is also the last one to write its `dwx`.
+  cudaStreamWaitEvent(stream2, data_->event, 0);
+
+  // du += h^T dwx over the chunk, in the `[2H, H]` layout of the weight.
+  const profiler::Range range(
+      profiler::kWeightGrad, stream2,
+      sizeof(T) * (3.0 * data_->batch_size * steps * hidden_size +
+                   (overwrite ? 2.0 : 4.0) * hidden_size * hidden_size));
+  cublasSetStream(blas_handle, stream2);
+  blas<T>::gemm(blas_handle, CUBLAS_OP_N, CUBLAS_OP_T, hidden_size,
+                hidden_size * 2, data_->batch_size * steps, &alpha, h,
+                hidden_size, dwx, hidden_size * 2,
+                overwrite ? &beta : &beta_sum, du, hidden_size);
+}
 
 template <typename T>
 void BackwardPass<T>::Run(const int time_step, const T *wx_t, const T *u_t,
                           const T *h, const T *v, const T *grad_out, T *dwx,
-                          T *du, T *dh) {
+                          T *du, void *workspace) {
+  const profiler::Scope scope("ligru_1_0::BackwardPass::Run");
+
+  const blas<void>::enable_tensor_cores scoped0(data_->blas_handle);
+  const blas<void>::set_pointer_mode scoped1(data_->blas_handle);
+
+  const int batch_size = data_->batch_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  // `dh` carries the gradient from one step to the previous one.
+  const int NH = batch_size * hidden_size;
+  T *dh = take_workspace<T>(workspace, NH);
+  if (data_->dh_final)
+    cudaMemcpyAsync(dh, data_->dh_final, NH * sizeof(T),
+                    cudaMemcpyDeviceToDevice, data_->sync_stream);
+  else
+    cudaMemsetAsync(dh, 0, NH * sizeof(T), data_->sync_stream);
+
+  // Order the internal streams after the work already queued on the caller's
+  // stream; this also lets them join a stream capture started on it.
+  cudaEventRecord(data_->event, data_->sync_stream);
+  cudaStreamWaitEvent(data_->stream[0], data_->event, 0);
+  cudaStreamWaitEvent(data_->stream[1], data_->event, 0);
+
+  // `du` is accumulated on the second stream as soon as each chunk of `dwx`
+  // is complete, so the products overlap with the rest of the recurrence.
+  int chunk_end = time_step;
+  for (int i = time_step - 1; i >= 0; --i) {
+    IterateInternal(u_t, h + i * NH, v + i * NH * 3, nullptr, nullptr,
+                    grad_out + (i + 1) * NH, dh, dwx + i * NH * 2, batch_size,
+                    hidden_size, hidden_size * 2, data_->zoneout, i,
+                    data_->stream[0]);
+    if (i % kGradientChunk == 0) {
+      AccumulateGradient(h + i * NH, dwx + i * NH * 2, du, chunk_end - i,
+                         chunk_end == time_step);
+      chunk_end = i;
+    }
+  }
+
+  if (data_->dh_initial)
+    cudaMemcpyAsync(data_->dh_initial, dh, NH * sizeof(T),
+                    cudaMemcpyDeviceToDevice, data_->stream[0]);
+
+  // Order the caller's stream after everything issued above so the pass can
+  // be reused by later calls without being destroyed.
+  cudaEventRecord(data_->event, data_->stream[1]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+  cudaEventRecord(data_->event, data_->stream[0]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+
+  cublasSetStream(blas_handle, save_stream);
+}
+
+template <typename T>
+void BackwardPass<T>::RunRecompute(const int time_step, const T *wx,
+                                   const T *u_t, const T *h,
+                                   const T *grad_out, T *dwx, T *du,
+                                   void *workspace, const bool batch_first) {
+  const profiler::Scope scope("ligru_1_0::BackwardPass::RunRecompute");
 
   const blas<void>::enable_tensor_cores scoped0(data_->blas_handle);
   const blas<void>::set_pointer_mode scoped1(data_->blas_handle);
 
   const T alpha = static_cast<T>(1.0);
+  const T beta = static_cast<T>(0.0);
+
+  const int batch_size = data_->batch_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream1 = data_->stream[0];
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  const int NH = batch_size * hidden_size;
+  T *dh = take_workspace<T>(workspace, NH);
+  T *tmp_uh = take_workspace<T>(workspace, NH * 2);
+  if (data_->dh_final)
+    cudaMemcpyAsync(dh, data_->dh_final, NH * sizeof(T),
+                    cudaMemcpyDeviceToDevice, data_->sync_stream);
+  else
+    cudaMemsetAsync(dh, 0, NH * sizeof(T), data_->sync_stream);
+
+  cudaEventRecord(data_->event, data_->sync_stream);
+  cudaStreamWaitEvent(data_->stream[0], data_->event, 0);
+  cudaStreamWaitEvent(data_->stream[1], data_->event, 0);
+
+  // Each step first redoes the forward recurrent product of its input state,
+  // which the pointwise kernel combines with `wx` to rebuild the gates.
+  const int wx_step = batch_first ? hidden_size * 2 : NH * 2;
+  const int ldwx = batch_first ? time_step * hidden_size * 2 : hidden_size * 2;
+  int chunk_end = time_step;
+  for (int i = time_step - 1; i >= 0; --i) {
+    {
+      const profiler::Range range(
+          profiler::kRecurrentGemm, stream1,
+          sizeof(T) * (2.0 * hidden_size * hidden_size +
+                       3.0 * batch_size * hidden_size));
+      cublasSetStream(blas_handle, stream1);
+      blas<T>::gemm(blas_handle, CUBLAS_OP_T, CUBLAS_OP_N, hidden_size * 2,
+                    batch_size, hidden_size, &alpha, u_t, hidden_size,
+                    h + i * NH, hidden_size, &beta, tmp_uh, hidden_size * 2);
+    }
+
+    IterateInternal(u_t, h + i * NH, nullptr, wx + i * wx_step, tmp_uh,
+                    grad_out + (i + 1) * NH, dh, dwx + i * NH * 2, batch_size,
+                    hidden_size, ldwx, data_->zoneout, i, stream1);
+    if (i % kGradientChunk == 0) {
+      AccumulateGradient(h + i * NH, dwx + i * NH * 2, du, chunk_end - i,
+                         chunk_end == time_step);
+      chunk_end = i;
+    }
+  }
+
+  if (data_->dh_initial)
+    cudaMemcpyAsync(data_->dh_initial, dh, NH * sizeof(T),
+                    cudaMemcpyDeviceToDevice, stream1);
+
+  cudaEventRecord(data_->event, data_->stream[1]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+  cudaEventRecord(data_->event, data_->stream[0]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+
+  cublasSetStream(blas_handle, save_stream);
+}
+
+template <typename T>
+void BackwardPass<T>::RunPacked(const int time_step, const int *batch_sizes,
+                                const T *wx_t, const T *u_t, const T *h,
+                                const T *v, const T *grad_out, T *dwx, T *du,
+                                void *workspace) {
+  const profiler::Scope scope("ligru_1_0::BackwardPass::RunPacked");
+
+  const blas<void>::enable_tensor_cores scoped0(data_->blas_handle);
+  const blas<void>::set_pointer_mode scoped1(data_->blas_handle);
+
+  const T alpha = static_cast<T>(1.0);
+  const T beta = static_cast<T>(0.0);
   const T beta_sum = static_cast<T>(1.0);
 
   const int batch_size = data_->batch_size;
@@ -310,18 +468,129 @@ void BackwardPass<T>::Run(const int time_step, const T *wx_t, const T *u_t,
   cublasGetStream(blas_handle, &save_stream);
 
   const int NH = batch_size * hidden_size;
+  T *dh = take_workspace<T>(workspace, NH);
+  if (data_->dh_final)
+    cudaMemcpyAsync(dh, data_->dh_final, NH * sizeof(T),
+                    cudaMemcpyDeviceToDevice, data_->sync_stream);
+  else
+    cudaMemsetAsync(dh, 0, NH * sizeof(T), data_->sync_stream);
+
+  cudaEventRecord(data_->event, data_->sync_stream);
+  cudaStreamWaitEvent(data_->stream[0], data_->event, 0);
+  cudaStreamWaitEvent(data_->stream[1], data_->event, 0);
+
+  // A single `du` product would also sweep the padded rows, so each step
+  // accumulates its own as soon as its `dwx` is ready, overlapping with the
+  // rest of the recurrence on the second stream.
   for (int i = time_step - 1; i >= 0; --i) {
-    IterateInternal(u_t, h + i * NH, v + i * NH * 3, grad_out + (i + 1) * NH,
-                    dh, dwx + i * NH * 2);
+    IterateInternal(u_t, h + i * NH, v + i * NH * 3, nullptr, nullptr,
+                    grad_out + (i + 1) * NH, dh, dwx + i * NH * 2,
+                    batch_sizes[i], hidden_size, hidden_size * 2,
+                    data_->zoneout, i, data_->stream[0]);
+
+    cudaStreamWaitEvent(stream2, event, 0);
+    const profiler::Range range(
+        profiler::kWeightGrad, stream2,
+        sizeof(T) * (3.0 * batch_sizes[i] * hidden_size +
+                     4.0 * hidden_size * hidden_size));
+    cublasSetStream(blas_handle, stream2);
+    blas<T>::gemm(blas_handle, CUBLAS_OP_N, CUBLAS_OP_T, hidden_size,
+                  hidden_size * 2, batch_sizes[i], &alpha, h + i * NH,
+                  hidden_size, dwx + i * NH * 2, hidden_size * 2,
+                  i == time_step - 1 ? &beta : &beta_sum, du, hidden_size);
   }
 
-  cudaStreamWaitEvent(stream2, event, 0);
+  if (data_->dh_initial)
+    cudaMemcpyAsync(data_->dh_initial, dh, NH * sizeof(T),
+                    cudaMemcpyDeviceToDevice, data_->stream[0]);
 
-  cublasSetStream(blas_handle, stream2);
-  blas<T>::gemm(blas_handle, CUBLAS_OP_N, CUBLAS_OP_T, hidden_size * 2,
-                hidden_size, batch_size * time_step, &alpha, dwx,
-                hidden_size * 2, h, hidden_size, &beta_sum, du,
-                hidden_size * 2);
+  cudaEventRecord(data_->event, data_->stream[1]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+  cudaEventRecord(data_->event, data_->stream[0]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+
+  cublasSetStream(blas_handle, save_stream);
+}
+
+template <typename T>
+void BackwardPass<T>::RunBidirectional(const int time_step, const T *wx_t,
+                                       const T *u_t, const T *h, const T *v,
+                                       const T *grad_out, T *dwx, T *du,
+                                       void *workspace) {
+  const profiler::Scope scope("ligru_1_0::BackwardPass::RunBidirectional");
+
+  const blas<void>::enable_tensor_cores scoped0(data_->blas_handle);
+  const blas<void>::set_pointer_mode scoped1(data_->blas_handle);
+
+  const T alpha = static_cast<T>(1.0);
+  const T beta = static_cast<T>(0.0);
+  const T beta_sum = static_cast<T>(1.0);
+
+  const int batch_size = data_->batch_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream2 = data_->stream[1];
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  const int NH = batch_size * hidden_size;
+  T *dh = take_workspace<T>(workspace, NH * 2);
+  if (data_->dh_final)
+    cudaMemcpyAsync(dh, data_->dh_final, NH * 2 * sizeof(T),
+                    cudaMemcpyDeviceToDevice, data_->sync_stream);
+  else
+    cudaMemsetAsync(dh, 0, NH * 2 * sizeof(T), data_->sync_stream);
+
+  cudaEventRecord(data_->event, data_->sync_stream);
+  cudaStreamWaitEvent(data_->stream[0], data_->event, 0);
+  cudaStreamWaitEvent(data_->stream[1], data_->event, 0);
+
+  // Walk each direction back in the opposite order it was computed in, the
+  // forward one on stream[0] and the reverse one on stream[1].
+  const int ldh = hidden_size * 2;
+  const T *h_reverse = h + 2 * NH * 2 + hidden_size;
+  T *dwx_reverse = dwx + time_step * NH * 2;
+  const Zoneout reverse_zoneout = reverse_direction(data_->zoneout);
+  for (int i = 0; i < time_step; ++i) {
+    const int j = time_step - 1 - i;
+    IterateInternal(u_t, h + j * NH * 2, v + j * NH * 3, nullptr, nullptr,
+                    grad_out + (j + 1) * NH * 2, dh, dwx + j * NH * 2,
+                    batch_size, ldh, hidden_size * 2, data_->zoneout, j,
+                    data_->stream[0]);
+    IterateInternal(u_t, h_reverse + i * NH * 2,
+                    v + (time_step + i) * NH * 3, nullptr, nullptr,
+                    grad_out + (i + 1) * NH * 2 + hidden_size, dh + NH,
+                    dwx_reverse + i * NH * 2, batch_size, ldh,
+                    hidden_size * 2, reverse_zoneout, i, stream2);
+  }
+
+  cudaEventRecord(data_->event, data_->stream[0]);
+  cudaStreamWaitEvent(stream2, data_->event, 0);
+
+  if (data_->dh_initial)
+    cudaMemcpyAsync(data_->dh_initial, dh, NH * 2 * sizeof(T),
+                    cudaMemcpyDeviceToDevice, stream2);
+
+  {
+    const profiler::Range range(
+        profiler::kWeightGrad, stream2,
+        sizeof(T) * (6.0 * batch_size * time_step * hidden_size +
+                     6.0 * hidden_size * hidden_size));
+    cublasSetStream(blas_handle, stream2);
+    blas<T>::gemm(blas_handle, CUBLAS_OP_N, CUBLAS_OP_T, hidden_size,
+                  hidden_size * 2, batch_size * time_step, &alpha, h, ldh, dwx,
+                  hidden_size * 2, &beta, du, hidden_size);
+    blas<T>::gemm(blas_handle, CUBLAS_OP_N, CUBLAS_OP_T, hidden_size,
+                  hidden_size * 2, batch_size * time_step, &alpha, h_reverse,
+                  ldh, dwx_reverse, hidden_size * 2, &beta_sum, du,
+                  hidden_size);
+  }
+
+  cudaEventRecord(data_->event, data_->stream[1]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+  cudaEventRecord(data_->event, data_->stream[0]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
 
   cublasSetStream(blas_handle, save_stream);
 }
@@ -13,198 +13,256 @@
 // limitations under the License.
 // ==============================================================================
 
+#include <algorithm>
+#include <cassert>
+#include <cooperative_groups.h>
 #include <cublas_v2.h>
 #include <cuda_fp16.h>
 #include <cuda_runtime_api.h>
 
+#include "autotune.h"
 #include "blas.h"
 #include "device_assert.h"
 #include "inline_ops.h"
+#include "l2_persistence.h"
 #include "ligru_1_0.h"
+#include "profiler.h"
+#include "quantized_weight.h"
+#include "state_table.h"
+#include "workspace.h"
+#include "zoneout.h"
 #include <string>
 
 namespace {
 
-template <typename T, bool Training>
-__global__ void
-PointwiseOperationsReLU(const int batch_dim, const int hidden_dim, const T *wx,
-                        const T *uh, const T *h, T *h_out, T *v) {
-  const int row = blockDim.x * blockIdx.x + threadIdx.x;
+using haste::v0::Zoneout;
+using haste::v0::zoneout_keep;
+
+constexpr int kPointwiseBlockDim = 256;
+constexpr int kPointwiseMinBlocks = 4;
+// Widths along the hidden units of the `kPointwiseBlockDim` threads blocks
+// the autotuner picks from; the first one is the default.
+constexpr int kPointwiseBlockWidths[] = {32, 64, 128, 256};
+constexpr int kNumPointwiseBlockWidths = 4;
+
+// Applies the gates to `kVec` consecutive hidden units of one batch element
+// per thread. `ldwx` is the distance between the `wx` rows of two batch
+// elements, and `b` is an optional `[2 * hidden_dim]` bias added to every row
+// of `wx`. `zoneout` is applied to `h_out` as step `step` of the sequence;
+// `v` holds the gates before it. Vectorized launches need `hidden_dim` to be a
+// multiple of `kVec` and every pointer aligned to `aligned_vector<T, kVec>`.
+template <typename T, bool Training, typename Activation, int kVec>
+__global__ void __launch_bounds__(kPointwiseBlockDim, kPointwiseMinBlocks)
+    PointwiseOperations(const int batch_dim, const int hidden_dim,
+                        const int ldh, const int ldwx, const T *wx,
+                        const T *b, const T *uh, const T *h, T *h_out, T *v,
+                        const Zoneout zoneout, const int step) {
+  using acc_t = typename acc_type<T>::type;
+  using vec_t = aligned_vector<T, kVec>;
+
+  const int row = (blockDim.x * blockIdx.x + threadIdx.x) * kVec;
   const int col = blockDim.y * blockIdx.y + threadIdx.y;
 
   if (row >= hidden_dim || col >= batch_dim)
     return;
 
   const int weight_idx = col * (hidden_dim * 2) + row;
-
-
-  const int output_idx = col * hidden_dim + row;
-
+  const int wx_idx = col * ldwx + row;
+  const int output_idx = col * ldh + row;
 
   const int a_idx = weight_idx + 0 * hidden_dim;
   const int z_idx = weight_idx + 1 * hidden_dim;
 
-  const T z =
-      sigmoid(wx[z_idx] + uh[z_idx]); 
-  const T a = wx[a_idx] + uh[a_idx]; 
-  const T hcand = relu(a);
+  const vec_t wx_a = load_vector<kVec>(wx + wx_idx + 0 * hidden_dim);
+  const vec_t wx_z = load_vector<kVec>(wx + wx_idx + 1 * hidden_dim);
+  const vec_t uh_a = load_vector<kVec>(uh + a_idx);
+  const vec_t uh_z = load_vector<kVec>(uh + z_idx);
+  const vec_t h_prev = load_vector<kVec>(h + output_idx);
 
-  if (Training) {
-    const int base_v_idx = col * (hidden_dim * 3) + row;
-    v[base_v_idx + 1 * hidden_dim] = z;
-    v[base_v_idx + 0 * hidden_dim] = a;
-    v[base_v_idx + 2 * hidden_dim] = hcand;
+  vec_t b_a, b_z;
+  if (b) {
+    b_a = load_vector<kVec>(b + row + 0 * hidden_dim);
+    b_z = load_vector<kVec>(b + row + 1 * hidden_dim);
+  } else {
+#pragma unroll
+    for (int j = 0; j < kVec; ++j)
+      b_a.val[j] = b_z.val[j] = static_cast<T>(0.0);
   }
 
-  T cur_h_value = z * h[output_idx] + (static_cast<T>(1.0) - z) * hcand;
-
-  h_out[output_idx] = cur_h_value;
-}
-
-template <typename T, bool Training>
-__global__ void PointwiseOperationsLeakyReLU(const int batch_dim,
-                                             const int hidden_dim, const T *wx,
-                                             const T *uh, const T *h, T *h_out,
-                                             T *v) {
-  const int row = blockDim.x * blockIdx.x + threadIdx.x;
-  const int col = blockDim.y * blockIdx.y + threadIdx.y;
-
-  if (row >= hidden_dim || col >= batch_dim)
-    return;
-
-  const int weight_idx = col * (hidden_dim * 2) + row;
-
-
-  const int output_idx = col * hidden_dim + row;
-
-
-  const int a_idx = weight_idx + 0 * hidden_dim;
-  const int z_idx = weight_idx + 1 * hidden_dim;
-
-  const T z = sigmoid(wx[z_idx] + uh[z_idx]);
-
-  const T a = wx[a_idx] + uh[a_idx];
-
-  const T hcand = leaky_relu(a);
-
-  if (Training) {
-    const int base_v_idx = col * (hidden_dim * 3) + row;
-    v[base_v_idx + 1 * hidden_dim] = z;
-    v[base_v_idx + 0 * hidden_dim] = a;
-    v[base_v_idx + 2 * hidden_dim] = hcand;
+  vec_t a_out, z_out, hcand_out, h_next;
+#pragma unroll
+  for (int j = 0; j < kVec; ++j) {
+    const acc_t z = sigmoid(static_cast<acc_t>(wx_z.val[j]) +
+                            static_cast<acc_t>(b_z.val[j]) +
+                            static_cast<acc_t>(uh_z.val[j]));
+    const acc_t a = static_cast<acc_t>(wx_a.val[j]) +
+                    static_cast<acc_t>(b_a.val[j]) +
+                    static_cast<acc_t>(uh_a.val[j]);
+    const acc_t hcand = Activation::forward(a);
+
+    a_out.val[j] = static_cast<T>(a);
+    z_out.val[j] = static_cast<T>(z);
+    hcand_out.val[j] = static_cast<T>(hcand);
+
+    const acc_t prev = static_cast<acc_t>(h_prev.val[j]);
+    acc_t next = z * prev + (static_cast<acc_t>(1.0) - z) * hcand;
+    if (zoneout.prob > 0.0f) {
+      const acc_t keep =
+          zoneout_keep<acc_t>(zoneout, col * hidden_dim + row + j, step);
+      next = keep * prev + (static_cast<acc_t>(1.0) - keep) * next;
+    }
+    h_next.val[j] = static_cast<T>(next);
   }
 
-  T cur_h_value = z * h[output_idx] + (static_cast<T>(1.0) - z) * hcand;
-
-  h_out[output_idx] = cur_h_value;
-}
-
-template <typename T, bool Training>
-__global__ void
-PointwiseOperationsTanh(const int batch_dim, const int hidden_dim, const T *wx,
-                        const T *uh, const T *h, T *h_out, T *v) {
-  const int row = blockDim.x * blockIdx.x + threadIdx.x;
-  const int col = blockDim.y * blockIdx.y + threadIdx.y;
-
-  if (row >= hidden_dim || col >= batch_dim)
-    return;
-
-  const int weight_idx = col * (hidden_dim * 2) + row;
-
-
-  const int output_idx = col * hidden_dim + row;
-
-
-  const int a_idx = weight_idx + 0 * hidden_dim;
-  const int z_idx = weight_idx + 1 * hidden_dim;
-
-  const T z = sigmoid(wx[z_idx] + uh[z_idx]);
-
-  const T a = wx[a_idx] + uh[a_idx];
-
-  const T hcand = tanh(a);
-
   if (Training) {
     const int base_v_idx = col * (hidden_dim * 3) + row;
-    v[base_v_idx + 1 * hidden_dim] = z;
-    v[base_v_idx + 0 * hidden_dim] = a;
-    v[base_v_idx + 2 * hidden_dim] = hcand;
+    store_vector(v + base_v_idx + 0 * hidden_dim, a_out);
+    store_vector(v + base_v_idx + 1 * hidden_dim, z_out);
+    store_vector(v + base_v_idx + 2 * hidden_dim, hcand_out);
   }
 
-  T cur_h_value = z * h[output_idx] + (static_cast<T>(1.0) - z) * hcand;
-
-  h_out[output_idx] = cur_h_value;
+  store_vector(h_out + output_idx, h_next);
 }
 
-template <typename T, bool Training>
-__global__ void
-PointwiseOperationsSin(const int batch_dim, const int hidden_dim, const T *wx,
-                       const T *uh, const T *h, T *h_out, T *v) {
-  const int row = blockDim.x * blockIdx.x + threadIdx.x;
-  const int col = blockDim.y * blockIdx.y + threadIdx.y;
-
-  if (row >= hidden_dim || col >= batch_dim)
-    return;
-
-  const int weight_idx = col * (hidden_dim * 2) + row;
-
-
-  const int output_idx = col * hidden_dim + row;
-
-  const int a_idx = weight_idx + 0 * hidden_dim;
-  const int z_idx = weight_idx + 1 * hidden_dim;
-
-  const T z = sigmoid(wx[z_idx] + uh[z_idx]);
-
-  const T a = wx[a_idx] + uh[a_idx];
-
-  const T hcand = sin(a);
-
-  if (Training) {
-    const int base_v_idx = col * (hidden_dim * 3) + row;
-    v[base_v_idx + 1 * hidden_dim] = z;
-    v[base_v_idx + 0 * hidden_dim] = a;
-    v[base_v_idx + 2 * hidden_dim] = hcand;
-  }
-
-  T cur_h_value = z * h[output_idx] + (static_cast<T>(1.0) - z) * hcand;
-
-  h_out[output_idx] = cur_h_value;
+template <typename T>
+using PointwiseKernel = void (*)(const int, const int, const int, const int,
+                                 const T *, const T *, const T *, const T *,
+                                 T *, T *, const Zoneout, const int);
+
+template <typename T, bool Training, int kVec>
+PointwiseKernel<T> SelectPointwiseActivation(const int activation) {
+  if (activation == 0)
+    return PointwiseOperations<T, Training, ReLU, kVec>;
+  if (activation == 1)
+    return PointwiseOperations<T, Training, LeakyReLU, kVec>;
+  if (activation == 2)
+    return PointwiseOperations<T, Training, Sin, kVec>;
+  return PointwiseOperations<T, Training, Tanh, kVec>;
 }
 
-#if defined(__CUDA_ARCH__) && (__CUDA_ARCH__ < 700)
-template <typename T, bool Training>
-__global__ void PointwiseOperationsReLU(const int batch_dim,
-                                        const int hidden_dim, const half *wx,
-                                        const half *uh, const half *h,
-                                        half *h_out, half *v) {
-  device_assert_fail("FP16 is not supported on compute capability < 7.0.");
+template <typename T, int kVec>
+PointwiseKernel<T> SelectPointwiseKernel(const bool training,
+                                         const int activation) {
+  if (training)
+    return SelectPointwiseActivation<T, true, kVec>(activation);
+  return SelectPointwiseActivation<T, false, kVec>(activation);
 }
 
-template <typename T, bool Training>
-__global__ void
-PointwiseOperationsLeakyReLU(const int batch_dim, const int hidden_dim,
-                             const half *wx, const half *uh, const half *h,
-                             half *h_out, half *v) {
-  device_assert_fail("FP16 is not supported on compute capability < 7.0.");
-}
+constexpr int kPersistentBlockDim = 256;
+
+// Weight-stationary forward kernel covering the whole sequence in one launch.
+// Each block owns `units_per_block` hidden units and keeps the matching `a`
+// and `z` rows of `u` in shared memory for all time steps. Every warp computes
+// the recurrent dot products of one (unit, batch) pair, applies the gates and
+// writes `h_out`; the grid then synchronizes before the next step reads it.
+// Step `t` reads its `wx` at `wx + t * wx_step` with rows `ldwx` apart, plus
+// the optional bias `b`.
+template <typename T, bool Training, typename Activation>
+__global__ void __launch_bounds__(kPersistentBlockDim)
+    PersistentForward(const int seq_length, const int batch_dim,
+                      const int hidden_dim, const int units_per_block,
+                      const int wx_step, const int ldwx, const T *wx,
+                      const T *b, const T *u, T *h, T *v) {
+#if defined(__CUDA_ARCH__) && (__CUDA_ARCH__ < 600)
+  device_assert_fail("Grid synchronization requires compute capability 6.0.");
+#else
+  using acc_t = typename acc_type<T>::type;
+
+  extern __shared__ int shared_var[];
+  T *u_shared = reinterpret_cast<T *>(shared_var);
+
+  const int unit_begin = blockIdx.x * units_per_block;
+  const int units = min(units_per_block, hidden_dim - unit_begin);
+
+  // u is the row-major [2H, H] weight; row `r` of the shared copy holds the
+  // weights of gate `r / units` for unit `unit_begin + r % units`, so both
+  // sides of the copy are contiguous along `k`.
+  for (int i = threadIdx.x; i < 2 * units * hidden_dim; i += blockDim.x) {
+    const int k = i % hidden_dim;
+    const int gate = (i / hidden_dim) / units;
+    const int j = (i / hidden_dim) % units;
+    u_shared[i] = u[(gate * hidden_dim + unit_begin + j) * hidden_dim + k];
+  }
+  __syncthreads();
+
+  cooperative_groups::grid_group grid = cooperative_groups::this_grid();
+
+  const int lane = threadIdx.x % 32;
+  const int warp = threadIdx.x / 32;
+  const int num_warps = blockDim.x / 32;
+  const int NH = batch_dim * hidden_dim;
+
+  for (int t = 0; t < seq_length; ++t) {
+    const T *h_t = h + t * NH;
+    T *h_next = h + (t + 1) * NH;
+    const T *wx_t = wx + t * wx_step;
+
+    for (int p = warp; p < units * batch_dim; p += num_warps) {
+      const int j = p % units;
+      const int col = p / units;
+      const T *h_row = h_t + col * hidden_dim;
+      const T *u_a = u_shared + j * hidden_dim;
+      const T *u_z = u_shared + (units + j) * hidden_dim;
+
+      acc_t uh_a = static_cast<acc_t>(0.0);
+      acc_t uh_z = static_cast<acc_t>(0.0);
+      for (int k = lane; k < hidden_dim; k += 32) {
+        const acc_t h_k = static_cast<acc_t>(h_row[k]);
+        uh_a += static_cast<acc_t>(u_a[k]) * h_k;
+        uh_z += static_cast<acc_t>(u_z[k]) * h_k;
+      }
+      uh_a = warp_reduce_sum(uh_a);
+      uh_z = warp_reduce_sum(uh_z);
+
+      if (lane == 0) {
+        const int row = unit_begin + j;
+        const int weight_idx = col * ldwx + row;
+        const int output_idx = col * hidden_dim + row;
+
+        const acc_t b_a =
+            b ? static_cast<acc_t>(b[row]) : static_cast<acc_t>(0.0);
+        const acc_t b_z = b ? static_cast<acc_t>(b[row + hidden_dim])
+                            : static_cast<acc_t>(0.0);
+
+        const acc_t z = sigmoid(
+            static_cast<acc_t>(wx_t[weight_idx + hidden_dim]) + b_z + uh_z);
+        const acc_t a = static_cast<acc_t>(wx_t[weight_idx]) + b_a + uh_a;
+        const acc_t hcand = Activation::forward(a);
+
+        if (Training) {
+          const int base_v_idx = t * NH * 3 + col * (hidden_dim * 3) + row;
+          v[base_v_idx + 0 * hidden_dim] = static_cast<T>(a);
+          v[base_v_idx + 1 * hidden_dim] = static_cast<T>(z);
+          v[base_v_idx + 2 * hidden_dim] = static_cast<T>(hcand);
+        }
+
+        const acc_t cur_h_value =
+            z * static_cast<acc_t>(h_t[output_idx]) +
+            (static_cast<acc_t>(1.0) - z) * hcand;
+        h_next[output_idx] = static_cast<T>(cur_h_value);
+      }
+    }
 
-template <typename T, bool Training>
-__global__ void PointwiseOperationsTanh(const int batch_dim,
-                                        const int hidden_dim, const half *wx,
-                                        const half *uh, const half *h,
-                                        half *h_out, half *v) {
-  device_assert_fail("FP16 is not supported on compute capability < 7.0.");
+    grid.sync();
+  }
+#endif
 }
 
+template <typename T>
+using PersistentKernel = void (*)(const int, const int, const int, const int,
+                                  const int, const int, const T *, const T *,
+                                  const T *, T *, T *);
+
 template <typename T, bool Training>
-__global__ void PointwiseOperationsSin(const int batch_dim,
-                                       const int hidden_dim, const half *wx,
-                                       const half *uh, const half *h,
-                                       half *h_out, half *v) {
-  device_assert_fail("FP16 is not supported on compute capability < 7.0.");
+PersistentKernel<T> SelectPersistentKernel(const int activation) {
+  if (activation == 0)
+    return PersistentForward<T, Training, ReLU>;
+  if (activation == 1)
+    return PersistentForward<T, Training, LeakyReLU>;
+  if (activation == 2)
+    return PersistentForward<T, Training, Sin>;
+  return PersistentForward<T, Training, Tanh>;
 }
-#endif
 } // anonymous namespace
 
 namespace haste {
@@ -217,9 +275,24 @@ template <typename T> struct ForwardPass<T>::private_data {
   int input_size;
   int hidden_size;
   int activation;
+  bool persistent;
+  const T *bias;
+  Zoneout zoneout;
+  QuantizedWeight quantized_u;
+  int groups;
+  bool cooperative_launch;
+  int multiprocessor_count;
+  int max_shared_memory;
+  // Whether the grid of the persistent kernel `co_resident_kernel` with
+  // `co_resident_shared_mem` bytes of shared memory fits on the device, as
+  // found by the first `RunPersistent`.
+  PersistentKernel<T> co_resident_kernel;
+  int co_resident_shared_mem;
+  bool co_resident;
   cublasHandle_t blas_handle;
   cudaStream_t stream[2];
   cudaEvent_t event;
+  cudaEvent_t projection_event;
   cudaStream_t sync_stream;
 };
 
@@ -236,9 +309,28 @@ ForwardPass<T>::ForwardPass(const bool training, const int batch_size,
   data_->hidden_size = hidden_size;
   data_->blas_handle = blas_handle;
   data_->sync_stream = stream;
+  data_->persistent = true;
+  data_->bias = nullptr;
+  data_->groups = 1;
+  data_->co_resident_kernel = nullptr;
+  data_->co_resident_shared_mem = 0;
+  data_->co_resident = false;
+
+  int device;
+  int cooperative_launch;
+  cudaGetDevice(&device);
+  cudaDeviceGetAttribute(&cooperative_launch, cudaDevAttrCooperativeLaunch,
+                         device);
+  cudaDeviceGetAttribute(&data_->multiprocessor_count,
+                         cudaDevAttrMultiProcessorCount, device);
+  cudaDeviceGetAttribute(&data_->max_shared_memory,
+                         cudaDevAttrMaxSharedMemoryPerBlockOptin, device);
+  data_->cooperative_launch = cooperative_launch != 0;
+
   cudaStreamCreate(&data_->stream[0]);
   cudaStreamCreate(&data_->stream[1]);
   cudaEventCreateWithFlags(&data_->event, cudaEventDisableTiming);
+  cudaEventCreateWithFlags(&data_->projection_event, cudaEventDisableTiming);
 }
 
 template <typename T> ForwardPass<T>::~ForwardPass() {
@@ -251,78 +343,502 @@ template <typename T> ForwardPass<T>::~ForwardPass() {
     cudaStreamSynchronize(data_->stream[1]);
     cudaStreamSynchronize(data_->stream[0]);
   }
+  cudaEventDestroy(data_->projection_event);
   cudaEventDestroy(data_->event);
   cudaStreamDestroy(data_->stream[1]);
   cudaStreamDestroy(data_->stream[0]);
   delete data_;
 }
 
+template <typename T>
+size_t ForwardPass<T>::GetWorkspaceSize(const int time_step,
+                                        const int batch_size,
+                                        const int hidden_size,
+                                        const bool training,
+                                        const bool bidirectional) {
+  // One `tmp_uh` per direction; nothing here grows with the sequence.
+  const int directions = bidirectional ? 2 : 1;
+  return workspace_size<T>(directions * batch_size * hidden_size * 2);
+}
+
+template <typename T>
+void ForwardPass<T>::SetPersistent(const bool persistent) {
+  data_->persistent = persistent;
+}
+
+template <typename T> void ForwardPass<T>::SetBias(const T *b) {
+  data_->bias = b;
+}
+
+template <typename T>
+void ForwardPass<T>::SetZoneout(const Zoneout &zoneout) {
+  data_->zoneout = zoneout;
+}
+
+template <typename T>
+void ForwardPass<T>::SetQuantizedWeight(const QuantizedWeight &u) {
+  assert(!data_->training || !u.data);
+  data_->quantized_u = u;
+}
+
+template <typename T> void ForwardPass<T>::SetGroups(const int groups) {
+  assert(groups > 0 && data_->batch_size % groups == 0);
+  data_->groups = groups;
+}
+
 template <typename T>
 void ForwardPass<T>::IterateInternal(const T *u, const T *h, T *h_out, T *v,
-                                     T *tmp_wx, T *tmp_uh) {
+                                     T *tmp_wx, T *tmp_uh, const int batch_size,
+                                     const int ldh, const int ldwx,
+                                     const Zoneout &zoneout, const int step,
+                                     const cudaStream_t &stream1) {
   static const T alpha = static_cast<T>(1.0);
   static const T beta = static_cast<T>(0.0);
 
   const bool training = data_->training;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaEvent_t event = data_->event;
+  const int groups = data_->groups;
+  assert(groups == 1 || (!data_->bias && !data_->quantized_u.data));
+
+  {
+    const double weight_bytes = data_->quantized_u.data ? 1.0 : sizeof(T);
+    const profiler::Range range(
+        profiler::kRecurrentGemm, stream1,
+        weight_bytes * 2.0 * groups * hidden_size * hidden_size +
+            sizeof(T) * 3.0 * batch_size * hidden_size);
+    if (data_->quantized_u.data) {
+      QuantizedMatMul(data_->quantized_u, hidden_size * 2, hidden_size,
+                      batch_size, h, ldh, tmp_uh, stream1);
+    } else if (groups > 1) {
+      // Layer `g` reads every `groups`-th row of `h` from row `g` on and
+      // writes the matching rows of `tmp_uh`.
+      cublasSetStream(blas_handle, stream1);
+      blas<T>::gemmStridedBatched(
+          blas_handle, CUBLAS_OP_T, CUBLAS_OP_N, hidden_size * 2,
+          batch_size / groups, hidden_size, &alpha, u, hidden_size,
+          2LL * hidden_size * hidden_size, h, ldh * groups, ldh, &beta,
+          tmp_uh, hidden_size * 2 * groups, hidden_size * 2, groups);
+    } else {
+      const autotune::GemmPlan *plan = autotune::PlanGemm<T>(
+          CUBLAS_OP_T, CUBLAS_OP_N, hidden_size * 2, batch_size, hidden_size,
+          hidden_size, ldh, hidden_size * 2, stream1);
+      cublasSetStream(blas_handle, stream1);
+      autotune::gemm<T>(plan, blas_handle, CUBLAS_OP_T, CUBLAS_OP_N,
+                        hidden_size * 2, batch_size, hidden_size, &alpha, u,
+                        hidden_size, h, ldh, &beta, tmp_uh, hidden_size * 2);
+    }
+  }
+
+  // Compute launch configuration for pointwise operations kernel.
+  constexpr int kVec = vector_width<T>::value;
+  const T *bias = data_->bias;
+  const bool vectorized =
+      hidden_size % kVec == 0 &&
+      is_aligned<T, kVec>({tmp_wx, bias, tmp_uh, h, h_out, v});
+  const PointwiseKernel<T> kernel =
+      vectorized ? SelectPointwiseKernel<T, kVec>(training, data_->activation)
+                 : SelectPointwiseKernel<T, 1>(training, data_->activation);
+  const int vec = vectorized ? kVec : 1;
+
+  const auto launch = [&](const int width) {
+    const dim3 blockDim(width, kPointwiseBlockDim / width);
+    const dim3 gridDim((hidden_size / vec + blockDim.x - 1) / blockDim.x,
+                       (batch_size + blockDim.y - 1) / blockDim.y);
+    kernel<<<gridDim, blockDim, 0, stream1>>>(batch_size, hidden_size, ldh,
+                                              ldwx, tmp_wx, bias, tmp_uh, h,
+                                              h_out, v, zoneout, step);
+    return true;
+  };
+
+  // Reads `wx`, `uh` and `h`, writes `h_out` and the gates when training.
+  const profiler::Range range(
+      profiler::kPointwise, stream1,
+      sizeof(T) * (training ? 9.0 : 6.0) * batch_size * hidden_size);
+  cudaStreamWaitEvent(stream1, event, 0);
+
+  // The kernel only reads `h` and writes `h_out` and `v`, so timing the
+  // candidate shapes on the live tensors leaves the same results.
+  int width = kPointwiseBlockWidths[0];
+  if (autotune::Enabled()) {
+    const autotune::Key key = {autotune::kPointwise, 1,
+                               autotune::type_code<T>(),
+                               autotune::DeviceArch(), batch_size, hidden_size,
+                               vec, training, data_->activation};
+    width = kPointwiseBlockWidths[autotune::Select(
+        key, kNumPointwiseBlockWidths,
+        [&](const int i) { return launch(kPointwiseBlockWidths[i]); },
+        stream1)];
+  }
+  launch(width);
+}
+
+template <typename T>
+bool ForwardPass<T>::RunPersistent(const int seq_length, const T *wx,
+                                   int wx_step, int ldwx, const T *u, T *h,
+                                   T *v) {
+  // The per-step kernels are the only ones that apply zoneout, read a
+  // quantized weight or run grouped layers.
+  if (!data_->cooperative_launch || data_->zoneout.prob > 0.0f ||
+      data_->quantized_u.data || data_->groups > 1)
+    return false;
+
+  int batch_size = data_->batch_size;
+  int hidden_size = data_->hidden_size;
+  int run_length = seq_length;
+
+  // One block per multiprocessor, each holding an equal share of the units.
+  int units_per_block = (hidden_size + data_->multiprocessor_count - 1) /
+                        data_->multiprocessor_count;
+  const int num_blocks = (hidden_size + units_per_block - 1) / units_per_block;
+  const int shared_mem_size = sizeof(T) * 2 * units_per_block * hidden_size;
+  if (shared_mem_size > data_->max_shared_memory)
+    return false;
+
+  const PersistentKernel<T> kernel =
+      data_->training ? SelectPersistentKernel<T, true>(data_->activation)
+                      : SelectPersistentKernel<T, false>(data_->activation);
+
+  // Every block must be co-resident for the grid-wide barrier.
+  if (kernel != data_->co_resident_kernel ||
+      shared_mem_size != data_->co_resident_shared_mem) {
+    int blocks_per_multiprocessor = 0;
+    cudaFuncSetAttribute(kernel, cudaFuncAttributeMaxDynamicSharedMemorySize,
+                         shared_mem_size);
+    cudaOccupancyMaxActiveBlocksPerMultiprocessor(
+        &blocks_per_multiprocessor, kernel, kPersistentBlockDim,
+        shared_mem_size);
+    data_->co_resident_kernel = kernel;
+    data_->co_resident_shared_mem = shared_mem_size;
+    data_->co_resident =
+        blocks_per_multiprocessor * data_->multiprocessor_count >= num_blocks;
+    if (!data_->co_resident)
+      cudaGetLastError();
+  }
+  if (!data_->co_resident)
+    return false;
+
+  const T *bias = data_->bias;
+  void *args[] = {&run_length,
+                  &batch_size,
+                  &hidden_size,
+                  &units_per_block,
+                  &wx_step,
+                  &ldwx,
+                  const_cast<T **>(&wx),
+                  const_cast<T **>(&bias),
+                  const_cast<T **>(&u),
+                  &h,
+                  &v};
+  const profiler::Range range(
+      profiler::kPersistent, data_->stream[0],
+      sizeof(T) * (2.0 * hidden_size * hidden_size +
+                   (data_->training ? 6.0 : 3.0) * seq_length * batch_size *
+                       hidden_size));
+  if (cudaLaunchCooperativeKernel(kernel, num_blocks, kPersistentBlockDim,
+                                  args, shared_mem_size,
+                                  data_->stream[0]) != cudaSuccess) {
+    cudaGetLastError();
+    return false;
+  }
+  return true;
+}
+
+template <typename T>
+void ForwardPass<T>::Run(const int seq_length, T *wx, const T *u, T *h, T *v,
+                         void *workspace, const bool batch_first) {
+  const profiler::Scope scope("ligru_1_0::ForwardPass::Run");
+
+  const int batch_size = data_->batch_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  // Order the internal streams after the work already queued on the caller's
+  // stream; this also lets them join a stream capture started on it.
+  cudaEventRecord(data_->event, data_->sync_stream);
+  cudaStreamWaitEvent(data_->stream[0], data_->event, 0);
+  cudaStreamWaitEvent(data_->stream[1], data_->event, 0);
+
+  // `u` is re-read by every step, so it is kept in the L2 set aside for
+  // persisting accesses, if any, for the duration of the call.
+  const l2_persistence::Window window(
+      data_->stream, 2, u,
+      sizeof(T) * 2 * data_->groups * hidden_size * hidden_size);
+
+  const int NH = batch_size * hidden_size;
+  T *tmp_uh = take_workspace<T>(workspace, NH * 2);
+
+  // A batch-first `wx` is read in place, one strided slice per step.
+  const int wx_step = batch_first ? hidden_size * 2 : NH * 2;
+  const int ldwx = batch_first ? seq_length * hidden_size * 2 : hidden_size * 2;
+
+  const auto per_step = [&]() {
+    for (int i = 0; i < seq_length; ++i) {
+      IterateInternal(u, h + i * NH, h + (i + 1) * NH, v + i * NH * 3,
+                      wx + i * wx_step, tmp_uh, batch_size, hidden_size, ldwx,
+                      data_->zoneout, i, data_->stream[0]);
+    }
+  };
+
+  // Both paths compute `h` and `v` from `wx` alone, so the autotuner can
+  // time them on the first call of a shape and keep the faster one.
+  bool persistent = data_->persistent;
+  if (persistent && autotune::Enabled()) {
+    const autotune::Key key = {autotune::kPersistent, 1,
+                               autotune::type_code<T>(),
+                               autotune::DeviceArch(), batch_size, hidden_size,
+                               data_->training, data_->activation,
+                               batch_first};
+    persistent = autotune::Select(
+                     key, 2,
+                     [&](const int i) {
+                       if (i == 1)
+                         return RunPersistent(seq_length, wx, wx_step, ldwx,
+                                              u, h, v);
+                       per_step();
+                       return true;
+                     },
+                     data_->stream[0]) == 1;
+  }
+  if (!persistent || !RunPersistent(seq_length, wx, wx_step, ldwx, u, h, v))
+    per_step();
+
+  // Order the caller's stream after everything issued above so the pass can
+  // be reused by later calls without being destroyed.
+  cudaEventRecord(data_->event, data_->stream[1]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+  cudaEventRecord(data_->event, data_->stream[0]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+
+  cublasSetStream(blas_handle, save_stream);
+}
+
+template <typename T>
+void ForwardPass<T>::RunPipelined(const int seq_length, const int chunk_size,
+                                  const T *x, const T *w, T *wx, const T *u,
+                                  T *h, T *v, void *workspace) {
+  const profiler::Scope scope("ligru_1_0::ForwardPass::RunPipelined");
+
+  assert(data_->groups == 1);
+
+  static const T alpha = static_cast<T>(1.0);
+  static const T beta = static_cast<T>(0.0);
+
   const int batch_size = data_->batch_size;
+  const int input_size = data_->input_size;
   const int hidden_size = data_->hidden_size;
   const cublasHandle_t blas_handle = data_->blas_handle;
   const cudaStream_t stream1 = data_->stream[0];
-  const cudaEvent_t event = data_->event;
+  const cudaStream_t stream2 = data_->stream[1];
 
-  cublasSetStream(blas_handle, stream1);
-  blas<T>::gemm(blas_handle, CUBLAS_OP_N, CUBLAS_OP_N, hidden_size * 2,
-                batch_size, hidden_size, &alpha, u, hidden_size * 2, h,
-                hidden_size, &beta, tmp_uh, hidden_size * 2);
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
 
-  // Compute launch configuration for pointwise operations kernel.
-  const dim3 blockDim(32, 16);
-  const dim3 gridDim((hidden_size + blockDim.x - 1) / blockDim.x,
-                     (batch_size + blockDim.y - 1) / blockDim.y);
+  cudaEventRecord(data_->event, data_->sync_stream);
+  cudaStreamWaitEvent(stream1, data_->event, 0);
+  cudaStreamWaitEvent(stream2, data_->event, 0);
 
-  cudaStreamWaitEvent(stream1, event, 0);
+  const l2_persistence::Window window(
+      &stream1, 1, u, sizeof(T) * 2 * hidden_size * hidden_size);
 
-  if (training) {
-    if (data_->activation == 0) {
-      PointwiseOperationsReLU<T, true><<<gridDim, blockDim, 0, stream1>>>(
-          batch_size, hidden_size, tmp_wx, tmp_uh, h, h_out, v);
-    } else if (data_->activation == 1) {
-      PointwiseOperationsLeakyReLU<T, true><<<gridDim, blockDim, 0, stream1>>>(
-          batch_size, hidden_size, tmp_wx, tmp_uh, h, h_out, v);
-    } else if (data_->activation == 2) {
-      PointwiseOperationsSin<T, true><<<gridDim, blockDim, 0, stream1>>>(
-          batch_size, hidden_size, tmp_wx, tmp_uh, h, h_out, v);
-    } else if (data_->activation == 3) {
-      PointwiseOperationsTanh<T, true><<<gridDim, blockDim, 0, stream1>>>(
-          batch_size, hidden_size, tmp_wx, tmp_uh, h, h_out, v);
+  const int NH = batch_size * hidden_size;
+  T *tmp_uh = take_workspace<T>(workspace, NH * 2);
+
+  // stream[1] only ever runs the projection, so it runs ahead of the
+  // recurrence by as many chunks as the device lets it; each chunk of the
+  // recurrence waits for its own projection alone.
+  for (int begin = 0; begin < seq_length; begin += chunk_size) {
+    const int steps = std::min(chunk_size, seq_length - begin);
+    T *wx_chunk = wx + begin * NH * 2;
+
+    {
+      const profiler::Range range(
+          profiler::kInputProjection, stream2,
+          sizeof(T) * (2.0 * hidden_size * input_size +
+                       steps * batch_size * (input_size + 2.0 * hidden_size)));
+      cublasSetStream(blas_handle, stream2);
+      blas<T>::gemm(blas_handle, CUBLAS_OP_T, CUBLAS_OP_N, hidden_size * 2,
+                    steps * batch_size, input_size, &alpha, w, input_size,
+                    x + begin * batch_size * input_size, input_size, &beta,
+                    wx_chunk, hidden_size * 2);
     }
-  } else {
-    if (data_->activation == 0) {
-      PointwiseOperationsReLU<T, false><<<gridDim, blockDim, 0, stream1>>>(
-          batch_size, hidden_size, tmp_wx, tmp_uh, h, h_out, v);
-    } else if (data_->activation == 1) {
-      PointwiseOperationsLeakyReLU<T, false><<<gridDim, blockDim, 0, stream1>>>(
-          batch_size, hidden_size, tmp_wx, tmp_uh, h, h_out, v);
-    } else if (data_->activation == 3) {
-      PointwiseOperationsTanh<T, false><<<gridDim, blockDim, 0, stream1>>>(
-          batch_size, hidden_size, tmp_wx, tmp_uh, h, h_out, v);
+    cudaEventRecord(data_->projection_event, stream2);
+    cudaStreamWaitEvent(stream1, data_->projection_event, 0);
+
+    T *h_chunk = h + begin * NH;
+    T *v_chunk = v + begin * NH * 3;
+    if (data_->persistent &&
+        RunPersistent(steps, wx_chunk, NH * 2, hidden_size * 2, u, h_chunk,
+                      v_chunk))
+      continue;
+    for (int i = 0; i < steps; ++i) {
+      IterateInternal(u, h_chunk + i * NH, h_chunk + (i + 1) * NH,
+                      v_chunk + i * NH * 3, wx_chunk + i * NH * 2, tmp_uh,
+                      batch_size, hidden_size, hidden_size * 2,
+                      data_->zoneout, begin + i, stream1);
     }
   }
+
+  cudaEventRecord(data_->event, data_->stream[1]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+  cudaEventRecord(data_->event, data_->stream[0]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+
+  cublasSetStream(blas_handle, save_stream);
 }
 
 template <typename T>
-void ForwardPass<T>::Run(const int seq_length, T *wx, const T *u, T *h, T *v,
-                         T *tmp_uh) {
+void ForwardPass<T>::RunPacked(const int seq_length, const int *batch_sizes,
+                               T *wx, const T *u, T *h, T *v,
+                               void *workspace) {
+  const profiler::Scope scope("ligru_1_0::ForwardPass::RunPacked");
 
   const int batch_size = data_->batch_size;
   const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
 
-  const int NH = batch_size * hidden_size;
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
 
+  cudaEventRecord(data_->event, data_->sync_stream);
+  cudaStreamWaitEvent(data_->stream[0], data_->event, 0);
+  cudaStreamWaitEvent(data_->stream[1], data_->event, 0);
+
+  const l2_persistence::Window window(
+      data_->stream, 2, u,
+      sizeof(T) * 2 * data_->groups * hidden_size * hidden_size);
+
+  // Steps keep their padded offsets; only the leading `batch_sizes[i]`
+  // sequences that are still running are multiplied and updated.
+  const int NH = batch_size * hidden_size;
+  T *tmp_uh = take_workspace<T>(workspace, NH * 2);
   for (int i = 0; i < seq_length; ++i) {
+    assert(batch_sizes[i] > 0 && batch_sizes[i] <= batch_size);
+    assert(i == 0 || batch_sizes[i] <= batch_sizes[i - 1]);
     IterateInternal(u, h + i * NH, h + (i + 1) * NH, v + i * NH * 3,
-                    wx + i * NH * 2, tmp_uh);
+                    wx + i * NH * 2, tmp_uh, batch_sizes[i], hidden_size,
+                    hidden_size * 2, data_->zoneout, i, data_->stream[0]);
   }
+
+  cudaEventRecord(data_->event, data_->stream[1]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+  cudaEventRecord(data_->event, data_->stream[0]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+
+  cublasSetStream(blas_handle, save_stream);
+}
+
+template <typename T>
+void ForwardPass<T>::RunIndexed(const int seq_length, T *wx, const T *u, T *h,
+                                T *v, void *workspace, T *h_table,
+                                const int *slots) {
+  const profiler::Scope scope("ligru_1_0::ForwardPass::RunIndexed");
+
+  const int batch_size = data_->batch_size;
+  const int hidden_size = data_->hidden_size;
+
+  state_table::Gather(data_->sync_stream, batch_size, hidden_size, slots,
+                      h_table, h);
+  Run(seq_length, wx, u, h, v, workspace);
+  state_table::Scatter(data_->sync_stream, batch_size, hidden_size, slots,
+                       h + seq_length * batch_size * hidden_size, h_table);
+}
+
+template <typename T>
+void ForwardPass<T>::RunInference(const int seq_length, T *wx, const T *u,
+                                  T *h, void *workspace,
+                                  const bool batch_first) {
+  const profiler::Scope scope("ligru_1_0::ForwardPass::RunInference");
+
+  assert(!data_->training);
+
+  const int batch_size = data_->batch_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  cudaEventRecord(data_->event, data_->sync_stream);
+  cudaStreamWaitEvent(data_->stream[0], data_->event, 0);
+  cudaStreamWaitEvent(data_->stream[1], data_->event, 0);
+
+  const l2_persistence::Window window(
+      data_->stream, 2, u,
+      sizeof(T) * 2 * data_->groups * hidden_size * hidden_size);
+
+  const int NH = batch_size * hidden_size;
+  const int wx_step = batch_first ? hidden_size * 2 : NH * 2;
+  const int ldwx = batch_first ? seq_length * hidden_size * 2 : hidden_size * 2;
+  T *tmp_uh = take_workspace<T>(workspace, NH * 2);
+  for (int i = 0; i < seq_length; ++i) {
+    IterateInternal(u, h + (i % 2) * NH, h + ((i + 1) % 2) * NH, nullptr,
+                    wx + i * wx_step, tmp_uh, batch_size, hidden_size, ldwx,
+                    data_->zoneout, i, data_->stream[0]);
+  }
+
+  cudaEventRecord(data_->event, data_->stream[1]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+  cudaEventRecord(data_->event, data_->stream[0]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+
+  cublasSetStream(blas_handle, save_stream);
+}
+
+template <typename T>
+void ForwardPass<T>::RunBidirectional(const int seq_length, T *wx, const T *u,
+                                      T *h, T *v, void *workspace,
+                                      const bool batch_first) {
+  const profiler::Scope scope("ligru_1_0::ForwardPass::RunBidirectional");
+
+  const int batch_size = data_->batch_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  cudaEventRecord(data_->event, data_->sync_stream);
+  cudaStreamWaitEvent(data_->stream[0], data_->event, 0);
+  cudaStreamWaitEvent(data_->stream[1], data_->event, 0);
+
+  const l2_persistence::Window window(
+      data_->stream, 2, u,
+      sizeof(T) * 2 * data_->groups * hidden_size * hidden_size);
+
+  // Both directions read the same `wx` and write their half of each
+  // interleaved `[batch_size, 2 * hidden_size]` slot of `h`: the forward one
+  // goes from slot 0 to seq_length on stream[0], the reverse one goes from
+  // slot seq_length + 1 down to 1 on stream[1]. Interleaving the issue order
+  // lets the two chains overlap on the device.
+  const int NH = batch_size * hidden_size;
+  const int ldh = hidden_size * 2;
+  const int wx_step = batch_first ? hidden_size * 2 : NH * 2;
+  const int ldwx = batch_first ? seq_length * hidden_size * 2 : hidden_size * 2;
+  T *tmp_uh = take_workspace<T>(workspace, NH * 4);
+  const Zoneout reverse_zoneout = reverse_direction(data_->zoneout);
+  for (int i = 0; i < seq_length; ++i) {
+    const int j = seq_length - 1 - i;
+    IterateInternal(u, h + i * NH * 2, h + (i + 1) * NH * 2,
+                    v + i * NH * 3, wx + i * wx_step, tmp_uh, batch_size, ldh,
+                    ldwx, data_->zoneout, i, data_->stream[0]);
+    IterateInternal(u, h + (j + 2) * NH * 2 + hidden_size,
+                    h + (j + 1) * NH * 2 + hidden_size,
+                    v + (seq_length + j) * NH * 3, wx + j * wx_step,
+                    tmp_uh + NH * 2, batch_size, ldh, ldwx, reverse_zoneout,
+                    j, data_->stream[1]);
+  }
+
+  cudaEventRecord(data_->event, data_->stream[1]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+  cudaEventRecord(data_->event, data_->stream[0]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+
+  cublasSetStream(blas_handle, save_stream);
 }
 
 template struct ForwardPass<half>;
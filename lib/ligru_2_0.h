@@ -16,8 +16,12 @@
 #pragma once
 
 #include <cublas_v2.h>
+#include <cstddef>
 #include <cuda_runtime_api.h>
 
+#include "quantized_weight.h"
+#include "zoneout.h"
+
 namespace haste {
 namespace v0 {
 namespace ligru_2_0 {
@@ -35,15 +39,92 @@ public:
 
   // Releases internal resources.
   // Blocks until all iterations have completed executing on the GPU.
+  //
+  // Both passes leave `stream` ordered after the work issued by `Run`, so
+  // they can be kept alive and reused across calls.
   ~ForwardPass();
 
+  // Size in bytes of the `workspace` of the entry points below, with the
+  // contract of `ligru_1_0::ForwardPass::GetWorkspaceSize`.
+  static size_t GetWorkspaceSize(const int time_step, const int batch_size,
+                                 const int hidden_size, const bool training,
+                                 const bool bidirectional = false);
+
+  // Same as `ligru_1_0::ForwardPass::SetBias`; the bias is added to `wx`
+  // after the recurrent product has been normalized.
+  void SetBias(const T *b);
+
+  // Same as `ligru_1_0::ForwardPass::SetZoneout`; zoneout is applied after
+  // the gates, so `tmp_uh` and the layer norm statistics do not depend on it.
+  void SetZoneout(const Zoneout &zoneout);
+
+  // Sets a quantized copy of `u` (see `quantized_weight.h`) that the per-step
+  // recurrent product of every entry point below reads instead of the `u`
+  // they are given, or clears it when `u.data` is null (the default). Only
+  // inference passes (`training == false`) support it, since the backward
+  // pass differentiates the full-precision weight.
+  void SetQuantizedWeight(const QuantizedWeight &u);
+
+  // Same as `ligru_1_0::ForwardPass::SetGroups`. The layer norm has no
+  // parameters of its own, so each row is normalized as in a single layer.
+  void SetGroups(const int groups);
+
+  // `u` and `wx` (including `batch_first`) follow
+  // `ligru_1_0::ForwardPass::Run`. `tmp_uh` receives the pre-normalization
+  // recurrent projection of every step,
+  // `[time_step, batch_size, 2 * hidden_size]`, for the backward pass. A pass
+  // constructed with `training == false` keeps it in the workspace instead
+  // and ignores `tmp_uh`, which may be null.
   void Run(const int time_step, T *wx, const T *u, T *h, T *v,
-           layer_norm::ForwardPass<T> &layer_norm1, T *tmp_uh_norm, T *tmp_uh);
+           layer_norm::ForwardPass<T> &layer_norm1, T *tmp_uh,
+           void *workspace, const bool batch_first = false);
+
+  // `Run` fed by its own input projection, computed chunk by chunk alongside
+  // the recurrence; `x`, `w` and `wx` follow
+  // `ligru_1_0::ForwardPass::RunPipelined`.
+  void RunPipelined(const int time_step, const int chunk_size, const T *x,
+                    const T *w, T *wx, const T *u, T *h, T *v,
+                    layer_norm::ForwardPass<T> &layer_norm1, T *tmp_uh,
+                    void *workspace);
+
+  // `Run` over the state table rows `slots`, as in
+  // `ligru_1_0::ForwardPass::RunIndexed`.
+  void RunIndexed(const int time_step, T *wx, const T *u, T *h, T *v,
+                  layer_norm::ForwardPass<T> &layer_norm1, T *tmp_uh,
+                  void *workspace, T *h_table, const int *slots);
+
+  // Inference-only variant of `Run`, with the ping-pong `h` of
+  // `ligru_1_0::ForwardPass::RunInference`; only the layer norm statistics
+  // still grow with `time_step`.
+  void RunInference(const int time_step, T *wx, const T *u, T *h,
+                    layer_norm::ForwardPass<T> &layer_norm1, void *workspace,
+                    const bool batch_first = false);
+
+  // Variable-length variant of `Run`, with the `batch_sizes` of
+  // `ligru_1_0::ForwardPass::RunPacked`. When training, `tmp_uh` holds the
+  // `sum(batch_sizes)` rows of the active sequences back to back.
+  void RunPacked(const int time_step, const int *batch_sizes, T *wx,
+                 const T *u, T *h, T *v,
+                 layer_norm::ForwardPass<T> &layer_norm1, T *tmp_uh,
+                 void *workspace);
+
+  // Runs both directions of a bidirectional layer concurrently, with the
+  // `h` and `v` layouts of `ligru_1_0::ForwardPass::RunBidirectional`. Each
+  // direction normalizes with its own layer norm, and `tmp_uh` holds one
+  // buffer per direction, forward first.
+  void RunBidirectional(const int time_step, T *wx, const T *u, T *h, T *v,
+                        layer_norm::ForwardPass<T> &layer_norm_forward,
+                        layer_norm::ForwardPass<T> &layer_norm_reverse,
+                        T *tmp_uh, void *workspace,
+                        const bool batch_first = false);
 
 private:
   void IterateInternal(const T *u, const T *h, T *h_out, T *v, T *tmp_wx,
                        T *tmp_uh, T *tmp_uh_norm,
-                       layer_norm::ForwardPass<T> &layer_norm1);
+                       layer_norm::ForwardPass<T> &layer_norm1,
+                       const int batch_size, const int ldh, const int ldwx,
+                       const Zoneout &zoneout, const int step,
+                       const cudaStream_t &stream);
 
   struct private_data;
   private_data *data_;
@@ -63,14 +144,58 @@ public:
   // Blocks until all iterations have completed executing on the GPU.
   ~BackwardPass();
 
+  // Same as `ligru_1_0::BackwardPass::SetZoneout`.
+  void SetZoneout(const Zoneout &zoneout);
+
+  // Same as `ligru_1_0::BackwardPass::SetStateGradient`.
+  void SetStateGradient(const T *dh_final, T *dh_initial);
+
+  // Same as `ligru_1_0::BackwardPass::GetWorkspaceSize`.
+  static size_t GetWorkspaceSize(const int time_step, const int batch_size,
+                                 const int hidden_size, const bool training,
+                                 const bool bidirectional = false);
+
+  // `u_t` and `du` follow `ligru_1_0::BackwardPass::Run`.
   void Run(const int time_step, const T *wx_t, const T *u_t, const T *h,
-           const T *v, const T *grad_out, T *tmp_dwx, T *dwx, T *du, T *dh,
+           const T *v, const T *grad_out, T *dwx, T *du, void *workspace,
            layer_norm::BackwardPass<T> &layer_norm1);
 
+  // Backward of a `ForwardPass::Run` made without the gate cache and the
+  // per-step recurrent products (a pass constructed with `training == false`).
+  // Each step redoes its product of `h` with `u_t`, normalizes it with the
+  // `[time_step, batch_size, 2]` statistics `norm_cache` saved by the forward
+  // layer norm and rebuilds the gates from it and `wx`, laid out as in the
+  // forward call.
+  void RunRecompute(const int time_step, const T *wx, const T *u_t,
+                    const T *h, const T *grad_out, T *dwx, T *du,
+                    T *norm_cache, void *workspace,
+                    const bool batch_first = false);
+
+  // Backward of `ForwardPass::RunPacked`; `layer_norm1` must be built over
+  // `sum(batch_sizes)` rows and `dwx` is zero-filled by the caller.
+  void RunPacked(const int time_step, const int *batch_sizes, const T *wx_t,
+                 const T *u_t, const T *h, const T *v, const T *grad_out,
+                 T *dwx, T *du, void *workspace,
+                 layer_norm::BackwardPass<T> &layer_norm1);
+
+  // Backward of `ForwardPass::RunBidirectional`. `dwx` holds one buffer per
+  // direction, forward first.
+  void RunBidirectional(const int time_step, const T *wx_t, const T *u_t,
+                        const T *h, const T *v, const T *grad_out, T *dwx,
+                        T *du, void *workspace,
+                        layer_norm::BackwardPass<T> &layer_norm_forward,
+                        layer_norm::BackwardPass<T> &layer_norm_reverse);
+
 private:
-  void IterateInternal(const T *u_t, const T *h, const T *v, const T *dh_new,
+  // `v` is the gate cache of the step; when it is null the gates are
+  // recomputed from `wx`, `uh` and its layer norm statistics `norm_cache`.
+  void IterateInternal(const T *u_t, const T *h, const T *v, const T *wx,
+                       const T *uh, const T *norm_cache, const T *dh_new,
                        T *dh, T *tmp_dwx, T *dwx,
-                       layer_norm::BackwardPass<T> &layer_norm1);
+                       layer_norm::BackwardPass<T> &layer_norm1,
+                       const int batch_size, const int ldh, const int ldwx,
+                       const Zoneout &zoneout, const int step,
+                       const cudaStream_t &stream);
 
   struct private_data;
   private_data *data_;
@@ -14,151 +14,261 @@
 // ==============================================================================
 
 #include <cublas_v2.h>
+#include <cuda_bf16.h>
+#include <cuda_fp16.h>
 #include <cuda_runtime_api.h>
 
+#include "autotune.h"
 #include "blas.h"
 #include "device_assert.h"
 
 #include "inline_ops.h"
 #include "layer_norm.h"
 #include "ligru_2_0.h"
+#include "profiler.h"
+#include "workspace.h"
+#include "zoneout.h"
 
 namespace {
 
-template <typename T>
-__global__ void PointwiseOperationsReLU(
-    const int batch_dim, const int hidden_dim, const T *h, const T *v,
-    T *dh_prev, const T *grad_out,
-    T *dwx) {
-  const int row = blockDim.x * blockIdx.x + threadIdx.x;
+using haste::v0::Zoneout;
+using haste::v0::zoneout_keep;
+
+constexpr int kPointwiseBlockDim = 256;
+constexpr int kPointwiseMinBlocks = 4;
+
+// Backpropagates through the gates of `kVec` consecutive hidden units of one
+// batch element per thread. The gates are read from the cache `v`, or
+// recomputed from `wx` (with rows `ldwx` apart) and the raw recurrent product
+// `uh` normalized with the (mean, invstd) pairs of `norm_cache` when
+// `Recompute` is set, and the zoneout masks of step `step` are regenerated
+// from `zoneout`. Vectorized launches need `hidden_dim` to be a multiple of
+// `kVec` and every pointer aligned to `aligned_vector<T, kVec>`.
+template <typename T, typename Activation, bool Recompute, int kVec>
+__global__ void __launch_bounds__(kPointwiseBlockDim, kPointwiseMinBlocks)
+    PointwiseOperations(const int batch_dim, const int hidden_dim,
+                        const int ldh, const int ldwx, const T *h, const T *v,
+                        const T *wx, const T *uh, const T *norm_cache,
+                        T *dh_prev, const T *grad_out, T *dwx,
+                        const Zoneout zoneout, const int step) {
+  using acc_t = typename acc_type<T>::type;
+  using vec_t = aligned_vector<T, kVec>;
+
+  const int row = (blockDim.x * blockIdx.x + threadIdx.x) * kVec;
   const int col = blockDim.y * blockIdx.y + threadIdx.y;
 
   if (row >= hidden_dim || col >= batch_dim)
     return;
 
   const int base_idx = col * hidden_dim + row;
-
-  T dh = grad_out[base_idx] + dh_prev[base_idx];
-
-  const int stride3_base_idx = col * (hidden_dim * 3) + row;
-  const int z_idx = stride3_base_idx + 1 * hidden_dim;
-  const int a_idx = stride3_base_idx + 0 * hidden_dim;
-  const int hcand_idx = stride3_base_idx + 2 * hidden_dim;
-
-  const T z = v[z_idx];
-  const T a = v[a_idx];
-  const T hcand = v[hcand_idx];
-
-  const T dat = d_relu(a) * (static_cast<T>(1.0) - z) * dh;
-  const T dzt = (h[base_idx] - hcand) * dh * (z * (static_cast<T>(1.0) - z));
-
-  dh_prev[base_idx] = dh * z;
-
+  const int h_idx = col * ldh + row;
   const int idx = col * (hidden_dim * 2) + row;
-  dwx[idx + 1 * hidden_dim] = dzt;
-  dwx[idx + 0 * hidden_dim] = dat;
-}
-
-template <typename T>
-__global__ void PointwiseOperationsLeakyReLU(
-    const int batch_dim, const int hidden_dim, const T *h, const T *v,
-    T *dh_prev, const T *grad_out,
-    T *dwx) {
-  const int row = blockDim.x * blockIdx.x + threadIdx.x;
-  const int col = blockDim.y * blockIdx.y + threadIdx.y;
-
-  if (row >= hidden_dim || col >= batch_dim)
-    return;
-
-  const int base_idx = col * hidden_dim + row;
-
-  T dh = grad_out[base_idx] + dh_prev[base_idx];
 
   const int stride3_base_idx = col * (hidden_dim * 3) + row;
   const int z_idx = stride3_base_idx + 1 * hidden_dim;
   const int a_idx = stride3_base_idx + 0 * hidden_dim;
   const int hcand_idx = stride3_base_idx + 2 * hidden_dim;
 
-  const T z = v[z_idx];
-  const T a = v[a_idx];
-  const T hcand = v[hcand_idx];
+  const vec_t grad = load_vector<kVec>(grad_out + h_idx);
+  const vec_t dh_next = load_vector<kVec>(dh_prev + base_idx);
+  const vec_t h_prev = load_vector<kVec>(h + h_idx);
+
+  vec_t gate_a, gate_z, gate_hcand, uh_a, uh_z;
+  acc_t mean = static_cast<acc_t>(0.0);
+  acc_t invstd = static_cast<acc_t>(1.0);
+  if (Recompute) {
+    gate_a = load_vector<kVec>(wx + col * ldwx + row + 0 * hidden_dim);
+    gate_z = load_vector<kVec>(wx + col * ldwx + row + 1 * hidden_dim);
+    uh_a = load_vector<kVec>(uh + idx + 0 * hidden_dim);
+    uh_z = load_vector<kVec>(uh + idx + 1 * hidden_dim);
+    mean = static_cast<acc_t>(norm_cache[col * 2 + 0]);
+    invstd = static_cast<acc_t>(norm_cache[col * 2 + 1]);
+  } else {
+    gate_a = load_vector<kVec>(v + a_idx);
+    gate_z = load_vector<kVec>(v + z_idx);
+    gate_hcand = load_vector<kVec>(v + hcand_idx);
+  }
 
-  const T dat = d_leaky_relu(a) * (static_cast<T>(1.0) - z) * dh;
-  const T dzt = (h[base_idx] - hcand) * dh * (z * (static_cast<T>(1.0) - z));
+  vec_t dh_out, da_out, dz_out;
+#pragma unroll
+  for (int j = 0; j < kVec; ++j) {
+    const acc_t dh =
+        static_cast<acc_t>(grad.val[j]) + static_cast<acc_t>(dh_next.val[j]);
+
+    acc_t z, a, hcand;
+    if (Recompute) {
+      z = sigmoid(static_cast<acc_t>(gate_z.val[j]) +
+                  (static_cast<acc_t>(uh_z.val[j]) - mean) * invstd);
+      a = static_cast<acc_t>(gate_a.val[j]) +
+          (static_cast<acc_t>(uh_a.val[j]) - mean) * invstd;
+      hcand = Activation::forward(a);
+    } else {
+      z = static_cast<acc_t>(gate_z.val[j]);
+      a = static_cast<acc_t>(gate_a.val[j]);
+      hcand = static_cast<acc_t>(gate_hcand.val[j]);
+    }
+
+    acc_t keep = static_cast<acc_t>(0.0);
+    if (zoneout.prob > 0.0f)
+      keep = zoneout_keep<acc_t>(zoneout, col * hidden_dim + row + j, step);
+    const acc_t dh_gates = (static_cast<acc_t>(1.0) - keep) * dh;
+
+    const acc_t dat =
+        Activation::backward(a) * (static_cast<acc_t>(1.0) - z) * dh_gates;
+    const acc_t dzt = (static_cast<acc_t>(h_prev.val[j]) - hcand) * dh_gates *
+                      (z * (static_cast<acc_t>(1.0) - z));
+
+    dh_out.val[j] = static_cast<T>(keep * dh + z * dh_gates);
+    da_out.val[j] = static_cast<T>(dat);
+    dz_out.val[j] = static_cast<T>(dzt);
+  }
 
-  dh_prev[base_idx] = dh * z;
+  store_vector(dh_prev + base_idx, dh_out);
 
-  const int idx = col * (hidden_dim * 2) + row;
-  dwx[idx + 1 * hidden_dim] = dzt;
-  dwx[idx + 0 * hidden_dim] = dat;
+  store_vector(dwx + idx + 1 * hidden_dim, dz_out);
+  store_vector(dwx + idx + 0 * hidden_dim, da_out);
 }
 
 template <typename T>
-__global__ void PointwiseOperationsTanh(
-    const int batch_dim, const int hidden_dim, const T *h, const T *v,
-    T *dh_prev, const T *grad_out,
-    T *dwx) {
-  const int row = blockDim.x * blockIdx.x + threadIdx.x;
-  const int col = blockDim.y * blockIdx.y + threadIdx.y;
-
-  if (row >= hidden_dim || col >= batch_dim)
-    return;
-
-  const int base_idx = col * hidden_dim + row;
-
-  T dh = grad_out[base_idx] + dh_prev[base_idx];
-
-  const int stride3_base_idx = col * (hidden_dim * 3) + row;
-  const int z_idx = stride3_base_idx + 1 * hidden_dim;
-  const int a_idx = stride3_base_idx + 0 * hidden_dim;
-  const int hcand_idx = stride3_base_idx + 2 * hidden_dim;
-
-  const T z = v[z_idx];
-  const T a = v[a_idx];
-  const T hcand = v[hcand_idx];
+using PointwiseKernel = void (*)(const int, const int, const int, const int,
+                                 const T *, const T *, const T *, const T *,
+                                 const T *, T *, const T *, T *,
+                                 const Zoneout, const int);
+
+template <typename T, bool Recompute, int kVec>
+PointwiseKernel<T> SelectPointwiseActivation(const int activation) {
+  if (activation == 0)
+    return PointwiseOperations<T, ReLU, Recompute, kVec>;
+  if (activation == 1)
+    return PointwiseOperations<T, LeakyReLU, Recompute, kVec>;
+  if (activation == 2)
+    return PointwiseOperations<T, Sin, Recompute, kVec>;
+  return PointwiseOperations<T, Tanh, Recompute, kVec>;
+}
 
-  const T dat = d_tanh(a) * (static_cast<T>(1.0) - z) * dh;
-  const T dzt = (h[base_idx] - hcand) * dh * (z * (static_cast<T>(1.0) - z));
+template <typename T, int kVec>
+PointwiseKernel<T> SelectPointwiseKernel(const bool recompute,
+                                         const int activation) {
+  if (recompute)
+    return SelectPointwiseActivation<T, true, kVec>(activation);
+  return SelectPointwiseActivation<T, false, kVec>(activation);
+}
 
-  dh_prev[base_idx] = dh * z;
+constexpr int kLayerNormBlockDim = 256;
+constexpr int kMaxFusedSharedMemory = 48 * 1024;
+
+// Backpropagates through the gates of one batch element and through the
+// layer norm of its recurrent product `uh` in the same launch (one block per
+// batch element), from the (mean, invstd) pair of the forward pass in
+// `norm_cache`. The gate gradients written to `dwx` are also the gradient of
+// the normalized product, so they are staged in shared memory next to the
+// centered `uh` row and the input gradient `duh` is computed without reading
+// either back from global memory. The gates are taken from `v` or rebuilt as
+// in `PointwiseOperations`.
+template <typename T, typename Activation, bool Recompute>
+__global__ void __launch_bounds__(kLayerNormBlockDim)
+    LayerNormPointwiseGrad(const int batch_dim, const int hidden_dim,
+                           const int ldh, const int ldwx, const T *h,
+                           const T *v, const T *wx, const T *uh,
+                           const T *norm_cache, T *dh_prev, const T *grad_out,
+                           T *dwx, T *duh, const Zoneout zoneout,
+                           const int step) {
+  using acc_t = typename acc_type<T>::type;
+
+  extern __shared__ int shared_var[];
+  const int row_size = hidden_dim * 2;
+  acc_t *row_x = reinterpret_cast<acc_t *>(shared_var);
+  acc_t *row_dy = row_x + row_size;
+  __shared__ acc_t warp_sums[32];
+
+  const int col = blockIdx.x;
+  const T *uh_row = uh + col * row_size;
+  const acc_t mean = static_cast<acc_t>(norm_cache[col * 2 + 0]);
+  const acc_t invstd = static_cast<acc_t>(norm_cache[col * 2 + 1]);
+
+  acc_t dsigma_tmp = static_cast<acc_t>(0.0);
+  acc_t dmu1_tmp = static_cast<acc_t>(0.0);
+  acc_t dmu2_tmp = static_cast<acc_t>(0.0);
+  for (int row = threadIdx.x; row < hidden_dim; row += blockDim.x) {
+    const int base_idx = col * hidden_dim + row;
+    const int h_idx = col * ldh + row;
+    const int idx = col * row_size + row;
+
+    const acc_t x_a = static_cast<acc_t>(uh_row[row]) - mean;
+    const acc_t x_z = static_cast<acc_t>(uh_row[row + hidden_dim]) - mean;
+
+    acc_t z, a, hcand;
+    if (Recompute) {
+      z = sigmoid(static_cast<acc_t>(wx[col * ldwx + row + hidden_dim]) +
+                  x_z * invstd);
+      a = static_cast<acc_t>(wx[col * ldwx + row]) + x_a * invstd;
+      hcand = Activation::forward(a);
+    } else {
+      const int v_idx = col * (hidden_dim * 3) + row;
+      a = static_cast<acc_t>(v[v_idx + 0 * hidden_dim]);
+      z = static_cast<acc_t>(v[v_idx + 1 * hidden_dim]);
+      hcand = static_cast<acc_t>(v[v_idx + 2 * hidden_dim]);
+    }
+
+    const acc_t dh = static_cast<acc_t>(grad_out[h_idx]) +
+                     static_cast<acc_t>(dh_prev[base_idx]);
+    acc_t keep = static_cast<acc_t>(0.0);
+    if (zoneout.prob > 0.0f)
+      keep = zoneout_keep<acc_t>(zoneout, col * hidden_dim + row, step);
+    const acc_t dh_gates = (static_cast<acc_t>(1.0) - keep) * dh;
+
+    const acc_t dat =
+        Activation::backward(a) * (static_cast<acc_t>(1.0) - z) * dh_gates;
+    const acc_t dzt = (static_cast<acc_t>(h[h_idx]) - hcand) * dh_gates *
+                      (z * (static_cast<acc_t>(1.0) - z));
+
+    dh_prev[base_idx] = static_cast<T>(keep * dh + z * dh_gates);
+    dwx[idx + 0 * hidden_dim] = static_cast<T>(dat);
+    dwx[idx + 1 * hidden_dim] = static_cast<T>(dzt);
+
+    row_x[row] = x_a;
+    row_x[row + hidden_dim] = x_z;
+    row_dy[row] = dat;
+    row_dy[row + hidden_dim] = dzt;
+    dsigma_tmp += x_a * dat + x_z * dzt;
+    dmu1_tmp += x_a + x_z;
+    dmu2_tmp += dat + dzt;
+  }
 
-  const int idx = col * (hidden_dim * 2) + row;
-  dwx[idx + 1 * hidden_dim] = dzt;
-  dwx[idx + 0 * hidden_dim] = dat;
+  // The reductions also order the shared row writes above before the reads
+  // below.
+  dsigma_tmp = block_reduce_sum(dsigma_tmp, warp_sums);
+  dmu1_tmp = block_reduce_sum(dmu1_tmp, warp_sums);
+  dmu2_tmp = block_reduce_sum(dmu2_tmp, warp_sums);
+
+  const acc_t dsigma =
+      static_cast<acc_t>(-0.5) * dsigma_tmp * invstd * invstd * invstd;
+  const acc_t dmu = (static_cast<acc_t>(-2.0) * dmu1_tmp * dsigma / row_size) -
+                    (dmu2_tmp * invstd);
+
+  T *duh_row = duh + col * row_size;
+  for (int i = threadIdx.x; i < row_size; i += blockDim.x)
+    duh_row[i] = static_cast<T>(
+        (static_cast<acc_t>(2.0) * row_x[i] * dsigma / row_size) +
+        (invstd * row_dy[i]) + (dmu / row_size));
 }
 
 template <typename T>
-__global__ void PointwiseOperationsSin(
-    const int batch_dim, const int hidden_dim, const T *h, const T *v,
-    T *dh_prev, const T *grad_out,
-    T *dwx) { 
-  const int row = blockDim.x * blockIdx.x + threadIdx.x;
-  const int col = blockDim.y * blockIdx.y + threadIdx.y;
-
-  if (row >= hidden_dim || col >= batch_dim)
-    return;
-
-  const int base_idx = col * hidden_dim + row;
-
-  T dh = grad_out[base_idx] + dh_prev[base_idx];
-
-  const int stride3_base_idx = col * (hidden_dim * 3) + row;
-  const int z_idx = stride3_base_idx + 1 * hidden_dim;
-  const int a_idx = stride3_base_idx + 0 * hidden_dim;
-  const int hcand_idx = stride3_base_idx + 2 * hidden_dim;
-
-  const T z = v[z_idx];
-  const T a = v[a_idx];
-  const T hcand = v[hcand_idx];
-
-  const T dat = d_sin(a) * (static_cast<T>(1.0) - z) * dh;
-  const T dzt = (h[base_idx] - hcand) * dh * (z * (static_cast<T>(1.0) - z));
-
-  dh_prev[base_idx] = dh * z;
-
-  const int idx = col * (hidden_dim * 2) + row;
-  dwx[idx + 1 * hidden_dim] = dzt;
-  dwx[idx + 0 * hidden_dim] = dat;
+using LayerNormPointwiseGradKernel =
+    void (*)(const int, const int, const int, const int, const T *, const T *,
+             const T *, const T *, const T *, T *, const T *, T *, T *,
+             const Zoneout, const int);
+
+template <typename T, bool Recompute>
+LayerNormPointwiseGradKernel<T>
+SelectLayerNormPointwiseGradKernel(const int activation) {
+  if (activation == 0)
+    return LayerNormPointwiseGrad<T, ReLU, Recompute>;
+  if (activation == 1)
+    return LayerNormPointwiseGrad<T, LeakyReLU, Recompute>;
+  if (activation == 2)
+    return LayerNormPointwiseGrad<T, Sin, Recompute>;
+  return LayerNormPointwiseGrad<T, Tanh, Recompute>;
 }
 
 } // anonymous namespace
@@ -172,9 +282,13 @@ template <typename T> struct BackwardPass<T>::private_data {
   int input_size;
   int hidden_size;
   int activation;
+  Zoneout zoneout;
+  const T *dh_final;
+  T *dh_initial;
   cublasHandle_t blas_handle;
   cudaStream_t stream[2];
   cudaEvent_t event;
+  cudaEvent_t workspace_event[2];
   cudaStream_t sync_stream;
 };
 
@@ -190,9 +304,13 @@ BackwardPass<T>::BackwardPass(const int batch_size, const int input_size,
   data_->hidden_size = hidden_size;
   data_->blas_handle = blas_handle;
   data_->sync_stream = stream;
+  data_->dh_final = nullptr;
+  data_->dh_initial = nullptr;
   cudaStreamCreate(&data_->stream[0]);
   cudaStreamCreate(&data_->stream[1]);
   cudaEventCreateWithFlags(&data_->event, cudaEventDisableTiming);
+  cudaEventCreateWithFlags(&data_->workspace_event[0], cudaEventDisableTiming);
+  cudaEventCreateWithFlags(&data_->workspace_event[1], cudaEventDisableTiming);
 }
 
 template <typename T> BackwardPass<T>::~BackwardPass() {
@@ -205,67 +323,136 @@ template <typename T> BackwardPass<T>::~BackwardPass() {
     cudaStreamSynchronize(data_->stream[1]);
     cudaStreamSynchronize(data_->stream[0]);
   }
+  cudaEventDestroy(data_->workspace_event[1]);
+  cudaEventDestroy(data_->workspace_event[0]);
   cudaEventDestroy(data_->event);
   cudaStreamDestroy(data_->stream[1]);
   cudaStreamDestroy(data_->stream[0]);
   delete data_;
 }
 
+template <typename T>
+void BackwardPass<T>::SetZoneout(const Zoneout &zoneout) {
+  data_->zoneout = zoneout;
+}
+
+template <typename T>
+void BackwardPass<T>::SetStateGradient(const T *dh_final, T *dh_initial) {
+  data_->dh_final = dh_final;
+  data_->dh_initial = dh_initial;
+}
+
+template <typename T>
+size_t BackwardPass<T>::GetWorkspaceSize(const int time_step,
+                                         const int batch_size,
+                                         const int hidden_size,
+                                         const bool training,
+                                         const bool bidirectional) {
+  // `dh` and the layer norm gradients: a two-step ring, except for the
+  // bidirectional pass that keeps every step for its final `du` products.
+  // `RunRecompute` also rebuilds one step of the recurrent product.
+  const int NH = batch_size * hidden_size;
+  if (bidirectional)
+    return workspace_size<T>(NH * 2) + workspace_size<T>(time_step * NH * 4);
+  size_t size = workspace_size<T>(NH) + workspace_size<T>(NH * 4);
+  if (!training)
+    size += workspace_size<T>(NH * 2);
+  return size;
+}
+
 template <typename T>
 void BackwardPass<T>::IterateInternal(
-    const T *u_t, const T *h, const T *v, const T *grad_out, T *dh, T *tmp_dwx,
-    T *dwx, layer_norm::BackwardPass<T> &layer_norm1) {
+    const T *u_t, const T *h, const T *v, const T *wx, const T *uh,
+    const T *norm_cache, const T *grad_out, T *dh, T *tmp_dwx, T *dwx,
+    layer_norm::BackwardPass<T> &layer_norm1, const int batch_size,
+    const int ldh, const int ldwx, const Zoneout &zoneout, const int step,
+    const cudaStream_t &stream1) {
   const T alpha = static_cast<T>(1.0);
   const T beta_sum = static_cast<T>(1.0);
 
-  const int batch_size = data_->batch_size;
   const int hidden_size = data_->hidden_size;
   const cublasHandle_t blas_handle = data_->blas_handle;
-  const cudaStream_t stream1 = data_->stream[0];
   const cudaEvent_t event = data_->event;
 
-  const dim3 blockDim(32, 16);
-  const dim3 gridDim((hidden_size + blockDim.x - 1) / blockDim.x,
-                     (batch_size + blockDim.y - 1) / blockDim.y);
-
-  if (data_->activation == 0) {
-    PointwiseOperationsReLU<T><<<gridDim, blockDim, 0, stream1>>>(
-        batch_size, hidden_size, h, v, dh, grad_out, dwx);
-    cudaEventRecord(event, stream1);
-  } else if (data_->activation == 1) {
-    PointwiseOperationsLeakyReLU<T><<<gridDim, blockDim, 0, stream1>>>(
-        batch_size, hidden_size, h, v, dh, grad_out, dwx);
-    cudaEventRecord(event, stream1);
-  } else if (data_->activation == 2) {
-    PointwiseOperationsSin<T><<<gridDim, blockDim, 0, stream1>>>(
-        batch_size, hidden_size, h, v, dh, grad_out, dwx);
-    cudaEventRecord(event, stream1);
-  } else if (data_->activation == 3) {
-    PointwiseOperationsTanh<T><<<gridDim, blockDim, 0, stream1>>>(
-        batch_size, hidden_size, h, v, dh, grad_out, dwx);
-    cudaEventRecord(event, stream1);
+  const bool recompute = v == nullptr;
+
+  // Fuse the layer norm backward into the gate kernel whenever a row of the
+  // gradient and of the centered product fits in shared memory.
+  const int shared_mem_size =
+      sizeof(typename acc_type<T>::type) * hidden_size * 4;
+  if (shared_mem_size <= kMaxFusedSharedMemory) {
+    const LayerNormPointwiseGradKernel<T> kernel =
+        recompute
+            ? SelectLayerNormPointwiseGradKernel<T, true>(data_->activation)
+            : SelectLayerNormPointwiseGradKernel<T, false>(data_->activation);
+    const T *uh_rows;
+    const T *uh_stats;
+    layer_norm1.ReservePartial(batch_size, &uh_rows, &uh_stats);
+
+    // Reads the gates (or `wx`), `uh`, `h`, `grad_out` and `dh`; writes
+    // `dh`, `dwx` and `tmp_dwx`.
+    const profiler::Range range(
+        profiler::kPointwise, stream1,
+        sizeof(T) * (recompute ? 12.0 : 13.0) * batch_size * hidden_size);
+    kernel<<<batch_size, kLayerNormBlockDim, shared_mem_size, stream1>>>(
+        batch_size, hidden_size, ldh, ldwx, h, v, wx, uh_rows, uh_stats, dh,
+        grad_out, dwx, tmp_dwx, zoneout, step);
+  } else {
+    constexpr int kVec = vector_width<T>::value;
+    const bool vectorized =
+        hidden_size % kVec == 0 &&
+        is_aligned<T, kVec>({h, v, wx, uh, dh, grad_out, dwx});
+    const PointwiseKernel<T> kernel =
+        vectorized
+            ? SelectPointwiseKernel<T, kVec>(recompute, data_->activation)
+            : SelectPointwiseKernel<T, 1>(recompute, data_->activation);
+    const int vec = vectorized ? kVec : 1;
+
+    const dim3 blockDim(32, kPointwiseBlockDim / 32);
+    const dim3 gridDim((hidden_size / vec + blockDim.x - 1) / blockDim.x,
+                       (batch_size + blockDim.y - 1) / blockDim.y);
+
+    {
+      const profiler::Range range(
+          profiler::kPointwise, stream1,
+          sizeof(T) * (recompute ? 10.0 : 9.0) * batch_size * hidden_size);
+      kernel<<<gridDim, blockDim, 0, stream1>>>(
+          batch_size, hidden_size, ldh, ldwx, h, v, wx, uh, norm_cache, dh,
+          grad_out, dwx, zoneout, step);
+    }
+
+    // Reads `dwx` and the saved `uh`, writes `tmp_dwx`.
+    const profiler::Range range(profiler::kLayerNorm, stream1,
+                                sizeof(T) * 6.0 * batch_size * hidden_size);
+    layer_norm1.RunPartial(stream1, batch_size, dwx, tmp_dwx);
   }
 
+  // `tmp_dwx` is complete: the caller's `du` product on the other stream
+  // waits for this event. Everything else of the step is ordered by
+  // `stream1` alone.
   cudaEventRecord(event, stream1);
   cublasSetStream(blas_handle, stream1);
-  layer_norm1.RunPartial(stream1, batch_size, dwx, tmp_dwx);
-
-  cudaStreamWaitEvent(stream1, event, 0);
-
-  cudaEventRecord(event, stream1);
-  blas<T>::gemm(blas_handle, CUBLAS_OP_N, CUBLAS_OP_N, hidden_size, batch_size,
-                hidden_size * 2, &alpha, u_t, hidden_size, tmp_dwx,
-                hidden_size * 2, &beta_sum, dh, hidden_size);
-  cudaStreamWaitEvent(stream1, event, 0);
-};
+  const profiler::Range range(
+      profiler::kRecurrentGemm, stream1,
+      sizeof(T) * (2.0 * hidden_size * hidden_size +
+                   4.0 * batch_size * hidden_size));
+  const autotune::GemmPlan *plan = autotune::PlanGemm<T>(
+      CUBLAS_OP_N, CUBLAS_OP_N, hidden_size, batch_size, hidden_size * 2,
+      hidden_size, hidden_size * 2, hidden_size, stream1);
+  autotune::gemm<T>(plan, blas_handle, CUBLAS_OP_N, CUBLAS_OP_N, hidden_size,
+                    batch_size, hidden_size * 2, &alpha, u_t, hidden_size,
+                    tmp_dwx, hidden_size * 2, &beta_sum, dh, hidden_size);
+}
 
 template <typename T>
 void BackwardPass<T>::Run(const int time_step, const T *wx_t, const T *u_t,
-                          const T *h, const T *v, const T *grad_out, T *tmp_dwx,
-                          T *dwx, T *du, T *dh,
+                          const T *h, const T *v, const T *grad_out, T *dwx,
+                          T *du, void *workspace,
                           layer_norm::BackwardPass<T> &layer_norm1) {
+  const profiler::Scope scope("ligru_2_0::BackwardPass::Run");
 
   const T alpha = static_cast<T>(1.0);
+  const T beta = static_cast<T>(0.0);
   const T beta_sum = static_cast<T>(1.0);
 
   const blas<void>::set_pointer_mode scoped1(data_->blas_handle);
@@ -273,6 +460,7 @@ void BackwardPass<T>::Run(const int time_step, const T *wx_t, const T *u_t,
   const int batch_size = data_->batch_size;
   const int hidden_size = data_->hidden_size;
   const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream1 = data_->stream[0];
   const cudaStream_t stream2 = data_->stream[1];
   const cudaEvent_t event = data_->event;
 
@@ -280,21 +468,318 @@ void BackwardPass<T>::Run(const int time_step, const T *wx_t, const T *u_t,
   cublasGetStream(blas_handle, &save_stream);
 
   const int NH = batch_size * hidden_size;
+  T *dh = take_workspace<T>(workspace, NH);
+  T *tmp_dwx = take_workspace<T>(workspace, NH * 4);
+  if (data_->dh_final)
+    cudaMemcpyAsync(dh, data_->dh_final, NH * sizeof(T),
+                    cudaMemcpyDeviceToDevice, data_->sync_stream);
+  else
+    cudaMemsetAsync(dh, 0, NH * sizeof(T), data_->sync_stream);
+
+  // Order the internal streams after the work already queued on the caller's
+  // stream; this also lets them join a stream capture started on it.
+  cudaEventRecord(data_->event, data_->sync_stream);
+  cudaStreamWaitEvent(data_->stream[0], data_->event, 0);
+  cudaStreamWaitEvent(data_->stream[1], data_->event, 0);
+
+  // The layer norm gradients only feed `dh` and `du`, so rather than keeping
+  // all of them for one final product, each step folds its own into `du` on
+  // the second stream and `tmp_dwx` is a two-slot ring; a slot is refilled
+  // only once the product that read it two steps earlier has completed.
   for (int i = time_step - 1; i >= 0; --i) {
-    IterateInternal(u_t, h + i * NH, v + i * NH * 3, grad_out + (i + 1) * NH,
-                    dh, tmp_dwx + i * NH * 2, dwx + i * NH * 2, layer_norm1);
+    const int slot = i % 2;
+    if (i < time_step - 2)
+      cudaStreamWaitEvent(stream1, data_->workspace_event[slot], 0);
+
+    IterateInternal(u_t, h + i * NH, v + i * NH * 3, nullptr, nullptr, nullptr,
+                    grad_out + (i + 1) * NH, dh, tmp_dwx + slot * NH * 2,
+                    dwx + i * NH * 2, layer_norm1, batch_size, hidden_size,
+                    hidden_size * 2, data_->zoneout, i, stream1);
+
+    cudaStreamWaitEvent(stream2, event, 0);
+    const profiler::Range range(
+        profiler::kWeightGrad, stream2,
+        sizeof(T) * (3.0 * batch_size * hidden_size +
+                     4.0 * hidden_size * hidden_size));
+    cublasSetStream(blas_handle, stream2);
+    blas<T>::gemm(blas_handle, CUBLAS_OP_N, CUBLAS_OP_T, hidden_size,
+                  hidden_size * 2, batch_size, &alpha, h + i * NH, hidden_size,
+                  tmp_dwx + slot * NH * 2, hidden_size * 2,
+                  i == time_step - 1 ? &beta : &beta_sum, du, hidden_size);
+    cudaEventRecord(data_->workspace_event[slot], stream2);
+  }
+
+  if (data_->dh_initial)
+    cudaMemcpyAsync(data_->dh_initial, dh, NH * sizeof(T),
+                    cudaMemcpyDeviceToDevice, stream1);
+
+  // Order the caller's stream after everything issued above so the pass can
+  // be reused by later calls without being destroyed.
+  cudaEventRecord(data_->event, data_->stream[1]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+  cudaEventRecord(data_->event, data_->stream[0]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+
+  cublasSetStream(blas_handle, save_stream);
+}
+
+template <typename T>
+void BackwardPass<T>::RunRecompute(const int time_step, const T *wx,
+                                   const T *u_t, const T *h,
+                                   const T *grad_out, T *dwx, T *du,
+                                   T *norm_cache, void *workspace,
+                                   const bool batch_first) {
+  const profiler::Scope scope("ligru_2_0::BackwardPass::RunRecompute");
+
+  const T alpha = static_cast<T>(1.0);
+  const T beta = static_cast<T>(0.0);
+  const T beta_sum = static_cast<T>(1.0);
+
+  const blas<void>::set_pointer_mode scoped1(data_->blas_handle);
+
+  const int batch_size = data_->batch_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream1 = data_->stream[0];
+  const cudaStream_t stream2 = data_->stream[1];
+  const cudaEvent_t event = data_->event;
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  const int NH = batch_size * hidden_size;
+  T *dh = take_workspace<T>(workspace, NH);
+  T *tmp_dwx = take_workspace<T>(workspace, NH * 4);
+  T *tmp_uh = take_workspace<T>(workspace, NH * 2);
+  if (data_->dh_final)
+    cudaMemcpyAsync(dh, data_->dh_final, NH * sizeof(T),
+                    cudaMemcpyDeviceToDevice, data_->sync_stream);
+  else
+    cudaMemsetAsync(dh, 0, NH * sizeof(T), data_->sync_stream);
+
+  cudaEventRecord(data_->event, data_->sync_stream);
+  cudaStreamWaitEvent(data_->stream[0], data_->event, 0);
+  cudaStreamWaitEvent(data_->stream[1], data_->event, 0);
+
+  // The raw recurrent product of each step is rebuilt into `tmp_uh`; it is
+  // both the input of the gates (normalized with the saved statistics) and
+  // the `x` of that step's layer norm backward. `tmp_dwx` is the same ring
+  // as in `Run`.
+  const int wx_step = batch_first ? hidden_size * 2 : NH * 2;
+  const int ldwx = batch_first ? time_step * hidden_size * 2 : hidden_size * 2;
+  for (int i = time_step - 1; i >= 0; --i) {
+    const int slot = i % 2;
+    if (i < time_step - 2)
+      cudaStreamWaitEvent(stream1, data_->workspace_event[slot], 0);
+
+    {
+      const profiler::Range range(
+          profiler::kRecurrentGemm, stream1,
+          sizeof(T) * (2.0 * hidden_size * hidden_size +
+                       3.0 * batch_size * hidden_size));
+      cublasSetStream(blas_handle, stream1);
+      blas<T>::gemm(blas_handle, CUBLAS_OP_T, CUBLAS_OP_N, hidden_size * 2,
+                    batch_size, hidden_size, &alpha, u_t, hidden_size,
+                    h + i * NH, hidden_size, &beta, tmp_uh, hidden_size * 2);
+    }
+
+    T *step_norm_cache = norm_cache + i * batch_size * 2;
+    layer_norm::BackwardPass<T> layer_norm1(batch_size, hidden_size * 2,
+                                            nullptr, nullptr, tmp_uh, nullptr,
+                                            nullptr, step_norm_cache);
+    IterateInternal(u_t, h + i * NH, nullptr, wx + i * wx_step, tmp_uh,
+                    step_norm_cache, grad_out + (i + 1) * NH, dh,
+                    tmp_dwx + slot * NH * 2, dwx + i * NH * 2, layer_norm1,
+                    batch_size, hidden_size, ldwx, data_->zoneout, i,
+                    stream1);
+
+    cudaStreamWaitEvent(stream2, event, 0);
+    const profiler::Range range(
+        profiler::kWeightGrad, stream2,
+        sizeof(T) * (3.0 * batch_size * hidden_size +
+                     4.0 * hidden_size * hidden_size));
+    cublasSetStream(blas_handle, stream2);
+    blas<T>::gemm(blas_handle, CUBLAS_OP_N, CUBLAS_OP_T, hidden_size,
+                  hidden_size * 2, batch_size, &alpha, h + i * NH, hidden_size,
+                  tmp_dwx + slot * NH * 2, hidden_size * 2,
+                  i == time_step - 1 ? &beta : &beta_sum, du, hidden_size);
+    cudaEventRecord(data_->workspace_event[slot], stream2);
+  }
+
+  if (data_->dh_initial)
+    cudaMemcpyAsync(data_->dh_initial, dh, NH * sizeof(T),
+                    cudaMemcpyDeviceToDevice, stream1);
+
+  cudaEventRecord(data_->event, data_->stream[1]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+  cudaEventRecord(data_->event, data_->stream[0]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+
+  cublasSetStream(blas_handle, save_stream);
+}
+
+template <typename T>
+void BackwardPass<T>::RunPacked(const int time_step, const int *batch_sizes,
+                                const T *wx_t, const T *u_t, const T *h,
+                                const T *v, const T *grad_out, T *dwx, T *du,
+                                void *workspace,
+                                layer_norm::BackwardPass<T> &layer_norm1) {
+  const profiler::Scope scope("ligru_2_0::BackwardPass::RunPacked");
+
+  const T alpha = static_cast<T>(1.0);
+  const T beta = static_cast<T>(0.0);
+  const T beta_sum = static_cast<T>(1.0);
+
+  const blas<void>::set_pointer_mode scoped1(data_->blas_handle);
+
+  const int batch_size = data_->batch_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream1 = data_->stream[0];
+  const cudaStream_t stream2 = data_->stream[1];
+  const cudaEvent_t event = data_->event;
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  const int NH = batch_size * hidden_size;
+  T *dh = take_workspace<T>(workspace, NH);
+  T *tmp_dwx = take_workspace<T>(workspace, NH * 4);
+  if (data_->dh_final)
+    cudaMemcpyAsync(dh, data_->dh_final, NH * sizeof(T),
+                    cudaMemcpyDeviceToDevice, data_->sync_stream);
+  else
+    cudaMemsetAsync(dh, 0, NH * sizeof(T), data_->sync_stream);
+
+  cudaEventRecord(data_->event, data_->sync_stream);
+  cudaStreamWaitEvent(data_->stream[0], data_->event, 0);
+  cudaStreamWaitEvent(data_->stream[1], data_->event, 0);
+
+  // Same per-step `du` accumulation as `ligru_1_0::BackwardPass::RunPacked`,
+  // through the `tmp_dwx` ring of `Run`; the event waited on here is
+  // recorded after the layer norm gradient.
+  for (int i = time_step - 1; i >= 0; --i) {
+    const int slot = i % 2;
+    if (i < time_step - 2)
+      cudaStreamWaitEvent(stream1, data_->workspace_event[slot], 0);
+
+    IterateInternal(u_t, h + i * NH, v + i * NH * 3, nullptr, nullptr, nullptr,
+                    grad_out + (i + 1) * NH, dh, tmp_dwx + slot * NH * 2,
+                    dwx + i * NH * 2, layer_norm1, batch_sizes[i],
+                    hidden_size, hidden_size * 2, data_->zoneout, i, stream1);
+
+    cudaStreamWaitEvent(stream2, event, 0);
+    const profiler::Range range(
+        profiler::kWeightGrad, stream2,
+        sizeof(T) * (3.0 * batch_sizes[i] * hidden_size +
+                     4.0 * hidden_size * hidden_size));
+    cublasSetStream(blas_handle, stream2);
+    blas<T>::gemm(blas_handle, CUBLAS_OP_N, CUBLAS_OP_T, hidden_size,
+                  hidden_size * 2, batch_sizes[i], &alpha, h + i * NH,
+                  hidden_size, tmp_dwx + slot * NH * 2, hidden_size * 2,
+                  i == time_step - 1 ? &beta : &beta_sum, du, hidden_size);
+    cudaEventRecord(data_->workspace_event[slot], stream2);
+  }
+
+  if (data_->dh_initial)
+    cudaMemcpyAsync(data_->dh_initial, dh, NH * sizeof(T),
+                    cudaMemcpyDeviceToDevice, stream1);
+
+  cudaEventRecord(data_->event, data_->stream[1]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+  cudaEventRecord(data_->event, data_->stream[0]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+
+  cublasSetStream(blas_handle, save_stream);
+}
+
+template <typename T>
+void BackwardPass<T>::RunBidirectional(
+    const int time_step, const T *wx_t, const T *u_t, const T *h, const T *v,
+    const T *grad_out, T *dwx, T *du, void *workspace,
+    layer_norm::BackwardPass<T> &layer_norm_forward,
+    layer_norm::BackwardPass<T> &layer_norm_reverse) {
+  const profiler::Scope scope("ligru_2_0::BackwardPass::RunBidirectional");
+
+  const T alpha = static_cast<T>(1.0);
+  const T beta = static_cast<T>(0.0);
+  const T beta_sum = static_cast<T>(1.0);
+
+  const blas<void>::set_pointer_mode scoped1(data_->blas_handle);
+
+  const int batch_size = data_->batch_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream2 = data_->stream[1];
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  const int NH = batch_size * hidden_size;
+  T *dh = take_workspace<T>(workspace, NH * 2);
+  T *tmp_dwx = take_workspace<T>(workspace, time_step * NH * 4);
+  if (data_->dh_final)
+    cudaMemcpyAsync(dh, data_->dh_final, NH * 2 * sizeof(T),
+                    cudaMemcpyDeviceToDevice, data_->sync_stream);
+  else
+    cudaMemsetAsync(dh, 0, NH * 2 * sizeof(T), data_->sync_stream);
+
+  cudaEventRecord(data_->event, data_->sync_stream);
+  cudaStreamWaitEvent(data_->stream[0], data_->event, 0);
+  cudaStreamWaitEvent(data_->stream[1], data_->event, 0);
+
+  const int ldh = hidden_size * 2;
+  const T *h_reverse = h + 2 * NH * 2 + hidden_size;
+  T *tmp_dwx_reverse = tmp_dwx + time_step * NH * 2;
+  T *dwx_reverse = dwx + time_step * NH * 2;
+  const Zoneout reverse_zoneout = reverse_direction(data_->zoneout);
+  for (int i = 0; i < time_step; ++i) {
+    const int j = time_step - 1 - i;
+    IterateInternal(u_t, h + j * NH * 2, v + j * NH * 3, nullptr, nullptr,
+                    nullptr, grad_out + (j + 1) * NH * 2, dh,
+                    tmp_dwx + j * NH * 2, dwx + j * NH * 2, layer_norm_forward,
+                    batch_size, ldh, hidden_size * 2, data_->zoneout, j,
+                    data_->stream[0]);
+    IterateInternal(u_t, h_reverse + i * NH * 2, v + (time_step + i) * NH * 3,
+                    nullptr, nullptr, nullptr,
+                    grad_out + (i + 1) * NH * 2 + hidden_size, dh + NH,
+                    tmp_dwx_reverse + i * NH * 2, dwx_reverse + i * NH * 2,
+                    layer_norm_reverse, batch_size, ldh, hidden_size * 2,
+                    reverse_zoneout, i, stream2);
+  }
+
+  cudaEventRecord(data_->event, data_->stream[0]);
+  cudaStreamWaitEvent(stream2, data_->event, 0);
+
+  if (data_->dh_initial)
+    cudaMemcpyAsync(data_->dh_initial, dh, NH * 2 * sizeof(T),
+                    cudaMemcpyDeviceToDevice, stream2);
+
+  {
+    const profiler::Range range(
+        profiler::kWeightGrad, stream2,
+        sizeof(T) * (6.0 * batch_size * time_step * hidden_size +
+                     6.0 * hidden_size * hidden_size));
+    cublasSetStream(blas_handle, stream2);
+    blas<T>::gemm(blas_handle, CUBLAS_OP_N, CUBLAS_OP_T, hidden_size,
+                  hidden_size * 2, batch_size * time_step, &alpha, h, ldh,
+                  tmp_dwx, hidden_size * 2, &beta, du, hidden_size);
+    blas<T>::gemm(blas_handle, CUBLAS_OP_N, CUBLAS_OP_T, hidden_size,
+                  hidden_size * 2, batch_size * time_step, &alpha, h_reverse,
+                  ldh, tmp_dwx_reverse, hidden_size * 2, &beta_sum, du,
+                  hidden_size);
   }
 
-  cudaStreamWaitEvent(stream2, event, 0);
+  cudaEventRecord(data_->event, data_->stream[1]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+  cudaEventRecord(data_->event, data_->stream[0]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
 
-  cublasSetStream(blas_handle, stream2);
-  blas<T>::gemm(blas_handle, CUBLAS_OP_N, CUBLAS_OP_T, hidden_size * 2,
-                hidden_size, batch_size * time_step, &alpha, tmp_dwx,
-                hidden_size * 2, h, hidden_size, &beta_sum, du,
-                hidden_size * 2);
   cublasSetStream(blas_handle, save_stream);
 }
 
+template struct BackwardPass<half>;
+template struct BackwardPass<__nv_bfloat16>;
 template struct BackwardPass<float>;
 template struct BackwardPass<double>;
 } // namespace ligru_2_0
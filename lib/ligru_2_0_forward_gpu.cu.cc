@@ -13,166 +13,237 @@
 // limitations under the License.
 // ==============================================================================
 
+#include <algorithm>
+#include <cassert>
 #include <cublas_v2.h>
+#include <cuda_bf16.h>
 #include <cuda_fp16.h>
 #include <cuda_runtime_api.h>
 
+#include "autotune.h"
 #include "blas.h"
 #include "device_assert.h"
 
 #include "inline_ops.h"
+#include "l2_persistence.h"
 #include "layer_norm.h"
 #include "ligru_2_0.h"
+#include "profiler.h"
+#include "quantized_weight.h"
+#include "state_table.h"
+#include "workspace.h"
+#include "zoneout.h"
 
 namespace {
 
-template <typename T, bool Training>
-__global__ void
-PointwiseOperationsReLU(const int batch_dim, const int hidden_dim, const T *wx,
-                        const T *uh, const T *h, T *h_out, T *v) {
-  const int row = blockDim.x * blockIdx.x + threadIdx.x;
+using haste::v0::Zoneout;
+using haste::v0::zoneout_keep;
+
+constexpr int kPointwiseBlockDim = 256;
+constexpr int kPointwiseMinBlocks = 4;
+// Block widths the autotuner picks from, as in `ligru_1_0_forward_gpu.cu.cc`.
+constexpr int kPointwiseBlockWidths[] = {32, 64, 128, 256};
+constexpr int kNumPointwiseBlockWidths = 4;
+
+// Applies the gates to `kVec` consecutive hidden units of one batch element
+// per thread, reading `wx` with rows `ldwx` apart and adding the optional
+// `[2 * hidden_dim]` bias `b` to each of them, then applies `zoneout` to
+// `h_out` as step `step`. Vectorized launches need `hidden_dim` to be a
+// multiple of `kVec` and every pointer aligned to `aligned_vector<T, kVec>`.
+template <typename T, bool Training, typename Activation, int kVec>
+__global__ void __launch_bounds__(kPointwiseBlockDim, kPointwiseMinBlocks)
+    PointwiseOperations(const int batch_dim, const int hidden_dim,
+                        const int ldh, const int ldwx, const T *wx,
+                        const T *b, const T *uh, const T *h, T *h_out, T *v,
+                        const Zoneout zoneout, const int step) {
+  using acc_t = typename acc_type<T>::type;
+  using vec_t = aligned_vector<T, kVec>;
+
+  const int row = (blockDim.x * blockIdx.x + threadIdx.x) * kVec;
   const int col = blockDim.y * blockIdx.y + threadIdx.y;
 
   if (row >= hidden_dim || col >= batch_dim)
     return;
 
   const int weight_idx = col * (hidden_dim * 2) + row;
-
-
-  const int output_idx = col * hidden_dim + row;
-
+  const int wx_idx = col * ldwx + row;
+  const int output_idx = col * ldh + row;
 
   const int a_idx = weight_idx + 0 * hidden_dim;
   const int z_idx = weight_idx + 1 * hidden_dim;
 
-  const T z =
-      sigmoid(wx[z_idx] + uh[z_idx]);
-                                    
-  const T a = wx[a_idx] + uh[a_idx]; 
+  const vec_t wx_a = load_vector<kVec>(wx + wx_idx + 0 * hidden_dim);
+  const vec_t wx_z = load_vector<kVec>(wx + wx_idx + 1 * hidden_dim);
+  const vec_t uh_a = load_vector<kVec>(uh + a_idx);
+  const vec_t uh_z = load_vector<kVec>(uh + z_idx);
+  const vec_t h_prev = load_vector<kVec>(h + output_idx);
 
-  const T hcand = relu(a); 
-
-  if (Training) {
-    const int base_v_idx = col * (hidden_dim * 3) + row;
-    v[base_v_idx + 1 * hidden_dim] = z;
-    v[base_v_idx + 0 * hidden_dim] = a;
-    v[base_v_idx + 2 * hidden_dim] = hcand;
+  vec_t b_a, b_z;
+  if (b) {
+    b_a = load_vector<kVec>(b + row + 0 * hidden_dim);
+    b_z = load_vector<kVec>(b + row + 1 * hidden_dim);
+  } else {
+#pragma unroll
+    for (int j = 0; j < kVec; ++j)
+      b_a.val[j] = b_z.val[j] = static_cast<T>(0.0);
   }
 
-  T cur_h_value = z * h[output_idx] + (static_cast<T>(1.0) - z) * hcand;
-
-  h_out[output_idx] = cur_h_value;
-}
-
-template <typename T, bool Training>
-__global__ void PointwiseOperationsLeakyReLU(const int batch_dim,
-                                             const int hidden_dim, const T *wx,
-                                             const T *uh, const T *h, T *h_out,
-                                             T *v) {
-  const int row = blockDim.x * blockIdx.x + threadIdx.x;
-  const int col = blockDim.y * blockIdx.y + threadIdx.y;
-
-  if (row >= hidden_dim || col >= batch_dim)
-    return;
-
-  const int weight_idx = col * (hidden_dim * 2) + row;
-
-  const int output_idx = col * hidden_dim + row;
-
-
-  const int a_idx = weight_idx + 0 * hidden_dim;
-  const int z_idx = weight_idx + 1 * hidden_dim;
-
-  const T z =
-      sigmoid(wx[z_idx] + uh[z_idx]); 
-                                   
-  const T a = wx[a_idx] + uh[a_idx];  
-
-  const T hcand = leaky_relu(a); 
-
-  if (Training) {
-    const int base_v_idx = col * (hidden_dim * 3) + row;
-    v[base_v_idx + 1 * hidden_dim] = z;
-    v[base_v_idx + 0 * hidden_dim] = a;
-    v[base_v_idx + 2 * hidden_dim] = hcand;
+  vec_t a_out, z_out, hcand_out, h_next;
+#pragma unroll
+  for (int j = 0; j < kVec; ++j) {
+    const acc_t z = sigmoid(static_cast<acc_t>(wx_z.val[j]) +
+                            static_cast<acc_t>(b_z.val[j]) +
+                            static_cast<acc_t>(uh_z.val[j]));
+    const acc_t a = static_cast<acc_t>(wx_a.val[j]) +
+                    static_cast<acc_t>(b_a.val[j]) +
+                    static_cast<acc_t>(uh_a.val[j]);
+    const acc_t hcand = Activation::forward(a);
+
+    a_out.val[j] = static_cast<T>(a);
+    z_out.val[j] = static_cast<T>(z);
+    hcand_out.val[j] = static_cast<T>(hcand);
+
+    const acc_t prev = static_cast<acc_t>(h_prev.val[j]);
+    acc_t next = z * prev + (static_cast<acc_t>(1.0) - z) * hcand;
+    if (zoneout.prob > 0.0f) {
+      const acc_t keep =
+          zoneout_keep<acc_t>(zoneout, col * hidden_dim + row + j, step);
+      next = keep * prev + (static_cast<acc_t>(1.0) - keep) * next;
+    }
+    h_next.val[j] = static_cast<T>(next);
   }
 
-  T cur_h_value = z * h[output_idx] + (static_cast<T>(1.0) - z) * hcand;
-
-  h_out[output_idx] = cur_h_value;
-}
-
-template <typename T, bool Training>
-__global__ void
-PointwiseOperationsTanh(const int batch_dim, const int hidden_dim, const T *wx,
-                        const T *uh, const T *h, T *h_out, T *v) {
-  const int row = blockDim.x * blockIdx.x + threadIdx.x;
-  const int col = blockDim.y * blockIdx.y + threadIdx.y;
-
-  if (row >= hidden_dim || col >= batch_dim)
-    return;
-
-  const int weight_idx = col * (hidden_dim * 2) + row;
-
-  const int output_idx = col * hidden_dim + row;
-
-
-  const int a_idx = weight_idx + 0 * hidden_dim;
-  const int z_idx = weight_idx + 1 * hidden_dim;
-
-  const T z =
-      sigmoid(wx[z_idx] + uh[z_idx]); 
-  const T a = wx[a_idx] + uh[a_idx];  
-
-  const T hcand = tanh(a);
-
   if (Training) {
     const int base_v_idx = col * (hidden_dim * 3) + row;
-    v[base_v_idx + 1 * hidden_dim] = z;
-    v[base_v_idx + 0 * hidden_dim] = a;
-    v[base_v_idx + 2 * hidden_dim] = hcand;
+    store_vector(v + base_v_idx + 0 * hidden_dim, a_out);
+    store_vector(v + base_v_idx + 1 * hidden_dim, z_out);
+    store_vector(v + base_v_idx + 2 * hidden_dim, hcand_out);
   }
 
-  T cur_h_value = z * h[output_idx] + (static_cast<T>(1.0) - z) * hcand;
-
-  h_out[output_idx] = cur_h_value;
+  store_vector(h_out + output_idx, h_next);
 }
 
-template <typename T, bool Training>
-__global__ void
-PointwiseOperationsSin(const int batch_dim, const int hidden_dim, const T *wx,
-                       const T *uh, const T *h, T *h_out, T *v) {
-  const int row = blockDim.x * blockIdx.x + threadIdx.x;
-  const int col = blockDim.y * blockIdx.y + threadIdx.y;
-
-  if (row >= hidden_dim || col >= batch_dim)
-    return;
-
-  const int weight_idx = col * (hidden_dim * 2) + row;
-
+template <typename T>
+using PointwiseKernel = void (*)(const int, const int, const int, const int,
+                                 const T *, const T *, const T *, const T *,
+                                 T *, T *, const Zoneout, const int);
+
+template <typename T, bool Training, int kVec>
+PointwiseKernel<T> SelectPointwiseActivation(const int activation) {
+  if (activation == 0)
+    return PointwiseOperations<T, Training, ReLU, kVec>;
+  if (activation == 1)
+    return PointwiseOperations<T, Training, LeakyReLU, kVec>;
+  if (activation == 2)
+    return PointwiseOperations<T, Training, Sin, kVec>;
+  return PointwiseOperations<T, Training, Tanh, kVec>;
+}
 
-  const int output_idx = col * hidden_dim + row;
+template <typename T, int kVec>
+PointwiseKernel<T> SelectPointwiseKernel(const bool training,
+                                         const int activation) {
+  if (training)
+    return SelectPointwiseActivation<T, true, kVec>(activation);
+  return SelectPointwiseActivation<T, false, kVec>(activation);
+}
 
+constexpr int kLayerNormBlockDim = 256;
+constexpr int kMaxFusedSharedMemory = 48 * 1024;
+
+// Normalizes one row of `uh` and applies the gates in the same launch (one
+// block per batch element). The row is staged in shared memory so it is read
+// from global memory once and the normalized copy is never written back. The
+// (mean, invstd) pair needed by the layer norm backward pass is stored in
+// `norm_cache`. Zoneout is applied as in `PointwiseOperations`.
+template <typename T, bool Training, typename Activation>
+__global__ void __launch_bounds__(kLayerNormBlockDim)
+    LayerNormPointwiseOperations(const int batch_dim, const int hidden_dim,
+                                 const int ldh, const int ldwx, const T *wx,
+                                 const T *b, const T *uh, const T *h,
+                                 T *h_out, T *v, T *norm_cache,
+                                 const Zoneout zoneout, const int step) {
+  using acc_t = typename acc_type<T>::type;
+
+  extern __shared__ int shared_var[];
+  acc_t *row_uh = reinterpret_cast<acc_t *>(shared_var);
+  __shared__ acc_t warp_sums[32];
+
+  const int col = blockIdx.x;
+  const int row_size = hidden_dim * 2;
+  const T *uh_row = uh + col * row_size;
+
+  acc_t sum = static_cast<acc_t>(0.0);
+  for (int i = threadIdx.x; i < row_size; i += blockDim.x) {
+    const acc_t x = static_cast<acc_t>(uh_row[i]);
+    row_uh[i] = x;
+    sum += x;
+  }
+  const acc_t mean = block_reduce_sum(sum, warp_sums) / row_size;
 
-  const int a_idx = weight_idx + 0 * hidden_dim;
-  const int z_idx = weight_idx + 1 * hidden_dim;
+  acc_t sumsq = static_cast<acc_t>(0.0);
+  for (int i = threadIdx.x; i < row_size; i += blockDim.x) {
+    const acc_t diff = row_uh[i] - mean;
+    sumsq += diff * diff;
+  }
+  const acc_t invstd = rsqrt(block_reduce_sum(sumsq, warp_sums) / row_size +
+                             static_cast<acc_t>(1e-5));
 
-  const T z =
-      sigmoid(wx[z_idx] + uh[z_idx]); 
-  const T a = wx[a_idx] + uh[a_idx]; 
+  if (threadIdx.x == 0) {
+    norm_cache[col * 2 + 0] = static_cast<T>(mean);
+    norm_cache[col * 2 + 1] = static_cast<T>(invstd);
+  }
 
-  const T hcand = sin(a); 
+  for (int row = threadIdx.x; row < hidden_dim; row += blockDim.x) {
+    const int weight_idx = col * ldwx + row;
+    const int output_idx = col * ldh + row;
+
+    const acc_t uh_a = (row_uh[row] - mean) * invstd;
+    const acc_t uh_z = (row_uh[row + hidden_dim] - mean) * invstd;
+    const acc_t b_a =
+        b ? static_cast<acc_t>(b[row]) : static_cast<acc_t>(0.0);
+    const acc_t b_z = b ? static_cast<acc_t>(b[row + hidden_dim])
+                        : static_cast<acc_t>(0.0);
+
+    const acc_t z =
+        sigmoid(static_cast<acc_t>(wx[weight_idx + hidden_dim]) + b_z + uh_z);
+    const acc_t a = static_cast<acc_t>(wx[weight_idx]) + b_a + uh_a;
+    const acc_t hcand = Activation::forward(a);
+
+    if (Training) {
+      const int base_v_idx = col * (hidden_dim * 3) + row;
+      v[base_v_idx + 0 * hidden_dim] = static_cast<T>(a);
+      v[base_v_idx + 1 * hidden_dim] = static_cast<T>(z);
+      v[base_v_idx + 2 * hidden_dim] = static_cast<T>(hcand);
+    }
 
-  if (Training) {
-    const int base_v_idx = col * (hidden_dim * 3) + row;
-    v[base_v_idx + 1 * hidden_dim] = z;
-    v[base_v_idx + 0 * hidden_dim] = a;
-    v[base_v_idx + 2 * hidden_dim] = hcand;
+    const acc_t prev = static_cast<acc_t>(h[output_idx]);
+    acc_t cur_h_value = z * prev + (static_cast<acc_t>(1.0) - z) * hcand;
+    if (zoneout.prob > 0.0f) {
+      const acc_t keep =
+          zoneout_keep<acc_t>(zoneout, col * hidden_dim + row, step);
+      cur_h_value =
+          keep * prev + (static_cast<acc_t>(1.0) - keep) * cur_h_value;
+    }
+    h_out[output_idx] = static_cast<T>(cur_h_value);
   }
+}
 
-  T cur_h_value = z * h[output_idx] + (static_cast<T>(1.0) - z) * hcand;
+template <typename T>
+using LayerNormPointwiseKernel = void (*)(const int, const int, const int,
+                                          const int, const T *, const T *,
+                                          const T *, const T *, T *, T *, T *,
+                                          const Zoneout, const int);
 
-  h_out[output_idx] = cur_h_value;
+template <typename T, bool Training>
+LayerNormPointwiseKernel<T>
+SelectLayerNormPointwiseKernel(const int activation) {
+  if (activation == 0)
+    return LayerNormPointwiseOperations<T, Training, ReLU>;
+  if (activation == 1)
+    return LayerNormPointwiseOperations<T, Training, LeakyReLU>;
+  if (activation == 2)
+    return LayerNormPointwiseOperations<T, Training, Sin>;
+  return LayerNormPointwiseOperations<T, Training, Tanh>;
 }
 } // anonymous namespace
 
@@ -186,9 +257,14 @@ template <typename T> struct ForwardPass<T>::private_data {
   int input_size;
   int hidden_size;
   int activation;
+  const T *bias;
+  Zoneout zoneout;
+  QuantizedWeight quantized_u;
+  int groups;
   cublasHandle_t blas_handle;
   cudaStream_t stream[2];
   cudaEvent_t event;
+  cudaEvent_t projection_event;
   cudaStream_t sync_stream;
 };
 
@@ -205,9 +281,12 @@ ForwardPass<T>::ForwardPass(const bool training, const int batch_size,
   data_->hidden_size = hidden_size;
   data_->blas_handle = blas_handle;
   data_->sync_stream = stream;
+  data_->bias = nullptr;
+  data_->groups = 1;
   cudaStreamCreate(&data_->stream[0]);
   cudaStreamCreate(&data_->stream[1]);
   cudaEventCreateWithFlags(&data_->event, cudaEventDisableTiming);
+  cudaEventCreateWithFlags(&data_->projection_event, cudaEventDisableTiming);
 }
 
 template <typename T> ForwardPass<T>::~ForwardPass() {
@@ -220,71 +299,162 @@ template <typename T> ForwardPass<T>::~ForwardPass() {
     cudaStreamSynchronize(data_->stream[1]);
     cudaStreamSynchronize(data_->stream[0]);
   }
+  cudaEventDestroy(data_->projection_event);
   cudaEventDestroy(data_->event);
   cudaStreamDestroy(data_->stream[1]);
   cudaStreamDestroy(data_->stream[0]);
   delete data_;
 }
 
+template <typename T>
+size_t ForwardPass<T>::GetWorkspaceSize(const int time_step,
+                                        const int batch_size,
+                                        const int hidden_size,
+                                        const bool training,
+                                        const bool bidirectional) {
+  // The normalized product of the current step, plus the step of `tmp_uh`
+  // that inference keeps nowhere else.
+  const int directions = bidirectional ? 2 : 1;
+  const size_t step = workspace_size<T>(directions * batch_size * hidden_size * 2);
+  return training ? step : step * 2;
+}
+
+template <typename T> void ForwardPass<T>::SetBias(const T *b) {
+  data_->bias = b;
+}
+
+template <typename T>
+void ForwardPass<T>::SetZoneout(const Zoneout &zoneout) {
+  data_->zoneout = zoneout;
+}
+
+template <typename T>
+void ForwardPass<T>::SetQuantizedWeight(const QuantizedWeight &u) {
+  assert(!data_->training || !u.data);
+  data_->quantized_u = u;
+}
+
+template <typename T> void ForwardPass<T>::SetGroups(const int groups) {
+  assert(groups > 0 && data_->batch_size % groups == 0);
+  data_->groups = groups;
+}
+
 template <typename T>
 void ForwardPass<T>::IterateInternal(const T *u, const T *h, T *h_out, T *v,
                                      T *tmp_wx, T *tmp_uh, T *tmp_uh_norm,
-                                     layer_norm::ForwardPass<T> &layer_norm1) {
+                                     layer_norm::ForwardPass<T> &layer_norm1,
+                                     const int batch_size, const int ldh,
+                                     const int ldwx, const Zoneout &zoneout,
+                                     const int step,
+                                     const cudaStream_t &stream1) {
   static const T alpha = static_cast<T>(1.0);
   static const T beta = static_cast<T>(0.0);
 
   const bool training = data_->training;
-  const int batch_size = data_->batch_size;
   const int hidden_size = data_->hidden_size;
   const cublasHandle_t blas_handle = data_->blas_handle;
-  const cudaStream_t stream1 = data_->stream[0];
   const cudaEvent_t event = data_->event;
+  const T *bias = data_->bias;
+  const int groups = data_->groups;
+  assert(groups == 1 || (!bias && !data_->quantized_u.data));
+
+  {
+    const double weight_bytes = data_->quantized_u.data ? 1.0 : sizeof(T);
+    const profiler::Range range(
+        profiler::kRecurrentGemm, stream1,
+        weight_bytes * 2.0 * groups * hidden_size * hidden_size +
+            sizeof(T) * 3.0 * batch_size * hidden_size);
+    if (data_->quantized_u.data) {
+      QuantizedMatMul(data_->quantized_u, hidden_size * 2, hidden_size,
+                      batch_size, h, ldh, tmp_uh, stream1);
+    } else if (groups > 1) {
+      cublasSetStream(blas_handle, stream1);
+      blas<T>::gemmStridedBatched(
+          blas_handle, CUBLAS_OP_T, CUBLAS_OP_N, hidden_size * 2,
+          batch_size / groups, hidden_size, &alpha, u, hidden_size,
+          2LL * hidden_size * hidden_size, h, ldh * groups, ldh, &beta,
+          tmp_uh, hidden_size * 2 * groups, hidden_size * 2, groups);
+    } else {
+      const autotune::GemmPlan *plan = autotune::PlanGemm<T>(
+          CUBLAS_OP_T, CUBLAS_OP_N, hidden_size * 2, batch_size, hidden_size,
+          hidden_size, ldh, hidden_size * 2, stream1);
+      cublasSetStream(blas_handle, stream1);
+      autotune::gemm<T>(plan, blas_handle, CUBLAS_OP_T, CUBLAS_OP_N,
+                        hidden_size * 2, batch_size, hidden_size, &alpha, u,
+                        hidden_size, h, ldh, &beta, tmp_uh, hidden_size * 2);
+    }
+  }
 
-  cublasSetStream(blas_handle, stream1);
-  blas<T>::gemm(blas_handle, CUBLAS_OP_N, CUBLAS_OP_N, hidden_size * 2,
-                batch_size, hidden_size, &alpha, u, hidden_size * 2, h,
-                hidden_size, &beta, tmp_uh, hidden_size * 2);
-  layer_norm1.RunPartial(stream1, batch_size, tmp_uh, tmp_uh_norm);
+  // Reads `wx`, `uh` and `h`, writes `h_out` and the gates when training.
+  const double pointwise_bytes =
+      sizeof(T) * (training ? 9.0 : 6.0) * batch_size * hidden_size;
+
+  // Normalize and apply the gates in one pass over `tmp_uh` whenever a row
+  // fits in shared memory; that kernel is charged to the pointwise phase.
+  const int shared_mem_size =
+      sizeof(typename acc_type<T>::type) * hidden_size * 2;
+  if (shared_mem_size <= kMaxFusedSharedMemory) {
+    const LayerNormPointwiseKernel<T> kernel =
+        training ? SelectLayerNormPointwiseKernel<T, true>(data_->activation)
+                 : SelectLayerNormPointwiseKernel<T, false>(data_->activation);
+
+    const profiler::Range range(profiler::kPointwise, stream1,
+                                pointwise_bytes);
+    cudaStreamWaitEvent(stream1, event, 0);
+    kernel<<<batch_size, kLayerNormBlockDim, shared_mem_size, stream1>>>(
+        batch_size, hidden_size, ldh, ldwx, tmp_wx, bias, tmp_uh, h, h_out, v,
+        layer_norm1.ReservePartial(batch_size), zoneout, step);
+    return;
+  }
 
-  // Compute launch configuration for pointwise operations kernel.
-  const dim3 blockDim(32, 16);
-  const dim3 gridDim((hidden_size + blockDim.x - 1) / blockDim.x,
-                     (batch_size + blockDim.y - 1) / blockDim.y);
+  {
+    const profiler::Range range(profiler::kLayerNorm, stream1,
+                                sizeof(T) * 4.0 * batch_size * hidden_size);
+    layer_norm1.RunPartial(stream1, batch_size, tmp_uh, tmp_uh_norm);
+  }
 
+  // Compute launch configuration for pointwise operations kernel.
+  constexpr int kVec = vector_width<T>::value;
+  const bool vectorized =
+      hidden_size % kVec == 0 &&
+      is_aligned<T, kVec>({tmp_wx, bias, tmp_uh_norm, h, h_out, v});
+  const PointwiseKernel<T> kernel =
+      vectorized ? SelectPointwiseKernel<T, kVec>(training, data_->activation)
+                 : SelectPointwiseKernel<T, 1>(training, data_->activation);
+  const int vec = vectorized ? kVec : 1;
+
+  const auto launch = [&](const int width) {
+    const dim3 blockDim(width, kPointwiseBlockDim / width);
+    const dim3 gridDim((hidden_size / vec + blockDim.x - 1) / blockDim.x,
+                       (batch_size + blockDim.y - 1) / blockDim.y);
+    kernel<<<gridDim, blockDim, 0, stream1>>>(batch_size, hidden_size, ldh,
+                                              ldwx, tmp_wx, bias, tmp_uh_norm,
+                                              h, h_out, v, zoneout, step);
+    return true;
+  };
+
+  const profiler::Range range(profiler::kPointwise, stream1, pointwise_bytes);
   cudaStreamWaitEvent(stream1, event, 0);
 
-  if (training) {
-    if (data_->activation == 0) {
-      PointwiseOperationsReLU<T, true><<<gridDim, blockDim, 0, stream1>>>(
-          batch_size, hidden_size, tmp_wx, tmp_uh_norm, h, h_out, v);
-    } else if (data_->activation == 1) {
-      PointwiseOperationsLeakyReLU<T, true><<<gridDim, blockDim, 0, stream1>>>(
-          batch_size, hidden_size, tmp_wx, tmp_uh_norm, h, h_out, v);
-    } else if (data_->activation == 2) {
-      PointwiseOperationsSin<T, true><<<gridDim, blockDim, 0, stream1>>>(
-          batch_size, hidden_size, tmp_wx, tmp_uh_norm, h, h_out, v);
-    } else if (data_->activation == 3) {
-      PointwiseOperationsTanh<T, true><<<gridDim, blockDim, 0, stream1>>>(
-          batch_size, hidden_size, tmp_wx, tmp_uh_norm, h, h_out, v);
-    }
-  } else {
-    if (data_->activation == 0) {
-      PointwiseOperationsReLU<T, false><<<gridDim, blockDim, 0, stream1>>>(
-          batch_size, hidden_size, tmp_wx, tmp_uh_norm, h, h_out, v);
-    } else if (data_->activation == 1) {
-      PointwiseOperationsLeakyReLU<T, false><<<gridDim, blockDim, 0, stream1>>>(
-          batch_size, hidden_size, tmp_wx, tmp_uh_norm, h, h_out, v);
-    } else if (data_->activation == 3) {
-      PointwiseOperationsTanh<T, false><<<gridDim, blockDim, 0, stream1>>>(
-          batch_size, hidden_size, tmp_wx, tmp_uh_norm, h, h_out, v);
-    }
+  int width = kPointwiseBlockWidths[0];
+  if (autotune::Enabled()) {
+    const autotune::Key key = {autotune::kPointwise, 2,
+                               autotune::type_code<T>(),
+                               autotune::DeviceArch(), batch_size, hidden_size,
+                               vec, training, data_->activation};
+    width = kPointwiseBlockWidths[autotune::Select(
+        key, kNumPointwiseBlockWidths,
+        [&](const int i) { return launch(kPointwiseBlockWidths[i]); },
+        stream1)];
   }
+  launch(width);
 }
 
 template <typename T>
 void ForwardPass<T>::Run(const int seq_length, T *wx, const T *u, T *h, T *v,
-                         layer_norm::ForwardPass<T> &layer_norm1,
-                         T *tmp_uh_norm, T *tmp_uh) {
+                         layer_norm::ForwardPass<T> &layer_norm1, T *tmp_uh,
+                         void *workspace, const bool batch_first) {
+  const profiler::Scope scope("ligru_2_0::ForwardPass::Run");
 
   const blas<void>::set_pointer_mode scoped1(data_->blas_handle);
 
@@ -295,17 +465,293 @@ void ForwardPass<T>::Run(const int seq_length, T *wx, const T *u, T *h, T *v,
   cudaStream_t save_stream;
   cublasGetStream(blas_handle, &save_stream);
 
+  // Order the internal streams after the work already queued on the caller's
+  // stream; this also lets them join a stream capture started on it.
+  cudaEventRecord(data_->event, data_->sync_stream);
+  cudaStreamWaitEvent(data_->stream[0], data_->event, 0);
+  cudaStreamWaitEvent(data_->stream[1], data_->event, 0);
+
+  // `u` is re-read by every step, so it is kept in the L2 set aside for
+  // persisting accesses, if any, for the duration of the call.
+  const l2_persistence::Window window(
+      data_->stream, 2, u,
+      sizeof(T) * 2 * data_->groups * hidden_size * hidden_size);
+
   const int NH = batch_size * hidden_size;
+  T *tmp_uh_norm = take_workspace<T>(workspace, NH * 2);
+  if (!data_->training)
+    tmp_uh = take_workspace<T>(workspace, NH * 2);
+
+  const int wx_step = batch_first ? hidden_size * 2 : NH * 2;
+  const int ldwx = batch_first ? seq_length * hidden_size * 2 : hidden_size * 2;
 
+  // Only the backward pass reads `tmp_uh` back, so inference reuses one step.
+  const int uh_stride = data_->training ? NH * 2 : 0;
   for (int i = 0; i < seq_length; ++i) {
     IterateInternal(u, h + i * NH, h + (i + 1) * NH, v + i * NH * 3,
-                    wx + i * NH * 2, tmp_uh + i * NH * 2, tmp_uh_norm,
-                    layer_norm1);
+                    wx + i * wx_step, tmp_uh + i * uh_stride, tmp_uh_norm,
+                    layer_norm1, batch_size, hidden_size, ldwx,
+                    data_->zoneout, i, data_->stream[0]);
   }
 
+  // Order the caller's stream after everything issued above so the pass can
+  // be reused by later calls without being destroyed.
+  cudaEventRecord(data_->event, data_->stream[1]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+  cudaEventRecord(data_->event, data_->stream[0]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+
+  cublasSetStream(blas_handle, save_stream);
+}
+
+template <typename T>
+void ForwardPass<T>::RunPipelined(const int seq_length, const int chunk_size,
+                                  const T *x, const T *w, T *wx, const T *u,
+                                  T *h, T *v,
+                                  layer_norm::ForwardPass<T> &layer_norm1,
+                                  T *tmp_uh, void *workspace) {
+  const profiler::Scope scope("ligru_2_0::ForwardPass::RunPipelined");
+
+  assert(data_->groups == 1);
+
+  static const T alpha = static_cast<T>(1.0);
+  static const T beta = static_cast<T>(0.0);
+
+  const blas<void>::set_pointer_mode scoped1(data_->blas_handle);
+
+  const int batch_size = data_->batch_size;
+  const int input_size = data_->input_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream1 = data_->stream[0];
+  const cudaStream_t stream2 = data_->stream[1];
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  cudaEventRecord(data_->event, data_->sync_stream);
+  cudaStreamWaitEvent(stream1, data_->event, 0);
+  cudaStreamWaitEvent(stream2, data_->event, 0);
+
+  const l2_persistence::Window window(
+      &stream1, 1, u, sizeof(T) * 2 * hidden_size * hidden_size);
+
+  const int NH = batch_size * hidden_size;
+  T *tmp_uh_norm = take_workspace<T>(workspace, NH * 2);
+  if (!data_->training)
+    tmp_uh = take_workspace<T>(workspace, NH * 2);
+  const int uh_stride = data_->training ? NH * 2 : 0;
+
+  // The projection of each chunk is queued ahead on stream[1], as in
+  // `ligru_1_0::ForwardPass::RunPipelined`.
+  for (int begin = 0; begin < seq_length; begin += chunk_size) {
+    const int steps = std::min(chunk_size, seq_length - begin);
+    T *wx_chunk = wx + begin * NH * 2;
+
+    {
+      const profiler::Range range(
+          profiler::kInputProjection, stream2,
+          sizeof(T) * (2.0 * hidden_size * input_size +
+                       steps * batch_size * (input_size + 2.0 * hidden_size)));
+      cublasSetStream(blas_handle, stream2);
+      blas<T>::gemm(blas_handle, CUBLAS_OP_T, CUBLAS_OP_N, hidden_size * 2,
+                    steps * batch_size, input_size, &alpha, w, input_size,
+                    x + begin * batch_size * input_size, input_size, &beta,
+                    wx_chunk, hidden_size * 2);
+    }
+    cudaEventRecord(data_->projection_event, stream2);
+    cudaStreamWaitEvent(stream1, data_->projection_event, 0);
+
+    for (int i = begin; i < begin + steps; ++i) {
+      IterateInternal(u, h + i * NH, h + (i + 1) * NH, v + i * NH * 3,
+                      wx + i * NH * 2, tmp_uh + i * uh_stride, tmp_uh_norm,
+                      layer_norm1, batch_size, hidden_size, hidden_size * 2,
+                      data_->zoneout, i, stream1);
+    }
+  }
+
+  cudaEventRecord(data_->event, data_->stream[1]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+  cudaEventRecord(data_->event, data_->stream[0]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+
+  cublasSetStream(blas_handle, save_stream);
+}
+
+template <typename T>
+void ForwardPass<T>::RunPacked(const int seq_length, const int *batch_sizes,
+                               T *wx, const T *u, T *h, T *v,
+                               layer_norm::ForwardPass<T> &layer_norm1,
+                               T *tmp_uh, void *workspace) {
+  const profiler::Scope scope("ligru_2_0::ForwardPass::RunPacked");
+
+  const blas<void>::set_pointer_mode scoped1(data_->blas_handle);
+
+  const int batch_size = data_->batch_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  cudaEventRecord(data_->event, data_->sync_stream);
+  cudaStreamWaitEvent(data_->stream[0], data_->event, 0);
+  cudaStreamWaitEvent(data_->stream[1], data_->event, 0);
+
+  const l2_persistence::Window window(
+      data_->stream, 2, u,
+      sizeof(T) * 2 * data_->groups * hidden_size * hidden_size);
+
+  // The layer norm consumes its cache one minibatch after another, so the
+  // `tmp_uh` rows it reads back are packed the same way rather than padded.
+  const int NH = batch_size * hidden_size;
+  T *tmp_uh_norm = take_workspace<T>(workspace, NH * 2);
+  if (!data_->training)
+    tmp_uh = take_workspace<T>(workspace, NH * 2);
+  int rows = 0;
+  for (int i = 0; i < seq_length; ++i) {
+    assert(batch_sizes[i] > 0 && batch_sizes[i] <= batch_size);
+    assert(i == 0 || batch_sizes[i] <= batch_sizes[i - 1]);
+    IterateInternal(u, h + i * NH, h + (i + 1) * NH, v + i * NH * 3,
+                    wx + i * NH * 2, tmp_uh + rows * hidden_size * 2,
+                    tmp_uh_norm, layer_norm1, batch_sizes[i], hidden_size,
+                    hidden_size * 2, data_->zoneout, i, data_->stream[0]);
+    if (data_->training)
+      rows += batch_sizes[i];
+  }
+
+  cudaEventRecord(data_->event, data_->stream[1]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+  cudaEventRecord(data_->event, data_->stream[0]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+
+  cublasSetStream(blas_handle, save_stream);
+}
+
+template <typename T>
+void ForwardPass<T>::RunIndexed(const int seq_length, T *wx, const T *u, T *h,
+                                T *v, layer_norm::ForwardPass<T> &layer_norm1,
+                                T *tmp_uh, void *workspace, T *h_table,
+                                const int *slots) {
+  const profiler::Scope scope("ligru_2_0::ForwardPass::RunIndexed");
+
+  const int batch_size = data_->batch_size;
+  const int hidden_size = data_->hidden_size;
+
+  state_table::Gather(data_->sync_stream, batch_size, hidden_size, slots,
+                      h_table, h);
+  Run(seq_length, wx, u, h, v, layer_norm1, tmp_uh, workspace);
+  state_table::Scatter(data_->sync_stream, batch_size, hidden_size, slots,
+                       h + seq_length * batch_size * hidden_size, h_table);
+}
+
+template <typename T>
+void ForwardPass<T>::RunInference(const int seq_length, T *wx, const T *u,
+                                  T *h, layer_norm::ForwardPass<T> &layer_norm1,
+                                  void *workspace, const bool batch_first) {
+  const profiler::Scope scope("ligru_2_0::ForwardPass::RunInference");
+
+  assert(!data_->training);
+
+  const blas<void>::set_pointer_mode scoped1(data_->blas_handle);
+
+  const int batch_size = data_->batch_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  cudaEventRecord(data_->event, data_->sync_stream);
+  cudaStreamWaitEvent(data_->stream[0], data_->event, 0);
+  cudaStreamWaitEvent(data_->stream[1], data_->event, 0);
+
+  const l2_persistence::Window window(
+      data_->stream, 2, u,
+      sizeof(T) * 2 * data_->groups * hidden_size * hidden_size);
+
+  const int NH = batch_size * hidden_size;
+  const int wx_step = batch_first ? hidden_size * 2 : NH * 2;
+  const int ldwx = batch_first ? seq_length * hidden_size * 2 : hidden_size * 2;
+  T *tmp_uh_norm = take_workspace<T>(workspace, NH * 2);
+  T *tmp_uh = take_workspace<T>(workspace, NH * 2);
+  for (int i = 0; i < seq_length; ++i) {
+    IterateInternal(u, h + (i % 2) * NH, h + ((i + 1) % 2) * NH, nullptr,
+                    wx + i * wx_step, tmp_uh, tmp_uh_norm, layer_norm1,
+                    batch_size, hidden_size, ldwx, data_->zoneout, i,
+                    data_->stream[0]);
+  }
+
+  cudaEventRecord(data_->event, data_->stream[1]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+  cudaEventRecord(data_->event, data_->stream[0]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+
+  cublasSetStream(blas_handle, save_stream);
+}
+
+template <typename T>
+void ForwardPass<T>::RunBidirectional(
+    const int seq_length, T *wx, const T *u, T *h, T *v,
+    layer_norm::ForwardPass<T> &layer_norm_forward,
+    layer_norm::ForwardPass<T> &layer_norm_reverse, T *tmp_uh,
+    void *workspace, const bool batch_first) {
+  const profiler::Scope scope("ligru_2_0::ForwardPass::RunBidirectional");
+
+  const blas<void>::set_pointer_mode scoped1(data_->blas_handle);
+
+  const int batch_size = data_->batch_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  cudaEventRecord(data_->event, data_->sync_stream);
+  cudaStreamWaitEvent(data_->stream[0], data_->event, 0);
+  cudaStreamWaitEvent(data_->stream[1], data_->event, 0);
+
+  const l2_persistence::Window window(
+      data_->stream, 2, u,
+      sizeof(T) * 2 * data_->groups * hidden_size * hidden_size);
+
+  // Same slot layout as the Li-GRU. The reverse direction keeps its
+  // pre-normalization `tmp_uh` in the order it is computed in, which is the
+  // order its layer norm backward pass walks back.
+  const int NH = batch_size * hidden_size;
+  const int ldh = hidden_size * 2;
+  const int uh_stride = data_->training ? NH * 2 : 0;
+  const int wx_step = batch_first ? hidden_size * 2 : NH * 2;
+  const int ldwx = batch_first ? seq_length * hidden_size * 2 : hidden_size * 2;
+  T *tmp_uh_norm = take_workspace<T>(workspace, NH * 4);
+  if (!data_->training)
+    tmp_uh = take_workspace<T>(workspace, NH * 4);
+  T *tmp_uh_reverse = tmp_uh + (data_->training ? seq_length : 1) * NH * 2;
+  const Zoneout reverse_zoneout = reverse_direction(data_->zoneout);
+  for (int i = 0; i < seq_length; ++i) {
+    const int j = seq_length - 1 - i;
+    IterateInternal(u, h + i * NH * 2, h + (i + 1) * NH * 2, v + i * NH * 3,
+                    wx + i * wx_step, tmp_uh + i * uh_stride, tmp_uh_norm,
+                    layer_norm_forward, batch_size, ldh, ldwx,
+                    data_->zoneout, i, data_->stream[0]);
+    IterateInternal(u, h + (j + 2) * NH * 2 + hidden_size,
+                    h + (j + 1) * NH * 2 + hidden_size,
+                    v + (seq_length + j) * NH * 3, wx + j * wx_step,
+                    tmp_uh_reverse + i * uh_stride, tmp_uh_norm + NH * 2,
+                    layer_norm_reverse, batch_size, ldh, ldwx,
+                    reverse_zoneout, j, data_->stream[1]);
+  }
+
+  cudaEventRecord(data_->event, data_->stream[1]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+  cudaEventRecord(data_->event, data_->stream[0]);
+  cudaStreamWaitEvent(data_->sync_stream, data_->event, 0);
+
   cublasSetStream(blas_handle, save_stream);
 }
 
+template struct ForwardPass<half>;
+template struct ForwardPass<__nv_bfloat16>;
 template struct ForwardPass<float>;
 template struct ForwardPass<double>;
 
@@ -0,0 +1,71 @@
+// Copyright 2022 Adel Moumen. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#pragma once
+
+#include "zoneout.h"
+
+namespace haste {
+namespace v0 {
+namespace ligru_cpu {
+
+// Inference forward pass of a Li-GRU layer, or of an SLi-GRU layer when
+// `layer_norm` is set, on the host. Batch entries are independent, so the
+// batch is split into contiguous blocks of rows that the threads of the pass
+// run through the whole sequence with no synchronization between steps; each
+// block does its recurrent product with an Eigen GEMM and evaluates the gates
+// of a row in one vectorized expression. Instantiated for `float` and
+// `double`.
+template <typename T> class ForwardPass {
+public:
+  // batch_size: the number of inputs provided in each tensor.
+  // hidden_size: the expected dimension of each output vector.
+  // activation: the code of the candidate activation (0 = ReLU,
+  // 1 = LeakyReLU, 2 = Sin, 3 = Tanh).
+  // num_threads: the number of threads the batch is split across, including
+  // the calling one; 0 uses every hardware thread.
+  ForwardPass(const int batch_size, const int hidden_size,
+              const int activation, const bool layer_norm,
+              const int num_threads = 0);
+
+  // Joins the threads of the pass.
+  ~ForwardPass();
+
+  // Same as `ligru_1_0::ForwardPass::SetBias`.
+  void SetBias(const T *b);
+
+  // Sets the zoneout of the hidden state (none by default). Only the
+  // expectation is supported: `zoneout.sample` must be false.
+  void SetZoneout(const Zoneout &zoneout);
+
+  // wx: [batch_size, time_step, 2 * hidden_size] input projection.
+  // u: [2 * hidden_size, hidden_size] recurrent weight (row-major, as stored
+  // by `nn.Linear`).
+  // h0: [batch_size, hidden_size] initial state.
+  // h: [batch_size, time_step, hidden_size] output states.
+  // Returns once the whole sequence has been computed.
+  void Run(const int time_step, const T *wx, const T *u, const T *h0, T *h);
+
+private:
+  ForwardPass(const ForwardPass &) = delete;
+  ForwardPass &operator=(const ForwardPass &) = delete;
+
+  struct private_data;
+  private_data *data_;
+};
+
+} // namespace ligru_cpu
+} // namespace v0
+} // namespace haste
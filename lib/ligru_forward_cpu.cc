@@ -0,0 +1,223 @@
+// Copyright 2022 Adel Moumen. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <memory>
+#include <thread>
+
+#define EIGEN_USE_THREADS
+#include <Eigen/Dense>
+#include <unsupported/Eigen/CXX11/ThreadPool>
+
+#include "ligru_cpu.h"
+#include "zoneout.h"
+
+namespace {
+
+using haste::v0::Zoneout;
+
+// Smallest block of batch rows given to a thread: below it the per-step GEMM
+// of a block is too short to hide the cost of waking the thread up.
+constexpr int kMinRowsPerThread = 4;
+
+// Candidate activations, applied in place to the `a` gates of a row with the
+// packet math of Eigen (AVX2 or AVX-512 when the flags of the build enable
+// them). Same codes as the GPU kernels.
+struct ReLU {
+  template <typename A> static void forward(A &a) {
+    a = a.max(typename A::Scalar(0));
+  }
+};
+
+struct LeakyReLU {
+  template <typename A> static void forward(A &a) {
+    a = (a > typename A::Scalar(0)).select(a, a * typename A::Scalar(0.01));
+  }
+};
+
+struct Sin {
+  template <typename A> static void forward(A &a) { a = a.sin(); }
+};
+
+struct Tanh {
+  template <typename A> static void forward(A &a) { a = a.tanh(); }
+};
+
+// Runs batch rows `[begin, end)` through the whole sequence. `b` is the
+// `[2 * hidden_size]` bias (zeros when there is none) and `keep` the zoneout
+// weight of the previous state.
+template <typename T, typename Activation>
+void RunRows(const int time_step, const int hidden_size, const bool layer_norm,
+             const Eigen::Array<T, Eigen::Dynamic, 1> &b, const T keep,
+             const int begin, const int end, const T *wx, const T *u,
+             const T *h0, T *h) {
+  using Matrix =
+      Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+  using Array = Eigen::Array<T, Eigen::Dynamic, 1>;
+  using Stride = Eigen::OuterStride<>;
+
+  const int rows = end - begin;
+  const int ld_h = time_step * hidden_size;
+  const int ld_wx = time_step * hidden_size * 2;
+
+  const Eigen::Map<const Matrix> u_mat(u, hidden_size * 2, hidden_size);
+  Matrix uh(rows, hidden_size * 2);
+  Array a(hidden_size);
+  Array z(hidden_size);
+
+  for (int t = 0; t < time_step; ++t) {
+    const T *h_prev = t == 0 ? h0 + begin * hidden_size
+                             : h + begin * ld_h + (t - 1) * hidden_size;
+    const int ld_prev = t == 0 ? hidden_size : ld_h;
+
+    const Eigen::Map<const Matrix, 0, Stride> h_mat(h_prev, rows, hidden_size,
+                                                    Stride(ld_prev));
+    uh.noalias() = h_mat * u_mat.transpose();
+
+    for (int r = 0; r < rows; ++r) {
+      auto uh_row = uh.row(r).array();
+      if (layer_norm) {
+        const T mean = uh_row.mean();
+        uh_row -= mean;
+        const T var = uh_row.square().mean();
+        uh_row *= T(1) / std::sqrt(var + static_cast<T>(1e-5));
+      }
+
+      const T *wx_row = wx + (begin + r) * ld_wx + t * hidden_size * 2;
+      const Eigen::Map<const Array> wx_a(wx_row, hidden_size);
+      const Eigen::Map<const Array> wx_z(wx_row + hidden_size, hidden_size);
+      const Eigen::Map<const Array> hp(h_prev + r * ld_prev, hidden_size);
+      Eigen::Map<Array> out(h + (begin + r) * ld_h + t * hidden_size,
+                            hidden_size);
+
+      a = wx_a + uh_row.head(hidden_size).transpose() + b.head(hidden_size);
+      Activation::forward(a);
+      z = wx_z + uh_row.tail(hidden_size).transpose() + b.tail(hidden_size);
+      z = (T(1) + (-z).exp()).inverse();
+
+      if (keep > T(0))
+        out = keep * hp + (T(1) - keep) * (z * hp + (T(1) - z) * a);
+      else
+        out = z * hp + (T(1) - z) * a;
+    }
+  }
+}
+
+} // anonymous namespace
+
+namespace haste {
+namespace v0 {
+namespace ligru_cpu {
+
+template <typename T> struct ForwardPass<T>::private_data {
+  int batch_size;
+  int hidden_size;
+  int activation;
+  bool layer_norm;
+  int num_threads;
+  const T *b = nullptr;
+  Zoneout zoneout;
+  // Runs every block but the first, which the calling thread takes.
+  std::unique_ptr<Eigen::ThreadPool> pool;
+};
+
+template <typename T>
+ForwardPass<T>::ForwardPass(const int batch_size, const int hidden_size,
+                            const int activation, const bool layer_norm,
+                            const int num_threads)
+    : data_(new private_data) {
+  data_->batch_size = batch_size;
+  data_->hidden_size = hidden_size;
+  data_->activation = activation;
+  data_->layer_norm = layer_norm;
+  data_->num_threads =
+      num_threads > 0
+          ? num_threads
+          : std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+  data_->num_threads = std::max(
+      1, std::min(data_->num_threads, batch_size / kMinRowsPerThread));
+  if (data_->num_threads > 1)
+    data_->pool.reset(new Eigen::ThreadPool(data_->num_threads - 1));
+}
+
+template <typename T> ForwardPass<T>::~ForwardPass() { delete data_; }
+
+template <typename T> void ForwardPass<T>::SetBias(const T *b) {
+  data_->b = b;
+}
+
+template <typename T>
+void ForwardPass<T>::SetZoneout(const Zoneout &zoneout) {
+  assert(!zoneout.sample);
+  data_->zoneout = zoneout;
+}
+
+template <typename T>
+void ForwardPass<T>::Run(const int time_step, const T *wx, const T *u,
+                         const T *h0, T *h) {
+  const int batch_size = data_->batch_size;
+  const int hidden_size = data_->hidden_size;
+  const bool layer_norm = data_->layer_norm;
+  const int blocks = data_->num_threads;
+  const T keep = static_cast<T>(data_->zoneout.prob);
+
+  Eigen::Array<T, Eigen::Dynamic, 1> b(hidden_size * 2);
+  if (data_->b)
+    b = Eigen::Map<const Eigen::Array<T, Eigen::Dynamic, 1>>(data_->b,
+                                                             hidden_size * 2);
+  else
+    b.setZero();
+
+  decltype(&RunRows<T, ReLU>) run_rows;
+  switch (data_->activation) {
+  case 0:
+    run_rows = &RunRows<T, ReLU>;
+    break;
+  case 1:
+    run_rows = &RunRows<T, LeakyReLU>;
+    break;
+  case 2:
+    run_rows = &RunRows<T, Sin>;
+    break;
+  default:
+    run_rows = &RunRows<T, Tanh>;
+    break;
+  }
+
+  auto run_block = [&](const int i) {
+    run_rows(time_step, hidden_size, layer_norm, b, keep,
+             batch_size * i / blocks, batch_size * (i + 1) / blocks, wx, u,
+             h0, h);
+  };
+
+  Eigen::Barrier barrier(blocks - 1);
+  for (int i = 1; i < blocks; ++i) {
+    data_->pool->Schedule([&, i] {
+      run_block(i);
+      barrier.Notify();
+    });
+  }
+  run_block(0);
+  barrier.Wait();
+}
+
+template class ForwardPass<float>;
+template class ForwardPass<double>;
+
+} // namespace ligru_cpu
+} // namespace v0
+} // namespace haste
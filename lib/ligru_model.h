@@ -0,0 +1,73 @@
+// Copyright 2022 Adel Moumen. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#pragma once
+
+#include <cuda_runtime_api.h>
+
+#include "fast_ligru.h"
+
+namespace haste {
+namespace v0 {
+
+// Inference runtime for a whole Li-GRU or SLi-GRU stack that only depends on
+// CUDA and cuBLAS. Each layer projects its input with cuBLAS (the eval-mode
+// batch norm is folded into that projection at export time) and runs its
+// recurrence with the `ForwardPass` of its cell, which also adds the
+// projection bias; unidirectional layers issue the projection in chunks that
+// overlap with the recurrence. Layers exchange their time-major outputs
+// directly, without dropout.
+//
+// The model file is little-endian: the 8 bytes `FLIGRU\0\0`, then the int32
+// fields `version` (1), `cell` (0 for Li-GRU, 1 for SLi-GRU), `num_layers`,
+// `input_size`, `hidden_size`, `bidirectional` (0 or 1) and `activation`
+// (the code of `LiGRU_Layer.activation`), then for every layer the fp32
+// row-major tensors `w` `[2 * hidden_size, F]`, `b` `[2 * hidden_size]` and
+// `u` `[2 * hidden_size, hidden_size]`, where `F` is `input_size` for the
+// first layer and the output size of a layer for the others.
+class LiGRUModel {
+public:
+  LiGRUModel();
+
+  // Releases the device memory of the model.
+  // Blocks until the work issued by `Forward` has completed.
+  ~LiGRUModel();
+
+  // Loads the model file at `path` onto the current device, which every
+  // later call then runs on.
+  ligru_status_t Load(const char *path);
+
+  int input_size() const;
+  int output_size() const;
+
+  // Grows the device buffers to fit `time_step` steps of `batch_size`
+  // sequences; see `ligru_model_reserve`.
+  ligru_status_t Reserve(const int time_step, const int batch_size);
+
+  // x: [time_step, batch_size, input_size] device input.
+  // y: [time_step, batch_size, output_size] device output.
+  ligru_status_t Forward(const int time_step, const int batch_size,
+                         const float *x, float *y, const cudaStream_t &stream);
+
+private:
+  LiGRUModel(const LiGRUModel &) = delete;
+  LiGRUModel &operator=(const LiGRUModel &) = delete;
+
+  struct private_data;
+  private_data *data_;
+};
+
+} // namespace v0
+} // namespace haste
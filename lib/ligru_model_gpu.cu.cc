@@ -0,0 +1,469 @@
+// Copyright 2022 Adel Moumen. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cublas_v2.h>
+#include <cuda_runtime_api.h>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "blas.h"
+#include "layer_norm.h"
+#include "ligru_1_0.h"
+#include "ligru_2_0.h"
+#include "ligru_model.h"
+
+namespace {
+
+constexpr char kModelMagic[8] = {'F', 'L', 'I', 'G', 'R', 'U', '\0', '\0'};
+constexpr int32_t kModelVersion = 1;
+
+// Steps per input projection GEMM when it is pipelined with the recurrence.
+constexpr int kProjectionChunk = 32;
+
+// Batch sizes whose passes are kept; the least recently used one is dropped
+// to make room for another.
+constexpr size_t kMaxCachedBatchSizes = 8;
+
+// Makes `device` current for the lifetime of the guard.
+class DeviceGuard {
+public:
+  explicit DeviceGuard(const int device) {
+    cudaGetDevice(&saved_);
+    if (saved_ != device)
+      cudaSetDevice(device);
+  }
+  ~DeviceGuard() { cudaSetDevice(saved_); }
+
+private:
+  int saved_;
+};
+
+} // anonymous namespace
+
+namespace haste {
+namespace v0 {
+
+struct LiGRUModel::private_data {
+  struct Layer {
+    int input_size;
+    const float *w;
+    const float *b;
+    const float *u;
+  };
+
+  // Passes are built for one batch size and input size, so each cached batch
+  // size holds one for the first layer, which reads the model input, and one
+  // for the others, which read the hidden states.
+  template <typename Pass> struct Passes {
+    std::unique_ptr<Pass> layer[2];
+    uint64_t last_use = 0;
+  };
+
+  int device = -1;
+  int cell = 0;
+  int input_size = 0;
+  int hidden_size = 0;
+  int directions = 1;
+  int activation = 0;
+  cublasHandle_t blas_handle = nullptr;
+  float *weights = nullptr;
+  std::vector<Layer> layers;
+
+  // Scratch buffers, sized for `time_capacity` steps of `batch_capacity`
+  // sequences: the input projection of the current layer, the two hidden
+  // state sequences that consecutive layers alternate between, the layer
+  // norm statistics of the SLi-GRU and the pass workspace.
+  int time_capacity = 0;
+  int batch_capacity = 0;
+  float *wx = nullptr;
+  float *h[2] = {nullptr, nullptr};
+  float *norm_cache = nullptr;
+  void *workspace = nullptr;
+
+  // Every `Forward` runs on `stream`, which the passes are built for, after
+  // waiting for `ready`, recorded on the caller's stream. `done` is recorded
+  // on `stream` after the last use of the scratch buffers; the caller's
+  // stream waits for it, and `Reserve` before replacing the buffers.
+  cudaStream_t stream = nullptr;
+  cudaEvent_t ready = nullptr;
+  cudaEvent_t done = nullptr;
+
+  uint64_t uses = 0;
+  std::map<int, Passes<ligru_1_0::ForwardPass<float>>> ligru;
+  std::map<int, Passes<ligru_2_0::ForwardPass<float>>> sligru;
+
+  size_t workspace_size(const int time_step, const int batch_size) const {
+    const bool bidirectional = directions == 2;
+    return cell == 0 ? ligru_1_0::ForwardPass<float>::GetWorkspaceSize(
+                           time_step, batch_size, hidden_size, false,
+                           bidirectional)
+                     : ligru_2_0::ForwardPass<float>::GetWorkspaceSize(
+                           time_step, batch_size, hidden_size, false,
+                           bidirectional);
+  }
+
+  void release_buffers() {
+    cudaFree(wx);
+    cudaFree(h[0]);
+    cudaFree(h[1]);
+    cudaFree(norm_cache);
+    cudaFree(workspace);
+    wx = h[0] = h[1] = norm_cache = nullptr;
+    workspace = nullptr;
+    time_capacity = batch_capacity = 0;
+  }
+
+  void release_streams() {
+    if (stream) {
+      cudaStreamSynchronize(stream);
+      cudaStreamDestroy(stream);
+    }
+    if (ready)
+      cudaEventDestroy(ready);
+    if (done)
+      cudaEventDestroy(done);
+    done = ready = nullptr;
+    stream = nullptr;
+  }
+
+  template <typename Pass>
+  Pass &pass(std::map<int, Passes<Pass>> &passes, const int batch_size,
+             const size_t l) {
+    auto it = passes.find(batch_size);
+    if (it == passes.end()) {
+      using Entry = typename std::map<int, Passes<Pass>>::value_type;
+      if (passes.size() >= kMaxCachedBatchSizes)
+        passes.erase(std::min_element(
+            passes.begin(), passes.end(), [](const Entry &a, const Entry &b) {
+              return a.second.last_use < b.second.last_use;
+            }));
+      it = passes.emplace(batch_size, Passes<Pass>()).first;
+    }
+    it->second.last_use = ++uses;
+    std::unique_ptr<Pass> &pass = it->second.layer[l == 0 ? 0 : 1];
+    if (!pass)
+      pass.reset(new Pass(false, batch_size, layers[l].input_size,
+                          hidden_size, blas_handle, activation, stream));
+    return *pass;
+  }
+};
+
+LiGRUModel::LiGRUModel() : data_(new private_data) {}
+
+LiGRUModel::~LiGRUModel() {
+  if (data_->blas_handle) {
+    const DeviceGuard guard(data_->device);
+    data_->ligru.clear();
+    data_->sligru.clear();
+    data_->release_streams();
+    data_->release_buffers();
+    cudaFree(data_->weights);
+    cublasDestroy(data_->blas_handle);
+  }
+  delete data_;
+}
+
+int LiGRUModel::input_size() const { return data_->input_size; }
+
+int LiGRUModel::output_size() const {
+  return data_->hidden_size * data_->directions;
+}
+
+ligru_status_t LiGRUModel::Load(const char *path) {
+  if (data_->blas_handle)
+    return LIGRU_STATUS_INVALID_VALUE;
+
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+    return LIGRU_STATUS_IO_ERROR;
+
+  char magic[sizeof(kModelMagic)];
+  int32_t header[7];
+  if (!file.read(magic, sizeof(magic)) ||
+      !file.read(reinterpret_cast<char *>(header), sizeof(header)))
+    return LIGRU_STATUS_IO_ERROR;
+
+  const int32_t version = header[0];
+  const int32_t cell = header[1];
+  const int32_t num_layers = header[2];
+  const int32_t input_size = header[3];
+  const int32_t hidden_size = header[4];
+  const int32_t bidirectional = header[5];
+  const int32_t activation = header[6];
+  if (std::memcmp(magic, kModelMagic, sizeof(magic)) != 0 ||
+      version != kModelVersion || (cell != 0 && cell != 1) ||
+      num_layers <= 0 || input_size <= 0 || hidden_size <= 0 ||
+      (bidirectional != 0 && bidirectional != 1) || activation < 0 ||
+      activation > 3)
+    return LIGRU_STATUS_INVALID_MODEL;
+
+  const int directions = bidirectional ? 2 : 1;
+  std::vector<size_t> offsets;
+  size_t count = 0;
+  for (int l = 0; l < num_layers; ++l) {
+    const size_t layer_input = l == 0 ? input_size : hidden_size * directions;
+    offsets.push_back(count);
+    count += hidden_size * 2 * (layer_input + 1 + hidden_size);
+  }
+
+  std::vector<float> weights(count);
+  if (!file.read(reinterpret_cast<char *>(weights.data()),
+                 count * sizeof(float)))
+    return LIGRU_STATUS_IO_ERROR;
+  if (file.peek() != std::ifstream::traits_type::eof())
+    return LIGRU_STATUS_INVALID_MODEL;
+
+  cudaGetDevice(&data_->device);
+  if (cudaMalloc(&data_->weights, count * sizeof(float)) != cudaSuccess)
+    return LIGRU_STATUS_CUDA_ERROR;
+  if (cudaMemcpy(data_->weights, weights.data(), count * sizeof(float),
+                 cudaMemcpyHostToDevice) != cudaSuccess ||
+      cudaStreamCreate(&data_->stream) != cudaSuccess ||
+      cudaEventCreateWithFlags(&data_->ready, cudaEventDisableTiming) !=
+          cudaSuccess ||
+      cudaEventCreateWithFlags(&data_->done, cudaEventDisableTiming) !=
+          cudaSuccess ||
+      cublasCreate(&data_->blas_handle) != CUBLAS_STATUS_SUCCESS) {
+    data_->release_streams();
+    cudaFree(data_->weights);
+    data_->weights = nullptr;
+    data_->blas_handle = nullptr;
+    return LIGRU_STATUS_CUDA_ERROR;
+  }
+
+  data_->cell = cell;
+  data_->input_size = input_size;
+  data_->hidden_size = hidden_size;
+  data_->directions = directions;
+  data_->activation = activation;
+  for (int l = 0; l < num_layers; ++l) {
+    private_data::Layer layer;
+    layer.input_size = l == 0 ? input_size : hidden_size * directions;
+    layer.w = data_->weights + offsets[l];
+    layer.b = layer.w + hidden_size * 2 * layer.input_size;
+    layer.u = layer.b + hidden_size * 2;
+    data_->layers.push_back(layer);
+  }
+  return LIGRU_STATUS_SUCCESS;
+}
+
+ligru_status_t LiGRUModel::Reserve(const int time_step, const int batch_size) {
+  if (!data_->blas_handle || time_step <= 0 || batch_size <= 0)
+    return LIGRU_STATUS_INVALID_VALUE;
+  if (time_step <= data_->time_capacity && batch_size <= data_->batch_capacity)
+    return LIGRU_STATUS_SUCCESS;
+
+  const DeviceGuard guard(data_->device);
+  const size_t T = std::max(time_step, data_->time_capacity);
+  const size_t B = std::max(batch_size, data_->batch_capacity);
+  const size_t H = data_->hidden_size;
+  const size_t D = data_->directions;
+
+  // Work still in flight may read the buffers being replaced; only this
+  // model's is waited for.
+  cudaEventSynchronize(data_->done);
+  data_->release_buffers();
+
+  const bool allocated =
+      cudaMalloc(&data_->wx, T * B * H * 2 * sizeof(float)) == cudaSuccess &&
+      cudaMalloc(&data_->h[0], (T + D) * B * H * D * sizeof(float)) ==
+          cudaSuccess &&
+      cudaMalloc(&data_->h[1], (T + D) * B * H * D * sizeof(float)) ==
+          cudaSuccess &&
+      (data_->cell == 0 ||
+       cudaMalloc(&data_->norm_cache, D * T * B * 2 * sizeof(float)) ==
+           cudaSuccess) &&
+      cudaMalloc(&data_->workspace, data_->workspace_size(T, B)) ==
+          cudaSuccess;
+  if (!allocated) {
+    data_->release_buffers();
+    return LIGRU_STATUS_CUDA_ERROR;
+  }
+
+  data_->time_capacity = T;
+  data_->batch_capacity = B;
+  return LIGRU_STATUS_SUCCESS;
+}
+
+ligru_status_t LiGRUModel::Forward(const int time_step, const int batch_size,
+                                   const float *x, float *y,
+                                   const cudaStream_t &stream) {
+  if (!data_->blas_handle || time_step <= 0 || batch_size <= 0 || !x || !y)
+    return LIGRU_STATUS_INVALID_VALUE;
+
+  const ligru_status_t status = Reserve(time_step, batch_size);
+  if (status != LIGRU_STATUS_SUCCESS)
+    return status;
+
+  // The work runs on the model's stream, after that already queued on
+  // `stream` and before what is queued on it next, so the passes never hold
+  // on to a caller's stream, and consecutive calls on different streams are
+  // ordered by the model's stream itself.
+  const DeviceGuard guard(data_->device);
+  const cudaStream_t model_stream = data_->stream;
+  cudaEventRecord(data_->ready, stream);
+  cudaStreamWaitEvent(model_stream, data_->ready, 0);
+  const auto finish = [&]() {
+    cudaEventRecord(data_->done, model_stream);
+    cudaStreamWaitEvent(stream, data_->done, 0);
+  };
+
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const blas<void>::set_pointer_mode scoped(blas_handle);
+  cublasSetStream(blas_handle, model_stream);
+
+  const float alpha = 1.0f;
+  const float beta = 0.0f;
+
+  const int hidden_size = data_->hidden_size;
+  const int output_size = hidden_size * data_->directions;
+  const int rows = time_step * batch_size;
+  const bool bidirectional = data_->directions == 2;
+
+  // Each layer reads the time-major outputs of the previous one in place, so
+  // the only copy is that of the last layer into `y`.
+  const float *input = x;
+  for (size_t l = 0; l < data_->layers.size(); ++l) {
+    const private_data::Layer &layer = data_->layers[l];
+    float *wx = data_->wx;
+    float *h = data_->h[l % 2];
+
+    // The bias is added by the recurrence kernels, so the projection is a
+    // plain GEMM. Unidirectional layers leave it to the pass, which overlaps
+    // it with the recurrence; both directions of a bidirectional layer start
+    // from opposite ends of the sequence and need all of it up front.
+    if (bidirectional &&
+        blas<float>::gemm(blas_handle, CUBLAS_OP_T, CUBLAS_OP_N,
+                          hidden_size * 2, rows, layer.input_size, &alpha,
+                          layer.w, layer.input_size, input, layer.input_size,
+                          &beta, wx, hidden_size * 2) !=
+            CUBLAS_STATUS_SUCCESS) {
+      finish();
+      return LIGRU_STATUS_CUDA_ERROR;
+    }
+
+    // Zero initial state; a bidirectional layer takes its reverse one from the
+    // last slot.
+    const size_t slot = batch_size * output_size * sizeof(float);
+    cudaMemsetAsync(h, 0, slot, model_stream);
+    if (bidirectional)
+      cudaMemsetAsync(h + (time_step + 1) * batch_size * output_size, 0, slot,
+                      model_stream);
+
+    if (data_->cell == 0) {
+      auto &forward = data_->pass(data_->ligru, batch_size, l);
+      forward.SetBias(layer.b);
+      if (bidirectional)
+        forward.RunBidirectional(time_step, wx, layer.u, h, nullptr,
+                                 data_->workspace);
+      else
+        forward.RunPipelined(time_step, kProjectionChunk, input, layer.w, wx,
+                             layer.u, h, nullptr, data_->workspace);
+    } else {
+      auto &forward = data_->pass(data_->sligru, batch_size, l);
+      forward.SetBias(layer.b);
+      layer_norm::ForwardPass<float> layer_norm1(
+          rows, hidden_size * 2, nullptr, nullptr, data_->norm_cache);
+      if (bidirectional) {
+        layer_norm::ForwardPass<float> layer_norm2(
+            rows, hidden_size * 2, nullptr, nullptr,
+            data_->norm_cache + rows * 2);
+        forward.RunBidirectional(time_step, wx, layer.u, h, nullptr,
+                                 layer_norm1, layer_norm2, nullptr,
+                                 data_->workspace);
+      } else {
+        forward.RunPipelined(time_step, kProjectionChunk, input, layer.w, wx,
+                             layer.u, h, nullptr, layer_norm1, nullptr,
+                             data_->workspace);
+      }
+    }
+
+    input = h + batch_size * output_size;
+  }
+
+  cudaMemcpyAsync(y, input, rows * output_size * sizeof(float),
+                  cudaMemcpyDeviceToDevice, model_stream);
+  // The passes leave the model's stream ordered after their internal
+  // streams, so this covers every use of the scratch buffers.
+  finish();
+
+  return cudaGetLastError() == cudaSuccess ? LIGRU_STATUS_SUCCESS
+                                           : LIGRU_STATUS_CUDA_ERROR;
+}
+
+} // namespace v0
+} // namespace haste
+
+struct ligru_model {
+  haste::v0::LiGRUModel model;
+};
+
+const char *ligru_status_string(ligru_status_t status) {
+  switch (status) {
+  case LIGRU_STATUS_SUCCESS:
+    return "success";
+  case LIGRU_STATUS_IO_ERROR:
+    return "could not read the model file";
+  case LIGRU_STATUS_INVALID_MODEL:
+    return "not a fast_ligru model file";
+  case LIGRU_STATUS_INVALID_VALUE:
+    return "invalid argument";
+  case LIGRU_STATUS_CUDA_ERROR:
+    return "CUDA error";
+  }
+  return "unknown status";
+}
+
+ligru_status_t ligru_model_load(const char *path, ligru_model_t *model) {
+  if (!path || !model)
+    return LIGRU_STATUS_INVALID_VALUE;
+
+  std::unique_ptr<ligru_model> result(new ligru_model);
+  const ligru_status_t status = result->model.Load(path);
+  if (status == LIGRU_STATUS_SUCCESS)
+    *model = result.release();
+  return status;
+}
+
+void ligru_model_destroy(ligru_model_t model) { delete model; }
+
+int ligru_model_input_size(const ligru_model_t model) {
+  return model->model.input_size();
+}
+
+int ligru_model_output_size(const ligru_model_t model) {
+  return model->model.output_size();
+}
+
+ligru_status_t ligru_model_reserve(ligru_model_t model, int time_step,
+                                   int batch_size) {
+  if (!model)
+    return LIGRU_STATUS_INVALID_VALUE;
+  return model->model.Reserve(time_step, batch_size);
+}
+
+ligru_status_t ligru_model_forward(ligru_model_t model, int time_step,
+                                   int batch_size, const float *x, float *y,
+                                   cudaStream_t stream) {
+  if (!model)
+    return LIGRU_STATUS_INVALID_VALUE;
+  return model->model.Forward(time_step, batch_size, x, y, stream);
+}
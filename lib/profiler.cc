@@ -0,0 +1,250 @@
+// Copyright 2022 Adel Moumen. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#include <atomic>
+#include <cuda_runtime_api.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#ifdef LIGRU_NVTX
+#include <nvtx3/nvToolsExt.h>
+#endif
+
+#include "profiler.h"
+
+namespace {
+
+using haste::v0::profiler::Phase;
+using haste::v0::profiler::PhaseStats;
+using haste::v0::profiler::Scope;
+
+// Timed ranges whose events are still in flight; past this many, new ranges
+// are not timed until `Collect` catches up.
+constexpr size_t kMaxPending = 1 << 16;
+
+struct Sample {
+  const char *scope;
+  Phase phase;
+  double bytes;
+  int device;
+  cudaEvent_t start;
+  cudaEvent_t stop;
+};
+
+struct Registry {
+  std::mutex mutex;
+  std::vector<Sample> pending;
+  std::map<int, std::vector<cudaEvent_t>> free_events;
+  std::map<std::pair<std::string, int>, PhaseStats> totals;
+
+  // Returns an event of the current device `device`, or null if none can be
+  // created. Called with `mutex` held.
+  cudaEvent_t TakeEvent(const int device) {
+    std::vector<cudaEvent_t> &events = free_events[device];
+    if (!events.empty()) {
+      const cudaEvent_t event = events.back();
+      events.pop_back();
+      return event;
+    }
+    cudaEvent_t event;
+    if (cudaEventCreate(&event) != cudaSuccess) {
+      cudaGetLastError();
+      return nullptr;
+    }
+    return event;
+  }
+};
+
+// Never destroyed: passes may still be running from static destructors.
+Registry &registry() {
+  static Registry *instance = new Registry;
+  return *instance;
+}
+
+std::atomic<int> sample_period(0);
+std::atomic<unsigned> call_count(0);
+thread_local Scope *current_scope = nullptr;
+
+// Moves the completed samples out of the pending list into the totals,
+// waiting for all of them when `synchronize` is set.
+void Collect(const bool synchronize) {
+  Registry &r = registry();
+  std::vector<Sample> samples;
+  {
+    std::lock_guard<std::mutex> lock(r.mutex);
+    samples.swap(r.pending);
+  }
+
+  std::vector<Sample> waiting;
+  std::vector<float> elapsed(samples.size());
+  std::vector<cudaError_t> status(samples.size());
+  for (size_t i = 0; i < samples.size(); ++i) {
+    if (synchronize)
+      cudaEventSynchronize(samples[i].stop);
+    status[i] =
+        cudaEventElapsedTime(&elapsed[i], samples[i].start, samples[i].stop);
+    if (status[i] == cudaErrorNotReady)
+      waiting.push_back(samples[i]);
+  }
+
+  std::lock_guard<std::mutex> lock(r.mutex);
+  for (size_t i = 0; i < samples.size(); ++i) {
+    const Sample &s = samples[i];
+    if (status[i] == cudaErrorNotReady)
+      continue;
+    // Samples that failed to time are dropped, and their events recycled.
+    if (status[i] == cudaSuccess) {
+      PhaseStats &stats = r.totals[std::make_pair(std::string(s.scope),
+                                                  static_cast<int>(s.phase))];
+      stats.scope = s.scope;
+      stats.phase = s.phase;
+      stats.count += 1;
+      stats.milliseconds += elapsed[i];
+      stats.bytes += s.bytes;
+    }
+    r.free_events[s.device].push_back(s.start);
+    r.free_events[s.device].push_back(s.stop);
+  }
+  r.pending.insert(r.pending.end(), waiting.begin(), waiting.end());
+}
+
+} // anonymous namespace
+
+namespace haste {
+namespace v0 {
+namespace profiler {
+
+const char *PhaseName(const Phase phase) {
+  switch (phase) {
+  case kInputProjection:
+    return "input_projection";
+  case kRecurrentGemm:
+    return "recurrent_gemm";
+  case kLayerNorm:
+    return "layer_norm";
+  case kPointwise:
+    return "pointwise";
+  case kPersistent:
+    return "persistent";
+  case kWeightGrad:
+    return "weight_grad";
+  default:
+    return "unknown";
+  }
+}
+
+void SetSamplePeriod(const int period) {
+  sample_period.store(period > 0 ? period : 0, std::memory_order_relaxed);
+}
+
+std::vector<PhaseStats> GetStats(const bool synchronize) {
+  Collect(synchronize);
+  Registry &r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  std::vector<PhaseStats> stats;
+  for (const auto &entry : r.totals)
+    stats.push_back(entry.second);
+  return stats;
+}
+
+void ResetStats() {
+  Collect(true);
+  Registry &r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  r.totals.clear();
+}
+
+Scope::Scope(const char *name) : parent_(current_scope) {
+#ifdef LIGRU_NVTX
+  nvtxRangePushA(name);
+#endif
+  if (parent_) {
+    name_ = parent_->name_;
+    timed_ = parent_->timed_;
+  } else {
+    const int period = sample_period.load(std::memory_order_relaxed);
+    name_ = name;
+    timed_ = period > 0 &&
+             call_count.fetch_add(1, std::memory_order_relaxed) % period == 0;
+  }
+  current_scope = this;
+}
+
+Scope::~Scope() {
+  current_scope = parent_;
+  // Timed calls fold what has already completed, which bounds the pending
+  // list without waiting on the device.
+  if (timed_ && !parent_)
+    Collect(false);
+#ifdef LIGRU_NVTX
+  nvtxRangePop();
+#endif
+}
+
+Range::Range(const Phase phase, const cudaStream_t &stream,
+             const double bytes)
+    : scope_(nullptr), phase_(phase), stream_(stream), bytes_(bytes),
+      device_(0), start_(nullptr) {
+#ifdef LIGRU_NVTX
+  nvtxRangePushA(PhaseName(phase));
+#endif
+  const Scope *scope = current_scope;
+  if (!scope || !scope->timed_)
+    return;
+
+  cudaStreamCaptureStatus capture;
+  if (cudaStreamIsCapturing(stream, &capture) != cudaSuccess) {
+    cudaGetLastError();
+    return;
+  }
+  if (capture != cudaStreamCaptureStatusNone)
+    return;
+
+  cudaGetDevice(&device_);
+  Registry &r = registry();
+  {
+    std::lock_guard<std::mutex> lock(r.mutex);
+    if (r.pending.size() >= kMaxPending)
+      return;
+    start_ = r.TakeEvent(device_);
+  }
+  if (!start_)
+    return;
+  scope_ = scope->name_;
+  cudaEventRecord(start_, stream);
+}
+
+Range::~Range() {
+  if (start_) {
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    const cudaEvent_t stop = r.TakeEvent(device_);
+    if (stop) {
+      cudaEventRecord(stop, stream_);
+      r.pending.push_back({scope_, phase_, bytes_, device_, start_, stop});
+    } else {
+      r.free_events[device_].push_back(start_);
+    }
+  }
+#ifdef LIGRU_NVTX
+  nvtxRangePop();
+#endif
+}
+
+} // namespace profiler
+} // namespace v0
+} // namespace haste
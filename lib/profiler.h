@@ -0,0 +1,106 @@
+// Copyright 2022 Adel Moumen. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#pragma once
+
+#include <cuda_runtime_api.h>
+#include <string>
+#include <vector>
+
+namespace haste {
+namespace v0 {
+namespace profiler {
+
+// The parts of a pass the instrumentation tells apart.
+enum Phase {
+  kInputProjection, // `wx = x w^T` issued by the pipelined entry points
+  kRecurrentGemm,   // `u h` of a forward step, `u^T dv` of a backward one
+  kLayerNorm,       // normalization of `u h` (SLi-GRU) and its gradient
+  kPointwise,       // gate kernel of one step
+  kPersistent,      // whole-sequence persistent kernel
+  kWeightGrad,      // `du` accumulation of the backward pass
+  kNumPhases
+};
+
+const char *PhaseName(const Phase phase);
+
+// Cumulative figures of one phase of one entry point over the timed calls.
+// `bytes` is the device memory traffic the phase is modeled to move, one
+// read or write of each operand, so `bytes / milliseconds` is an achieved
+// bandwidth.
+struct PhaseStats {
+  std::string scope;
+  Phase phase;
+  long long count;
+  double milliseconds;
+  double bytes;
+};
+
+// Times one in every `period` calls of the instrumented entry points, or
+// none when `period` is 0 (the default). Calls that are not timed cost a
+// counter increment; timed ones record a pair of CUDA events around every
+// phase they issue.
+void SetSamplePeriod(const int period);
+
+// Returns the figures gathered since the last `ResetStats`, one entry per
+// entry point and phase. Samples whose events have not completed yet are
+// left out, unless `synchronize` is set, in which case they are waited for.
+std::vector<PhaseStats> GetStats(const bool synchronize);
+
+void ResetStats();
+
+// Marks one call of the entry point `name` (a string literal) on the calling
+// thread: an NVTX range when built with `LIGRU_NVTX`, and the scope the
+// `Range`s below are charged to. Nested scopes belong to the outermost one,
+// which decides whether the call is timed.
+class Scope {
+public:
+  explicit Scope(const char *name);
+  ~Scope();
+
+  Scope(const Scope &) = delete;
+  Scope &operator=(const Scope &) = delete;
+
+private:
+  friend class Range;
+
+  const char *name_;
+  bool timed_;
+  Scope *parent_;
+};
+
+// One phase of the current `Scope`: an NVTX range and, in timed calls, a pair
+// of events recorded on `stream` around the work it issues in between.
+// Streams being captured into a graph are not timed.
+class Range {
+public:
+  Range(const Phase phase, const cudaStream_t &stream, const double bytes);
+  ~Range();
+
+  Range(const Range &) = delete;
+  Range &operator=(const Range &) = delete;
+
+private:
+  const char *scope_;
+  Phase phase_;
+  cudaStream_t stream_;
+  double bytes_;
+  int device_;
+  cudaEvent_t start_;
+};
+
+} // namespace profiler
+} // namespace v0
+} // namespace haste
@@ -0,0 +1,53 @@
+// Copyright 2022 Adel Moumen. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#pragma once
+
+#include <cuda_runtime_api.h>
+
+namespace haste {
+namespace v0 {
+
+// Storage formats of a quantized weight. The codes are those of the bindings.
+enum class WeightFormat { kInt8 = 0, kFp8E4M3 = 1 };
+
+// Whether this build supports `WeightFormat::kFp8E4M3` (CUDA 11.8+). Any
+// device can read it; Ada and Hopper GPUs convert it in hardware.
+constexpr bool kFp8WeightsSupported = CUDART_VERSION >= 11080;
+
+// A row-major `[rows, cols]` device weight quantized per row, i.e. per output
+// channel: row `r` stands for `scale[r] * data[r]`, where `data` holds one
+// byte per element in `format` and `scale` is a `[rows]` fp32 array.
+struct QuantizedWeight {
+  WeightFormat format = WeightFormat::kInt8;
+  const void *data = nullptr;
+  const float *scale = nullptr;
+};
+
+// y = x w^T for the `[batch_size, cols]` input `x`, whose rows are `ldx`
+// elements apart, into the `[batch_size, rows]` output `y`. The weight is
+// read in its quantized format, the products are accumulated in fp32 (fp64
+// for `double`) and the scale of each channel is applied to its sum before
+// the store. Each weight row is decoded once into shared memory and reused
+// for every input row, so the weight is read from memory once per call
+// whatever `batch_size`: a quarter (fp32) to a half (fp16) of the bytes the
+// full-precision GEMM reads, where those reads bound the product.
+template <typename T>
+void QuantizedMatMul(const QuantizedWeight &w, const int rows, const int cols,
+                     const int batch_size, const T *x, const int ldx, T *y,
+                     const cudaStream_t &stream);
+
+} // namespace v0
+} // namespace haste
@@ -0,0 +1,217 @@
+// Copyright 2022 Adel Moumen. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#include <algorithm>
+#include <cstdint>
+#include <cuda_bf16.h>
+#include <cuda_fp16.h>
+#include <cuda_runtime_api.h>
+#if CUDART_VERSION >= 11080
+#include <cuda_fp8.h>
+#endif
+
+#include "inline_ops.h"
+#include "quantized_weight.h"
+
+namespace {
+
+using haste::v0::QuantizedWeight;
+using haste::v0::WeightFormat;
+
+constexpr int kWarpsPerBlock = 8;
+constexpr int kBatchTile = 4;
+
+// Shared memory a block may use for its decoded weight rows without opting
+// into the larger carve-out.
+constexpr int kMaxSharedMemory = 48 * 1024;
+
+// Value of byte `i` of `bits` in format `Format`.
+template <WeightFormat Format>
+__device__ __forceinline__ float decode(const uint32_t bits, const int i);
+
+template <>
+__device__ __forceinline__ float decode<WeightFormat::kInt8>(const uint32_t bits,
+                                                            const int i) {
+  return static_cast<float>(static_cast<int8_t>((bits >> (8 * i)) & 0xff));
+}
+
+#if CUDART_VERSION >= 11080
+template <>
+__device__ __forceinline__ float
+decode<WeightFormat::kFp8E4M3>(const uint32_t bits, const int i) {
+  __nv_fp8_e4m3 value;
+  value.__x = static_cast<__nv_fp8_storage_t>((bits >> (8 * i)) & 0xff);
+  return static_cast<float>(value);
+}
+#endif
+
+// Byte `k` of `w_row` in format `Format`.
+template <WeightFormat Format>
+__device__ __forceinline__ float decode_byte(const uint8_t *w_row,
+                                             const int k) {
+  return decode<Format>(w_row[k], 0);
+}
+
+// One warp per weight row, every block covering the whole batch. When
+// `Cached`, the warp first decodes its row into shared memory, 4 bytes per
+// lane at a time (`Packed` loads them as one word, which needs `cols` to be
+// a multiple of 4), so the quantized weight is read from memory once per
+// call whatever the batch size. It then walks the batch in tiles of
+// `kBatchTile` rows, the lanes striding over the row and reducing their
+// sums with warp shuffles. Rows too long to fit in shared memory are decoded
+// from memory again for every tile instead.
+template <typename T, WeightFormat Format, bool Packed, bool Cached>
+__global__ void __launch_bounds__(kWarpsPerBlock * 32)
+    QuantizedMatMulKernel(const int rows, const int cols, const int batch_size,
+                          const uint8_t *w, const float *scale, const T *x,
+                          const int ldx, T *y) {
+  using acc_t = typename acc_type<T>::type;
+  extern __shared__ int shared_var[];
+
+  const int lane = threadIdx.x % 32;
+  const int warp = threadIdx.x / 32;
+  const int row = blockIdx.x * (blockDim.x / 32) + warp;
+  if (row >= rows)
+    return;
+
+  const uint8_t *w_row = w + static_cast<size_t>(row) * cols;
+  acc_t *w_cache = reinterpret_cast<acc_t *>(shared_var) + warp * cols;
+  if (Cached) {
+    for (int k = lane * 4; k < cols; k += 32 * 4) {
+      uint32_t bits = 0;
+      if (Packed) {
+        bits = *reinterpret_cast<const uint32_t *>(w_row + k);
+      } else {
+        for (int j = 0; j < 4 && k + j < cols; ++j)
+          bits |= static_cast<uint32_t>(w_row[k + j]) << (8 * j);
+      }
+#pragma unroll
+      for (int j = 0; j < 4; ++j) {
+        if (!Packed && k + j >= cols)
+          break;
+        w_cache[k + j] = static_cast<acc_t>(decode<Format>(bits, j));
+      }
+    }
+    __syncwarp();
+  }
+
+  const acc_t channel_scale = static_cast<acc_t>(scale[row]);
+  for (int batch_begin = 0; batch_begin < batch_size;
+       batch_begin += kBatchTile) {
+    const int tile = min(kBatchTile, batch_size - batch_begin);
+
+    acc_t acc[kBatchTile];
+#pragma unroll
+    for (int b = 0; b < kBatchTile; ++b)
+      acc[b] = static_cast<acc_t>(0.0);
+
+    for (int k = lane; k < cols; k += 32) {
+      const acc_t weight =
+          Cached ? w_cache[k]
+                 : static_cast<acc_t>(decode_byte<Format>(w_row, k));
+#pragma unroll
+      for (int b = 0; b < kBatchTile; ++b) {
+        if (b < tile)
+          acc[b] += weight * static_cast<acc_t>(x[(batch_begin + b) * ldx + k]);
+      }
+    }
+
+#pragma unroll
+    for (int b = 0; b < kBatchTile; ++b) {
+      acc_t sum = acc[b];
+#pragma unroll
+      for (int offset = 16; offset > 0; offset /= 2)
+        sum += __shfl_xor_sync(0xffffffff, sum, offset);
+      if (lane == 0 && b < tile)
+        y[(batch_begin + b) * rows + row] = static_cast<T>(sum * channel_scale);
+    }
+  }
+}
+
+template <typename T, WeightFormat Format, bool Cached>
+void LaunchQuantizedMatMul(const QuantizedWeight &w, const int rows,
+                           const int cols, const int batch_size, const T *x,
+                           const int ldx, T *y, const int warps,
+                           const size_t shared_mem_size,
+                           const cudaStream_t &stream) {
+  const dim3 blockDim(warps * 32);
+  const dim3 gridDim((rows + warps - 1) / warps);
+  const uint8_t *data = static_cast<const uint8_t *>(w.data);
+  if (cols % 4 == 0)
+    QuantizedMatMulKernel<T, Format, true, Cached>
+        <<<gridDim, blockDim, shared_mem_size, stream>>>(
+            rows, cols, batch_size, data, w.scale, x, ldx, y);
+  else
+    QuantizedMatMulKernel<T, Format, false, Cached>
+        <<<gridDim, blockDim, shared_mem_size, stream>>>(
+            rows, cols, batch_size, data, w.scale, x, ldx, y);
+}
+
+template <typename T, WeightFormat Format>
+void LaunchQuantizedMatMul(const QuantizedWeight &w, const int rows,
+                           const int cols, const int batch_size, const T *x,
+                           const int ldx, T *y, const cudaStream_t &stream) {
+  using acc_t = typename acc_type<T>::type;
+
+  // As many warps per block as there are decoded rows that fit on-chip.
+  const size_t row_bytes = static_cast<size_t>(cols) * sizeof(acc_t);
+  const int warps = static_cast<int>(
+      std::min<size_t>(kWarpsPerBlock, kMaxSharedMemory / row_bytes));
+  if (warps > 0)
+    LaunchQuantizedMatMul<T, Format, true>(w, rows, cols, batch_size, x, ldx,
+                                           y, warps, warps * row_bytes,
+                                           stream);
+  else
+    LaunchQuantizedMatMul<T, Format, false>(w, rows, cols, batch_size, x, ldx,
+                                            y, kWarpsPerBlock, 0, stream);
+}
+
+} // anonymous namespace
+
+namespace haste {
+namespace v0 {
+
+template <typename T>
+void QuantizedMatMul(const QuantizedWeight &w, const int rows, const int cols,
+                     const int batch_size, const T *x, const int ldx, T *y,
+                     const cudaStream_t &stream) {
+#if CUDART_VERSION >= 11080
+  if (w.format == WeightFormat::kFp8E4M3) {
+    LaunchQuantizedMatMul<T, WeightFormat::kFp8E4M3>(w, rows, cols, batch_size,
+                                                     x, ldx, y, stream);
+    return;
+  }
+#endif
+  LaunchQuantizedMatMul<T, WeightFormat::kInt8>(w, rows, cols, batch_size, x,
+                                                ldx, y, stream);
+}
+
+template void QuantizedMatMul<float>(const QuantizedWeight &, const int,
+                                     const int, const int, const float *,
+                                     const int, float *, const cudaStream_t &);
+template void QuantizedMatMul<double>(const QuantizedWeight &, const int,
+                                      const int, const int, const double *,
+                                      const int, double *,
+                                      const cudaStream_t &);
+template void QuantizedMatMul<__half>(const QuantizedWeight &, const int,
+                                      const int, const int, const __half *,
+                                      const int, __half *,
+                                      const cudaStream_t &);
+template void QuantizedMatMul<__nv_bfloat16>(
+    const QuantizedWeight &, const int, const int, const int,
+    const __nv_bfloat16 *, const int, __nv_bfloat16 *, const cudaStream_t &);
+
+} // namespace v0
+} // namespace haste
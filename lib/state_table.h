@@ -0,0 +1,44 @@
+// Copyright 2022 Adel Moumen. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#pragma once
+
+#include <cuda_runtime_api.h>
+
+namespace haste {
+namespace v0 {
+namespace state_table {
+
+// A state table holds the hidden state of many independent sequences, one
+// [H] row per slot, so that a batch can be assembled from any subset of them
+// between two calls without moving the others.
+//
+// slots: [N] slot index of each batch entry, distinct within one call.
+// table: [S,H]
+// h: [N,H]
+
+// Copies the rows `slots` of `table` into `h`.
+template <typename T>
+void Gather(const cudaStream_t &stream, const int batch_size,
+            const int hidden_size, const int *slots, const T *table, T *h);
+
+// Copies the rows of `h` into the rows `slots` of `table`.
+template <typename T>
+void Scatter(const cudaStream_t &stream, const int batch_size,
+             const int hidden_size, const int *slots, const T *h, T *table);
+
+} // namespace state_table
+} // namespace v0
+} // namespace haste
@@ -0,0 +1,95 @@
+// Copyright 2022 Adel Moumen. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#include <cuda_bf16.h>
+#include <cuda_fp16.h>
+#include <cuda_runtime_api.h>
+
+#include "state_table.h"
+
+namespace {
+
+template <typename T>
+__global__ void GatherRows(const int batch_size, const int hidden_size,
+                           const int *slots, const T *table, T *h) {
+  const int row = blockDim.x * blockIdx.x + threadIdx.x;
+  const int col = blockDim.y * blockIdx.y + threadIdx.y;
+
+  if (row >= hidden_size || col >= batch_size)
+    return;
+
+  h[col * hidden_size + row] = table[slots[col] * hidden_size + row];
+}
+
+template <typename T>
+__global__ void ScatterRows(const int batch_size, const int hidden_size,
+                            const int *slots, const T *h, T *table) {
+  const int row = blockDim.x * blockIdx.x + threadIdx.x;
+  const int col = blockDim.y * blockIdx.y + threadIdx.y;
+
+  if (row >= hidden_size || col >= batch_size)
+    return;
+
+  table[slots[col] * hidden_size + row] = h[col * hidden_size + row];
+}
+
+} // anonymous namespace
+
+namespace haste {
+namespace v0 {
+namespace state_table {
+
+template <typename T>
+void Gather(const cudaStream_t &stream, const int batch_size,
+            const int hidden_size, const int *slots, const T *table, T *h) {
+  const dim3 blockDim(32, 16);
+  const dim3 gridDim((hidden_size + blockDim.x - 1) / blockDim.x,
+                     (batch_size + blockDim.y - 1) / blockDim.y);
+  GatherRows<T><<<gridDim, blockDim, 0, stream>>>(batch_size, hidden_size,
+                                                  slots, table, h);
+}
+
+template <typename T>
+void Scatter(const cudaStream_t &stream, const int batch_size,
+             const int hidden_size, const int *slots, const T *h, T *table) {
+  const dim3 blockDim(32, 16);
+  const dim3 gridDim((hidden_size + blockDim.x - 1) / blockDim.x,
+                     (batch_size + blockDim.y - 1) / blockDim.y);
+  ScatterRows<T><<<gridDim, blockDim, 0, stream>>>(batch_size, hidden_size,
+                                                   slots, h, table);
+}
+
+template void Gather<half>(const cudaStream_t &, const int, const int,
+                           const int *, const half *, half *);
+template void Gather<__nv_bfloat16>(const cudaStream_t &, const int, const int,
+                                    const int *, const __nv_bfloat16 *,
+                                    __nv_bfloat16 *);
+template void Gather<float>(const cudaStream_t &, const int, const int,
+                            const int *, const float *, float *);
+template void Gather<double>(const cudaStream_t &, const int, const int,
+                             const int *, const double *, double *);
+template void Scatter<half>(const cudaStream_t &, const int, const int,
+                            const int *, const half *, half *);
+template void Scatter<__nv_bfloat16>(const cudaStream_t &, const int,
+                                     const int, const int *,
+                                     const __nv_bfloat16 *, __nv_bfloat16 *);
+template void Scatter<float>(const cudaStream_t &, const int, const int,
+                             const int *, const float *, float *);
+template void Scatter<double>(const cudaStream_t &, const int, const int,
+                              const int *, const double *, double *);
+
+} // namespace state_table
+} // namespace v0
+} // namespace haste
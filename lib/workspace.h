@@ -0,0 +1,43 @@
+// Copyright 2022 Adel Moumen. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#pragma once
+
+#include <cstddef>
+
+namespace haste {
+namespace v0 {
+
+// Every buffer carved out of a workspace starts on this boundary, so an arena
+// returned by `cudaMalloc` (or any allocator with the same guarantee) keeps
+// all of them valid for vectorized access.
+constexpr size_t kWorkspaceAlignment = 256;
+
+// Bytes used in a workspace by a buffer of `count` elements of type `T`.
+template <typename T> size_t workspace_size(const size_t count) {
+  return (count * sizeof(T) + kWorkspaceAlignment - 1) / kWorkspaceAlignment *
+         kWorkspaceAlignment;
+}
+
+// Returns the buffer of `count` elements at the front of `workspace` and
+// advances `workspace` past it.
+template <typename T> T *take_workspace(void *&workspace, const size_t count) {
+  T *buffer = static_cast<T *>(workspace);
+  workspace = static_cast<char *>(workspace) + workspace_size<T>(count);
+  return buffer;
+}
+
+} // namespace v0
+} // namespace haste
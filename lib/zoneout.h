@@ -0,0 +1,64 @@
+// Copyright 2022 Adel Moumen. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#pragma once
+
+#ifdef __CUDACC__
+#include <curand_kernel.h>
+#endif
+
+namespace haste {
+namespace v0 {
+
+// Zoneout of the recurrent state: at every step, each hidden unit keeps its
+// previous value with probability `prob` instead of taking its update. When
+// `sample` is set (training), the choice of unit `i` at step `t` is drawn from
+// the Philox stream `i` of `seed`, at position `offset + t`, so a backward
+// pass given the same parameters regenerates every mask and none is stored.
+// Otherwise the update is blended with the previous state by `prob`, the
+// expectation of the sampled one. `offset` lets a sequence split across calls
+// keep drawing fresh masks.
+struct Zoneout {
+  float prob = 0.0f;
+  bool sample = false;
+  unsigned long long seed = 0;
+  unsigned long long offset = 0;
+};
+
+// Parameters of the reverse direction of a bidirectional layer, whose masks
+// are drawn independently of those of the forward direction.
+inline Zoneout reverse_direction(Zoneout zoneout) {
+  zoneout.seed = ~zoneout.seed;
+  return zoneout;
+}
+
+#ifdef __CUDACC__
+// Weight of the previous state in unit `index` at step `step`: 0 or 1 when
+// sampling, `prob` otherwise. Callers skip it when `prob` is 0.
+template <typename T>
+__device__ __forceinline__ T zoneout_keep(const Zoneout &zoneout,
+                                          const unsigned long long index,
+                                          const int step) {
+  if (!zoneout.sample)
+    return static_cast<T>(zoneout.prob);
+  curandStatePhilox4_32_10_t state;
+  curand_init(zoneout.seed, index, zoneout.offset + step, &state);
+  return curand_uniform(&state) <= zoneout.prob ? static_cast<T>(1.0)
+                                                : static_cast<T>(0.0);
+}
+#endif
+
+} // namespace v0
+} // namespace haste